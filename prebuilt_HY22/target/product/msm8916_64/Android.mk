@@ -685,6 +685,11 @@ LOCAL_COPY_HEADERS_TO := libflp
 LOCAL_COPY_HEADERS    := ../../.././target/product/msm8916_64/obj/include/libflp/FlpLocationClient.h
 include $(BUILD_COPY_HEADERS)
 
+include $(CLEAR_VARS)
+LOCAL_COPY_HEADERS_TO := libflp
+LOCAL_COPY_HEADERS    := ../../.././target/product/msm8916_64/obj/include/libflp/FlpLocationRing.h
+include $(BUILD_COPY_HEADERS)
+
 include $(CLEAR_VARS)
 LOCAL_COPY_HEADERS_TO := libflp
 LOCAL_COPY_HEADERS    := ../../.././target/product/msm8916_64/obj/include/libflp/fused_location_extended.h
@@ -695,16 +700,31 @@ LOCAL_COPY_HEADERS_TO := libgeofence
 LOCAL_COPY_HEADERS    := ../../.././target/product/msm8916_64/obj/include/libgeofence/GeofenceAdapter.h
 include $(BUILD_COPY_HEADERS)
 
+include $(CLEAR_VARS)
+LOCAL_COPY_HEADERS_TO := libgeofence
+LOCAL_COPY_HEADERS    := ../../.././target/product/msm8916_64/obj/include/libgeofence/GeofenceBatch.h
+include $(BUILD_COPY_HEADERS)
+
 include $(CLEAR_VARS)
 LOCAL_COPY_HEADERS_TO := libgeofence
 LOCAL_COPY_HEADERS    := ../../.././target/product/msm8916_64/obj/include/libgeofence/GeofenceCallbacks.h
 include $(BUILD_COPY_HEADERS)
 
+include $(CLEAR_VARS)
+LOCAL_COPY_HEADERS_TO := libgeofence
+LOCAL_COPY_HEADERS    := ../../.././target/product/msm8916_64/obj/include/libgeofence/GeofenceIdIndex.h
+include $(BUILD_COPY_HEADERS)
+
 include $(CLEAR_VARS)
 LOCAL_COPY_HEADERS_TO := libgeofence
 LOCAL_COPY_HEADERS    := ../../.././target/product/msm8916_64/obj/include/libgeofence/GeoFencer.h
 include $(BUILD_COPY_HEADERS)
 
+include $(CLEAR_VARS)
+LOCAL_COPY_HEADERS_TO := libgeofence
+LOCAL_COPY_HEADERS    := ../../.././target/product/msm8916_64/obj/include/libgeofence/GeofenceSpatialIndex.h
+include $(BUILD_COPY_HEADERS)
+
 include $(CLEAR_VARS)
 LOCAL_COPY_HEADERS_TO := libgeofence
 LOCAL_COPY_HEADERS    := ../../.././target/product/msm8916_64/obj/include/libgeofence/GpsGeofenceCb.h
@@ -730,11 +750,36 @@ LOCAL_COPY_HEADERS_TO := libizat_core
 LOCAL_COPY_HEADERS    := ../../.././target/product/msm8916_64/obj/include/libizat_core/IzatApiV02.h
 include $(BUILD_COPY_HEADERS)
 
+include $(CLEAR_VARS)
+LOCAL_COPY_HEADERS_TO := libizat_core
+LOCAL_COPY_HEADERS    := ../../.././target/product/msm8916_64/obj/include/libizat_core/IzatMsgPool.h
+include $(BUILD_COPY_HEADERS)
+
+include $(CLEAR_VARS)
+LOCAL_COPY_HEADERS_TO := libloc/base_util
+LOCAL_COPY_HEADERS    := ../../.././target/product/msm8916_64/obj/include/libloc/base_util/async_log.h
+include $(BUILD_COPY_HEADERS)
+
+include $(CLEAR_VARS)
+LOCAL_COPY_HEADERS_TO := libloc/base_util
+LOCAL_COPY_HEADERS    := ../../.././target/product/msm8916_64/obj/include/libloc/base_util/buffer_pool.h
+include $(BUILD_COPY_HEADERS)
+
+include $(CLEAR_VARS)
+LOCAL_COPY_HEADERS_TO := libloc/base_util
+LOCAL_COPY_HEADERS    := ../../.././target/product/msm8916_64/obj/include/libloc/base_util/clock_source.h
+include $(BUILD_COPY_HEADERS)
+
 include $(CLEAR_VARS)
 LOCAL_COPY_HEADERS_TO := libloc/base_util
 LOCAL_COPY_HEADERS    := ../../.././target/product/msm8916_64/obj/include/libloc/base_util/config_file.h
 include $(BUILD_COPY_HEADERS)
 
+include $(CLEAR_VARS)
+LOCAL_COPY_HEADERS_TO := libloc/base_util
+LOCAL_COPY_HEADERS    := ../../.././target/product/msm8916_64/obj/include/libloc/base_util/lazy_postcard.h
+include $(BUILD_COPY_HEADERS)
+
 include $(CLEAR_VARS)
 LOCAL_COPY_HEADERS_TO := libloc/base_util
 LOCAL_COPY_HEADERS    := ../../.././target/product/msm8916_64/obj/include/libloc/base_util/list.h
@@ -745,26 +790,61 @@ LOCAL_COPY_HEADERS_TO := libloc/base_util
 LOCAL_COPY_HEADERS    := ../../.././target/product/msm8916_64/obj/include/libloc/base_util/log.h
 include $(BUILD_COPY_HEADERS)
 
+include $(CLEAR_VARS)
+LOCAL_COPY_HEADERS_TO := libloc/base_util
+LOCAL_COPY_HEADERS    := ../../.././target/product/msm8916_64/obj/include/libloc/base_util/mapped_config_file.h
+include $(BUILD_COPY_HEADERS)
+
 include $(CLEAR_VARS)
 LOCAL_COPY_HEADERS_TO := libloc/base_util
 LOCAL_COPY_HEADERS    := ../../.././target/product/msm8916_64/obj/include/libloc/base_util/memorystream.h
 include $(BUILD_COPY_HEADERS)
 
+include $(CLEAR_VARS)
+LOCAL_COPY_HEADERS_TO := libloc/base_util
+LOCAL_COPY_HEADERS    := ../../.././target/product/msm8916_64/obj/include/libloc/base_util/mpsc_blocking_queue.h
+include $(BUILD_COPY_HEADERS)
+
 include $(CLEAR_VARS)
 LOCAL_COPY_HEADERS_TO := libloc/base_util
 LOCAL_COPY_HEADERS    := ../../.././target/product/msm8916_64/obj/include/libloc/base_util/postcard.h
 include $(BUILD_COPY_HEADERS)
 
+include $(CLEAR_VARS)
+LOCAL_COPY_HEADERS_TO := libloc/base_util
+LOCAL_COPY_HEADERS    := ../../.././target/product/msm8916_64/obj/include/libloc/base_util/postcard_profiler.h
+include $(BUILD_COPY_HEADERS)
+
+include $(CLEAR_VARS)
+LOCAL_COPY_HEADERS_TO := libloc/base_util
+LOCAL_COPY_HEADERS    := ../../.././target/product/msm8916_64/obj/include/libloc/base_util/postcard_schema.h
+include $(BUILD_COPY_HEADERS)
+
 include $(CLEAR_VARS)
 LOCAL_COPY_HEADERS_TO := libloc/base_util
 LOCAL_COPY_HEADERS    := ../../.././target/product/msm8916_64/obj/include/libloc/base_util/queue.h
 include $(BUILD_COPY_HEADERS)
 
+include $(CLEAR_VARS)
+LOCAL_COPY_HEADERS_TO := libloc/base_util
+LOCAL_COPY_HEADERS    := ../../.././target/product/msm8916_64/obj/include/libloc/base_util/ring_queue.h
+include $(BUILD_COPY_HEADERS)
+
+include $(CLEAR_VARS)
+LOCAL_COPY_HEADERS_TO := libloc/base_util
+LOCAL_COPY_HEADERS    := ../../.././target/product/msm8916_64/obj/include/libloc/base_util/shared_memorystream.h
+include $(BUILD_COPY_HEADERS)
+
 include $(CLEAR_VARS)
 LOCAL_COPY_HEADERS_TO := libloc/base_util
 LOCAL_COPY_HEADERS    := ../../.././target/product/msm8916_64/obj/include/libloc/base_util/sync.h
 include $(BUILD_COPY_HEADERS)
 
+include $(CLEAR_VARS)
+LOCAL_COPY_HEADERS_TO := libloc/base_util
+LOCAL_COPY_HEADERS    := ../../.././target/product/msm8916_64/obj/include/libloc/base_util/thread_pool_executor.h
+include $(BUILD_COPY_HEADERS)
+
 include $(CLEAR_VARS)
 LOCAL_COPY_HEADERS_TO := libloc/base_util
 LOCAL_COPY_HEADERS    := ../../.././target/product/msm8916_64/obj/include/libloc/base_util/time_routines.h
@@ -775,6 +855,11 @@ LOCAL_COPY_HEADERS_TO := libloc/base_util
 LOCAL_COPY_HEADERS    := ../../.././target/product/msm8916_64/obj/include/libloc/base_util/vector.h
 include $(BUILD_COPY_HEADERS)
 
+include $(CLEAR_VARS)
+LOCAL_COPY_HEADERS_TO := libloc/mq_client
+LOCAL_COPY_HEADERS    := ../../.././target/product/msm8916_64/obj/include/libloc/mq_client/mq_client_batch.h
+include $(BUILD_COPY_HEADERS)
+
 include $(CLEAR_VARS)
 LOCAL_COPY_HEADERS_TO := libloc/mq_client
 LOCAL_COPY_HEADERS    := ../../.././target/product/msm8916_64/obj/include/libloc/mq_client/mq_client_controller.h
@@ -785,11 +870,26 @@ LOCAL_COPY_HEADERS_TO := libloc/mq_client
 LOCAL_COPY_HEADERS    := ../../.././target/product/msm8916_64/obj/include/libloc/mq_client/mq_client.h
 include $(BUILD_COPY_HEADERS)
 
+include $(CLEAR_VARS)
+LOCAL_COPY_HEADERS_TO := libloc/mq_client
+LOCAL_COPY_HEADERS    := ../../.././target/product/msm8916_64/obj/include/libloc/mq_client/mq_shm_transport.h
+include $(BUILD_COPY_HEADERS)
+
+include $(CLEAR_VARS)
+LOCAL_COPY_HEADERS_TO := libloc/mq_client
+LOCAL_COPY_HEADERS    := ../../.././target/product/msm8916_64/obj/include/libloc/mq_client/timer_wheel.h
+include $(BUILD_COPY_HEADERS)
+
 include $(CLEAR_VARS)
 LOCAL_COPY_HEADERS_TO := libloc_nvmanager
 LOCAL_COPY_HEADERS    := ../../.././target/product/msm8916_64/obj/include/libloc_nvmanager/IzatDevId.h
 include $(BUILD_COPY_HEADERS)
 
+include $(CLEAR_VARS)
+LOCAL_COPY_HEADERS_TO := liblowi_client/inc
+LOCAL_COPY_HEADERS    := ../../.././target/product/msm8916_64/obj/include/liblowi_client/inc/lowi_bssid_cache.h
+include $(BUILD_COPY_HEADERS)
+
 include $(CLEAR_VARS)
 LOCAL_COPY_HEADERS_TO := liblowi_client/inc
 LOCAL_COPY_HEADERS    := ../../.././target/product/msm8916_64/obj/include/liblowi_client/inc/lowi_client.h
@@ -805,11 +905,21 @@ LOCAL_COPY_HEADERS_TO := liblowi_client/inc
 LOCAL_COPY_HEADERS    := ../../.././target/product/msm8916_64/obj/include/liblowi_client/inc/lowi_defines.h
 include $(BUILD_COPY_HEADERS)
 
+include $(CLEAR_VARS)
+LOCAL_COPY_HEADERS_TO := liblowi_client/inc
+LOCAL_COPY_HEADERS    := ../../.././target/product/msm8916_64/obj/include/liblowi_client/inc/lowi_load_generator.h
+include $(BUILD_COPY_HEADERS)
+
 include $(CLEAR_VARS)
 LOCAL_COPY_HEADERS_TO := liblowi_client/inc
 LOCAL_COPY_HEADERS    := ../../.././target/product/msm8916_64/obj/include/liblowi_client/inc/lowi_mac_address.h
 include $(BUILD_COPY_HEADERS)
 
+include $(CLEAR_VARS)
+LOCAL_COPY_HEADERS_TO := liblowi_client/inc
+LOCAL_COPY_HEADERS    := ../../.././target/product/msm8916_64/obj/include/liblowi_client/inc/lowi_ranging_scheduler.h
+include $(BUILD_COPY_HEADERS)
+
 include $(CLEAR_VARS)
 LOCAL_COPY_HEADERS_TO := liblowi_client/inc
 LOCAL_COPY_HEADERS    := ../../.././target/product/msm8916_64/obj/include/liblowi_client/inc/lowi_request.h
@@ -820,16 +930,36 @@ LOCAL_COPY_HEADERS_TO := liblowi_client/inc
 LOCAL_COPY_HEADERS    := ../../.././target/product/msm8916_64/obj/include/liblowi_client/inc/lowi_response.h
 include $(BUILD_COPY_HEADERS)
 
+include $(CLEAR_VARS)
+LOCAL_COPY_HEADERS_TO := liblowi_client/inc
+LOCAL_COPY_HEADERS    := ../../.././target/product/msm8916_64/obj/include/liblowi_client/inc/lowi_scan_coalescer.h
+include $(BUILD_COPY_HEADERS)
+
 include $(CLEAR_VARS)
 LOCAL_COPY_HEADERS_TO := liblowi_client/inc
 LOCAL_COPY_HEADERS    := ../../.././target/product/msm8916_64/obj/include/liblowi_client/inc/lowi_scan_measurement.h
 include $(BUILD_COPY_HEADERS)
 
+include $(CLEAR_VARS)
+LOCAL_COPY_HEADERS_TO := liblowi_client/inc
+LOCAL_COPY_HEADERS    := ../../.././target/product/msm8916_64/obj/include/liblowi_client/inc/lowi_scan_result_set.h
+include $(BUILD_COPY_HEADERS)
+
 include $(CLEAR_VARS)
 LOCAL_COPY_HEADERS_TO := liblowi_client/inc
 LOCAL_COPY_HEADERS    := ../../.././target/product/msm8916_64/obj/include/liblowi_client/inc/lowi_ssid.h
 include $(BUILD_COPY_HEADERS)
 
+include $(CLEAR_VARS)
+LOCAL_COPY_HEADERS_TO := liblowi_client/inc
+LOCAL_COPY_HEADERS    := ../../.././target/product/msm8916_64/obj/include/liblowi_client/inc/lowi_stand_in_server.h
+include $(BUILD_COPY_HEADERS)
+
+include $(CLEAR_VARS)
+LOCAL_COPY_HEADERS_TO := liblowi_client/inc
+LOCAL_COPY_HEADERS    := ../../.././target/product/msm8916_64/obj/include/liblowi_client/inc/lowi_utils.h
+include $(BUILD_COPY_HEADERS)
+
 include $(CLEAR_VARS)
 LOCAL_COPY_HEADERS_TO := libmdmdetect/inc
 LOCAL_COPY_HEADERS    := ../../.././target/product/msm8916_64/obj/include/libmdmdetect/inc/mdm_detect.h
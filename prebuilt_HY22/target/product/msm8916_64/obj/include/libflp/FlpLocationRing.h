@@ -0,0 +1,337 @@
+/*====*====*====*====*====*====*====*====*====*====*====*====*====*====*====*
+  Copyright (c) 2015 Qualcomm Technologies, Inc.
+  All Rights Reserved.
+  Confidential and Proprietary - Qualcomm Technologies, Inc.
+=============================================================================*/
+#ifndef FLP_LOCATION_RING_H
+#define FLP_LOCATION_RING_H
+
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <new>
+#include <log_util.h>
+#include <fused_location_extended.h>
+
+#define FLP_LOCATION_RING_MAGIC      0x474E4952504C46ULL  /* "FLPRING" */
+#define FLP_LOCATION_RING_VERSION    1
+#define FLP_LOCATION_RING_HEADER_SIZE 4096
+/** 24 hours of fixes at 1 Hz */
+#define FLP_LOCATION_RING_DEFAULT_CAPACITY (24 * 60 * 60)
+
+/** Persistent ring of batched locations, in a memory mapped file.
+
+    The adapter appends the locations it receives in handleReportedLocations,
+    so the history survives a daemon restart and is not limited by the
+    engine batch size. Reads hand out pointers into the mapping, in the
+    FlpExtLocation** form flp_ext_location_callback takes, so nothing is
+    copied or parsed on the way out.
+
+    Crash safety: a record is written with an invalid sequence number
+    first, then its location and checksum, and only then its sequence
+    number, after which the head in the file header is advanced. A
+    process dying at any point leaves either the old or the new record,
+    and on open every record is checked, so a torn record (e.g. after a
+    power loss without sync()) is dropped together with anything older.
+
+    One thread appends; others may read. A pointer handed out for sequence
+    number seq points at that record until the ring wraps over it, which
+    may happen while it is being read. A reader on another thread copies
+    the location first and then calls isStillValid(seq) to know whether
+    the copy is whole; read() does both. */
+class FlpLocationRing {
+
+    struct Header {
+        uint64_t magic;
+        uint32_t version;
+        uint32_t headerSize;
+        uint32_t recordSize;
+        uint32_t locationSize;
+        uint32_t capacity;
+        uint32_t reserved;
+        uint64_t head;      // sequence number of the next record
+    };
+
+    struct Record {
+        uint64_t seq;
+        uint32_t checksum;
+        uint32_t reserved;
+        FlpExtLocation location;
+    };
+
+    static const uint64_t INVALID_SEQ = ~0ULL;
+
+    int mFd;
+    uint8_t* mMap;
+    size_t mMapSize;
+    Header* mHeader;
+    Record* mRecords;
+    uint32_t mCapacity;
+    uint64_t mTail;         // sequence number of the oldest valid record
+
+    inline FlpLocationRing() :
+        mFd(-1), mMap(NULL), mMapSize(0), mHeader(NULL), mRecords(NULL),
+        mCapacity(0), mTail(0) {}
+
+    // private copy constructor and assignment operator so that
+    // the ring can not be copied.
+    FlpLocationRing(const FlpLocationRing&);
+    FlpLocationRing& operator=(const FlpLocationRing&);
+
+public:
+
+    /** Opens the ring in path, creating it if needed. An existing file of
+        a different capacity or record layout is started over.
+        @return NULL on failure */
+    static inline FlpLocationRing* createInstance(const char* path,
+                                                  uint32_t capacity =
+                                                  FLP_LOCATION_RING_DEFAULT_CAPACITY) {
+        FlpLocationRing* ring = new (std::nothrow) FlpLocationRing();
+        if (NULL != ring && !ring->open(path, capacity)) {
+            delete ring;
+            ring = NULL;
+        }
+        return ring;
+    }
+
+    inline ~FlpLocationRing() {
+        if (NULL != mMap) {
+            msync(mMap, mMapSize, MS_ASYNC);
+            munmap(mMap, mMapSize);
+        }
+        if (mFd >= 0) {
+            close(mFd);
+        }
+    }
+
+    inline void append(const FlpExtLocation& location) {
+        uint64_t seq = mHeader->head;
+        Record* record = &mRecords[seq % mCapacity];
+        // retire the record being overwritten before touching it
+        if (seq + 1 - mTail > mCapacity) {
+            __atomic_store_n(&mTail, seq + 1 - mCapacity, __ATOMIC_RELEASE);
+        }
+        __atomic_store_n(&record->seq, INVALID_SEQ, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        memcpy(&record->location, &location, sizeof(FlpExtLocation));
+        record->checksum = checksum(seq, record->location);
+        __atomic_store_n(&record->seq, seq, __ATOMIC_RELEASE);
+        __atomic_store_n(&mHeader->head, seq + 1, __ATOMIC_RELEASE);
+    }
+
+    /** Appends what handleReportedLocations received. */
+    inline void append(const FlpExtLocation* location, int32_t number) {
+        for (int32_t i = 0; i < number; i++) {
+            append(location[i]);
+        }
+    }
+
+    /** Flushes the mapping to the file; only needed against power loss. */
+    inline int sync(bool wait = false) {
+        return msync(mMap, mMapSize, wait ? MS_SYNC : MS_ASYNC);
+    }
+
+    inline uint64_t getHead() const {
+        return __atomic_load_n(&mHeader->head, __ATOMIC_ACQUIRE);
+    }
+    inline uint64_t getTail() const {
+        return __atomic_load_n(&mTail, __ATOMIC_ACQUIRE);
+    }
+    inline uint32_t size() const { return (uint32_t)(getHead() - getTail()); }
+    inline uint32_t getCapacity() const { return mCapacity; }
+
+    /** Whether the record of sequence number seq is still in the ring. */
+    inline bool isValid(uint64_t seq) const {
+        return seq >= getTail() && seq < getHead();
+    }
+
+    /** Whether a copy taken through a pointer handed out for sequence
+        number seq is whole, i.e. the ring had not yet wrapped over it. */
+    inline bool isStillValid(uint64_t seq) const {
+        // order the copy before the tail load; append() retires a record
+        // before it starts to overwrite it
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        return seq >= getTail();
+    }
+
+    inline const FlpExtLocation* get(uint64_t seq) const {
+        return isValid(seq) ? &mRecords[seq % mCapacity].location : NULL;
+    }
+
+    /** Copies the location of sequence number seq.
+        @return false if it is not in the ring, or was overwritten while
+                being copied */
+    inline bool read(uint64_t seq, FlpExtLocation& location) const {
+        if (!isValid(seq)) {
+            return false;
+        }
+        memcpy(&location, &mRecords[seq % mCapacity].location, sizeof(FlpExtLocation));
+        return isStillValid(seq);
+    }
+
+    /** Points locations at the last n records, oldest first.
+        @param firstSeq sequence number of locations[0]
+        @return number of pointers written */
+    inline int32_t getLast(int32_t n, const FlpExtLocation** locations,
+                           uint64_t* firstSeq = NULL) const {
+        uint64_t head = getHead();
+        uint64_t tail = getTail();
+        if (n <= 0) {
+            return 0;
+        }
+        uint64_t first = (head - tail > (uint64_t)n) ? head - n : tail;
+        for (uint64_t seq = first; seq < head; seq++) {
+            locations[seq - first] = &mRecords[seq % mCapacity].location;
+        }
+        if (NULL != firstSeq) {
+            *firstSeq = first;
+        }
+        return (int32_t)(head - first);
+    }
+
+    /** Points locations at up to max records with a timestamp in
+        [begin, end], oldest first. Records are taken to be appended in
+        timestamp order; the first one is found by binary search.
+        @return number of pointers written */
+    inline int32_t getRange(int64_t begin, int64_t end, int32_t max,
+                            const FlpExtLocation** locations,
+                            uint64_t* firstSeq = NULL) const {
+        uint64_t head = getHead();
+        uint64_t lo = getTail();
+        uint64_t hi = head;
+        while (lo < hi) {
+            uint64_t mid = lo + (hi - lo) / 2;
+            if (mRecords[mid % mCapacity].location.timestamp < begin) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        int32_t count = 0;
+        for (uint64_t seq = lo; seq < head && count < max; seq++) {
+            const FlpExtLocation* location = &mRecords[seq % mCapacity].location;
+            if (location->timestamp > end) {
+                break;
+            }
+            locations[count++] = location;
+        }
+        if (NULL != firstSeq) {
+            *firstSeq = lo;
+        }
+        return count;
+    }
+
+private:
+
+    static inline uint32_t checksum(uint64_t seq, const FlpExtLocation& location) {
+        // FNV-1a over the sequence number and the location
+        uint32_t h = 2166136261U;
+        for (int i = 0; i < 8; i++) {
+            h = (h ^ (uint8_t)(seq >> (8 * i))) * 16777619U;
+        }
+        const uint8_t* p = (const uint8_t*)&location;
+        for (size_t i = 0; i < sizeof(FlpExtLocation); i++) {
+            h = (h ^ p[i]) * 16777619U;
+        }
+        return h;
+    }
+
+    inline bool isIntact(uint64_t seq) const {
+        const Record& record = mRecords[seq % mCapacity];
+        return record.seq == seq && record.checksum == checksum(seq, record.location);
+    }
+
+    inline bool open(const char* path, uint32_t capacity) {
+        if (NULL == path || 0 == capacity) {
+            LOC_LOGE("%s: invalid arguments", __func__);
+            return false;
+        }
+        mCapacity = capacity;
+        mMapSize = FLP_LOCATION_RING_HEADER_SIZE + (size_t)capacity * sizeof(Record);
+        mFd = ::open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        if (mFd < 0) {
+            LOC_LOGE("%s: open %s failed, errno %d", __func__, path, errno);
+            return false;
+        }
+        struct stat st;
+        if (0 != fstat(mFd, &st)) {
+            LOC_LOGE("%s: fstat %s failed, errno %d", __func__, path, errno);
+            return false;
+        }
+        bool fresh = ((size_t)st.st_size != mMapSize);
+        if (fresh && (0 != ftruncate(mFd, 0) || 0 != ftruncate(mFd, mMapSize))) {
+            LOC_LOGE("%s: ftruncate %s failed, errno %d", __func__, path, errno);
+            return false;
+        }
+        void* map = mmap(NULL, mMapSize, PROT_READ | PROT_WRITE, MAP_SHARED, mFd, 0);
+        if (MAP_FAILED == map) {
+            LOC_LOGE("%s: mmap %s failed, errno %d", __func__, path, errno);
+            return false;
+        }
+        mMap = (uint8_t*)map;
+        mHeader = (Header*)mMap;
+        mRecords = (Record*)(mMap + FLP_LOCATION_RING_HEADER_SIZE);
+
+        if (!fresh &&
+            (mHeader->magic != FLP_LOCATION_RING_MAGIC ||
+             mHeader->version != FLP_LOCATION_RING_VERSION ||
+             mHeader->headerSize != FLP_LOCATION_RING_HEADER_SIZE ||
+             mHeader->recordSize != sizeof(Record) ||
+             mHeader->locationSize != sizeof(FlpExtLocation) ||
+             mHeader->capacity != capacity)) {
+            LOC_LOGW("%s: %s has another layout, starting over", __func__, path);
+            fresh = true;
+        }
+        if (fresh) {
+            memset(mMap, 0, mMapSize);
+            for (uint32_t i = 0; i < capacity; i++) {
+                mRecords[i].seq = INVALID_SEQ;
+            }
+            mHeader->version = FLP_LOCATION_RING_VERSION;
+            mHeader->headerSize = FLP_LOCATION_RING_HEADER_SIZE;
+            mHeader->recordSize = sizeof(Record);
+            mHeader->locationSize = sizeof(FlpExtLocation);
+            mHeader->capacity = capacity;
+            mHeader->head = 0;
+            // the magic goes last, so a half initialized file is not taken
+            __atomic_store_n(&mHeader->magic, FLP_LOCATION_RING_MAGIC, __ATOMIC_RELEASE);
+            mTail = 0;
+            return true;
+        }
+        recover();
+        return true;
+    }
+
+    inline void recover() {
+        uint64_t head = mHeader->head;
+        // a record written just before a crash may not have made it to head
+        if (isIntact(head)) {
+            head++;
+        }
+        // keep the newest run of intact records
+        uint64_t oldest = head > mCapacity ? head - mCapacity : 0;
+        // an append cut short has already retired the oldest record
+        if (head >= mCapacity && INVALID_SEQ == mRecords[head % mCapacity].seq) {
+            oldest++;
+        }
+        uint64_t tail = head;
+        while (tail > oldest && isIntact(tail - 1)) {
+            tail--;
+        }
+        if (head != mHeader->head || tail != oldest) {
+            LOC_LOGW("%s: head %llu -> %llu, %llu records dropped", __func__,
+                     (unsigned long long)mHeader->head, (unsigned long long)head,
+                     (unsigned long long)(tail - oldest));
+        }
+        mHeader->head = head;
+        mTail = tail;
+        LOC_LOGV("%s: %llu records, head %llu", __func__,
+                 (unsigned long long)(head - tail), (unsigned long long)head);
+    }
+};
+
+#endif /* FLP_LOCATION_RING_H */
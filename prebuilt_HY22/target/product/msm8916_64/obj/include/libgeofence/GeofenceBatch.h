@@ -0,0 +1,456 @@
+/*====*====*====*====*====*====*====*====*====*====*====*====*====*====*====*
+  Copyright (c) 2013-2015 Qualcomm Technologies, Inc.
+  All Rights Reserved.
+  Confidential and Proprietary - Qualcomm Technologies, Inc.
+=============================================================================*/
+#ifndef GEOFENCE_BATCH_H
+#define GEOFENCE_BATCH_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <IzatApiBase.h>
+
+/* Kernel selection. Define GEOFENCE_BATCH_NO_SIMD to build the scalar
+   kernel only. */
+#if !defined(GEOFENCE_BATCH_NO_SIMD)
+#if defined(__ARM_NEON__) || defined(__ARM_NEON)
+#define GEOFENCE_BATCH_NEON
+#include <arm_neon.h>
+#elif defined(__AVX__)
+#define GEOFENCE_BATCH_AVX
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#define GEOFENCE_BATCH_SSE
+#include <emmintrin.h>
+#endif
+#endif
+
+// mean earth radius in meters, same as GEOFENCE_EARTH_RADIUS_METERS
+#define GEOFENCE_BATCH_EARTH_RADIUS_METERS 6371008.8
+// fences are stored in blocks of this many lanes
+#define GEOFENCE_BATCH_BLOCK 8
+// number of uint32_t words of a mask covering n fences
+#define GEOFENCE_BATCH_MASK_WORDS(n) (((n) + 31) / 32)
+
+/* Circular fences in structure of arrays form, for evaluating one fix
+   against many fences at once.
+
+   Each centre is kept as a unit vector (x, y, z) and each radius as the
+   sine and cosine of half its central angle. Then, for a fix at unit
+   vector p and a fence at q with radius r,
+
+     distance <= r + m  <=>  |p - q| / 2 <= sin((r + m) / 2R)
+                             = sin(r/2R) cos(m/2R) + cos(r/2R) sin(m/2R)
+
+   so the kernel needs no trigonometry per fence, only multiply and add,
+   and runs 4 (NEON, SSE) or 8 (AVX) fences per instruction. The vectors
+   are single precision. That puts about half a meter of error on the
+   boundary, which evaluateReference(), the double precision haversine
+   version, can be used to check.
+
+   Results are bit masks, bit (i % 32) of word (i / 32) standing for the
+   fence at index i:
+     inside  distance of the fix to the centre <= radius
+     near    not inside, and distance <= radius + margin, where margin
+             is nearMeters plus the accuracy of the fix when it has one
+   Fences in neither mask are outside. */
+class GeofenceBatch {
+
+    float* mX;
+    float* mY;
+    float* mZ;
+    float* mSinR;     // sin(radius / 2R)
+    float* mCosR;     // cos(radius / 2R)
+    uint32_t* mHwIds;
+    uint32_t mSize;
+    uint32_t mCapacity;  // multiple of GEOFENCE_BATCH_BLOCK
+
+    // private copy constructor and assignment operator so that
+    // the batch can not be copied.
+    GeofenceBatch(const GeofenceBatch&);
+    GeofenceBatch& operator=(const GeofenceBatch&);
+
+public:
+
+    enum State {
+        OUTSIDE = 0,
+        NEAR    = 1,
+        INSIDE  = 2
+    };
+
+    inline GeofenceBatch() :
+        mX(NULL), mY(NULL), mZ(NULL), mSinR(NULL), mCosR(NULL), mHwIds(NULL),
+        mSize(0), mCapacity(0) {}
+
+    inline ~GeofenceBatch() {
+        release();
+    }
+
+    inline bool reserve(uint32_t capacity) {
+        if (capacity <= mCapacity) {
+            return true;
+        }
+        capacity = (capacity + GEOFENCE_BATCH_BLOCK - 1) & ~(GEOFENCE_BATCH_BLOCK - 1);
+        // one block holds the six arrays, each 32 byte aligned
+        void* block = NULL;
+        if (0 != posix_memalign(&block, 32, (size_t)capacity * 6 * sizeof(float))) {
+            return false;
+        }
+        float* base = (float*)block;
+        memset(base, 0, (size_t)capacity * 6 * sizeof(float));
+        if (mSize > 0) {
+            memcpy(base, mX, mSize * sizeof(float));
+            memcpy(base + capacity, mY, mSize * sizeof(float));
+            memcpy(base + 2 * capacity, mZ, mSize * sizeof(float));
+            memcpy(base + 3 * capacity, mSinR, mSize * sizeof(float));
+            memcpy(base + 4 * capacity, mCosR, mSize * sizeof(float));
+            memcpy(base + 5 * capacity, mHwIds, mSize * sizeof(uint32_t));
+        }
+        free(mX);
+        mX = base;
+        mY = base + capacity;
+        mZ = base + 2 * capacity;
+        mSinR = base + 3 * capacity;
+        mCosR = base + 4 * capacity;
+        mHwIds = (uint32_t*)(base + 5 * capacity);
+        mCapacity = capacity;
+        return true;
+    }
+
+    // appends a fence, returns its index or -1 if memory ran out
+    inline int32_t add(uint32_t hwId, double latitude, double longitude, double radius) {
+        if (mSize == mCapacity && !reserve(mCapacity > 0 ? mCapacity * 2 : 64)) {
+            return -1;
+        }
+        set(mSize, hwId, latitude, longitude, radius);
+        return (int32_t)mSize++;
+    }
+
+    inline void set(uint32_t i, uint32_t hwId, double latitude, double longitude, double radius) {
+        double x, y, z;
+        toUnitVector(latitude, longitude, x, y, z);
+        double halfAngle = (radius > 0 ? radius : 0) / (2 * GEOFENCE_BATCH_EARTH_RADIUS_METERS);
+        if (halfAngle > M_PI / 2) {
+            halfAngle = M_PI / 2;
+        }
+        mX[i] = (float)x;
+        mY[i] = (float)y;
+        mZ[i] = (float)z;
+        mSinR[i] = (float)sin(halfAngle);
+        mCosR[i] = (float)cos(halfAngle);
+        mHwIds[i] = hwId;
+    }
+
+    // removes the fence at index i; the last fence takes its index
+    inline void remove(uint32_t i) {
+        if (i >= mSize) {
+            return;
+        }
+        mSize--;
+        mX[i] = mX[mSize];
+        mY[i] = mY[mSize];
+        mZ[i] = mZ[mSize];
+        mSinR[i] = mSinR[mSize];
+        mCosR[i] = mCosR[mSize];
+        mHwIds[i] = mHwIds[mSize];
+    }
+
+    inline void clear() { mSize = 0; }
+    inline void release() {
+        free(mX);
+        mX = mY = mZ = mSinR = mCosR = NULL;
+        mHwIds = NULL;
+        mSize = mCapacity = 0;
+    }
+    inline uint32_t size() const { return mSize; }
+    inline uint32_t getHwId(uint32_t i) const { return mHwIds[i]; }
+
+    // state of fence i from the masks written by evaluate()
+    static inline State getState(const uint32_t* inside, const uint32_t* near, uint32_t i) {
+        uint32_t bit = 1U << (i % 32);
+        return (inside[i / 32] & bit) ? INSIDE : ((near[i / 32] & bit) ? NEAR : OUTSIDE);
+    }
+
+    /* Evaluates one fix against all fences. inside and near must hold
+       GEOFENCE_BATCH_MASK_WORDS(size()) words each. A fix without latitude
+       and longitude leaves every fence outside. */
+    inline void evaluate(const FlpExtLocation& location, double nearMeters,
+                         uint32_t* inside, uint32_t* near) const {
+        Query q;
+        if (!getQuery(location, nearMeters, q)) {
+            memset(inside, 0, GEOFENCE_BATCH_MASK_WORDS(mSize) * sizeof(uint32_t));
+            memset(near, 0, GEOFENCE_BATCH_MASK_WORDS(mSize) * sizeof(uint32_t));
+            return;
+        }
+#if defined(GEOFENCE_BATCH_NEON)
+        evaluateNeon(q, inside, near);
+#elif defined(GEOFENCE_BATCH_AVX)
+        evaluateAvx(q, inside, near);
+#elif defined(GEOFENCE_BATCH_SSE)
+        evaluateSse(q, inside, near);
+#else
+        memset(inside, 0, GEOFENCE_BATCH_MASK_WORDS(mSize) * sizeof(uint32_t));
+        memset(near, 0, GEOFENCE_BATCH_MASK_WORDS(mSize) * sizeof(uint32_t));
+        evaluateScalar(q, inside, near);
+#endif
+    }
+
+    /* Evaluates numLocations fixes; the masks of fix j start at word
+       j * GEOFENCE_BATCH_MASK_WORDS(size()). */
+    inline void evaluate(const FlpExtLocation* locations, uint32_t numLocations,
+                         double nearMeters, uint32_t* inside, uint32_t* near) const {
+        uint32_t words = GEOFENCE_BATCH_MASK_WORDS(mSize);
+        for (uint32_t j = 0; j < numLocations; j++) {
+            evaluate(locations[j], nearMeters, inside + j * words, near + j * words);
+        }
+    }
+
+    // same as evaluate(), always with the portable kernel
+    inline void evaluateScalar(const FlpExtLocation& location, double nearMeters,
+                               uint32_t* inside, uint32_t* near) const {
+        Query q;
+        memset(inside, 0, GEOFENCE_BATCH_MASK_WORDS(mSize) * sizeof(uint32_t));
+        memset(near, 0, GEOFENCE_BATCH_MASK_WORDS(mSize) * sizeof(uint32_t));
+        if (getQuery(location, nearMeters, q)) {
+            evaluateScalar(q, inside, near);
+        }
+    }
+
+    /* Double precision haversine on the same fences, for checking the
+       kernels. Writes the distance of the fix to each centre in meters to
+       distances when given. */
+    inline void evaluateReference(const FlpExtLocation& location, double nearMeters,
+                                  uint32_t* inside, uint32_t* near,
+                                  double* distances = NULL) const {
+        memset(inside, 0, GEOFENCE_BATCH_MASK_WORDS(mSize) * sizeof(uint32_t));
+        memset(near, 0, GEOFENCE_BATCH_MASK_WORDS(mSize) * sizeof(uint32_t));
+        if (!(location.flags & FLP_EXTENDED_LOCATION_HAS_LAT_LONG)) {
+            return;
+        }
+        double margin = getMargin(location, nearMeters);
+        double rad = M_PI / 180.0;
+        for (uint32_t i = 0; i < mSize; i++) {
+            // back from the stored unit vector, so the fences are the same
+            double lat = atan2((double)mZ[i], hypot((double)mX[i], (double)mY[i]));
+            double lon = atan2((double)mY[i], (double)mX[i]);
+            double radius = 2 * GEOFENCE_BATCH_EARTH_RADIUS_METERS *
+                atan2((double)mSinR[i], (double)mCosR[i]);
+            double sLat = sin((lat - location.latitude * rad) / 2);
+            double sLon = sin((lon - location.longitude * rad) / 2);
+            double a = sLat * sLat + cos(lat) * cos(location.latitude * rad) * sLon * sLon;
+            double d = 2 * GEOFENCE_BATCH_EARTH_RADIUS_METERS * asin(sqrt(a > 1.0 ? 1.0 : a));
+            if (NULL != distances) {
+                distances[i] = d;
+            }
+            if (d <= radius) {
+                inside[i / 32] |= 1U << (i % 32);
+            } else if (d <= radius + margin) {
+                near[i / 32] |= 1U << (i % 32);
+            }
+        }
+    }
+
+private:
+
+    struct Query {
+        float x;
+        float y;
+        float z;
+        float sinM;   // sin(margin / 2R)
+        float cosM;   // cos(margin / 2R)
+    };
+
+    static inline void toUnitVector(double latitude, double longitude,
+                                    double& x, double& y, double& z) {
+        double lat = latitude * M_PI / 180.0;
+        double lon = longitude * M_PI / 180.0;
+        x = cos(lat) * cos(lon);
+        y = cos(lat) * sin(lon);
+        z = sin(lat);
+    }
+
+    static inline double getMargin(const FlpExtLocation& location, double nearMeters) {
+        double margin = nearMeters > 0 ? nearMeters : 0;
+        if ((location.flags & FLP_EXTENDED_LOCATION_HAS_ACCURACY) && location.accuracy > 0) {
+            margin += location.accuracy;
+        }
+        return margin;
+    }
+
+    static inline bool getQuery(const FlpExtLocation& location, double nearMeters, Query& q) {
+        if (!(location.flags & FLP_EXTENDED_LOCATION_HAS_LAT_LONG)) {
+            return false;
+        }
+        double x, y, z;
+        toUnitVector(location.latitude, location.longitude, x, y, z);
+        double halfAngle = getMargin(location, nearMeters) /
+            (2 * GEOFENCE_BATCH_EARTH_RADIUS_METERS);
+        if (halfAngle > M_PI / 2) {
+            halfAngle = M_PI / 2;
+        }
+        q.x = (float)x;
+        q.y = (float)y;
+        q.z = (float)z;
+        q.sinM = (float)sin(halfAngle);
+        q.cosM = (float)cos(halfAngle);
+        return true;
+    }
+
+    // clears the mask bits of the lanes past the last fence
+    inline void trimMasks(uint32_t* inside, uint32_t* near) const {
+        if (0 != mSize % 32) {
+            uint32_t keep = (1U << (mSize % 32)) - 1;
+            inside[mSize / 32] &= keep;
+            near[mSize / 32] &= keep;
+        }
+    }
+
+    inline void evaluateScalar(const Query& q, uint32_t* inside, uint32_t* near) const {
+        for (uint32_t i = 0; i < mSize; i++) {
+            float dx = mX[i] - q.x;
+            float dy = mY[i] - q.y;
+            float dz = mZ[i] - q.z;
+            // (half chord)^2 against sin^2 of the half angles
+            float h2 = (dx * dx + dy * dy + dz * dz) * 0.25f;
+            float sinR = mSinR[i];
+            float sinN = sinR * q.cosM + mCosR[i] * q.sinM;
+            // past a half angle of pi/2 the circle covers the whole sphere
+            if (mCosR[i] * q.cosM - sinR * q.sinM <= 0) {
+                sinN = 1.0f;
+            }
+            uint32_t bit = 1U << (i % 32);
+            if (h2 <= sinR * sinR) {
+                inside[i / 32] |= bit;
+            } else if (h2 <= sinN * sinN) {
+                near[i / 32] |= bit;
+            }
+        }
+    }
+
+#if defined(GEOFENCE_BATCH_NEON)
+    static inline uint32_t movemask(uint32x4_t v) {
+        static const uint32_t weights[4] = { 1, 2, 4, 8 };
+        uint32x4_t bits = vandq_u32(v, vld1q_u32(weights));
+        uint32x2_t sum = vadd_u32(vget_low_u32(bits), vget_high_u32(bits));
+        return vget_lane_u32(vpadd_u32(sum, sum), 0);
+    }
+
+    inline void evaluateNeon(const Query& q, uint32_t* inside, uint32_t* near) const {
+        const float32x4_t qx = vdupq_n_f32(q.x);
+        const float32x4_t qy = vdupq_n_f32(q.y);
+        const float32x4_t qz = vdupq_n_f32(q.z);
+        const float32x4_t sinM = vdupq_n_f32(q.sinM);
+        const float32x4_t cosM = vdupq_n_f32(q.cosM);
+        const float32x4_t quarter = vdupq_n_f32(0.25f);
+        const float32x4_t zero = vdupq_n_f32(0.0f);
+        const float32x4_t one = vdupq_n_f32(1.0f);
+        for (uint32_t i = 0; i < mSize; i += 32) {
+            uint32_t in = 0, nr = 0;
+            uint32_t end = mSize - i < 32 ? mSize - i : 32;
+            for (uint32_t k = 0; k < end; k += 4) {
+                float32x4_t dx = vsubq_f32(vld1q_f32(mX + i + k), qx);
+                float32x4_t dy = vsubq_f32(vld1q_f32(mY + i + k), qy);
+                float32x4_t dz = vsubq_f32(vld1q_f32(mZ + i + k), qz);
+                float32x4_t h2 = vmulq_f32(dx, dx);
+                h2 = vmlaq_f32(h2, dy, dy);
+                h2 = vmlaq_f32(h2, dz, dz);
+                h2 = vmulq_f32(h2, quarter);
+                float32x4_t sinR = vld1q_f32(mSinR + i + k);
+                float32x4_t cosR = vld1q_f32(mCosR + i + k);
+                float32x4_t sinN = vmlaq_f32(vmulq_f32(sinR, cosM), cosR, sinM);
+                float32x4_t cosN = vmlsq_f32(vmulq_f32(cosR, cosM), sinR, sinM);
+                sinN = vbslq_f32(vcleq_f32(cosN, zero), one, sinN);
+                uint32x4_t isIn = vcleq_f32(h2, vmulq_f32(sinR, sinR));
+                uint32x4_t isNear = vbicq_u32(vcleq_f32(h2, vmulq_f32(sinN, sinN)), isIn);
+                in |= movemask(isIn) << k;
+                nr |= movemask(isNear) << k;
+            }
+            inside[i / 32] = in;
+            near[i / 32] = nr;
+        }
+        trimMasks(inside, near);
+    }
+#endif
+
+#if defined(GEOFENCE_BATCH_AVX)
+    inline void evaluateAvx(const Query& q, uint32_t* inside, uint32_t* near) const {
+        const __m256 qx = _mm256_set1_ps(q.x);
+        const __m256 qy = _mm256_set1_ps(q.y);
+        const __m256 qz = _mm256_set1_ps(q.z);
+        const __m256 sinM = _mm256_set1_ps(q.sinM);
+        const __m256 cosM = _mm256_set1_ps(q.cosM);
+        const __m256 quarter = _mm256_set1_ps(0.25f);
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 one = _mm256_set1_ps(1.0f);
+        for (uint32_t i = 0; i < mSize; i += 32) {
+            uint32_t in = 0, nr = 0;
+            uint32_t end = mSize - i < 32 ? mSize - i : 32;
+            for (uint32_t k = 0; k < end; k += 8) {
+                __m256 dx = _mm256_sub_ps(_mm256_load_ps(mX + i + k), qx);
+                __m256 dy = _mm256_sub_ps(_mm256_load_ps(mY + i + k), qy);
+                __m256 dz = _mm256_sub_ps(_mm256_load_ps(mZ + i + k), qz);
+                __m256 h2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx),
+                                                        _mm256_mul_ps(dy, dy)),
+                                          _mm256_mul_ps(dz, dz));
+                h2 = _mm256_mul_ps(h2, quarter);
+                __m256 sinR = _mm256_load_ps(mSinR + i + k);
+                __m256 cosR = _mm256_load_ps(mCosR + i + k);
+                __m256 sinN = _mm256_add_ps(_mm256_mul_ps(sinR, cosM), _mm256_mul_ps(cosR, sinM));
+                __m256 cosN = _mm256_sub_ps(_mm256_mul_ps(cosR, cosM), _mm256_mul_ps(sinR, sinM));
+                sinN = _mm256_blendv_ps(sinN, one, _mm256_cmp_ps(cosN, zero, _CMP_LE_OQ));
+                __m256 isIn = _mm256_cmp_ps(h2, _mm256_mul_ps(sinR, sinR), _CMP_LE_OQ);
+                __m256 isNear = _mm256_andnot_ps(isIn,
+                    _mm256_cmp_ps(h2, _mm256_mul_ps(sinN, sinN), _CMP_LE_OQ));
+                in |= (uint32_t)_mm256_movemask_ps(isIn) << k;
+                nr |= (uint32_t)_mm256_movemask_ps(isNear) << k;
+            }
+            inside[i / 32] = in;
+            near[i / 32] = nr;
+        }
+        trimMasks(inside, near);
+    }
+#endif
+
+#if defined(GEOFENCE_BATCH_SSE)
+    inline void evaluateSse(const Query& q, uint32_t* inside, uint32_t* near) const {
+        const __m128 qx = _mm_set1_ps(q.x);
+        const __m128 qy = _mm_set1_ps(q.y);
+        const __m128 qz = _mm_set1_ps(q.z);
+        const __m128 sinM = _mm_set1_ps(q.sinM);
+        const __m128 cosM = _mm_set1_ps(q.cosM);
+        const __m128 quarter = _mm_set1_ps(0.25f);
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps(1.0f);
+        for (uint32_t i = 0; i < mSize; i += 32) {
+            uint32_t in = 0, nr = 0;
+            uint32_t end = mSize - i < 32 ? mSize - i : 32;
+            for (uint32_t k = 0; k < end; k += 4) {
+                __m128 dx = _mm_sub_ps(_mm_load_ps(mX + i + k), qx);
+                __m128 dy = _mm_sub_ps(_mm_load_ps(mY + i + k), qy);
+                __m128 dz = _mm_sub_ps(_mm_load_ps(mZ + i + k), qz);
+                __m128 h2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)),
+                                       _mm_mul_ps(dz, dz));
+                h2 = _mm_mul_ps(h2, quarter);
+                __m128 sinR = _mm_load_ps(mSinR + i + k);
+                __m128 cosR = _mm_load_ps(mCosR + i + k);
+                __m128 sinN = _mm_add_ps(_mm_mul_ps(sinR, cosM), _mm_mul_ps(cosR, sinM));
+                __m128 cosN = _mm_sub_ps(_mm_mul_ps(cosR, cosM), _mm_mul_ps(sinR, sinM));
+                // no blendv in SSE2: select with and/andnot/or
+                __m128 full = _mm_cmple_ps(cosN, zero);
+                sinN = _mm_or_ps(_mm_and_ps(full, one), _mm_andnot_ps(full, sinN));
+                __m128 isIn = _mm_cmple_ps(h2, _mm_mul_ps(sinR, sinR));
+                __m128 isNear = _mm_andnot_ps(isIn, _mm_cmple_ps(h2, _mm_mul_ps(sinN, sinN)));
+                in |= (uint32_t)_mm_movemask_ps(isIn) << k;
+                nr |= (uint32_t)_mm_movemask_ps(isNear) << k;
+            }
+            inside[i / 32] = in;
+            near[i / 32] = nr;
+        }
+        trimMasks(inside, near);
+    }
+#endif
+};
+
+#endif /* GEOFENCE_BATCH_H */
@@ -0,0 +1,403 @@
+/*====*====*====*====*====*====*====*====*====*====*====*====*====*====*====*
+  Copyright (c) 2013-2015 Qualcomm Technologies, Inc.
+  All Rights Reserved.
+  Confidential and Proprietary - Qualcomm Technologies, Inc.
+=============================================================================*/
+#ifndef GEOFENCE_ID_INDEX_H
+#define GEOFENCE_ID_INDEX_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <vector>
+#include <GeofenceAdapter.h>
+
+#define GEOFENCE_ID_INDEX_MIN_BUCKETS 64
+
+/* Bidirectional hash index between the framework geofence id of a client
+   (GeofenceKey) and the hardware id of the fence.
+
+   Both directions are open addressing tables with linear probing over a
+   shared node array, so a lookup either way is O(1) and allocation free.
+   Nodes of the same client are chained, so removeClient() costs the
+   number of fences of that client, not the number of fences.
+
+   Lookups take a read lock and updates a write lock, so the adapter's
+   message thread can read while commands update the index. */
+class GeofenceIdIndex {
+
+    struct Node {
+        uint32_t afwId;
+        GeoFencer* client;
+        uint32_t hwId;
+        // chain of the nodes of the same client, or of free nodes
+        uint32_t prev;
+        uint32_t next;
+    };
+
+    struct Client {
+        GeoFencer* client;
+        uint32_t head;
+        uint32_t count;
+    };
+
+    // node and bucket references are index + 1, so 0 means none.
+    // the arrays only grow in reserve(), so an update that got past
+    // reserve() can not fail half way
+    Node* mNodes;
+    uint32_t mNumNodes;
+    uint32_t mNodeCapacity;
+    uint32_t* mKeyBuckets;
+    uint32_t* mHwBuckets;
+    uint32_t mNumBuckets;    // power of two
+    uint32_t mFree;
+    uint32_t mSize;
+    Client* mClients;
+    uint32_t mNumClients;
+    uint32_t mClientCapacity;
+    mutable pthread_rwlock_t mLock;
+
+    // private copy constructor and assignment operator so that
+    // the index can not be copied.
+    GeofenceIdIndex(const GeofenceIdIndex&);
+    GeofenceIdIndex& operator=(const GeofenceIdIndex&);
+
+public:
+
+    inline GeofenceIdIndex() :
+        mNodes(NULL), mNumNodes(0), mNodeCapacity(0),
+        mKeyBuckets(NULL), mHwBuckets(NULL), mNumBuckets(0),
+        mFree(0), mSize(0),
+        mClients(NULL), mNumClients(0), mClientCapacity(0) {
+        pthread_rwlock_init(&mLock, NULL);
+    }
+
+    inline ~GeofenceIdIndex() {
+        free(mNodes);
+        free(mClients);
+        free(mKeyBuckets);
+        free(mHwBuckets);
+        pthread_rwlock_destroy(&mLock);
+    }
+
+    /* Maps key to hwId. An existing mapping of the key or of the hwId is
+       replaced. Returns false, with the index unchanged, if memory could
+       not be allocated. */
+    inline bool add(const GeofenceKey& key, uint32_t hwId) {
+        WriteLock lock(mLock);
+        if (!reserve(mSize + 1, key.client)) {
+            return false;
+        }
+        eraseNode(findKey(key.afwId, key.client));
+        eraseNode(findHwId(hwId));
+        uint32_t n = allocNode();
+        Node& node = mNodes[n - 1];
+        node.afwId = key.afwId;
+        node.client = key.client;
+        node.hwId = hwId;
+        linkClient(n);
+        insertBucket(mKeyBuckets, hashKey(key.afwId, key.client), n);
+        insertBucket(mHwBuckets, hashHwId(hwId), n);
+        mSize++;
+        return true;
+    }
+
+    inline bool getHwIdFromAfwId(int32_t afwId, GeoFencer* client, uint32_t& hwId) const {
+        ReadLock lock(mLock);
+        uint32_t n = findKey(afwId, client);
+        if (0 == n) {
+            return false;
+        }
+        hwId = mNodes[n - 1].hwId;
+        return true;
+    }
+
+    inline bool getHwId(const GeofenceKey& key, uint32_t& hwId) const {
+        return getHwIdFromAfwId(key.afwId, key.client, hwId);
+    }
+
+    // reverse lookup, as needed for breach, status and response events
+    inline bool getKey(uint32_t hwId, int32_t& afwId, GeoFencer*& client) const {
+        ReadLock lock(mLock);
+        uint32_t n = findHwId(hwId);
+        if (0 == n) {
+            return false;
+        }
+        afwId = mNodes[n - 1].afwId;
+        client = mNodes[n - 1].client;
+        return true;
+    }
+
+    inline bool removeKey(const GeofenceKey& key) {
+        WriteLock lock(mLock);
+        return eraseNode(findKey(key.afwId, key.client));
+    }
+
+    inline bool removeHwId(uint32_t hwId) {
+        WriteLock lock(mLock);
+        return eraseNode(findHwId(hwId));
+    }
+
+    /* Drops every mapping of a client, e.g. when it goes away. The hwIds
+       dropped are appended to hwIds when given. Returns their number. */
+    inline size_t removeClient(GeoFencer* client, std::vector<uint32_t>* hwIds = NULL) {
+        WriteLock lock(mLock);
+        size_t i = findClient(client);
+        if (i == mNumClients) {
+            return 0;
+        }
+        size_t count = 0;
+        // erasing the last node of the client also drops its mClients slot
+        for (uint32_t n = mClients[i].head, next; n != 0; n = next) {
+            next = mNodes[n - 1].next;
+            if (NULL != hwIds) {
+                hwIds->push_back(mNodes[n - 1].hwId);
+            }
+            eraseNode(n);
+            count++;
+        }
+        return count;
+    }
+
+    inline size_t getNumFences(GeoFencer* client) const {
+        ReadLock lock(mLock);
+        size_t i = findClient(client);
+        return i == mNumClients ? 0 : mClients[i].count;
+    }
+
+    inline size_t size() const {
+        ReadLock lock(mLock);
+        return mSize;
+    }
+
+    inline void clear() {
+        WriteLock lock(mLock);
+        mNumNodes = 0;
+        mNumClients = 0;
+        if (mNumBuckets > 0) {
+            memset(mKeyBuckets, 0, mNumBuckets * sizeof(uint32_t));
+            memset(mHwBuckets, 0, mNumBuckets * sizeof(uint32_t));
+        }
+        mFree = 0;
+        mSize = 0;
+    }
+
+private:
+
+    class ReadLock {
+        pthread_rwlock_t& mLock;
+    public:
+        inline ReadLock(pthread_rwlock_t& lock) : mLock(lock) {
+            pthread_rwlock_rdlock(&mLock);
+        }
+        inline ~ReadLock() { pthread_rwlock_unlock(&mLock); }
+    };
+
+    class WriteLock {
+        pthread_rwlock_t& mLock;
+    public:
+        inline WriteLock(pthread_rwlock_t& lock) : mLock(lock) {
+            pthread_rwlock_wrlock(&mLock);
+        }
+        inline ~WriteLock() { pthread_rwlock_unlock(&mLock); }
+    };
+
+    static inline uint32_t mix(uint64_t h) {
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        h *= 0xc4ceb9fe1a85ec53ULL;
+        h ^= h >> 33;
+        return (uint32_t)h;
+    }
+
+    static inline uint32_t hashKey(uint32_t afwId, GeoFencer* client) {
+        return mix(((uint64_t)(uintptr_t)client << 16) ^ afwId);
+    }
+
+    static inline uint32_t hashHwId(uint32_t hwId) {
+        return mix(hwId);
+    }
+
+    inline uint32_t findKey(uint32_t afwId, GeoFencer* client) const {
+        if (0 == mSize) {
+            return 0;
+        }
+        uint32_t mask = mNumBuckets - 1;
+        for (uint32_t b = hashKey(afwId, client) & mask; ; b = (b + 1) & mask) {
+            uint32_t n = mKeyBuckets[b];
+            if (0 == n ||
+                (mNodes[n - 1].afwId == afwId && mNodes[n - 1].client == client)) {
+                return n;
+            }
+        }
+    }
+
+    inline uint32_t findHwId(uint32_t hwId) const {
+        if (0 == mSize) {
+            return 0;
+        }
+        uint32_t mask = mNumBuckets - 1;
+        for (uint32_t b = hashHwId(hwId) & mask; ; b = (b + 1) & mask) {
+            uint32_t n = mHwBuckets[b];
+            if (0 == n || mNodes[n - 1].hwId == hwId) {
+                return n;
+            }
+        }
+    }
+
+    inline size_t findClient(GeoFencer* client) const {
+        size_t i = 0;
+        while (i < mNumClients && mClients[i].client != client) {
+            i++;
+        }
+        return i;
+    }
+
+    inline uint32_t nodeHash(const uint32_t* buckets, uint32_t n) const {
+        const Node& node = mNodes[n - 1];
+        return buckets == mKeyBuckets ?
+            hashKey(node.afwId, node.client) : hashHwId(node.hwId);
+    }
+
+    inline void insertBucket(uint32_t* buckets, uint32_t hash, uint32_t n) {
+        uint32_t mask = mNumBuckets - 1;
+        uint32_t b = hash & mask;
+        while (0 != buckets[b]) {
+            b = (b + 1) & mask;
+        }
+        buckets[b] = n;
+    }
+
+    // backward shift deletion, so the tables never hold tombstones
+    inline void eraseBucket(uint32_t* buckets, uint32_t hash, uint32_t n) {
+        uint32_t mask = mNumBuckets - 1;
+        uint32_t b = hash & mask;
+        while (buckets[b] != n) {
+            b = (b + 1) & mask;
+        }
+        for (uint32_t next = (b + 1) & mask; 0 != buckets[next]; next = (next + 1) & mask) {
+            uint32_t home = nodeHash(buckets, buckets[next]) & mask;
+            // move the entry back unless its home lies in (b, next]
+            if (((next - home) & mask) >= ((next - b) & mask)) {
+                buckets[b] = buckets[next];
+                b = next;
+            }
+        }
+        buckets[b] = 0;
+    }
+
+    template <typename T>
+    static inline bool grow(T*& array, uint32_t& capacity, uint32_t minCapacity) {
+        uint32_t newCapacity = capacity > 0 ? capacity * 2 : minCapacity;
+        T* newArray = (T*)realloc(array, newCapacity * sizeof(T));
+        if (NULL == newArray) {
+            return false;
+        }
+        array = newArray;
+        capacity = newCapacity;
+        return true;
+    }
+
+    // makes room for size mappings and a node and client slot for one more
+    inline bool reserve(uint32_t size, GeoFencer* client) {
+        if (0 == mFree && mNumNodes == mNodeCapacity &&
+            !grow(mNodes, mNodeCapacity, GEOFENCE_ID_INDEX_MIN_BUCKETS)) {
+            return false;
+        }
+        if (mNumClients == mClientCapacity && findClient(client) == mNumClients &&
+            !grow(mClients, mClientCapacity, 4)) {
+            return false;
+        }
+        // keep the load factor at or below 1/2
+        if (size * 2 <= mNumBuckets) {
+            return true;
+        }
+        uint32_t numBuckets = mNumBuckets > 0 ? mNumBuckets * 2 : GEOFENCE_ID_INDEX_MIN_BUCKETS;
+        while (size * 2 > numBuckets) {
+            numBuckets *= 2;
+        }
+        uint32_t* keyBuckets = (uint32_t*)calloc(numBuckets, sizeof(uint32_t));
+        uint32_t* hwBuckets = (uint32_t*)calloc(numBuckets, sizeof(uint32_t));
+        if (NULL == keyBuckets || NULL == hwBuckets) {
+            free(keyBuckets);
+            free(hwBuckets);
+            return false;
+        }
+        uint32_t* oldKeyBuckets = mKeyBuckets;
+        uint32_t oldNumBuckets = mNumBuckets;
+        free(mHwBuckets);
+        mKeyBuckets = keyBuckets;
+        mHwBuckets = hwBuckets;
+        mNumBuckets = numBuckets;
+        // every live node is in the old key table exactly once
+        for (uint32_t b = 0; b < oldNumBuckets; b++) {
+            uint32_t n = oldKeyBuckets[b];
+            if (0 != n) {
+                insertBucket(mKeyBuckets, hashKey(mNodes[n - 1].afwId, mNodes[n - 1].client), n);
+                insertBucket(mHwBuckets, hashHwId(mNodes[n - 1].hwId), n);
+            }
+        }
+        free(oldKeyBuckets);
+        return true;
+    }
+
+    inline uint32_t allocNode() {
+        if (0 != mFree) {
+            uint32_t n = mFree;
+            mFree = mNodes[n - 1].next;
+            return n;
+        }
+        return ++mNumNodes;
+    }
+
+    inline void linkClient(uint32_t n) {
+        Node& node = mNodes[n - 1];
+        size_t i = findClient(node.client);
+        if (i == mNumClients) {
+            Client c = { node.client, 0, 0 };
+            mClients[mNumClients++] = c;
+        }
+        node.prev = 0;
+        node.next = mClients[i].head;
+        if (0 != node.next) {
+            mNodes[node.next - 1].prev = n;
+        }
+        mClients[i].head = n;
+        mClients[i].count++;
+    }
+
+    inline void unlinkClient(uint32_t n) {
+        Node& node = mNodes[n - 1];
+        size_t i = findClient(node.client);
+        if (0 != node.prev) {
+            mNodes[node.prev - 1].next = node.next;
+        } else {
+            mClients[i].head = node.next;
+        }
+        if (0 != node.next) {
+            mNodes[node.next - 1].prev = node.prev;
+        }
+        if (0 == --mClients[i].count) {
+            mClients[i] = mClients[--mNumClients];
+        }
+    }
+
+    inline bool eraseNode(uint32_t n) {
+        if (0 == n) {
+            return false;
+        }
+        Node& node = mNodes[n - 1];
+        eraseBucket(mKeyBuckets, hashKey(node.afwId, node.client), n);
+        eraseBucket(mHwBuckets, hashHwId(node.hwId), n);
+        unlinkClient(n);
+        node.client = NULL;
+        node.next = mFree;
+        mFree = n;
+        mSize--;
+        return true;
+    }
+};
+
+#endif /* GEOFENCE_ID_INDEX_H */
@@ -0,0 +1,343 @@
+/*====*====*====*====*====*====*====*====*====*====*====*====*====*====*====*
+  Copyright (c) 2013-2015 Qualcomm Technologies, Inc.
+  All Rights Reserved.
+  Confidential and Proprietary - Qualcomm Technologies, Inc.
+=============================================================================*/
+#ifndef GEOFENCE_SPATIAL_INDEX_H
+#define GEOFENCE_SPATIAL_INDEX_H
+
+#include <stdint.h>
+#include <math.h>
+#include <map>
+#include <vector>
+#include <IzatApiBase.h>
+#include <geofence.h>
+
+// mean earth radius in meters, as used for geofence distances
+#define GEOFENCE_EARTH_RADIUS_METERS        6371008.8
+// default edge of a grid cell, in meters of latitude
+#define GEOFENCE_INDEX_DEFAULT_CELL_METERS  2000.0
+// a fence or query covering more cells than this is not gridded
+#define GEOFENCE_INDEX_MAX_CELLS            1024
+
+/* Grid index over the circular geofences of an adapter, keyed by hwId.
+
+   The globe is cut into cells of a fixed size in degrees, the same way a
+   geohash of fixed length does. Every fence is registered in each cell its
+   bounding box touches, so the candidates for a fix are found by visiting
+   only the cells around the fix. Fences too large to grid (or touching a
+   pole) are kept on a short list that every query checks.
+
+   Insert, remove, pause and resume are incremental; nothing is rebuilt.
+   Like mGeoFences the index is not locked, and is meant to be used from
+   the adapter's message thread. */
+class GeofenceSpatialIndex {
+
+    struct Entry {
+        uint32_t hwId;
+        GeoFenceData data;
+        double latitude;
+        double longitude;
+        double radius;
+        bool paused;
+        bool wide;
+        uint32_t stamp;
+        // covered cells: rows [row0, row1], columns col0 .. col0 + cols - 1
+        // (modulo mNumCols)
+        uint32_t row0;
+        uint32_t row1;
+        uint32_t col0;
+        uint32_t cols;
+    };
+    typedef std::map<uint32_t, Entry> EntryMap;
+    typedef std::vector<Entry*> EntryList;
+    typedef std::map<uint64_t, EntryList> CellMap;
+
+    double mCellDeg;
+    uint32_t mNumRows;
+    uint32_t mNumCols;
+    uint32_t mStamp;
+    uint32_t mNumPaused;
+    EntryMap mEntries;   //map hwId to entry
+    CellMap mCells;      //map cell key to the entries registered in it
+    EntryList mWide;     //entries not registered in any cell
+
+public:
+
+    inline GeofenceSpatialIndex(double cellMeters = GEOFENCE_INDEX_DEFAULT_CELL_METERS) :
+        mCellDeg(metersToDegrees(cellMeters > 1.0 ? cellMeters : 1.0)),
+        mNumRows((uint32_t)ceil(180.0 / mCellDeg)),
+        mNumCols((uint32_t)ceil(360.0 / mCellDeg)),
+        mStamp(0),
+        mNumPaused(0) {}
+    inline ~GeofenceSpatialIndex() {}
+
+    // great circle distance in meters
+    static inline double distanceMeters(double lat1, double lon1,
+                                        double lat2, double lon2) {
+        const double rad = M_PI / 180.0;
+        double sLat = sin((lat2 - lat1) * rad / 2);
+        double sLon = sin((lon2 - lon1) * rad / 2);
+        double a = sLat * sLat + cos(lat1 * rad) * cos(lat2 * rad) * sLon * sLon;
+        if (a > 1.0) {
+            a = 1.0;
+        }
+        return 2 * GEOFENCE_EARTH_RADIUS_METERS * asin(sqrt(a));
+    }
+
+    // adds a fence, or replaces the fence saved under the same hwId
+    inline void insert(uint32_t hwId, const GeoFenceData& data, bool paused = false) {
+        remove(hwId);
+        Entry& e = mEntries[hwId];
+        e.hwId = hwId;
+        e.data = data;
+        e.latitude = data.latitude;
+        e.longitude = data.longitude;
+        e.radius = data.radius > 0 ? data.radius : 0;
+        e.paused = paused;
+        e.stamp = mStamp;
+        if (paused) {
+            mNumPaused++;
+        }
+        e.wide = !getCells(e.latitude, e.longitude, e.radius,
+                           e.row0, e.row1, e.col0, e.cols);
+        if (e.wide) {
+            mWide.push_back(&e);
+        } else {
+            for (uint32_t row = e.row0; row <= e.row1; row++) {
+                for (uint32_t i = 0; i < e.cols; i++) {
+                    mCells[cellKey(row, (e.col0 + i) % mNumCols)].push_back(&e);
+                }
+            }
+        }
+    }
+
+    // takes the options of a modify command, as modifyGeoFenceItem does.
+    // a modify carries no geometry, so the fence stays where it is
+    inline bool modify(uint32_t hwId, const GeoFenceData& data) {
+        EntryMap::iterator it = mEntries.find(hwId);
+        if (it == mEntries.end()) {
+            return false;
+        }
+        it->second.data.breachMask = data.breachMask;
+        it->second.data.responsiveness = data.responsiveness;
+        return true;
+    }
+
+    inline bool remove(uint32_t hwId) {
+        EntryMap::iterator it = mEntries.find(hwId);
+        if (it == mEntries.end()) {
+            return false;
+        }
+        Entry* e = &it->second;
+        if (e->wide) {
+            eraseFrom(mWide, e);
+        } else {
+            for (uint32_t row = e->row0; row <= e->row1; row++) {
+                for (uint32_t i = 0; i < e->cols; i++) {
+                    CellMap::iterator cell =
+                        mCells.find(cellKey(row, (e->col0 + i) % mNumCols));
+                    if (cell != mCells.end()) {
+                        eraseFrom(cell->second, e);
+                        if (cell->second.empty()) {
+                            mCells.erase(cell);
+                        }
+                    }
+                }
+            }
+        }
+        if (e->paused) {
+            mNumPaused--;
+        }
+        mEntries.erase(it);
+        return true;
+    }
+
+    // paused fences stay in the grid but are not returned as candidates
+    inline bool pause(uint32_t hwId) {
+        return setPaused(hwId, true);
+    }
+
+    inline bool resume(uint32_t hwId) {
+        return setPaused(hwId, false);
+    }
+
+    inline void clear() {
+        mEntries.clear();
+        mCells.clear();
+        mWide.clear();
+        mNumPaused = 0;
+    }
+
+    inline const GeoFenceData* find(uint32_t hwId) const {
+        EntryMap::const_iterator it = mEntries.find(hwId);
+        return it == mEntries.end() ? NULL : &it->second.data;
+    }
+
+    inline bool isPaused(uint32_t hwId) const {
+        EntryMap::const_iterator it = mEntries.find(hwId);
+        return it != mEntries.end() && it->second.paused;
+    }
+
+    inline size_t size() const { return mEntries.size(); }
+    inline size_t getNumPaused() const { return mNumPaused; }
+    inline size_t getNumCells() const { return mCells.size(); }
+    inline size_t getNumWide() const { return mWide.size(); }
+
+    /* Appends to hwIds the active fences whose circle, grown by marginMeters
+       and by the accuracy of the location when it has one, contains the
+       location. The result is unordered. Returns the number of ids appended. */
+    inline size_t getCandidates(const FlpExtLocation& location,
+                                double marginMeters,
+                                std::vector<uint32_t>& hwIds) {
+        if (!(location.flags & FLP_EXTENDED_LOCATION_HAS_LAT_LONG)) {
+            return 0;
+        }
+        double reach = marginMeters > 0 ? marginMeters : 0;
+        if ((location.flags & FLP_EXTENDED_LOCATION_HAS_ACCURACY) &&
+            location.accuracy > 0) {
+            reach += location.accuracy;
+        }
+        return getCandidates(location.latitude, location.longitude, reach, hwIds);
+    }
+
+    // same as above, for a point and a search distance in meters
+    inline size_t getCandidates(double latitude, double longitude,
+                                double reachMeters,
+                                std::vector<uint32_t>& hwIds) {
+        size_t count = hwIds.size();
+        if (mEntries.size() == mNumPaused) {
+            return 0;
+        }
+        // stamps tell entries already visited through another cell
+        if (++mStamp == 0) {
+            for (EntryMap::iterator it = mEntries.begin(); it != mEntries.end(); it++) {
+                it->second.stamp = 0;
+            }
+            mStamp = 1;
+        }
+
+        uint32_t row0, row1, col0, cols;
+        if (getCells(latitude, longitude, reachMeters, row0, row1, col0, cols) &&
+            (uint64_t)(row1 - row0 + 1) * cols <= mCells.size()) {
+            for (uint32_t row = row0; row <= row1; row++) {
+                for (uint32_t i = 0; i < cols; i++) {
+                    CellMap::iterator cell =
+                        mCells.find(cellKey(row, (col0 + i) % mNumCols));
+                    if (cell != mCells.end()) {
+                        checkList(cell->second, latitude, longitude,
+                                  reachMeters, hwIds);
+                    }
+                }
+            }
+            checkList(mWide, latitude, longitude, reachMeters, hwIds);
+        } else {
+            // the search area covers more cells than are in use
+            for (EntryMap::iterator it = mEntries.begin(); it != mEntries.end(); it++) {
+                check(&it->second, latitude, longitude, reachMeters, hwIds);
+            }
+        }
+        return hwIds.size() - count;
+    }
+
+private:
+
+    static inline double metersToDegrees(double meters) {
+        return meters / GEOFENCE_EARTH_RADIUS_METERS * 180.0 / M_PI;
+    }
+
+    inline uint64_t cellKey(uint32_t row, uint32_t col) const {
+        return ((uint64_t)row << 32) | col;
+    }
+
+    inline uint32_t getRow(double latitude) const {
+        int32_t row = (int32_t)floor((latitude + 90.0) / mCellDeg);
+        if (row < 0) {
+            return 0;
+        }
+        return (uint32_t)row < mNumRows ? (uint32_t)row : mNumRows - 1;
+    }
+
+    inline uint32_t getCol(double longitude) const {
+        // the last column is narrower, so wrap the longitude, not the column
+        double lon = fmod(longitude + 180.0, 360.0);
+        if (lon < 0) {
+            lon += 360.0;
+        }
+        uint32_t col = (uint32_t)(lon / mCellDeg);
+        return col < mNumCols ? col : mNumCols - 1;
+    }
+
+    /* Cells covered by the bounding box of a circle. Returns false when the
+       circle touches a pole or covers more than GEOFENCE_INDEX_MAX_CELLS. */
+    inline bool getCells(double latitude, double longitude, double radius,
+                         uint32_t& row0, uint32_t& row1,
+                         uint32_t& col0, uint32_t& cols) const {
+        double dLat = metersToDegrees(radius);
+        double south = latitude - dLat;
+        double north = latitude + dLat;
+        if (south <= -90.0 || north >= 90.0) {
+            return false;
+        }
+        // longitude span is widest on the edge nearest to the pole
+        double maxLat = fabs(south) > fabs(north) ? fabs(south) : fabs(north);
+        double dLon = dLat / cos(maxLat * M_PI / 180.0);
+        if (2 * dLon >= 360.0 - mCellDeg) {
+            return false;
+        }
+        row0 = getRow(south);
+        row1 = getRow(north);
+        col0 = getCol(longitude - dLon);
+        uint32_t col1 = getCol(longitude + dLon);
+        cols = (col1 >= col0 ? col1 - col0 : col1 + mNumCols - col0) + 1;
+        return (uint64_t)(row1 - row0 + 1) * cols <= GEOFENCE_INDEX_MAX_CELLS;
+    }
+
+    inline bool setPaused(uint32_t hwId, bool paused) {
+        EntryMap::iterator it = mEntries.find(hwId);
+        if (it == mEntries.end()) {
+            return false;
+        }
+        if (it->second.paused != paused) {
+            it->second.paused = paused;
+            if (paused) {
+                mNumPaused++;
+            } else {
+                mNumPaused--;
+            }
+        }
+        return true;
+    }
+
+    static inline void eraseFrom(EntryList& list, Entry* e) {
+        for (size_t i = 0; i < list.size(); i++) {
+            if (list[i] == e) {
+                list[i] = list.back();
+                list.pop_back();
+                return;
+            }
+        }
+    }
+
+    inline void check(Entry* e, double latitude, double longitude,
+                      double reachMeters, std::vector<uint32_t>& hwIds) {
+        if (e->stamp == mStamp) {
+            return;
+        }
+        e->stamp = mStamp;
+        if (!e->paused &&
+            distanceMeters(latitude, longitude, e->latitude, e->longitude) <=
+            e->radius + reachMeters) {
+            hwIds.push_back(e->hwId);
+        }
+    }
+
+    inline void checkList(EntryList& list, double latitude, double longitude,
+                          double reachMeters, std::vector<uint32_t>& hwIds) {
+        for (size_t i = 0; i < list.size(); i++) {
+            check(list[i], latitude, longitude, reachMeters, hwIds);
+        }
+    }
+};
+
+#endif /* GEOFENCE_SPATIAL_INDEX_H */
@@ -0,0 +1,250 @@
+/*====*====*====*====*====*====*====*====*====*====*====*====*====*====*====*
+  Copyright (c) 2013-2015 Qualcomm Technologies, Inc.
+  All Rights Reserved.
+  Confidential and Proprietary - Qualcomm Technologies, Inc.
+=============================================================================*/
+#ifndef IZAT_MSG_POOL_H
+#define IZAT_MSG_POOL_H
+
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <new>
+#include <MsgTask.h>
+
+/** default number of free messages kept per type */
+#define IZAT_MSG_POOL_DEFAULT_MAX_FREE 64
+#define IZAT_MSG_POOL_NAME_LEN 48
+
+namespace izat_core {
+
+/** Counters of one message type. */
+struct IzatMsgPoolStats {
+    const char* name;
+    uint64_t allocs;        // messages constructed
+    uint64_t frees;         // messages released after proc()
+    uint64_t pooled;        // allocations served from the pool, i.e. avoided
+    uint64_t heapAllocs;    // allocations that went to the heap
+    uint64_t heapFrees;     // releases the pool was too full to keep
+    uint32_t free;          // messages now in the pool
+    uint32_t maxFree;
+    int64_t timeNs;         // CLOCK_MONOTONIC when the counters were read
+
+    inline uint64_t getInFlight() const { return allocs - frees; }
+
+    /** messages per second between an earlier snapshot and this one */
+    inline double getMsgsPerSec(const IzatMsgPoolStats& earlier) const {
+        int64_t ns = timeNs - earlier.timeNs;
+        return ns > 0 ? (double)(allocs - earlier.allocs) * 1e9 / ns : 0;
+    }
+};
+
+/** Registry of the pools of all message types, for dumping their stats. */
+class IzatMsgPoolBase {
+    IzatMsgPoolBase* mNext;
+    char mName[IZAT_MSG_POOL_NAME_LEN];
+
+    static inline pthread_mutex_t* getRegistryLock() {
+        static pthread_mutex_t sLock = PTHREAD_MUTEX_INITIALIZER;
+        return &sLock;
+    }
+    static inline IzatMsgPoolBase** getRegistryHead() {
+        static IzatMsgPoolBase* sHead = NULL;
+        return &sHead;
+    }
+
+protected:
+    inline IzatMsgPoolBase(const char* prettyFunction) : mNext(NULL) {
+        // no RTTI here: the type name is cut out of "... [with T = Name]"
+        const char* name = strstr(prettyFunction, "T = ");
+        name = (NULL != name) ? name + 4 : prettyFunction;
+        size_t len = strcspn(name, ";]");
+        if (len >= sizeof(mName)) {
+            len = sizeof(mName) - 1;
+        }
+        memcpy(mName, name, len);
+        mName[len] = '\0';
+        pthread_mutex_lock(getRegistryLock());
+        mNext = *getRegistryHead();
+        *getRegistryHead() = this;
+        pthread_mutex_unlock(getRegistryLock());
+    }
+    virtual ~IzatMsgPoolBase() {}
+
+public:
+    inline const char* getName() const { return mName; }
+    virtual void getStats(IzatMsgPoolStats& stats) const = 0;
+
+    /** Fills up to max stats, one per message type used so far.
+        @return number of stats written */
+    static inline uint32_t getAllStats(IzatMsgPoolStats* stats, uint32_t max) {
+        uint32_t count = 0;
+        pthread_mutex_lock(getRegistryLock());
+        for (IzatMsgPoolBase* pool = *getRegistryHead();
+             NULL != pool && count < max; pool = pool->mNext) {
+            pool->getStats(stats[count++]);
+        }
+        pthread_mutex_unlock(getRegistryLock());
+        return count;
+    }
+};
+
+/** Free list of recycled storage for messages of type T.
+
+    A message is allocated on the thread reporting the engine event and
+    released on the adapter's message thread after proc(), so the list is
+    locked. The lock is held only to push or pop one pointer. Up to
+    maxFree released messages are kept; past that they go back to the
+    heap. */
+template <typename T>
+class IzatMsgPool : public IzatMsgPoolBase {
+
+    struct FreeNode {
+        FreeNode* next;
+    };
+
+    pthread_mutex_t mLock;
+    FreeNode* mFree;
+    uint32_t mNumFree;
+    uint32_t mMaxFree;
+    uint64_t mAllocs;
+    uint64_t mFrees;
+    uint64_t mPooled;
+    uint64_t mHeapAllocs;
+    uint64_t mHeapFrees;
+
+    inline IzatMsgPool() :
+        IzatMsgPoolBase(__PRETTY_FUNCTION__),
+        mFree(NULL), mNumFree(0), mMaxFree(IZAT_MSG_POOL_DEFAULT_MAX_FREE),
+        mAllocs(0), mFrees(0), mPooled(0), mHeapAllocs(0), mHeapFrees(0) {
+        pthread_mutex_init(&mLock, NULL);
+    }
+    // pools live as long as the process
+    inline ~IzatMsgPool() {}
+
+public:
+
+    static inline IzatMsgPool& get() {
+        static IzatMsgPool sPool;
+        return sPool;
+    }
+
+    inline void* alloc(size_t size) {
+        __atomic_add_fetch(&mAllocs, 1, __ATOMIC_RELAXED);
+        void* p = NULL;
+        // a further derived message is bigger, and is left to the heap
+        if (size == sizeof(T)) {
+            pthread_mutex_lock(&mLock);
+            if (NULL != mFree) {
+                p = mFree;
+                mFree = mFree->next;
+                mNumFree--;
+            }
+            pthread_mutex_unlock(&mLock);
+        }
+        if (NULL != p) {
+            __atomic_add_fetch(&mPooled, 1, __ATOMIC_RELAXED);
+            return p;
+        }
+        __atomic_add_fetch(&mHeapAllocs, 1, __ATOMIC_RELAXED);
+        // out of memory is handled the same way as for any other new
+        return ::operator new(size < sizeof(FreeNode) ? sizeof(FreeNode) : size);
+    }
+
+    inline void release(void* p, size_t size) {
+        if (NULL == p) {
+            return;
+        }
+        __atomic_add_fetch(&mFrees, 1, __ATOMIC_RELAXED);
+        if (size == sizeof(T)) {
+            pthread_mutex_lock(&mLock);
+            if (mNumFree < mMaxFree) {
+                FreeNode* node = (FreeNode*)p;
+                node->next = mFree;
+                mFree = node;
+                mNumFree++;
+                p = NULL;
+            }
+            pthread_mutex_unlock(&mLock);
+        }
+        if (NULL != p) {
+            __atomic_add_fetch(&mHeapFrees, 1, __ATOMIC_RELAXED);
+            ::operator delete(p);
+        }
+    }
+
+    /** Sets how many released messages are kept, and allocates up to that
+        many now so the first events do not hit the heap either. */
+    inline void reserve(uint32_t maxFree) {
+        FreeNode* extra = NULL;
+        pthread_mutex_lock(&mLock);
+        mMaxFree = maxFree;
+        while (mNumFree < mMaxFree) {
+            FreeNode* node = (FreeNode*)::operator new(sizeof(T) < sizeof(FreeNode) ?
+                                                       sizeof(FreeNode) : sizeof(T),
+                                                       std::nothrow);
+            if (NULL == node) {
+                break;
+            }
+            node->next = mFree;
+            mFree = node;
+            mNumFree++;
+        }
+        // trim a pool that is over the new limit
+        while (mNumFree > mMaxFree) {
+            FreeNode* node = mFree;
+            mFree = node->next;
+            mNumFree--;
+            node->next = extra;
+            extra = node;
+        }
+        pthread_mutex_unlock(&mLock);
+        while (NULL != extra) {
+            FreeNode* next = extra->next;
+            ::operator delete(extra);
+            extra = next;
+        }
+    }
+
+    virtual void getStats(IzatMsgPoolStats& stats) const {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        stats.name = getName();
+        stats.allocs = __atomic_load_n(&mAllocs, __ATOMIC_RELAXED);
+        stats.frees = __atomic_load_n(&mFrees, __ATOMIC_RELAXED);
+        stats.pooled = __atomic_load_n(&mPooled, __ATOMIC_RELAXED);
+        stats.heapAllocs = __atomic_load_n(&mHeapAllocs, __ATOMIC_RELAXED);
+        stats.heapFrees = __atomic_load_n(&mHeapFrees, __ATOMIC_RELAXED);
+        stats.free = __atomic_load_n(&mNumFree, __ATOMIC_RELAXED);
+        stats.maxFree = __atomic_load_n(&mMaxFree, __ATOMIC_RELAXED);
+        stats.timeNs = (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+    }
+};
+
+/** Base for a LocMsg whose storage is recycled. Deriving
+        struct MsgFoo : public IzatPooledMsg<MsgFoo> { ... };
+    is all it takes: "new MsgFoo(...)" at the event and the "delete msg"
+    MsgTask does after proc() go through IzatMsgPool<MsgFoo>, since the
+    virtual destructor of LocMsg hands the class operator delete the size
+    of the actual message.
+
+    Both the new and the delete have to see these operators, so a message
+    type can only be switched over when the code allocating it is built
+    against this header. */
+template <typename T>
+struct IzatPooledMsg : public loc_core::LocMsg {
+    inline IzatPooledMsg() : loc_core::LocMsg() {}
+    inline virtual ~IzatPooledMsg() {}
+
+    static inline void* operator new(size_t size) {
+        return IzatMsgPool<T>::get().alloc(size);
+    }
+    static inline void operator delete(void* p, size_t size) {
+        IzatMsgPool<T>::get().release(p, size);
+    }
+};
+
+}  // namespace izat_core
+
+#endif /* IZAT_MSG_POOL_H */
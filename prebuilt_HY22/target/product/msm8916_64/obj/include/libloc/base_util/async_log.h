@@ -0,0 +1,763 @@
+/*====*====*====*====*====*====*====*====*====*====*====*====*====*====*====*
+
+ Asynchronous log utility
+
+ GENERAL DESCRIPTION
+ This header declares an asynchronous front end for the logging utility.
+ Callers only record the format pointer and raw arguments into a per-thread
+ lock-free ring; a background thread formats and emits them through log.h
+
+ Copyright (c) 2015 Qualcomm Technologies, Inc.
+ All Rights Reserved.
+ Confidential and Proprietary - Qualcomm Technologies, Inc.
+ =============================================================================*/
+#ifndef __XTRAT_WIFI_ASYNC_LOG_H__
+#define __XTRAT_WIFI_ASYNC_LOG_H__
+
+#include <new>
+#include <errno.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include <base_util/log.h>
+#include <base_util/sync.h>
+
+namespace qc_loc_fw
+{
+
+// Usage
+//
+//   async_log_start();                       // once, e.g. in main. optional
+//   async_log_info(TAG, "fix %d at %f", n, t);
+//   if(async_is_log_verbose_enabled(TAG)) ... // cached per tag
+//   async_log_stop();                         // drains and joins, e.g. at exit
+//
+// until async_log_start() is called (or after async_log_stop()), the async_log_xxx
+// functions format on the caller's thread, so they are always safe to use.
+//
+// limitations, compared to the synchronous log_xxx
+// - up to ASYNC_LOG_MAX_ARGS arguments, of integer, floating point, pointer or
+//   C string type. '*' width and precision are not supported
+// - format strings and tags are kept by pointer: use string literals, like log.h does
+// - string arguments are copied, truncated to what fits in one record
+// - when a thread's ring is full, that call is formatted synchronously instead. it
+//   then shows up in the log ahead of the older records of the same thread still
+//   in the ring; getNumOfOverflows() tells whether that has happened
+// - a call racing with async_log_stop() on another thread may be left in its ring
+//   until the next async_log_start()
+
+static const unsigned int ASYNC_LOG_MAX_ARGS = 8;
+static const unsigned int ASYNC_LOG_RING_SIZE = 256;
+static const unsigned int ASYNC_LOG_STRING_SPACE = 96;
+static const unsigned int ASYNC_LOG_TAG_CACHE_SIZE = 64;
+
+// one log call, as recorded by the calling thread
+struct AsyncLogRecord
+{
+  enum ARG_TYPE
+  {
+    AT_INT64 = 0, AT_UINT64, AT_DOUBLE, AT_POINTER, AT_STRING
+  };
+
+  union Arg
+  {
+    int64_t i;
+    uint64_t u;
+    double d;
+    const void * p;
+    // offset into m_strings
+    unsigned int s;
+  };
+
+  const char * m_tag;
+  const char * m_format;
+  ERROR_LEVEL m_level;
+  unsigned int m_num_args;
+  unsigned int m_string_used;
+  uint8_t m_types[ASYNC_LOG_MAX_ARGS];
+  Arg m_args[ASYNC_LOG_MAX_ARGS];
+  char m_strings[ASYNC_LOG_STRING_SPACE];
+
+  inline void begin(const ERROR_LEVEL level, const char * const tag, const char * const format)
+  {
+    m_tag = tag;
+    m_format = format;
+    m_level = level;
+    m_num_args = 0;
+    m_string_used = 0;
+  }
+
+  // overloads pick the argument type at compile time; no format parsing on the caller's thread
+  inline void add(const int v)                { addInt(v); }
+  inline void add(const long v)               { addInt(v); }
+  inline void add(const long long v)          { addInt(v); }
+  inline void add(const short v)              { addInt(v); }
+  inline void add(const char v)               { addInt(v); }
+  inline void add(const signed char v)        { addInt(v); }
+  inline void add(const bool v)               { addInt(v ? 1 : 0); }
+  inline void add(const unsigned int v)       { addUInt(v); }
+  inline void add(const unsigned long v)      { addUInt(v); }
+  inline void add(const unsigned long long v) { addUInt(v); }
+  inline void add(const unsigned short v)     { addUInt(v); }
+  inline void add(const unsigned char v)      { addUInt(v); }
+  inline void add(const double v)
+  {
+    if(m_num_args < ASYNC_LOG_MAX_ARGS)
+    {
+      m_types[m_num_args] = AT_DOUBLE;
+      m_args[m_num_args++].d = v;
+    }
+  }
+  inline void add(const float v)              { add((double) v); }
+  inline void add(const void * const v)
+  {
+    if(m_num_args < ASYNC_LOG_MAX_ARGS)
+    {
+      m_types[m_num_args] = AT_POINTER;
+      m_args[m_num_args++].p = v;
+    }
+  }
+  inline void add(const char * const v)
+  {
+    if(m_num_args >= ASYNC_LOG_MAX_ARGS)
+    {
+      return;
+    }
+    if(0 == v)
+    {
+      add(static_cast<const void *>(0));
+      m_types[m_num_args - 1] = AT_STRING;
+      m_args[m_num_args - 1].s = ASYNC_LOG_STRING_SPACE;
+      return;
+    }
+    unsigned int offset = m_string_used;
+    if(offset >= ASYNC_LOG_STRING_SPACE)
+    {
+      // no room left, share the terminating null of the previous string
+      offset = ASYNC_LOG_STRING_SPACE - 1;
+    }
+    else
+    {
+      const size_t room = ASYNC_LOG_STRING_SPACE - offset - 1;
+      size_t length = strlen(v);
+      if(length > room)
+      {
+        length = room;
+      }
+      memcpy(m_strings + offset, v, length);
+      m_strings[offset + length] = 0;
+      m_string_used = (unsigned int) (offset + length + 1);
+    }
+    m_types[m_num_args] = AT_STRING;
+    m_args[m_num_args++].s = offset;
+  }
+  inline void add(char * const v)             { add(static_cast<const char *>(v)); }
+  template<typename T>
+  inline void add(T * const v)                { add(static_cast<const void *>(v)); }
+
+  inline void addInt(const int64_t v)
+  {
+    if(m_num_args < ASYNC_LOG_MAX_ARGS)
+    {
+      m_types[m_num_args] = AT_INT64;
+      m_args[m_num_args++].i = v;
+    }
+  }
+  inline void addUInt(const uint64_t v)
+  {
+    if(m_num_args < ASYNC_LOG_MAX_ARGS)
+    {
+      m_types[m_num_args] = AT_UINT64;
+      m_args[m_num_args++].u = v;
+    }
+  }
+
+  // format the record into 'out', walking the format string one conversion at a time
+  void format(char * const out, const size_t out_size) const
+  {
+    size_t used = 0;
+    unsigned int arg = 0;
+    const char * p = m_format;
+    out[0] = 0;
+    while ((0 != *p) && ((used + 1) < out_size))
+    {
+      if('%' != *p)
+      {
+        out[used++] = *p++;
+        continue;
+      }
+      if('%' == p[1])
+      {
+        out[used++] = '%';
+        p += 2;
+        continue;
+      }
+
+      // copy one conversion specification, e.g. "%-08.3lld"
+      char spec[32];
+      size_t spec_length = 0;
+      const char * q = p;
+      spec[spec_length++] = *q++;
+      while ((0 != *q) && (0 == strchr("diouxXeEfFgGaAcspn", *q)) && (spec_length < (sizeof(spec) - 2)))
+      {
+        spec[spec_length++] = *q++;
+      }
+      if(0 == *q)
+      {
+        break;
+      }
+      const char conversion = *q++;
+      spec[spec_length++] = conversion;
+      spec[spec_length] = 0;
+      p = q;
+
+      if(('n' == conversion) || (arg >= m_num_args) || (0 != strchr(spec, '*')))
+      {
+        // unsupported, or missing argument: print the specification as is
+        used += snprintf(out + used, out_size - used, "%s", spec);
+        used = (used < out_size) ? used : (out_size - 1);
+        continue;
+      }
+      used += formatOne(out + used, out_size - used, spec, spec_length, conversion, arg);
+      used = (used < out_size) ? used : (out_size - 1);
+      ++arg;
+    }
+    out[used] = 0;
+  }
+
+private:
+  int formatOne(char * const out, const size_t out_size, const char * const spec, const size_t spec_length,
+      const char conversion, const unsigned int arg) const
+  {
+    const Arg & value = m_args[arg];
+    const uint8_t type = m_types[arg];
+    int written = 0;
+    if('s' == conversion)
+    {
+      const char * const str = (AT_STRING != type) ? "?"
+          : ((value.s >= ASYNC_LOG_STRING_SPACE) ? "(null)" : (m_strings + value.s));
+      written = snprintf(out, out_size, spec, str);
+    }
+    else if('p' == conversion)
+    {
+      written = snprintf(out, out_size, spec, (AT_POINTER == type) ? value.p : (const void *) (uintptr_t) value.u);
+    }
+    else if(0 != strchr("eEfFgGaA", conversion))
+    {
+      const double d = (AT_DOUBLE == type) ? value.d : ((AT_UINT64 == type) ? (double) value.u : (double) value.i);
+      written = snprintf(out, out_size, spec, d);
+    }
+    else
+    {
+      // integer conversions: pass the value with the width the length modifier asks for
+      const int64_t i = (AT_DOUBLE == type) ? (int64_t) value.d : value.i;
+      const char l1 = (spec_length >= 3) ? spec[spec_length - 2] : 0;
+      const char l2 = (spec_length >= 4) ? spec[spec_length - 3] : 0;
+      if((('l' == l1) && ('l' == l2)) || ('j' == l1) || ('q' == l1))
+      {
+        written = snprintf(out, out_size, spec, (long long) i);
+      }
+      else if('l' == l1)
+      {
+        written = snprintf(out, out_size, spec, (long) i);
+      }
+      else if(('z' == l1) || ('t' == l1))
+      {
+        written = snprintf(out, out_size, spec, (size_t) i);
+      }
+      else
+      {
+        written = snprintf(out, out_size, spec, (int) i);
+      }
+    }
+    return (written > 0) ? written : 0;
+  }
+};
+
+// single producer (the owning thread), single consumer (the log thread)
+struct AsyncLogRing
+{
+  AsyncLogRecord m_records[ASYNC_LOG_RING_SIZE];
+  unsigned int m_head;
+  char m_padding[60];
+  unsigned int m_tail;
+  // set at thread exit. the log thread frees the ring once it's drained
+  int m_orphaned;
+  AsyncLogRing * m_pNext;
+};
+
+class AsyncLogger;
+
+// templated only so that these static members can be defined in this header
+template<typename T>
+struct AsyncLogStatics
+{
+  static pthread_once_t s_once;
+  static AsyncLogger * s_pInstance;
+};
+template<typename T>
+pthread_once_t AsyncLogStatics<T>::s_once = PTHREAD_ONCE_INIT;
+template<typename T>
+AsyncLogger * AsyncLogStatics<T>::s_pInstance = 0;
+
+class AsyncLogger: public Runnable
+{
+private:
+  // header only class, so the log tag is a function rather than a static data member
+  static const char * TAG()
+  {
+    return "AsyncLogger";
+  }
+  typedef AsyncLogStatics<void> Statics;
+public:
+  static AsyncLogger & getInstance()
+  {
+    pthread_once(&Statics::s_once, createInstance);
+    return *Statics::s_pInstance;
+  }
+
+  // the logger lives until the process exits; run() is driven by m_pThread
+  virtual ~AsyncLogger()
+  {
+  }
+
+  int start()
+  {
+    int result = 1;
+    do
+    {
+      if(0 != __atomic_load_n(&m_running, __ATOMIC_ACQUIRE))
+      {
+        result = 0;
+        break;
+      }
+      if(0 == m_pThread)
+      {
+        m_pThread = Thread::createInstance(TAG(), this, false);
+        if(0 == m_pThread)
+        {
+          result = 2;
+          break;
+        }
+      }
+      __atomic_store_n(&m_stop_requested, 0, __ATOMIC_RELEASE);
+      __atomic_store_n(&m_running, 1, __ATOMIC_RELEASE);
+      if(0 != m_pThread->launch())
+      {
+        __atomic_store_n(&m_running, 0, __ATOMIC_RELEASE);
+        result = 3;
+        break;
+      }
+      result = 0;
+    } while (false);
+
+    if(0 != result)
+    {
+      log_error(TAG(), "start: failed %d", result);
+    }
+    return result;
+  }
+
+  // flushes every pending record, then joins the log thread
+  int stop()
+  {
+    if(0 == __atomic_load_n(&m_running, __ATOMIC_ACQUIRE))
+    {
+      return 0;
+    }
+    // new calls log synchronously from here on, so the rings can only shrink
+    __atomic_store_n(&m_running, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&m_stop_requested, 1, __ATOMIC_RELEASE);
+    wake();
+    const int result = m_pThread->join();
+    delete m_pThread;
+    m_pThread = 0;
+    // the log thread is gone, so this thread can be the consumer now. this picks
+    // up the calls which saw the logger running but committed after its last pass
+    (void) drainAll();
+    return result;
+  }
+
+  inline bool isRunning() const
+  {
+    return (0 != __atomic_load_n(&m_running, __ATOMIC_ACQUIRE));
+  }
+
+  // returns a record to fill in, or 0 if the caller should log synchronously
+  AsyncLogRecord * reserve()
+  {
+    if(!isRunning())
+    {
+      return 0;
+    }
+    AsyncLogRing * const pRing = getThreadRing();
+    if(0 == pRing)
+    {
+      return 0;
+    }
+    const unsigned int tail = pRing->m_tail;
+    if((tail - __atomic_load_n(&pRing->m_head, __ATOMIC_ACQUIRE)) >= ASYNC_LOG_RING_SIZE)
+    {
+      __atomic_add_fetch(&m_num_overflows, 1, __ATOMIC_RELAXED);
+      return 0;
+    }
+    return &pRing->m_records[tail % ASYNC_LOG_RING_SIZE];
+  }
+
+  // publish the record obtained from reserve()
+  inline void commit()
+  {
+    AsyncLogRing * const pRing = reinterpret_cast<AsyncLogRing *>(pthread_getspecific(m_ring_key));
+    __atomic_store_n(&pRing->m_tail, pRing->m_tail + 1, __ATOMIC_RELEASE);
+
+    // pairs with the fence in run: either we see the log thread parked, or it sees
+    // the record we just published. only the first producer to see it parked pays
+    // for the wake-up system call
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if((0 != __atomic_load_n(&m_consumer_waiting, __ATOMIC_RELAXED))
+        && (0 != __atomic_exchange_n(&m_consumer_waiting, 0, __ATOMIC_ACQ_REL)))
+    {
+      wake();
+    }
+  }
+
+  // number of calls which fell back to synchronous logging because a ring was full
+  inline uint64_t getNumOfOverflows() const
+  {
+    return __atomic_load_n(&m_num_overflows, __ATOMIC_RELAXED);
+  }
+
+  // cached version of is_log_verbose_enabled. the cache is keyed on the tag pointer
+  // and becomes stale whenever async_log_set_local_level_for_tag (or the other
+  // level setters below) bump the generation
+  bool isVerboseEnabled(const char * const tag)
+  {
+    const unsigned int generation = __atomic_load_n(&m_level_generation, __ATOMIC_ACQUIRE) & 0x7FFFFFFF;
+    const uintptr_t key = reinterpret_cast<uintptr_t>(tag);
+    TagCacheEntry & entry = m_tag_cache[(key >> 3) % ASYNC_LOG_TAG_CACHE_SIZE];
+
+    // per entry seqlock: an odd sequence means a writer is busy, a changed one a torn read
+    unsigned int seq = __atomic_load_n(&entry.m_seq, __ATOMIC_ACQUIRE);
+    if(0 == (seq & 1))
+    {
+      const uintptr_t cached_tag = __atomic_load_n(&entry.m_tag, __ATOMIC_RELAXED);
+      const unsigned int cached_state = __atomic_load_n(&entry.m_state, __ATOMIC_RELAXED);
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      if((seq == __atomic_load_n(&entry.m_seq, __ATOMIC_RELAXED)) && (cached_tag == key)
+          && ((cached_state >> 1) == generation))
+      {
+        return (0 != (cached_state & 1));
+      }
+    }
+
+    const bool enabled = is_log_verbose_enabled(tag);
+    // only fill the entry if no other thread is writing it; losing the race just means a miss later
+    seq = __atomic_load_n(&entry.m_seq, __ATOMIC_RELAXED);
+    if((0 == (seq & 1))
+        && __atomic_compare_exchange_n(&entry.m_seq, &seq, seq + 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    {
+      __atomic_store_n(&entry.m_tag, key, __ATOMIC_RELAXED);
+      __atomic_store_n(&entry.m_state, (generation << 1) | (enabled ? 1 : 0), __ATOMIC_RELAXED);
+      __atomic_store_n(&entry.m_seq, seq + 2, __ATOMIC_RELEASE);
+    }
+    return enabled;
+  }
+
+  inline void invalidateLevelCache()
+  {
+    __atomic_add_fetch(&m_level_generation, 1, __ATOMIC_ACQ_REL);
+  }
+
+  // format and emit through the synchronous log.h backend
+  static void emit(const AsyncLogRecord & record)
+  {
+    char line[512];
+    record.format(line, sizeof(line));
+    switch (record.m_level)
+    {
+    case EL_ERROR:
+      log_error(record.m_tag, "%s", line);
+      break;
+    case EL_WARNING:
+      log_warning(record.m_tag, "%s", line);
+      break;
+    case EL_INFO:
+      log_info(record.m_tag, "%s", line);
+      break;
+    case EL_DEBUG:
+      log_debug(record.m_tag, "%s", line);
+      break;
+    default:
+      log_verbose(record.m_tag, "%s", line);
+      break;
+    }
+  }
+
+  // parking protocol, as in MpscBlockingQueue: the log thread snapshots m_wake_seq,
+  // announces itself in m_consumer_waiting, drains once more and only then waits on
+  // the futex while m_wake_seq still holds the snapshot. commit and stop bump
+  // m_wake_seq before waking, so a wake-up can't be lost in between
+  virtual void run()
+  {
+    while (true)
+    {
+      if(0 != drainAll())
+      {
+        continue;
+      }
+      if(0 != __atomic_load_n(&m_stop_requested, __ATOMIC_ACQUIRE))
+      {
+        // records committed before the stop request was seen are picked up here
+        if(0 != drainAll())
+        {
+          continue;
+        }
+        break;
+      }
+
+      const int seq = __atomic_load_n(&m_wake_seq, __ATOMIC_ACQUIRE);
+      __atomic_store_n(&m_consumer_waiting, 1, __ATOMIC_RELAXED);
+      __atomic_thread_fence(__ATOMIC_SEQ_CST);
+      if((0 == drainAll()) && (0 == __atomic_load_n(&m_stop_requested, __ATOMIC_ACQUIRE)))
+      {
+        const int rc = syscall(__NR_futex, &m_wake_seq, FUTEX_WAIT_PRIVATE, seq, 0, 0, 0);
+        if((0 != rc) && (EAGAIN != errno) && (EINTR != errno))
+        {
+          log_error(TAG(), "run: futex wait failed %d", errno);
+        }
+      }
+      __atomic_store_n(&m_consumer_waiting, 0, __ATOMIC_RELAXED);
+    }
+  }
+
+private:
+  struct TagCacheEntry
+  {
+    unsigned int m_seq;
+    // generation << 1 | verbose enabled
+    unsigned int m_state;
+    uintptr_t m_tag;
+  };
+
+  AsyncLogger() :
+      m_pThread(0), m_running(0), m_stop_requested(0), m_consumer_waiting(0), m_wake_seq(0), m_num_overflows(0),
+      m_level_generation(0), m_pRings(0), m_ring_key_valid(false)
+  {
+    memset(m_tag_cache, 0, sizeof(m_tag_cache));
+    m_ring_key_valid = (0 == pthread_key_create(&m_ring_key, orphanRing));
+  }
+
+  // private copy constructor and assignment operator so that the
+  // the instance can not be copied.
+  AsyncLogger(const AsyncLogger & rhs);
+  AsyncLogger & operator=(const AsyncLogger & rhs);
+
+  static void createInstance()
+  {
+    Statics::s_pInstance = new AsyncLogger();
+  }
+
+  AsyncLogRing * getThreadRing()
+  {
+    if(!m_ring_key_valid)
+    {
+      return 0;
+    }
+    AsyncLogRing * pRing = reinterpret_cast<AsyncLogRing *>(pthread_getspecific(m_ring_key));
+    if(0 == pRing)
+    {
+      pRing = new (std::nothrow) AsyncLogRing;
+      if(0 == pRing)
+      {
+        return 0;
+      }
+      pRing->m_head = 0;
+      pRing->m_tail = 0;
+      pRing->m_orphaned = 0;
+      if(0 != pthread_setspecific(m_ring_key, pRing))
+      {
+        delete pRing;
+        return 0;
+      }
+      // lock-free push onto the list of rings. only the log thread ever unlinks
+      AsyncLogRing * pHead = __atomic_load_n(&m_pRings, __ATOMIC_ACQUIRE);
+      do
+      {
+        pRing->m_pNext = pHead;
+      } while (!__atomic_compare_exchange_n(&m_pRings, &pHead, pRing, true, __ATOMIC_ACQ_REL,
+          __ATOMIC_ACQUIRE));
+    }
+    return pRing;
+  }
+
+  void wake()
+  {
+    __atomic_add_fetch(&m_wake_seq, 1, __ATOMIC_SEQ_CST);
+    (void) syscall(__NR_futex, &m_wake_seq, FUTEX_WAKE_PRIVATE, 1, 0, 0, 0);
+  }
+
+  static void orphanRing(void * const ptr)
+  {
+    AsyncLogRing * const pRing = reinterpret_cast<AsyncLogRing *>(ptr);
+    __atomic_store_n(&pRing->m_orphaned, 1, __ATOMIC_RELEASE);
+  }
+
+  unsigned int drainAll()
+  {
+    unsigned int drained = 0;
+    // the head of the list may change under us, but only by pushes in front of it
+    AsyncLogRing ** ppLink = &m_pRings;
+    AsyncLogRing * pRing = __atomic_load_n(ppLink, __ATOMIC_ACQUIRE);
+    while (0 != pRing)
+    {
+      const bool orphaned = (0 != __atomic_load_n(&pRing->m_orphaned, __ATOMIC_ACQUIRE));
+      const unsigned int tail = __atomic_load_n(&pRing->m_tail, __ATOMIC_ACQUIRE);
+      unsigned int head = pRing->m_head;
+      while (head != tail)
+      {
+        emit(pRing->m_records[head % ASYNC_LOG_RING_SIZE]);
+        ++head;
+        ++drained;
+      }
+      __atomic_store_n(&pRing->m_head, head, __ATOMIC_RELEASE);
+
+      AsyncLogRing * const pNext = pRing->m_pNext;
+      if(orphaned && (ppLink != &m_pRings))
+      {
+        // the owning thread is gone and everything it wrote has been emitted.
+        // the first ring is never unlinked here, since producers push in front of it
+        *ppLink = pNext;
+        delete pRing;
+      }
+      else
+      {
+        ppLink = &pRing->m_pNext;
+      }
+      pRing = pNext;
+    }
+    return drained;
+  }
+
+  Thread * m_pThread;
+  int m_running;
+  int m_stop_requested;
+  int m_consumer_waiting;
+  // futex word
+  int m_wake_seq;
+  uint64_t m_num_overflows;
+  unsigned int m_level_generation;
+  AsyncLogRing * m_pRings;
+  pthread_key_t m_ring_key;
+  bool m_ring_key_valid;
+  TagCacheEntry m_tag_cache[ASYNC_LOG_TAG_CACHE_SIZE];
+};
+
+inline int async_log_start()
+{
+  return AsyncLogger::getInstance().start();
+}
+
+inline int async_log_stop()
+{
+  return AsyncLogger::getInstance().stop();
+}
+
+inline bool async_is_log_verbose_enabled(const char * const local_log_tag)
+{
+  return AsyncLogger::getInstance().isVerboseEnabled(local_log_tag);
+}
+
+// level setters which also invalidate the cache behind async_is_log_verbose_enabled
+inline int async_log_set_global_level(const ERROR_LEVEL level)
+{
+  const int result = log_set_global_level(level);
+  AsyncLogger::getInstance().invalidateLevelCache();
+  return result;
+}
+
+inline int async_log_set_local_level_for_tag(const char * const tag, const ERROR_LEVEL level)
+{
+  const int result = log_set_local_level_for_tag(tag, level);
+  AsyncLogger::getInstance().invalidateLevelCache();
+  return result;
+}
+
+inline int async_log_flush_local_level_for_tag(const char * const tag)
+{
+  const int result = log_flush_local_level_for_tag(tag);
+  AsyncLogger::getInstance().invalidateLevelCache();
+  return result;
+}
+
+inline int async_log_flush_all_local_level()
+{
+  const int result = log_flush_all_local_level();
+  AsyncLogger::getInstance().invalidateLevelCache();
+  return result;
+}
+
+// internal helpers of the async_log_xxx family
+class AsyncLogCall
+{
+public:
+  AsyncLogCall(const ERROR_LEVEL level, const char * const tag, const char * const format) :
+      m_pRecord(AsyncLogger::getInstance().reserve())
+  {
+    if(0 == m_pRecord)
+    {
+      m_pRecord = &m_local;
+    }
+    m_pRecord->begin(level, tag, format);
+  }
+
+  ~AsyncLogCall()
+  {
+    if(&m_local == m_pRecord)
+    {
+      // not running, or ring full
+      AsyncLogger::emit(m_local);
+    }
+    else
+    {
+      AsyncLogger::getInstance().commit();
+    }
+  }
+
+  template<typename T>
+  inline AsyncLogCall & operator ,(const T & value)
+  {
+    m_pRecord->add(value);
+    return *this;
+  }
+
+private:
+  AsyncLogCall(const AsyncLogCall & rhs);
+  AsyncLogCall & operator=(const AsyncLogCall & rhs);
+
+  AsyncLogRecord * m_pRecord;
+  AsyncLogRecord m_local;
+};
+
+} // namespace qc_loc_fw
+
+// the argument list is recorded with the comma operator, so any number of arguments
+// (up to ASYNC_LOG_MAX_ARGS) works without variadic templates
+#define ASYNC_LOG_CALL_(level, tag, format, ...) \
+  do { qc_loc_fw::AsyncLogCall async_log_call_(level, tag, format); (void) (async_log_call_, ##__VA_ARGS__); } while (0)
+
+#define async_log_error(tag, format, ...)   ASYNC_LOG_CALL_(qc_loc_fw::EL_ERROR, tag, format, ##__VA_ARGS__)
+#define async_log_warning(tag, format, ...) ASYNC_LOG_CALL_(qc_loc_fw::EL_WARNING, tag, format, ##__VA_ARGS__)
+#define async_log_info(tag, format, ...)    ASYNC_LOG_CALL_(qc_loc_fw::EL_INFO, tag, format, ##__VA_ARGS__)
+#define async_log_debug(tag, format, ...)   ASYNC_LOG_CALL_(qc_loc_fw::EL_DEBUG, tag, format, ##__VA_ARGS__)
+#define async_log_verbose(tag, format, ...) \
+  do { if(qc_loc_fw::async_is_log_verbose_enabled(tag)) \
+    { ASYNC_LOG_CALL_(qc_loc_fw::EL_VERBOSE, tag, format, ##__VA_ARGS__); } } while (0)
+
+#endif //#ifndef __XTRAT_WIFI_ASYNC_LOG_H__
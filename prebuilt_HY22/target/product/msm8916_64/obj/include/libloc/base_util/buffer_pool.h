@@ -0,0 +1,502 @@
+/*====*====*====*====*====*====*====*====*====*====*====*====*====*====*====*
+
+ Buffer pool
+
+ GENERAL DESCRIPTION
+ This header declares a size-classed, thread-caching pool of byte buffers,
+ and an OutMemoryStream which allocates its storage from that pool
+
+ Copyright (c) 2015 Qualcomm Technologies, Inc.
+ All Rights Reserved.
+ Confidential and Proprietary - Qualcomm Technologies, Inc.
+ =============================================================================*/
+#ifndef __XTRAT_WIFI_BUFFER_POOL_H__
+#define __XTRAT_WIFI_BUFFER_POOL_H__
+
+#include <new>
+#include <pthread.h>
+#include <sched.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <base_util/log.h>
+#include <base_util/memorystream.h>
+
+namespace qc_loc_fw
+{
+
+class BufferPool;
+
+// templated only so that these static members can be defined in this header
+template<typename T>
+struct BufferPoolStatics
+{
+  static pthread_once_t s_once;
+  static BufferPool * s_pInstance;
+};
+template<typename T>
+pthread_once_t BufferPoolStatics<T>::s_once = PTHREAD_ONCE_INIT;
+template<typename T>
+BufferPool * BufferPoolStatics<T>::s_pInstance = 0;
+
+// Buffers are grouped in size classes of 256 B, 1 KB, 4 KB, 16 KB and 64 KB.
+// a released buffer first goes to a small per-thread cache, which needs no
+// synchronization at all, and overflows into a shared free list per class.
+// requests larger than the biggest class go straight to malloc/free.
+//
+// every buffer is preceded by a small header recording its class, so release()
+// only needs the pointer. the pool itself is a process wide singleton
+class BufferPool
+{
+private:
+  // header only class, so the log tag is a function rather than a static data member
+  static const char * TAG()
+  {
+    return "BufferPool";
+  }
+public:
+  static const unsigned int NUM_SIZE_CLASSES = 5;
+  static const size_t MIN_CLASS_SIZE = 256;
+  static const size_t MAX_CLASS_SIZE = MIN_CLASS_SIZE << (2 * (NUM_SIZE_CLASSES - 1));
+  // buffers kept per class in each thread, and in the shared list
+  static const unsigned int THREAD_CACHE_DEPTH = 8;
+  static const unsigned int SHARED_LIST_DEPTH = 64;
+  // spins on a busy shared list before yielding the CPU
+  static const unsigned int MAX_LOCK_SPINS = 64;
+
+  struct Stats
+  {
+    // number of acquire calls, and how many of them were served from a cache
+    uint64_t acquired;
+    uint64_t hits;
+    // bytes currently handed out to users, and the highest value seen
+    uint64_t bytes_in_use;
+    uint64_t peak_bytes_in_use;
+  };
+
+  static BufferPool & getInstance()
+  {
+    pthread_once(&Statics::s_once, createInstance);
+    return *Statics::s_pInstance;
+  }
+
+  // returns a buffer of at least 'size' bytes, and its actual usable size in *pCapacity
+  void * acquire(const size_t size, size_t * const pCapacity)
+  {
+    const unsigned int cls = getSizeClass(size);
+    const size_t capacity = (cls < NUM_SIZE_CLASSES) ? getClassSize(cls) : size;
+    Header * pHeader = 0;
+
+    if(cls < NUM_SIZE_CLASSES)
+    {
+      ThreadCache * const pCache = getThreadCache();
+      if((0 != pCache) && (0 != pCache->m_count[cls]))
+      {
+        pHeader = pCache->m_pFree[cls];
+        pCache->m_pFree[cls] = pHeader->m_pNext;
+        --pCache->m_count[cls];
+      }
+      else
+      {
+        pHeader = popShared(cls);
+      }
+    }
+
+    __atomic_add_fetch(&m_stats.acquired, 1, __ATOMIC_RELAXED);
+    if(0 != pHeader)
+    {
+      __atomic_add_fetch(&m_stats.hits, 1, __ATOMIC_RELAXED);
+    }
+    else
+    {
+      pHeader = reinterpret_cast<Header *>(malloc(sizeof(Header) + capacity));
+      if(0 == pHeader)
+      {
+        log_error(TAG(), "acquire: out of memory for %d bytes", (int) capacity);
+        return 0;
+      }
+      pHeader->m_size_class = cls;
+      pHeader->m_capacity = capacity;
+    }
+    pHeader->m_pNext = 0;
+
+    const uint64_t in_use = __atomic_add_fetch(&m_stats.bytes_in_use, capacity, __ATOMIC_RELAXED);
+    uint64_t peak = __atomic_load_n(&m_stats.peak_bytes_in_use, __ATOMIC_RELAXED);
+    while ((in_use > peak)
+        && !__atomic_compare_exchange_n(&m_stats.peak_bytes_in_use, &peak, in_use, true, __ATOMIC_RELAXED,
+            __ATOMIC_RELAXED))
+    {
+      // peak has been reloaded by the failed exchange
+    }
+
+    if(0 != pCapacity)
+    {
+      *pCapacity = capacity;
+    }
+    return pHeader + 1;
+  }
+
+  void release(void * const pBuffer)
+  {
+    if(0 == pBuffer)
+    {
+      return;
+    }
+    Header * const pHeader = reinterpret_cast<Header *>(pBuffer) - 1;
+    const unsigned int cls = pHeader->m_size_class;
+    __atomic_sub_fetch(&m_stats.bytes_in_use, pHeader->m_capacity, __ATOMIC_RELAXED);
+
+    if(cls >= NUM_SIZE_CLASSES)
+    {
+      free(pHeader);
+      return;
+    }
+
+    ThreadCache * const pCache = getThreadCache();
+    if((0 != pCache) && (pCache->m_count[cls] < THREAD_CACHE_DEPTH))
+    {
+      pHeader->m_pNext = pCache->m_pFree[cls];
+      pCache->m_pFree[cls] = pHeader;
+      ++pCache->m_count[cls];
+    }
+    else if(!pushShared(cls, pHeader))
+    {
+      free(pHeader);
+    }
+  }
+
+  void getStats(Stats & stats) const
+  {
+    stats.acquired = __atomic_load_n(&m_stats.acquired, __ATOMIC_RELAXED);
+    stats.hits = __atomic_load_n(&m_stats.hits, __ATOMIC_RELAXED);
+    stats.bytes_in_use = __atomic_load_n(&m_stats.bytes_in_use, __ATOMIC_RELAXED);
+    stats.peak_bytes_in_use = __atomic_load_n(&m_stats.peak_bytes_in_use, __ATOMIC_RELAXED);
+  }
+
+  static inline size_t getClassSize(const unsigned int cls)
+  {
+    return MIN_CLASS_SIZE << (2 * cls);
+  }
+
+  // NUM_SIZE_CLASSES if the size is too big to be pooled
+  static inline unsigned int getSizeClass(const size_t size)
+  {
+    unsigned int cls = 0;
+    while ((cls < NUM_SIZE_CLASSES) && (getClassSize(cls) < size))
+    {
+      ++cls;
+    }
+    return cls;
+  }
+
+private:
+  // keeps the payload 16 byte aligned on both 32 and 64 bit targets
+  struct Header
+  {
+    Header * m_pNext;
+    unsigned int m_size_class;
+    size_t m_capacity;
+  } __attribute__((aligned(16)));
+
+  struct ThreadCache
+  {
+    Header * m_pFree[NUM_SIZE_CLASSES];
+    unsigned int m_count[NUM_SIZE_CLASSES];
+  };
+
+  BufferPool()
+  {
+    memset(&m_stats, 0, sizeof(m_stats));
+    memset(m_pShared, 0, sizeof(m_pShared));
+    memset(m_shared_count, 0, sizeof(m_shared_count));
+    memset(m_shared_lock, 0, sizeof(m_shared_lock));
+    if(0 != pthread_key_create(&m_cache_key, destroyThreadCache))
+    {
+      log_error(TAG(), "pthread_key_create failed, thread caches disabled");
+      m_cache_key_valid = false;
+    }
+    else
+    {
+      m_cache_key_valid = true;
+    }
+  }
+
+  // the pool lives until the process exits
+  ~BufferPool();
+  BufferPool(const BufferPool & rhs);
+  BufferPool & operator=(const BufferPool & rhs);
+
+  static void createInstance()
+  {
+    Statics::s_pInstance = new BufferPool();
+  }
+
+  ThreadCache * getThreadCache()
+  {
+    if(!m_cache_key_valid)
+    {
+      return 0;
+    }
+    ThreadCache * pCache = reinterpret_cast<ThreadCache *>(pthread_getspecific(m_cache_key));
+    if(0 == pCache)
+    {
+      pCache = new (std::nothrow) ThreadCache;
+      if(0 != pCache)
+      {
+        memset(pCache, 0, sizeof(*pCache));
+        if(0 != pthread_setspecific(m_cache_key, pCache))
+        {
+          delete pCache;
+          pCache = 0;
+        }
+      }
+    }
+    return pCache;
+  }
+
+  // called at thread exit: hand the cached buffers over to the shared lists
+  static void destroyThreadCache(void * const ptr)
+  {
+    ThreadCache * const pCache = reinterpret_cast<ThreadCache *>(ptr);
+    for (unsigned int cls = 0; cls < NUM_SIZE_CLASSES; ++cls)
+    {
+      Header * pHeader = pCache->m_pFree[cls];
+      while (0 != pHeader)
+      {
+        Header * const pNext = pHeader->m_pNext;
+        if(!Statics::s_pInstance->pushShared(cls, pHeader))
+        {
+          free(pHeader);
+        }
+        pHeader = pNext;
+      }
+    }
+    delete pCache;
+  }
+
+  // the critical sections are a few instructions long, so a short spin is cheaper
+  // than a mutex. past that the holder has most likely been preempted, and
+  // spinning on would only keep it from running, so give the CPU away
+  inline void lockShared(const unsigned int cls)
+  {
+    unsigned int spins = 0;
+    while (__atomic_exchange_n(&m_shared_lock[cls], 1, __ATOMIC_ACQUIRE))
+    {
+      // wait on a plain load, so the cache line isn't written back and forth
+      while (0 != __atomic_load_n(&m_shared_lock[cls], __ATOMIC_RELAXED))
+      {
+        if(++spins < MAX_LOCK_SPINS)
+        {
+          continue;
+        }
+        spins = 0;
+        (void) sched_yield();
+      }
+    }
+  }
+
+  inline void unlockShared(const unsigned int cls)
+  {
+    __atomic_store_n(&m_shared_lock[cls], 0, __ATOMIC_RELEASE);
+  }
+
+  Header * popShared(const unsigned int cls)
+  {
+    lockShared(cls);
+    Header * const pHeader = m_pShared[cls];
+    if(0 != pHeader)
+    {
+      m_pShared[cls] = pHeader->m_pNext;
+      --m_shared_count[cls];
+    }
+    unlockShared(cls);
+    return pHeader;
+  }
+
+  bool pushShared(const unsigned int cls, Header * const pHeader)
+  {
+    bool pushed = false;
+    lockShared(cls);
+    if(m_shared_count[cls] < SHARED_LIST_DEPTH)
+    {
+      pHeader->m_pNext = m_pShared[cls];
+      m_pShared[cls] = pHeader;
+      ++m_shared_count[cls];
+      pushed = true;
+    }
+    unlockShared(cls);
+    return pushed;
+  }
+
+  typedef BufferPoolStatics<void> Statics;
+
+  Stats m_stats;
+  pthread_key_t m_cache_key;
+  bool m_cache_key_valid;
+  Header * m_pShared[NUM_SIZE_CLASSES];
+  unsigned int m_shared_count[NUM_SIZE_CLASSES];
+  int m_shared_lock[NUM_SIZE_CLASSES];
+};
+
+// OutMemoryStream on top of BufferPool. the buffer goes back to the pool when
+// the stream is deleted.
+// note: InMemoryStream::createInstance(OutMemoryStream*) would try to take over
+// (and later delete[]) a pooled buffer, so it doesn't accept this stream: passing
+// a PooledOutMemoryStream * to it fails to compile. use
+// InMemoryStream::setBufferNoDup on getBuffer() instead, within the lifetime of this
+// stream, or SharedMemoryBlock::createInstance, which has an overload for this stream.
+// do not upcast this stream to OutMemoryStream * to get around that
+class PooledOutMemoryStream: public OutMemoryStream
+{
+private:
+  // header only class, so the log tag is a function rather than a static data member
+  static const char * TAG()
+  {
+    return "PooledOutMemoryStream";
+  }
+public:
+  // 'size_hint' is the expected final size of the stream. reserving it up front
+  // avoids growing (and copying) the buffer piecemeal in append
+  static PooledOutMemoryStream * createInstance(const size_t size_hint = 0)
+  {
+    PooledOutMemoryStream * const pStream = new (std::nothrow) PooledOutMemoryStream();
+    if((0 != pStream) && (0 != size_hint) && (0 != pStream->reserve(size_hint)))
+    {
+      delete pStream;
+      return 0;
+    }
+    return pStream;
+  }
+
+  virtual ~PooledOutMemoryStream()
+  {
+    BufferPool::getInstance().release(m_pBuffer);
+    m_pBuffer = 0;
+  }
+
+  virtual size_t getSize() const
+  {
+    return m_size;
+  }
+
+  virtual const BYTE * getBuffer() const
+  {
+    return m_pBuffer;
+  }
+
+  virtual BYTE * getBufferNonConst()
+  {
+    return m_pBuffer;
+  }
+
+  virtual int append(const void * const pData, const size_t length)
+  {
+    int result = 1;
+    do
+    {
+      if((0 == pData) && (0 != length))
+      {
+        result = 2;
+        break;
+      }
+      if(length > (m_capacity - m_size))
+      {
+        // grow geometrically so that a series of small appends stays linear
+        size_t new_capacity = (0 == m_capacity) ? BufferPool::MIN_CLASS_SIZE : (2 * m_capacity);
+        if(new_capacity < (m_size + length))
+        {
+          new_capacity = m_size + length;
+        }
+        if(0 != reserve(new_capacity))
+        {
+          result = 3;
+          break;
+        }
+      }
+      if(0 != length)
+      {
+        memcpy(m_pBuffer + m_size, pData, length);
+      }
+      m_size += length;
+      result = 0;
+    } while (false);
+
+    if(0 != result)
+    {
+      log_error(TAG(), "append: failed %d", result);
+    }
+    return result;
+  }
+
+  virtual size_t getPutCursor() const
+  {
+    return m_size;
+  }
+
+  // make sure at least 'capacity' bytes can be held without growing
+  int reserve(const size_t capacity)
+  {
+    if(capacity <= m_capacity)
+    {
+      return 0;
+    }
+    size_t new_capacity = 0;
+    BYTE * const pNewBuffer = reinterpret_cast<BYTE *>(BufferPool::getInstance().acquire(capacity, &new_capacity));
+    if(0 == pNewBuffer)
+    {
+      log_error(TAG(), "reserve: failed for %d bytes", (int) capacity);
+      return 1;
+    }
+    if(0 != m_size)
+    {
+      memcpy(pNewBuffer, m_pBuffer, m_size);
+    }
+    BufferPool::getInstance().release(m_pBuffer);
+    m_pBuffer = pNewBuffer;
+    m_capacity = new_capacity;
+    return 0;
+  }
+
+  inline size_t getCapacity() const
+  {
+    return m_capacity;
+  }
+
+  // take over the buffer of 'rhs' without copying it. 'rhs' is left empty, and
+  // can still be appended to or deleted
+  void takeBuffer(PooledOutMemoryStream & rhs)
+  {
+    if(&rhs == this)
+    {
+      return;
+    }
+    BufferPool::getInstance().release(m_pBuffer);
+    m_pBuffer = rhs.m_pBuffer;
+    m_size = rhs.m_size;
+    m_capacity = rhs.m_capacity;
+    rhs.m_pBuffer = 0;
+    rhs.m_size = 0;
+    rhs.m_capacity = 0;
+  }
+
+private:
+  PooledOutMemoryStream() :
+      m_pBuffer(0), m_size(0), m_capacity(0)
+  {
+  }
+
+  // private copy constructor and assignment operator so that the
+  // the instance can not be copied.
+  PooledOutMemoryStream(const PooledOutMemoryStream & rhs);
+  PooledOutMemoryStream & operator=(const PooledOutMemoryStream & rhs);
+
+  BYTE * m_pBuffer;
+  size_t m_size;
+  size_t m_capacity;
+};
+
+} // namespace qc_loc_fw
+
+#endif //#ifndef __XTRAT_WIFI_BUFFER_POOL_H__
@@ -0,0 +1,552 @@
+/*====*====*====*====*====*====*====*====*====*====*====*====*====*====*====*
+
+ Clock source
+
+ GENERAL DESCRIPTION
+ This header declares cheaper alternatives to clock_gettime for code which
+ stamps many messages: coarse (tick granularity) clocks, a per-thread "now"
+ cached once per run loop iteration, and a calibrated cycle counter
+
+ Copyright (c) 2015 Qualcomm Technologies, Inc.
+ All Rights Reserved.
+ Confidential and Proprietary - Qualcomm Technologies, Inc.
+ =============================================================================*/
+#ifndef __XTRAT_WIFI_CLOCK_SOURCE_H__
+#define __XTRAT_WIFI_CLOCK_SOURCE_H__
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <base_util/log.h>
+#include <base_util/time_routines.h>
+
+namespace qc_loc_fw
+{
+
+// Precision contract
+//
+//   PRECISION_EXACT          clock_gettime on the requested clock, same as Timestamp::reset_to_xxx
+//                            and get_time_xxx_ms.
+//   PRECISION_COARSE         the clock as of the last scheduler tick (CLOCK_xxx_COARSE), so it lags
+//                            by up to one tick (1-10 ms, see getResolutionNs), or a little more
+//                            right after the CPU leaves tickless idle. CLOCK_BOOTTIME has
+//                            no coarse variant, it is derived from CLOCK_MONOTONIC_COARSE plus the
+//                            boot-monotonic offset, which is re-read after at most
+//                            RECALIBRATE_INTERVAL_NS of awake time. right after a resume from
+//                            suspend, it can lag by the time spent suspended until then.
+//   PRECISION_CACHED         the clock as of the last refreshCachedNow() on the calling thread.
+//                            run loops call refreshCachedNow() once per iteration, and everything
+//                            handling that iteration's message gets the same timestamp. on a
+//                            thread which has never called refreshCachedNow(), this is EXACT.
+//   PRECISION_CYCLE_COUNTER  the CPU's constant-rate counter (cntvct on aarch64, TSC on x86_64)
+//                            scaled to CLOCK_MONOTONIC and re-anchored to it at least every
+//                            RECALIBRATE_INTERVAL_NS, so a reading can step by the calibration
+//                            error (well under a microsecond) at a re-anchor. meant for interval
+//                            measurement. only serves CLOCK_MONOTONIC and CLOCK_BOOTTIME, and
+//                            falls back to EXACT where no usable counter exists (e.g. 32-bit ARM,
+//                            where user access to the counter depends on the kernel).
+//
+// every precision returns the time of the requested clock id, so a Timestamp set through
+// ClockSource::reset is interchangeable with one set through Timestamp::reset_to_xxx, including
+// insert_into_postcard/retrieve_from_postcard and comparisons between the two.
+//
+// Usage
+//
+//   while (running)                                   // run loop
+//   {
+//     ClockSource::refreshCachedNow();
+//     ... wait for and handle a message ...
+//     Timestamp ts(false);
+//     ClockSource::reset(ts, CLOCK_BOOTTIME, ClockSource::PRECISION_CACHED);
+//     long long now_ms = ClockSource::now_ms(CLOCK_MONOTONIC, ClockSource::PRECISION_COARSE);
+//   }
+
+class ClockSource
+{
+private:
+  // header only class, so the log tag is a function rather than a static data member
+  static const char * TAG()
+  {
+    return "ClockSource";
+  }
+
+  static const long long NSEC_PER_SEC = 1000000000LL;
+  static const long long NSEC_PER_MSEC = 1000000LL;
+
+  enum CLOCK_SLOT
+  {
+    SLOT_REALTIME = 0, SLOT_MONOTONIC, SLOT_BOOTTIME, NUM_OF_SLOTS
+  };
+
+public:
+  enum Precision
+  {
+    PRECISION_EXACT = 0, PRECISION_COARSE, PRECISION_CACHED, PRECISION_CYCLE_COUNTER
+  };
+
+  // how much awake time a derived clock (coarse boottime, cycle counter) may run on a single
+  // calibration against the exact clocks
+  static const long long RECALIBRATE_INTERVAL_NS = NSEC_PER_SEC;
+
+  // clock_id is CLOCK_REALTIME, CLOCK_MONOTONIC or CLOCK_BOOTTIME. other clock ids are always
+  // read with clock_gettime. returns 0 on success
+  static int now(const int clock_id, const Precision precision, timespec & ts)
+  {
+    const int slot = slotOf(clock_id);
+    if(slot < 0)
+    {
+      return readExact(clock_id, ts);
+    }
+    switch (precision)
+    {
+    case PRECISION_COARSE:
+      return readCoarse(slot, ts);
+    case PRECISION_CACHED:
+      return readCached(slot, ts);
+    case PRECISION_CYCLE_COUNTER:
+      return readCycleCounter(slot, ts);
+    case PRECISION_EXACT:
+    default:
+      return readExact(clock_id, ts);
+    }
+  }
+
+  // milliseconds, rounded the same way as get_time_boot_ms/get_time_monotonic_ms/get_time_rtc_ms.
+  // returns 0 if the clock can't be read
+  static long long now_ms(const int clock_id, const Precision precision)
+  {
+    timespec ts;
+    if(0 != now(clock_id, precision, ts))
+    {
+      return 0;
+    }
+    return (long long) ts.tv_sec * 1000LL + ((long long) ts.tv_nsec + NSEC_PER_MSEC / 2) / NSEC_PER_MSEC;
+  }
+
+  // sets 'timestamp' to the given clock, or invalidates it on failure. returns 0 on success
+  static int reset(Timestamp & timestamp, const int clock_id, const Precision precision)
+  {
+    timespec ts;
+    if(0 != now(clock_id, precision, ts))
+    {
+      timestamp.invalidate();
+      return 1;
+    }
+    timestamp = Timestamp(clock_id, ts);
+    return 0;
+  }
+
+  // starts a new run loop iteration on the calling thread: the next PRECISION_CACHED read of
+  // each clock on this thread re-reads it, later ones return the same value.
+  // returns 0 on success
+  static int refreshCachedNow()
+  {
+    CachedNow * const pCache = getCachedNow(true);
+    if(0 == pCache)
+    {
+      return 1;
+    }
+    ++pCache->m_generation;
+    if(0 == pCache->m_generation)
+    {
+      // 0 means "no run loop on this thread"
+      pCache->m_generation = 1;
+      memset(pCache->m_generation_read, 0, sizeof(pCache->m_generation_read));
+    }
+    return 0;
+  }
+
+  // true if PRECISION_CYCLE_COUNTER reads a hardware counter rather than falling back to EXACT
+  static bool hasCycleCounter()
+  {
+#if defined(__aarch64__) || defined(__x86_64__)
+    return true;
+#else
+    return false;
+#endif
+  }
+
+  // worst-case granularity of a reading in nanoseconds, or -1 for PRECISION_CACHED, which is only
+  // bounded by the length of the caller's run loop iteration
+  static long long getResolutionNs(const int clock_id, const Precision precision)
+  {
+    timespec res;
+    int id = clock_id;
+    switch (precision)
+    {
+    case PRECISION_CACHED:
+      return -1;
+    case PRECISION_COARSE:
+#ifdef CLOCK_MONOTONIC_COARSE
+      id = (CLOCK_REALTIME == clock_id) ? CLOCK_REALTIME_COARSE : CLOCK_MONOTONIC_COARSE;
+#endif
+      break;
+    case PRECISION_CYCLE_COUNTER:
+    {
+      const uint64_t mult = __atomic_load_n(&calibration().m_ns_per_cycle, __ATOMIC_RELAXED);
+      if(hasCycleCounter() && (0 != mult) && (CLOCK_REALTIME != clock_id))
+      {
+        // m_ns_per_cycle is a 32.32 fixed point number
+        return (long long) ((mult + 0xFFFFFFFFULL) >> 32);
+      }
+      break;
+    }
+    case PRECISION_EXACT:
+    default:
+      break;
+    }
+    if(0 != clock_getres(id, &res))
+    {
+      return -1;
+    }
+    return (long long) res.tv_sec * NSEC_PER_SEC + res.tv_nsec;
+  }
+
+private:
+  struct CachedNow
+  {
+    uint32_t m_generation;
+    uint32_t m_generation_read[NUM_OF_SLOTS];
+    timespec m_value[NUM_OF_SLOTS];
+  };
+
+  // cycle counter to CLOCK_MONOTONIC mapping, and the boot-monotonic offset. zero-initialized
+  // static storage, so it needs no constructor and is shared by every translation unit
+  struct Calibration
+  {
+    // seqlock around the cycle anchor, odd while it's being written
+    uint32_t m_seq;
+    uint64_t m_base_cycles;
+    int64_t m_base_ns;
+    // nanoseconds per cycle, 32.32 fixed point. 0 until known
+    uint64_t m_ns_per_cycle;
+    // cycles after which the anchor is considered stale
+    uint64_t m_max_cycles;
+
+    int64_t m_boot_offset_ns;
+    // CLOCK_MONOTONIC when m_boot_offset_ns was measured, 0 if never
+    int64_t m_boot_offset_at_ns;
+  };
+
+  // static only
+  ClockSource();
+
+  static Calibration & calibration()
+  {
+    static Calibration s_calibration;
+    return s_calibration;
+  }
+
+  static int slotOf(const int clock_id)
+  {
+    switch (clock_id)
+    {
+    case CLOCK_REALTIME:
+      return SLOT_REALTIME;
+    case CLOCK_MONOTONIC:
+      return SLOT_MONOTONIC;
+#ifdef CLOCK_BOOTTIME
+    case CLOCK_BOOTTIME:
+      return SLOT_BOOTTIME;
+#endif
+    default:
+      return -1;
+    }
+  }
+
+  static int clockOf(const int slot)
+  {
+#ifdef CLOCK_BOOTTIME
+    if(SLOT_BOOTTIME == slot)
+    {
+      return CLOCK_BOOTTIME;
+    }
+#endif
+    return (SLOT_REALTIME == slot) ? CLOCK_REALTIME : CLOCK_MONOTONIC;
+  }
+
+  static inline int64_t toNs(const timespec & ts)
+  {
+    return (int64_t) ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+  }
+
+  static inline void fromNs(const int64_t ns, timespec & ts)
+  {
+    ts.tv_sec = (time_t) (ns / NSEC_PER_SEC);
+    ts.tv_nsec = (long) (ns % NSEC_PER_SEC);
+  }
+
+  static int readExact(const int clock_id, timespec & ts)
+  {
+    if(0 != clock_gettime(clock_id, &ts))
+    {
+      const int err = errno;
+      log_error(TAG(), "readExact: clock %d failed %d, %s", clock_id, err, strerror(err));
+      return 1;
+    }
+    return 0;
+  }
+
+  static int readCoarse(const int slot, timespec & ts)
+  {
+#ifdef CLOCK_MONOTONIC_COARSE
+    if(SLOT_REALTIME == slot)
+    {
+      return readExact(CLOCK_REALTIME_COARSE, ts);
+    }
+    if(0 != readExact(CLOCK_MONOTONIC_COARSE, ts))
+    {
+      return 1;
+    }
+    if(SLOT_BOOTTIME == slot)
+    {
+      int64_t offset_ns = 0;
+      if(0 != getBootOffset(toNs(ts), offset_ns))
+      {
+        return 1;
+      }
+      fromNs(toNs(ts) + offset_ns, ts);
+    }
+    return 0;
+#else
+    return readExact(clockOf(slot), ts);
+#endif
+  }
+
+  static int readCached(const int slot, timespec & ts)
+  {
+    CachedNow * const pCache = getCachedNow(false);
+    if((0 == pCache) || (0 == pCache->m_generation))
+    {
+      return readExact(clockOf(slot), ts);
+    }
+    if(pCache->m_generation_read[slot] != pCache->m_generation)
+    {
+      if(0 != readExact(clockOf(slot), pCache->m_value[slot]))
+      {
+        return 1;
+      }
+      pCache->m_generation_read[slot] = pCache->m_generation;
+    }
+    ts = pCache->m_value[slot];
+    return 0;
+  }
+
+  static void deleteCachedNow(void * pCache)
+  {
+    free(pCache);
+  }
+
+  static pthread_key_t & cacheKey()
+  {
+    static pthread_key_t s_key;
+    return s_key;
+  }
+
+  static bool & cacheKeyValid()
+  {
+    static bool s_valid;
+    return s_valid;
+  }
+
+  static void createCacheKey()
+  {
+    cacheKeyValid() = (0 == pthread_key_create(&cacheKey(), deleteCachedNow));
+  }
+
+  static CachedNow * getCachedNow(const bool create)
+  {
+    static pthread_once_t s_once = PTHREAD_ONCE_INIT;
+    (void) pthread_once(&s_once, createCacheKey);
+    if(!cacheKeyValid())
+    {
+      return 0;
+    }
+    CachedNow * pCache = static_cast<CachedNow *>(pthread_getspecific(cacheKey()));
+    if((0 == pCache) && create)
+    {
+      pCache = static_cast<CachedNow *>(calloc(1, sizeof(CachedNow)));
+      if((0 != pCache) && (0 != pthread_setspecific(cacheKey(), pCache)))
+      {
+        free(pCache);
+        pCache = 0;
+      }
+      if(0 == pCache)
+      {
+        log_error(TAG(), "getCachedNow: failed to allocate the per-thread cache");
+      }
+    }
+    return pCache;
+  }
+
+  // CLOCK_BOOTTIME - CLOCK_MONOTONIC, re-measured once 'monotonic_ns' is
+  // RECALIBRATE_INTERVAL_NS past the last measurement
+  static int getBootOffset(const int64_t monotonic_ns, int64_t & offset_ns)
+  {
+#ifdef CLOCK_BOOTTIME
+    Calibration & cal = calibration();
+    const int64_t at_ns = __atomic_load_n(&cal.m_boot_offset_at_ns, __ATOMIC_ACQUIRE);
+    if((0 != at_ns) && (monotonic_ns - at_ns < RECALIBRATE_INTERVAL_NS))
+    {
+      offset_ns = __atomic_load_n(&cal.m_boot_offset_ns, __ATOMIC_RELAXED);
+      return 0;
+    }
+    timespec mono;
+    timespec boot;
+    if((0 != readExact(CLOCK_MONOTONIC, mono)) || (0 != readExact(CLOCK_BOOTTIME, boot)))
+    {
+      return 1;
+    }
+    offset_ns = toNs(boot) - toNs(mono);
+    // racing threads all store an offset they measured, any of them is good
+    __atomic_store_n(&cal.m_boot_offset_ns, offset_ns, __ATOMIC_RELAXED);
+    __atomic_store_n(&cal.m_boot_offset_at_ns, toNs(mono), __ATOMIC_RELEASE);
+#else
+    (void) monotonic_ns;
+    offset_ns = 0;
+#endif
+    return 0;
+  }
+
+  static inline uint64_t readCycles()
+  {
+#if defined(__aarch64__)
+    uint64_t cycles;
+    __asm__ __volatile__("isb\n\tmrs %0, cntvct_el0" : "=r" (cycles) : : "memory");
+    return cycles;
+#elif defined(__x86_64__)
+    uint32_t lo;
+    uint32_t hi;
+    __asm__ __volatile__("rdtsc" : "=a" (lo), "=d" (hi) : : "memory");
+    return ((uint64_t) hi << 32) | lo;
+#else
+    return 0;
+#endif
+  }
+
+  static int readCycleCounter(const int slot, timespec & ts)
+  {
+    if((SLOT_REALTIME == slot) || !hasCycleCounter())
+    {
+      return readExact(clockOf(slot), ts);
+    }
+
+    int64_t monotonic_ns = 0;
+    if(0 != cyclesToMonotonic(monotonic_ns))
+    {
+      return 1;
+    }
+    if(SLOT_BOOTTIME == slot)
+    {
+      int64_t offset_ns = 0;
+      if(0 != getBootOffset(monotonic_ns, offset_ns))
+      {
+        return 1;
+      }
+      monotonic_ns += offset_ns;
+    }
+    fromNs(monotonic_ns, ts);
+    return 0;
+  }
+
+  static int cyclesToMonotonic(int64_t & monotonic_ns)
+  {
+#if defined(__aarch64__) || defined(__x86_64__)
+    Calibration & cal = calibration();
+    const uint64_t cycles = readCycles();
+    const uint32_t seq = __atomic_load_n(&cal.m_seq, __ATOMIC_ACQUIRE);
+    const uint64_t base_cycles = __atomic_load_n(&cal.m_base_cycles, __ATOMIC_RELAXED);
+    const int64_t base_ns = __atomic_load_n(&cal.m_base_ns, __ATOMIC_RELAXED);
+    const uint64_t mult = __atomic_load_n(&cal.m_ns_per_cycle, __ATOMIC_RELAXED);
+    const uint64_t max_cycles = __atomic_load_n(&cal.m_max_cycles, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    const bool consistent = (0 == (seq & 1)) && (seq == __atomic_load_n(&cal.m_seq, __ATOMIC_RELAXED));
+
+    if(consistent && (0 != mult) && (cycles >= base_cycles) && (cycles - base_cycles < max_cycles))
+    {
+      monotonic_ns = base_ns + (int64_t) (((unsigned __int128) (cycles - base_cycles) * mult) >> 32);
+      return 0;
+    }
+
+    // stale, not calibrated yet, or being re-anchored by another thread: read the exact clock,
+    // and re-anchor the counter to it while we're at it
+    timespec ts;
+    if(0 != readExact(CLOCK_MONOTONIC, ts))
+    {
+      return 1;
+    }
+    const uint64_t cycles_after = readCycles();
+    monotonic_ns = toNs(ts);
+    anchor(cycles + (cycles_after - cycles) / 2, monotonic_ns);
+    return 0;
+#else
+    (void) monotonic_ns;
+    return 1;
+#endif
+  }
+
+#if defined(__aarch64__) || defined(__x86_64__)
+  static void anchor(const uint64_t cycles, const int64_t monotonic_ns)
+  {
+    Calibration & cal = calibration();
+    uint32_t seq = __atomic_load_n(&cal.m_seq, __ATOMIC_RELAXED);
+    if((0 != (seq & 1)) || !__atomic_compare_exchange_n(&cal.m_seq, &seq, seq + 1, false, __ATOMIC_ACQUIRE,
+        __ATOMIC_RELAXED))
+    {
+      // another thread is re-anchoring
+      return;
+    }
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    const uint64_t base_cycles = __atomic_load_n(&cal.m_base_cycles, __ATOMIC_RELAXED);
+    const int64_t base_ns = __atomic_load_n(&cal.m_base_ns, __ATOMIC_RELAXED);
+    uint64_t mult = __atomic_load_n(&cal.m_ns_per_cycle, __ATOMIC_RELAXED);
+#if defined(__aarch64__)
+    if(0 == mult)
+    {
+      uint64_t frequency;
+      __asm__ __volatile__("mrs %0, cntfrq_el0" : "=r" (frequency));
+      if(0 != frequency)
+      {
+        mult = (uint64_t) (((unsigned __int128) NSEC_PER_SEC << 32) / frequency);
+      }
+    }
+    // the rate is fixed, so any new anchor is good
+    const bool move_anchor = true;
+#else
+    // the TSC rate isn't architecturally visible, so measure it between two anchors at least
+    // 10 ms apart and keep refining it. assumes an invariant TSC
+    const int64_t elapsed_ns = monotonic_ns - base_ns;
+    const bool move_anchor = (0 == base_ns) || (elapsed_ns >= 10 * NSEC_PER_MSEC);
+    if((0 != base_ns) && move_anchor && (cycles > base_cycles))
+    {
+      const uint64_t measured = (uint64_t) (((unsigned __int128) elapsed_ns << 32) / (cycles - base_cycles));
+      // a suspend between the anchors stops CLOCK_MONOTONIC but not necessarily the TSC, so
+      // once the rate is known, only accept measurements within 1% of it
+      if((0 == mult) || ((measured > mult - mult / 100) && (measured < mult + mult / 100)))
+      {
+        mult = measured;
+      }
+    }
+#endif
+    if(move_anchor)
+    {
+      __atomic_store_n(&cal.m_base_cycles, cycles, __ATOMIC_RELAXED);
+      __atomic_store_n(&cal.m_base_ns, monotonic_ns, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&cal.m_ns_per_cycle, mult, __ATOMIC_RELAXED);
+    __atomic_store_n(&cal.m_max_cycles,
+        (0 != mult) ? (uint64_t) (((unsigned __int128) RECALIBRATE_INTERVAL_NS << 32) / mult) : 0, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&cal.m_seq, seq + 2, __ATOMIC_RELEASE);
+  }
+#endif
+};
+
+} // namespace qc_loc_fw
+
+#endif //#ifndef __XTRAT_WIFI_CLOCK_SOURCE_H__
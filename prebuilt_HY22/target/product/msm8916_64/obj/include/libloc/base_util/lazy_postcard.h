@@ -0,0 +1,1234 @@
+/*====*====*====*====*====*====*====*====*====*====*====*====*====*====*====*
+
+ Lazy IPC message decoder
+
+ GENERAL DESCRIPTION
+ This header declares an InPostcard which decodes the encoded buffer on
+ demand. init() only validates the card header, the field index is built
+ as gets need it, nested cards are not decoded until they are requested,
+ and arrays can be read as views into the encoded buffer
+
+ Copyright (c) 2015 Qualcomm Technologies, Inc.
+ All Rights Reserved.
+ Confidential and Proprietary - Qualcomm Technologies, Inc.
+ =============================================================================*/
+#ifndef __XTRAT_WIFI_LAZY_POSTCARD_H__
+#define __XTRAT_WIFI_LAZY_POSTCARD_H__
+
+#include <new>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <base_util/log.h>
+#include <base_util/memorystream.h>
+#include <base_util/postcard.h>
+
+namespace qc_loc_fw
+{
+
+// Wire format (as produced by OutPostcard)
+//
+//   card  : length of the rest of the card (4 bytes) | field ... | terminator (1 byte, 0)
+//   field : type (2) | name length including the NUL (2) | name | value
+//
+// simple values are stored raw, strings/blobs/arrays are prefixed with their byte length (4),
+// and a nested card is stored as its complete encoded buffer, so it can be skipped over
+// using its own length header without being decoded.
+//
+// the stock InPostcard scans the card from the beginning for every get, so reading N fields
+// from a card with M fields costs O(N * M), and walking repeated sub-cards with
+// getCard(name, &pCard, index) costs O(M^2). LazyInPostcard indexes the top-level fields in
+// encoding order only as far as a get needs, and answers every get after that from the index.
+// the first miss indexes the rest of the card, so it costs about as much as a miss on the
+// stock InPostcard, later misses are free.
+
+// read-only view of an array field inside the encoded buffer.
+// the view is only valid as long as the card it came from (and, for a card returned by
+// LazyInPostcard::getCard, the parent card) is alive.
+// the encoded buffer gives no alignment guarantee, so elements are copied out with memcpy.
+// getAlignedPointer returns a direct pointer only when the data happens to be aligned for T
+template<typename T>
+class PostcardArrayView
+{
+public:
+  PostcardArrayView() :
+      m_pData(0), m_num_elements(0)
+  {
+  }
+
+  inline int getNumOfElements() const
+  {
+    return m_num_elements;
+  }
+
+  inline bool isEmpty() const
+  {
+    return (0 == m_num_elements);
+  }
+
+  inline T operator[](const int index) const
+  {
+    T value;
+    memcpy(&value, m_pData + index * sizeof(T), sizeof(T));
+    return value;
+  }
+
+  // returns 0 if the data is not aligned for T
+  inline const T * getAlignedPointer() const
+  {
+    if(0 != (reinterpret_cast<uintptr_t>(m_pData) % sizeof(T)))
+    {
+      return 0;
+    }
+    return reinterpret_cast<const T *>(m_pData);
+  }
+
+  // copies min(capacity, number of elements) elements, returns number of elements copied
+  int copyTo(T * const array, const int capacity) const
+  {
+    if((0 == array) || (capacity <= 0))
+    {
+      return 0;
+    }
+    const int num = (capacity < m_num_elements) ? capacity : m_num_elements;
+    memcpy(array, m_pData, num * sizeof(T));
+    return num;
+  }
+
+private:
+  friend class LazyInPostcard;
+
+  void set(const uint8_t * const pData, const int num_elements)
+  {
+    m_pData = pData;
+    m_num_elements = num_elements;
+  }
+
+  const uint8_t * m_pData;
+  int m_num_elements;
+};
+
+class LazyInPostcard: public InPostcard
+{
+private:
+  // header only class, so the log tag is a function rather than a static data member
+  static const char * TAG()
+  {
+    return "LazyInPostcard";
+  }
+
+  // type codes used on the wire by OutPostcard
+  enum FIELD_TYPE
+  {
+    FT_CARD = 1,
+    FT_INT64 = 10, FT_UINT64, FT_INT32, FT_UINT32, FT_INT16, FT_UINT16, FT_INT8, FT_UINT8, FT_BOOL,
+    FT_STRING, FT_BLOB, FT_DOUBLE, FT_FLOAT,
+    FT_ARRAY_INT64 = 30, FT_ARRAY_UINT64, FT_ARRAY_INT32, FT_ARRAY_UINT32, FT_ARRAY_INT16,
+    FT_ARRAY_UINT16, FT_ARRAY_INT8, FT_ARRAY_UINT8, FT_ARRAY_BOOL, FT_ARRAY_DOUBLE, FT_ARRAY_FLOAT
+  };
+
+  static const size_t LENGTH_PREFIX = 4;
+  static const size_t FIELD_HEADER_LENGTH = 4;
+  static const uint32_t FNV_OFFSET_BASIS = 2166136261U;
+  static const uint32_t FNV_PRIME = 16777619U;
+
+  struct Field
+  {
+    const char * m_name;
+    uint32_t m_hash;
+    uint16_t m_name_length;
+    uint16_t m_type;
+    // offset of the value, past the length prefix for strings/blobs/arrays.
+    // for a card, offset of its length header
+    uint32_t m_offset;
+    uint32_t m_length;
+    // next field with the same name and type, in encoding order, or -1
+    int m_next;
+    // last field and number of fields with the same name and type.
+    // only maintained on the first one, m_count is 0 on the others
+    int m_last;
+    int m_count;
+  };
+
+  // most sub-cards are small, so their index lives in the object and is searched linearly.
+  // the hash table is only allocated once a card has more fields than this
+  static const unsigned int INLINE_FIELDS = 16;
+
+public:
+  static LazyInPostcard * createInstance()
+  {
+    return new (std::nothrow) LazyInPostcard(0);
+  }
+
+  // assume ownership of the memory stream pointed by pInMem, same as InPostcard::createInstance
+  static LazyInPostcard * createInstance(InMemoryStream * const pInMem)
+  {
+    int result = 1;
+    LazyInPostcard * pCard = 0;
+    do
+    {
+      if(0 == pInMem)
+      {
+        result = 2;
+        break;
+      }
+      pCard = new (std::nothrow) LazyInPostcard(pInMem);
+      if(0 == pCard)
+      {
+        delete pInMem;
+        result = 3;
+        break;
+      }
+      if(0 != pCard->attach(pInMem->getBuffer(), pInMem->getSize()))
+      {
+        delete pCard;
+        pCard = 0;
+        result = 4;
+        break;
+      }
+      result = 0;
+    } while (false);
+
+    if(0 != result)
+    {
+      log_error(TAG(), "createInstance: failed %d", result);
+    }
+    return pCard;
+  }
+
+  virtual ~LazyInPostcard()
+  {
+    reset();
+  }
+
+  // only validates the card header. fields are indexed as gets need them
+  virtual int init(const void * const pIn, const size_t length, bool assume_ownership = false)
+  {
+    int result = 1;
+    do
+    {
+      reset();
+      if(0 == pIn)
+      {
+        result = 2;
+        break;
+      }
+      if(assume_ownership)
+      {
+        m_pStream = InMemoryStream::createInstance();
+        if(0 == m_pStream)
+        {
+          result = 3;
+          break;
+        }
+        const void * p = pIn;
+        if(0 != m_pStream->setBufferOwnership(&p, length))
+        {
+          result = 4;
+          break;
+        }
+      }
+      // without ownership, the InMemoryStream for getBuffer is only created if somebody asks
+      // for it. this saves an allocation for every card returned by getCard
+      if(0 != attach(static_cast<const uint8_t *>(pIn), length))
+      {
+        result = 5;
+        break;
+      }
+      result = 0;
+    } while (false);
+
+    if(0 != result)
+    {
+      log_error(TAG(), "init: failed %d", result);
+    }
+    return result;
+  }
+
+  virtual const MemoryStreamBase * getBuffer() const
+  {
+    if((0 == m_pStream) && (0 != m_pData))
+    {
+      m_pStream = InMemoryStream::createInstance();
+      if((0 != m_pStream) && (0 != m_pStream->setBufferNoDup(m_pData, m_size)))
+      {
+        delete m_pStream;
+        m_pStream = 0;
+      }
+    }
+    return m_pStream;
+  }
+
+  // number of top-level fields, nested card contents are not counted.
+  // this indexes the whole card
+  unsigned int getNumOfFields()
+  {
+    while (0 == scanNext())
+    {
+    }
+    return m_num_fields;
+  }
+
+  virtual int getDouble(const char * const name, DOUBLE & value)
+  {
+    return getSimple(name, FT_DOUBLE, value);
+  }
+  virtual int getFloat(const char * const name, FLOAT & value)
+  {
+    return getSimple(name, FT_FLOAT, value);
+  }
+  virtual int getInt64(const char * const name, INT64 & value)
+  {
+    return getSimple(name, FT_INT64, value);
+  }
+  virtual int getUInt64(const char * const name, UINT64 & value)
+  {
+    return getSimple(name, FT_UINT64, value);
+  }
+  virtual int getInt32(const char * const name, INT32 & value)
+  {
+    return getSimple(name, FT_INT32, value);
+  }
+  virtual int getUInt32(const char * const name, UINT32 & value)
+  {
+    return getSimple(name, FT_UINT32, value);
+  }
+  virtual int getInt16(const char * const name, INT16 & value)
+  {
+    return getSimple(name, FT_INT16, value);
+  }
+  virtual int getUInt16(const char * const name, UINT16 & value)
+  {
+    return getSimple(name, FT_UINT16, value);
+  }
+  virtual int getInt8(const char * const name, INT8 & value)
+  {
+    return getSimple(name, FT_INT8, value);
+  }
+  virtual int getUInt8(const char * const name, UINT8 & value)
+  {
+    return getSimple(name, FT_UINT8, value);
+  }
+  virtual int getBool(const char * const name, BOOL & value)
+  {
+    UINT8 byte = 0;
+    const int result = getSimple(name, FT_BOOL, byte);
+    if(0 == result)
+    {
+      value = (1 == byte);
+    }
+    return result;
+  }
+
+  virtual int getString(const char * const name, const char ** pStr)
+  {
+    int result = 1;
+    do
+    {
+      if(0 == name)
+      {
+        result = 2;
+        break;
+      }
+      if(0 == pStr)
+      {
+        result = 3;
+        break;
+      }
+      *pStr = 0;
+      const Field * pField = 0;
+      const int rc = findField(FT_STRING, name, 0, &pField);
+      if(FIELD_NOT_FOUND == rc)
+      {
+        return FIELD_NOT_FOUND;
+      }
+      if(0 != rc)
+      {
+        result = 4;
+        break;
+      }
+      *pStr = reinterpret_cast<const char *>(m_pData + pField->m_offset);
+      result = 0;
+    } while (false);
+
+    if(0 != result)
+    {
+      log_error(TAG(), "getString: failed %d", result);
+    }
+    return result;
+  }
+
+  virtual int getStringDup(const char * const name, const char ** pStr)
+  {
+    int result = 1;
+    do
+    {
+      if(0 == pStr)
+      {
+        result = 2;
+        break;
+      }
+      *pStr = 0;
+      const char * str = 0;
+      const int rc = getString(name, &str);
+      if(FIELD_NOT_FOUND == rc)
+      {
+        return FIELD_NOT_FOUND;
+      }
+      if(0 != rc)
+      {
+        result = 3;
+        break;
+      }
+      const size_t length = strlen(str) + 1;
+      char * const dup = new (std::nothrow) char[length];
+      if(0 == dup)
+      {
+        result = 4;
+        break;
+      }
+      memcpy(dup, str, length);
+      *pStr = dup;
+      result = 0;
+    } while (false);
+
+    if(0 != result)
+    {
+      log_error(TAG(), "getStringDup: failed %d", result);
+    }
+    return result;
+  }
+
+  virtual int getDoubleDefault(const char * const name, DOUBLE & value)
+  {
+    return notFoundIsOk(getDouble(name, value));
+  }
+  virtual int getFloatDefault(const char * const name, FLOAT & value)
+  {
+    return notFoundIsOk(getFloat(name, value));
+  }
+  virtual int getInt64Default(const char * const name, INT64 & value)
+  {
+    return notFoundIsOk(getInt64(name, value));
+  }
+  virtual int getUInt64Default(const char * const name, UINT64 & value)
+  {
+    return notFoundIsOk(getUInt64(name, value));
+  }
+  virtual int getInt32Default(const char * const name, INT32 & value)
+  {
+    return notFoundIsOk(getInt32(name, value));
+  }
+  virtual int getUInt32Default(const char * const name, UINT32 & value)
+  {
+    return notFoundIsOk(getUInt32(name, value));
+  }
+  virtual int getInt16Default(const char * const name, INT16 & value)
+  {
+    return notFoundIsOk(getInt16(name, value));
+  }
+  virtual int getUInt16Default(const char * const name, UINT16 & value)
+  {
+    return notFoundIsOk(getUInt16(name, value));
+  }
+  virtual int getInt8Default(const char * const name, INT8 & value)
+  {
+    return notFoundIsOk(getInt8(name, value));
+  }
+  virtual int getUInt8Default(const char * const name, UINT8 & value)
+  {
+    return notFoundIsOk(getUInt8(name, value));
+  }
+  virtual int getBoolDefault(const char * const name, BOOL & value)
+  {
+    return notFoundIsOk(getBool(name, value));
+  }
+  virtual int getStringOptional(const char * const name, const char ** pStr)
+  {
+    return notFoundIsOk(getString(name, pStr));
+  }
+
+  // pointers are encoded as INT64 by OutPostcard::addPtr
+  virtual int getPtr(const char * const name, PTR & value)
+  {
+    INT64 raw = 0;
+    const int result = getSimple(name, FT_INT64, raw);
+    if(0 == result)
+    {
+      value = reinterpret_cast<PTR>(static_cast<intptr_t>(raw));
+    }
+    return result;
+  }
+
+  // *pBlob points into the encoded buffer
+  virtual int getBlob(const char * const name, const void ** const pBlob, size_t * const pLength)
+  {
+    int result = 1;
+    do
+    {
+      if(0 == name)
+      {
+        result = 2;
+        break;
+      }
+      if((0 == pBlob) || (0 == pLength))
+      {
+        result = 3;
+        break;
+      }
+      *pBlob = 0;
+      *pLength = 0;
+      const Field * pField = 0;
+      const int rc = findField(FT_BLOB, name, 0, &pField);
+      if(FIELD_NOT_FOUND == rc)
+      {
+        return FIELD_NOT_FOUND;
+      }
+      if(0 != rc)
+      {
+        result = 4;
+        break;
+      }
+      *pBlob = m_pData + pField->m_offset;
+      *pLength = pField->m_length;
+      result = 0;
+    } while (false);
+
+    if(0 != result)
+    {
+      log_error(TAG(), "getBlob: failed %d", result);
+    }
+    return result;
+  }
+
+  // the returned card is a LazyInPostcard viewing the encoded buffer of this card. it is not
+  // decoded until it is read from, and it must be deleted before this card is
+  virtual int getCard(const char * const name, InPostcard ** const ppCard, const int index = 0)
+  {
+    int result = 1;
+    LazyInPostcard * pCard = 0;
+    do
+    {
+      if(0 == name)
+      {
+        result = 2;
+        break;
+      }
+      if(0 == ppCard)
+      {
+        result = 3;
+        break;
+      }
+      *ppCard = 0;
+      const Field * pField = 0;
+      const int rc = findField(FT_CARD, name, index, &pField);
+      if(FIELD_NOT_FOUND == rc)
+      {
+        return FIELD_NOT_FOUND;
+      }
+      if(0 != rc)
+      {
+        result = 4;
+        break;
+      }
+      pCard = createInstance();
+      if(0 == pCard)
+      {
+        result = 8;
+        break;
+      }
+      if(0 != pCard->init(m_pData + pField->m_offset, pField->m_length, false))
+      {
+        result = 9;
+        break;
+      }
+      *ppCard = pCard;
+      pCard = 0;
+      result = 0;
+    } while (false);
+
+    if(0 != pCard)
+    {
+      delete pCard;
+    }
+    if(0 != result)
+    {
+      log_error(TAG(), "getCard: failed %d", result);
+    }
+    return result;
+  }
+
+  virtual int getArrayDouble(const char * const name, int * const pNumElem, DOUBLE * const array = 0)
+  {
+    return getArray(name, pNumElem, array);
+  }
+  virtual int getArrayFloat(const char * const name, int * const pNumElem, FLOAT * const array = 0)
+  {
+    return getArray(name, pNumElem, array);
+  }
+  virtual int getArrayInt64(const char * const name, int * const pNumElem, INT64 * const array = 0)
+  {
+    return getArray(name, pNumElem, array);
+  }
+  virtual int getArrayUInt64(const char * const name, int * const pNumElem, UINT64 * const array = 0)
+  {
+    return getArray(name, pNumElem, array);
+  }
+  virtual int getArrayInt32(const char * const name, int * const pNumElem, INT32 * const array = 0)
+  {
+    return getArray(name, pNumElem, array);
+  }
+  virtual int getArrayUInt32(const char * const name, int * const pNumElem, UINT32 * const array = 0)
+  {
+    return getArray(name, pNumElem, array);
+  }
+  virtual int getArrayInt16(const char * const name, int * const pNumElem, INT16 * const array = 0)
+  {
+    return getArray(name, pNumElem, array);
+  }
+  virtual int getArrayUInt16(const char * const name, int * const pNumElem, UINT16 * const array = 0)
+  {
+    return getArray(name, pNumElem, array);
+  }
+  virtual int getArrayInt8(const char * const name, int * const pNumElem, INT8 * const array = 0)
+  {
+    return getArray(name, pNumElem, array);
+  }
+  virtual int getArrayUInt8(const char * const name, int * const pNumElem, UINT8 * const array = 0)
+  {
+    return getArray(name, pNumElem, array);
+  }
+  virtual int getArrayBool(const char * const name, int * const pNumElem, BOOL * const array = 0)
+  {
+    return getArray(name, pNumElem, array);
+  }
+
+  // OutPostcard::addArrayPtr encodes pointers with the INT64 array type but at their
+  // native size, so this only reads arrays written by a process of the same word size
+  virtual int getArrayPtr(const char * const name, int * const pNumElem, PTR * const array = 0)
+  {
+    return getArrayByType(name, FT_ARRAY_INT64, pNumElem, array);
+  }
+
+  // zero-copy alternative to getArrayXxx. T is one of the PostcardBase typedefs, except PTR
+  template<typename T>
+  int getArrayView(const char * const name, PostcardArrayView<T> & view)
+  {
+    int result = 1;
+    do
+    {
+      view.set(0, 0);
+      if(0 == name)
+      {
+        result = 2;
+        break;
+      }
+      const Field * pField = 0;
+      const int rc = findField(arrayTypeOf(static_cast<const T *>(0)), name, 0, &pField);
+      if(FIELD_NOT_FOUND == rc)
+      {
+        return FIELD_NOT_FOUND;
+      }
+      if(0 != rc)
+      {
+        result = 3;
+        break;
+      }
+      if(0 != (pField->m_length % sizeof(T)))
+      {
+        result = 4;
+        break;
+      }
+      view.set(m_pData + pField->m_offset, static_cast<int>(pField->m_length / sizeof(T)));
+      result = 0;
+    } while (false);
+
+    if(0 != result)
+    {
+      log_error(TAG(), "getArrayView: failed %d", result);
+    }
+    return result;
+  }
+
+private:
+  explicit LazyInPostcard(InMemoryStream * const pStream) :
+      m_pStream(pStream), m_pData(0), m_size(0), m_end(0), m_scan_pos(0), m_scan_error(0),
+      m_pFields(m_inline_fields), m_num_fields(0), m_max_fields(INLINE_FIELDS), m_pSlots(0), m_slot_mask(0),
+      m_cursor_head(-1), m_cursor_index(0), m_cursor_field(-1)
+  {
+  }
+
+  // private copy constructor and assignment operator so that the
+  // the instance can not be copied.
+  LazyInPostcard(const LazyInPostcard & rhs);
+  LazyInPostcard & operator=(const LazyInPostcard & rhs);
+
+  static int notFoundIsOk(const int result)
+  {
+    return (FIELD_NOT_FOUND == result) ? 0 : result;
+  }
+
+  static uint32_t readUInt32(const uint8_t * const p)
+  {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+  }
+
+  static uint16_t readUInt16(const uint8_t * const p)
+  {
+    uint16_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+  }
+
+  static uint32_t hashOf(const char * const name, const size_t name_length, const unsigned int type)
+  {
+    uint32_t hash = FNV_OFFSET_BASIS ^ type;
+    for (size_t i = 0; i < name_length; ++i)
+    {
+      hash ^= static_cast<uint8_t>(name[i]);
+      hash *= FNV_PRIME;
+    }
+    return hash;
+  }
+
+  static size_t simpleValueLength(const unsigned int type)
+  {
+    switch (type)
+    {
+    case FT_INT64:
+    case FT_UINT64:
+    case FT_DOUBLE:
+      return 8;
+    case FT_INT32:
+    case FT_UINT32:
+    case FT_FLOAT:
+      return 4;
+    case FT_INT16:
+    case FT_UINT16:
+      return 2;
+    case FT_INT8:
+    case FT_UINT8:
+    case FT_BOOL:
+      return 1;
+    default:
+      return 0;
+    }
+  }
+
+  // maps the element type to its array type code, T is picked by overload resolution
+  static unsigned int arrayTypeOf(const DOUBLE *)
+  {
+    return FT_ARRAY_DOUBLE;
+  }
+  static unsigned int arrayTypeOf(const FLOAT *)
+  {
+    return FT_ARRAY_FLOAT;
+  }
+  static unsigned int arrayTypeOf(const INT64 *)
+  {
+    return FT_ARRAY_INT64;
+  }
+  static unsigned int arrayTypeOf(const UINT64 *)
+  {
+    return FT_ARRAY_UINT64;
+  }
+  static unsigned int arrayTypeOf(const INT32 *)
+  {
+    return FT_ARRAY_INT32;
+  }
+  static unsigned int arrayTypeOf(const UINT32 *)
+  {
+    return FT_ARRAY_UINT32;
+  }
+  static unsigned int arrayTypeOf(const INT16 *)
+  {
+    return FT_ARRAY_INT16;
+  }
+  static unsigned int arrayTypeOf(const UINT16 *)
+  {
+    return FT_ARRAY_UINT16;
+  }
+  static unsigned int arrayTypeOf(const INT8 *)
+  {
+    return FT_ARRAY_INT8;
+  }
+  static unsigned int arrayTypeOf(const UINT8 *)
+  {
+    return FT_ARRAY_UINT8;
+  }
+  static unsigned int arrayTypeOf(const BOOL *)
+  {
+    return FT_ARRAY_BOOL;
+  }
+
+  static bool isLengthPrefixed(const unsigned int type)
+  {
+    return (FT_STRING == type) || (FT_BLOB == type) || ((FT_ARRAY_INT64 <= type) && (type <= FT_ARRAY_FLOAT));
+  }
+
+  static bool isSameKey(const Field & field, const char * const name, const size_t name_length,
+      const unsigned int type, const uint32_t hash)
+  {
+    return (field.m_hash == hash) && (field.m_type == type) && (field.m_name_length == name_length)
+        && (0 == memcmp(field.m_name, name, name_length));
+  }
+
+  void reset()
+  {
+    if(0 != m_pStream)
+    {
+      delete m_pStream;
+      m_pStream = 0;
+    }
+    if(m_inline_fields != m_pFields)
+    {
+      delete[] m_pFields;
+      m_pFields = m_inline_fields;
+    }
+    if(0 != m_pSlots)
+    {
+      delete[] m_pSlots;
+      m_pSlots = 0;
+    }
+    m_pData = 0;
+    m_size = 0;
+    m_end = 0;
+    m_scan_pos = 0;
+    m_scan_error = 0;
+    m_num_fields = 0;
+    m_max_fields = INLINE_FIELDS;
+    m_slot_mask = 0;
+    m_cursor_head = -1;
+    m_cursor_index = 0;
+    m_cursor_field = -1;
+  }
+
+  // checks the card header. nothing past it is touched until a get needs it
+  int attach(const uint8_t * const pData, const size_t size)
+  {
+    int result = 1;
+    do
+    {
+      if((0 == pData) || (size < LENGTH_PREFIX + 1))
+      {
+        result = 2;
+        break;
+      }
+      const uint32_t length = readUInt32(pData);
+      if(length > size - LENGTH_PREFIX)
+      {
+        result = 3;
+        break;
+      }
+      m_pData = pData;
+      m_size = size;
+      m_end = LENGTH_PREFIX + length;
+      m_scan_pos = LENGTH_PREFIX;
+      result = 0;
+    } while (false);
+
+    if(0 != result)
+    {
+      log_error(TAG(), "attach: failed %d", result);
+    }
+    return result;
+  }
+
+  inline bool isScanComplete() const
+  {
+    // the last byte of a card is the terminator
+    return (0 != m_scan_error) || (m_scan_pos + 1 >= m_end);
+  }
+
+  // indexes the next top-level field. values are not touched, and nested cards are skipped
+  // over using their length header. returns 0 if a field has been added, non-zero once the
+  // whole card has been indexed or malformed input has been hit. on malformed input the
+  // fields before the bad one stay indexed and m_scan_error is set
+  int scanNext()
+  {
+    if(isScanComplete())
+    {
+      return 1;
+    }
+
+    int result = 1;
+    do
+    {
+      const size_t pos = m_scan_pos;
+      if(pos + FIELD_HEADER_LENGTH > m_end)
+      {
+        result = 2;
+        break;
+      }
+      const unsigned int type = readUInt16(m_pData + pos);
+      const size_t name_length = readUInt16(m_pData + pos + 2);
+      const size_t name_pos = pos + FIELD_HEADER_LENGTH;
+      if((0 == name_length) || (name_length > m_end - name_pos) || (0 != m_pData[name_pos + name_length - 1]))
+      {
+        result = 3;
+        break;
+      }
+
+      size_t value_pos = name_pos + name_length;
+      size_t value_length = simpleValueLength(type);
+      if(0 != value_length)
+      {
+        if(value_length > m_end - value_pos)
+        {
+          result = 4;
+          break;
+        }
+        m_scan_pos = value_pos + value_length;
+      }
+      else if(isLengthPrefixed(type) || (FT_CARD == type))
+      {
+        if(LENGTH_PREFIX > m_end - value_pos)
+        {
+          result = 5;
+          break;
+        }
+        const uint32_t length = readUInt32(m_pData + value_pos);
+        // OutPostcard writes empty blobs, but nothing else of length 0
+        if(((0 == length) && (FT_BLOB != type)) || (length > m_end - value_pos - LENGTH_PREFIX))
+        {
+          result = 6;
+          break;
+        }
+        m_scan_pos = value_pos + LENGTH_PREFIX + length;
+        if(FT_CARD == type)
+        {
+          // a card is handed to its own decoder complete with the length header
+          value_length = LENGTH_PREFIX + length;
+        }
+        else
+        {
+          value_pos += LENGTH_PREFIX;
+          value_length = length;
+        }
+      }
+      else
+      {
+        result = 7;
+        break;
+      }
+
+      if(0 != addField(reinterpret_cast<const char *>(m_pData + name_pos), name_length, type, value_pos,
+          value_length))
+      {
+        result = 8;
+        break;
+      }
+      result = 0;
+    } while (false);
+
+    if(0 != result)
+    {
+      log_error(TAG(), "scanNext: failed %d after %u fields", result, m_num_fields);
+      m_scan_error = result;
+    }
+    return result;
+  }
+
+  int addField(const char * const name, const size_t name_length, const unsigned int type, const size_t offset,
+      const size_t length)
+  {
+    if(m_num_fields == m_max_fields)
+    {
+      if(0 != grow())
+      {
+        return 1;
+      }
+    }
+
+    const uint32_t hash = hashOf(name, name_length, type);
+    const int head = lookup(name, name_length, type, hash);
+    const int id = static_cast<int>(m_num_fields);
+    Field & field = m_pFields[id];
+    field.m_name = name;
+    field.m_name_length = static_cast<uint16_t>(name_length);
+    field.m_type = static_cast<uint16_t>(type);
+    field.m_hash = hash;
+    field.m_offset = static_cast<uint32_t>(offset);
+    field.m_length = static_cast<uint32_t>(length);
+    field.m_next = -1;
+    field.m_last = id;
+    field.m_count = 1;
+    ++m_num_fields;
+
+    if(head >= 0)
+    {
+      // duplicate name, append to the chain of the first one
+      Field & first = m_pFields[head];
+      m_pFields[first.m_last].m_next = id;
+      first.m_last = id;
+      ++first.m_count;
+      field.m_count = 0;
+    }
+    else if(0 != m_pSlots)
+    {
+      insertSlot(id);
+    }
+    return 0;
+  }
+
+  // moves the index out of the object on first use, then doubles it. the slot table is kept
+  // at twice the size of the field table
+  int grow()
+  {
+    const unsigned int max_fields = m_max_fields * 2;
+    const unsigned int num_slots = max_fields * 2;
+    Field * const pFields = new (std::nothrow) Field[max_fields];
+    int * const pSlots = new (std::nothrow) int[num_slots];
+    if((0 == pFields) || (0 == pSlots))
+    {
+      delete[] pFields;
+      delete[] pSlots;
+      log_error(TAG(), "grow: out of memory for %u fields", max_fields);
+      return 1;
+    }
+    memcpy(pFields, m_pFields, m_num_fields * sizeof(Field));
+    for (unsigned int i = 0; i < num_slots; ++i)
+    {
+      pSlots[i] = -1;
+    }
+    if(m_inline_fields != m_pFields)
+    {
+      delete[] m_pFields;
+    }
+    delete[] m_pSlots;
+    m_pFields = pFields;
+    m_pSlots = pSlots;
+    m_max_fields = max_fields;
+    m_slot_mask = num_slots - 1;
+
+    // only the first field of each name and type lives in the slot table
+    for (unsigned int i = 0; i < m_num_fields; ++i)
+    {
+      if(0 != m_pFields[i].m_count)
+      {
+        insertSlot(static_cast<int>(i));
+      }
+    }
+    return 0;
+  }
+
+  void insertSlot(const int id)
+  {
+    uint32_t slot = m_pFields[id].m_hash & m_slot_mask;
+    while (m_pSlots[slot] >= 0)
+    {
+      slot = (slot + 1) & m_slot_mask;
+    }
+    m_pSlots[slot] = id;
+  }
+
+  // returns the first indexed field with this name and type, or -1
+  int lookup(const char * const name, const size_t name_length, const unsigned int type, const uint32_t hash) const
+  {
+    if(0 == m_pSlots)
+    {
+      for (unsigned int i = 0; i < m_num_fields; ++i)
+      {
+        if((0 != m_pFields[i].m_count) && isSameKey(m_pFields[i], name, name_length, type, hash))
+        {
+          return static_cast<int>(i);
+        }
+      }
+      return -1;
+    }
+    uint32_t slot = hash & m_slot_mask;
+    while (m_pSlots[slot] >= 0)
+    {
+      const int id = m_pSlots[slot];
+      if(isSameKey(m_pFields[id], name, name_length, type, hash))
+      {
+        return id;
+      }
+      slot = (slot + 1) & m_slot_mask;
+    }
+    return -1;
+  }
+
+  // walks the chain of duplicates starting at 'head'. the position of the last walk is
+  // remembered, so reading getCard(name, &pCard, index) with increasing index is O(1) per call
+  const Field * nthField(const int head, const int index)
+  {
+    int id = head;
+    int i = 0;
+    if((head == m_cursor_head) && (m_cursor_index <= index))
+    {
+      id = m_cursor_field;
+      i = m_cursor_index;
+    }
+    for (; i < index; ++i)
+    {
+      id = m_pFields[id].m_next;
+    }
+    m_cursor_head = head;
+    m_cursor_index = index;
+    m_cursor_field = id;
+    return &m_pFields[id];
+  }
+
+  // returns 0 and sets *ppField if found, FIELD_NOT_FOUND if the card is well formed and
+  // doesn't contain the field, or a positive error code.
+  // fields are indexed in encoding order only as far as needed to find the requested one,
+  // so fields near the front of a big card are found without touching the rest of it
+  int findField(const unsigned int type, const char * const name, const int index, const Field ** const ppField)
+  {
+    if(0 == m_pData)
+    {
+      return 2;
+    }
+    if(index < 0)
+    {
+      return FIELD_NOT_FOUND;
+    }
+
+    const size_t name_length = strlen(name) + 1;
+    const uint32_t hash = hashOf(name, name_length, type);
+    int head = lookup(name, name_length, type, hash);
+    while ((head < 0) || (m_pFields[head].m_count <= index))
+    {
+      if(0 != scanNext())
+      {
+        // a missing field might be hidden behind the malformed part of the card
+        return (0 == m_scan_error) ? FIELD_NOT_FOUND : 3;
+      }
+      if(head < 0)
+      {
+        const Field & added = m_pFields[m_num_fields - 1];
+        if(isSameKey(added, name, name_length, type, hash))
+        {
+          head = static_cast<int>(m_num_fields - 1);
+        }
+      }
+    }
+    *ppField = nthField(head, index);
+    return 0;
+  }
+
+  template<typename T>
+  int getSimple(const char * const name, const unsigned int type, T & value)
+  {
+    int result = 1;
+    do
+    {
+      if(0 == name)
+      {
+        result = 2;
+        break;
+      }
+      const Field * pField = 0;
+      const int rc = findField(type, name, 0, &pField);
+      if(FIELD_NOT_FOUND == rc)
+      {
+        return FIELD_NOT_FOUND;
+      }
+      if(0 != rc)
+      {
+        result = 3;
+        break;
+      }
+      memcpy(&value, m_pData + pField->m_offset, sizeof(value));
+      result = 0;
+    } while (false);
+
+    if(0 != result)
+    {
+      log_error(TAG(), "getSimple: failed %d, name [%s], type %u", result, (0 != name) ? name : "", type);
+    }
+    return result;
+  }
+
+  template<typename T>
+  int getArray(const char * const name, int * const pNumElem, T * const array)
+  {
+    return getArrayByType(name, arrayTypeOf(static_cast<const T *>(0)), pNumElem, array);
+  }
+
+  // same return codes as the stock InPostcard, which treats a missing array as an error
+  template<typename T>
+  int getArrayByType(const char * const name, const unsigned int type, int * const pNumElem, T * const array)
+  {
+    int result = 1;
+    do
+    {
+      if(0 == name)
+      {
+        result = 2;
+        break;
+      }
+      if(0 == pNumElem)
+      {
+        result = 3;
+        break;
+      }
+      const Field * pField = 0;
+      if(0 != findField(type, name, 0, &pField))
+      {
+        result = 4;
+        break;
+      }
+      if(0 != (pField->m_length % sizeof(T)))
+      {
+        result = 5;
+        break;
+      }
+      const int num_elements = static_cast<int>(pField->m_length / sizeof(T));
+      if(0 == num_elements)
+      {
+        result = 6;
+        break;
+      }
+      if(0 != array)
+      {
+        if(num_elements > *pNumElem)
+        {
+          result = 7;
+          break;
+        }
+        memcpy(array, m_pData + pField->m_offset, pField->m_length);
+      }
+      *pNumElem = num_elements;
+      result = 0;
+    } while (false);
+
+    if(0 != result)
+    {
+      log_error(TAG(), "getArray: failed %d, name [%s]", result, (0 != name) ? name : "");
+    }
+    return result;
+  }
+
+  // only set when the buffer is owned, or after getBuffer has been called on a view
+  mutable InMemoryStream * m_pStream;
+  const uint8_t * m_pData;
+  size_t m_size;
+  // offset of the terminator + 1
+  size_t m_end;
+  // offset of the first field not indexed yet
+  size_t m_scan_pos;
+  int m_scan_error;
+
+  Field m_inline_fields[INLINE_FIELDS];
+  Field * m_pFields;
+  unsigned int m_num_fields;
+  unsigned int m_max_fields;
+  // open addressing on the field hash, holds the first field of each name and type.
+  // 0 while the index fits in m_inline_fields
+  int * m_pSlots;
+  uint32_t m_slot_mask;
+
+  // last position reached by nthField
+  int m_cursor_head;
+  int m_cursor_index;
+  int m_cursor_field;
+};
+
+} // namespace qc_loc_fw
+
+#endif //#ifndef __XTRAT_WIFI_LAZY_POSTCARD_H__
@@ -0,0 +1,832 @@
+/*====*====*====*====*====*====*====*====*====*====*====*====*====*====*====*
+
+ Memory mapped config file
+
+ GENERAL DESCRIPTION
+ This header declares a config file parser which parses the file in place,
+ indexes the keys with a hash table, and optionally reloads the file when
+ it changes
+
+ Copyright (c) 2015 Qualcomm Technologies, Inc.
+ All Rights Reserved.
+ Confidential and Proprietary - Qualcomm Technologies, Inc.
+ =============================================================================*/
+#ifndef __XTRAT_WIFI_MAPPED_CONFIG_FILE_H__
+#define __XTRAT_WIFI_MAPPED_CONFIG_FILE_H__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <new>
+#include <poll.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <base_util/config_file.h>
+#include <base_util/log.h>
+#include <base_util/sync.h>
+
+namespace qc_loc_fw
+{
+
+// drop-in replacement for ConfigFile::createInstance, for large or frequently read files
+//
+// - the file is read once into a private mapping and parsed in place: values are
+//   terminated inside the mapping, so getString returns pointers into it without copying
+// - keys are found through a hash index built once per load, instead of a list search
+// - with hot_reload, a thread watches the file with inotify. a changed file is parsed
+//   into a new snapshot which is swapped in atomically; readers never take a lock
+//
+// strings returned by getString/getStringView stay valid until this object is deleted,
+// even across reloads, since replaced snapshots are only freed at destruction. a reload
+// which finds the file unchanged keeps the current snapshot, so only real changes cost
+// a mapping.
+// the file format is the same: "NAME = VALUE" lines, '#' starts a comment line.
+// when a name is defined more than once, the first definition wins
+class MappedConfigFile: public ConfigFile
+{
+private:
+  // header only class, so the log tag is a function rather than a static data member
+  static const char * TAG()
+  {
+    return "MappedConfigFile";
+  }
+public:
+  static MappedConfigFile * createInstance(const char * const filename, const bool hot_reload = false,
+      const bool verbose = false)
+  {
+    MappedConfigFile * pConfig = 0;
+    int result = 1;
+    do
+    {
+      if(0 == filename)
+      {
+        result = 2;
+        break;
+      }
+      pConfig = new (std::nothrow) MappedConfigFile(verbose);
+      if(0 == pConfig)
+      {
+        result = 3;
+        break;
+      }
+      pConfig->m_filename = strdup(filename);
+      if((0 == pConfig->m_filename) || (0 == pConfig->m_pReloadMutex))
+      {
+        result = 4;
+        break;
+      }
+      // a missing file isn't fatal when it's being watched: it may show up later
+      const int load_result = pConfig->reload();
+      if((0 != load_result) && !hot_reload)
+      {
+        result = 5;
+        break;
+      }
+      if(hot_reload && (0 != pConfig->startWatching()))
+      {
+        result = 6;
+        break;
+      }
+      result = 0;
+    } while (false);
+
+    if(0 != result)
+    {
+      log_error(TAG(), "createInstance: failed %d [%s]", result, (0 != filename) ? filename : "");
+      delete pConfig;
+      pConfig = 0;
+    }
+    return pConfig;
+  }
+
+  virtual ~MappedConfigFile()
+  {
+    stopWatching();
+    Snapshot * pSnapshot = __atomic_exchange_n(&m_pCurrent, static_cast<Snapshot *>(0), __ATOMIC_ACQ_REL);
+    delete pSnapshot;
+    while (0 != m_pRetired)
+    {
+      pSnapshot = m_pRetired;
+      m_pRetired = pSnapshot->m_pNext;
+      delete pSnapshot;
+    }
+    delete m_pReloadMutex;
+    m_pReloadMutex = 0;
+    free(m_filename);
+    m_filename = 0;
+  }
+
+  virtual bool loaded() const
+  {
+    return (0 != __atomic_load_n(&m_pCurrent, __ATOMIC_ACQUIRE));
+  }
+
+  // zero copy: 'pStr' points into the current snapshot and is null terminated
+  int getStringView(const char * const name, const char ** pStr, size_t & length) const
+  {
+    int result = 1;
+    do
+    {
+      if((0 == name) || (0 == pStr))
+      {
+        result = 2;
+        break;
+      }
+      const Snapshot * const pSnapshot = __atomic_load_n(&m_pCurrent, __ATOMIC_ACQUIRE);
+      const Entry * const pEntry = (0 != pSnapshot) ? pSnapshot->find(name) : 0;
+      if(0 == pEntry)
+      {
+        return NOT_FOUND;
+      }
+      *pStr = pSnapshot->m_pData + pEntry->m_value_offset;
+      length = pEntry->m_value_length;
+      result = 0;
+    } while (false);
+
+    if(0 != result)
+    {
+      log_error(TAG(), "getStringView failed %d", result);
+    }
+    return result;
+  }
+
+  virtual int getString(const char * const name, const char ** pStr)
+  {
+    size_t length = 0;
+    return getStringView(name, pStr, length);
+  }
+
+  // the copy is allocated with new[], and must be freed by the caller with delete[]
+  virtual int getStringDup(const char * const name, const char ** pStr, const char * const strDefault = 0)
+  {
+    int result = 1;
+    do
+    {
+      if(0 == pStr)
+      {
+        result = 2;
+        break;
+      }
+      const char * value = 0;
+      size_t length = 0;
+      result = getStringView(name, &value, length);
+      if(NOT_FOUND == result)
+      {
+        if(0 == strDefault)
+        {
+          *pStr = 0;
+          return NOT_FOUND;
+        }
+        value = strDefault;
+        length = strlen(strDefault);
+      }
+      else if(0 != result)
+      {
+        break;
+      }
+      char * const copy = new (std::nothrow) char[length + 1];
+      if(0 == copy)
+      {
+        result = 3;
+        break;
+      }
+      memcpy(copy, value, length);
+      copy[length] = 0;
+      *pStr = copy;
+      result = 0;
+    } while (false);
+
+    if(0 != result)
+    {
+      log_error(TAG(), "getStringDup failed [%s] %d", (0 != name) ? name : "", result);
+    }
+    return result;
+  }
+
+  virtual int getInt32(const char * const name, int & value)
+  {
+    const char * str = 0;
+    size_t length = 0;
+    int result = getStringView(name, &str, length);
+    if(0 != result)
+    {
+      return result;
+    }
+    char * end = 0;
+    errno = 0;
+    const long converted = strtol(str, &end, 10);
+    if((0 != errno) || (end == str) || (0 != *end) || (converted < INT_MIN) || (converted > INT_MAX))
+    {
+      log_error(TAG(), "getInt32 failed [%s] [%s]", name, str);
+      return 100;
+    }
+    value = (int) converted;
+    return 0;
+  }
+
+  virtual int getInt32Default(const char * const name, int & value, const int & Default)
+  {
+    const int result = getInt32(name, value);
+    if(NOT_FOUND == result)
+    {
+      value = Default;
+      return 0;
+    }
+    return result;
+  }
+
+  // positive or zero, otherwise the default
+  virtual int get_PZ_Int32Default(const char * const name, int & value, const int & Default)
+  {
+    const int result = getInt32(name, value);
+    if(NOT_FOUND == result)
+    {
+      value = Default;
+      return 0;
+    }
+    if(value < 0)
+    {
+      value = Default;
+      return 1;
+    }
+    return result;
+  }
+
+  // positive and non-zero, otherwise the default
+  virtual int get_PNZ_Int32Default(const char * const name, int & value, const int & Default)
+  {
+    const int result = getInt32(name, value);
+    if(NOT_FOUND == result)
+    {
+      value = Default;
+      return 0;
+    }
+    if(value <= 0)
+    {
+      value = Default;
+      return 1;
+    }
+    return result;
+  }
+
+  virtual int getDouble(const char * const name, double & value)
+  {
+    const char * str = 0;
+    size_t length = 0;
+    int result = getStringView(name, &str, length);
+    if(0 != result)
+    {
+      return result;
+    }
+    char * end = 0;
+    errno = 0;
+    const double converted = strtod(str, &end);
+    if((0 != errno) || (end == str) || (0 != *end))
+    {
+      log_error(TAG(), "getDouble failed [%s] [%s]", name, str);
+      return 100;
+    }
+    value = converted;
+    return 0;
+  }
+
+  virtual int getDoubleDefault(const char * const name, double & value, const double & Default)
+  {
+    const int result = getDouble(name, value);
+    if(NOT_FOUND == result)
+    {
+      value = Default;
+      return 0;
+    }
+    return result;
+  }
+
+  // parse the file again and swap the new snapshot in. called by the watcher thread,
+  // but can also be called directly. on failure the current snapshot is kept
+  int reload()
+  {
+    int result = 1;
+    do
+    {
+      AutoLock autolock(m_pReloadMutex, TAG());
+      if(0 != autolock.ZeroIfLocked())
+      {
+        result = 2;
+        break;
+      }
+      Snapshot * const pNew = Snapshot::load(m_filename, m_verbose);
+      if(0 == pNew)
+      {
+        result = 3;
+        break;
+      }
+      // swaps only happen with m_pReloadMutex held, so the current snapshot stays put
+      const Snapshot * const pCurrent = __atomic_load_n(&m_pCurrent, __ATOMIC_ACQUIRE);
+      if((0 != pCurrent) && (pCurrent->m_data_size == pNew->m_data_size)
+          && (0 == memcmp(pCurrent->m_pData, pNew->m_pData, pNew->m_data_size)))
+      {
+        // e.g. touched or saved without changes: nothing to swap in
+        delete pNew;
+        result = 0;
+        break;
+      }
+      Snapshot * const pOld = __atomic_exchange_n(&m_pCurrent, pNew, __ATOMIC_ACQ_REL);
+      if(0 != pOld)
+      {
+        // readers may still hold strings from it
+        pOld->m_pNext = m_pRetired;
+        m_pRetired = pOld;
+        __atomic_add_fetch(&m_num_reloads, 1, __ATOMIC_RELAXED);
+      }
+      if(m_verbose)
+      {
+        log_verbose(TAG(), "reload: [%s] %u keys", m_filename, pNew->m_num_entries);
+      }
+      result = 0;
+    } while (false);
+
+    if(0 != result)
+    {
+      log_error(TAG(), "reload: failed %d [%s]", result, (0 != m_filename) ? m_filename : "");
+    }
+    return result;
+  }
+
+  // number of times a changed file has been swapped in
+  inline unsigned int getNumOfReloads() const
+  {
+    return __atomic_load_n(&m_num_reloads, __ATOMIC_RELAXED);
+  }
+
+  inline unsigned int getNumOfKeys() const
+  {
+    const Snapshot * const pSnapshot = __atomic_load_n(&m_pCurrent, __ATOMIC_ACQUIRE);
+    return (0 != pSnapshot) ? pSnapshot->m_num_entries : 0;
+  }
+
+private:
+  struct Entry
+  {
+    uint32_t m_hash;
+    uint32_t m_name_offset;
+    uint32_t m_value_offset;
+    uint32_t m_value_length;
+  };
+
+  // one parsed version of the file. never modified once published
+  struct Snapshot
+  {
+    char * m_pData;
+    size_t m_data_size;
+    Entry * m_pEntries;
+    unsigned int m_num_entries;
+    // open addressing, entry index + 1, 0 for empty
+    uint32_t * m_pSlots;
+    unsigned int m_slot_mask;
+    Snapshot * m_pNext;
+
+    Snapshot() :
+        m_pData(0), m_data_size(0), m_pEntries(0), m_num_entries(0), m_pSlots(0),
+        m_slot_mask(0), m_pNext(0)
+    {
+    }
+
+    ~Snapshot()
+    {
+      if(0 != m_pData)
+      {
+        munmap(m_pData, m_data_size);
+      }
+      delete[] m_pEntries;
+      delete[] m_pSlots;
+    }
+
+    static inline uint32_t hash(const char * str)
+    {
+      // FNV-1a
+      uint32_t h = 2166136261U;
+      while (0 != *str)
+      {
+        h = (h ^ (uint8_t) *str++) * 16777619U;
+      }
+      return h;
+    }
+
+    const Entry * find(const char * const name) const
+    {
+      const uint32_t h = hash(name);
+      for (uint32_t i = h & m_slot_mask;; i = (i + 1) & m_slot_mask)
+      {
+        const uint32_t slot = m_pSlots[i];
+        if(0 == slot)
+        {
+          return 0;
+        }
+        const Entry & entry = m_pEntries[slot - 1];
+        if((entry.m_hash == h) && (0 == strcmp(m_pData + entry.m_name_offset, name)))
+        {
+          return &entry;
+        }
+      }
+    }
+
+    static Snapshot * load(const char * const filename, const bool verbose)
+    {
+      Snapshot * pSnapshot = 0;
+      int fd = -1;
+      int result = 1;
+      do
+      {
+        fd = open(filename, O_RDONLY | O_CLOEXEC);
+        if(fd < 0)
+        {
+          result = 2;
+          break;
+        }
+        struct stat st;
+        if((0 != fstat(fd, &st)) || (st.st_size < 0) || (st.st_size >= (off_t) UINT32_MAX))
+        {
+          result = 3;
+          break;
+        }
+        pSnapshot = new (std::nothrow) Snapshot();
+        if(0 == pSnapshot)
+        {
+          result = 4;
+          break;
+        }
+        // the file is read once into a private anonymous mapping, rather than mapping the
+        // file itself: truncating a file, e.g. rewriting it in place, discards even the
+        // copied-on-write pages of private file mappings, and readers would fault
+        const size_t size = (size_t) st.st_size;
+        void * const ptr = mmap(0, size + 1, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(MAP_FAILED == ptr)
+        {
+          result = 5;
+          break;
+        }
+        pSnapshot->m_pData = reinterpret_cast<char *>(ptr);
+        pSnapshot->m_data_size = size + 1;
+        size_t done = 0;
+        while (done < size)
+        {
+          const ssize_t n = read(fd, pSnapshot->m_pData + done, size - done);
+          if(n <= 0)
+          {
+            if((n < 0) && (EINTR == errno))
+            {
+              continue;
+            }
+            break;
+          }
+          done += (size_t) n;
+        }
+        if(done != size)
+        {
+          result = 6;
+          break;
+        }
+        pSnapshot->m_pData[size] = 0;
+        if(0 != pSnapshot->index(size, verbose))
+        {
+          result = 7;
+          break;
+        }
+        result = 0;
+      } while (false);
+
+      if(fd >= 0)
+      {
+        close(fd);
+      }
+      if(0 != result)
+      {
+        log_error(TAG(), "load: failed %d [%s], error [%d][%s]", result, filename, errno, strerror(errno));
+        delete pSnapshot;
+        pSnapshot = 0;
+      }
+      return pSnapshot;
+    }
+
+    static inline bool isSpace(const char c)
+    {
+      return (' ' == c) || ('\t' == c) || ('\r' == c) || ('\n' == c) || ('\v' == c) || ('\f' == c);
+    }
+
+    int index(const size_t size, const bool verbose)
+    {
+      char * const data = m_pData;
+      // upper bound on the number of entries: lines containing '='
+      unsigned int max_entries = 0;
+      for (size_t i = 0; i < size; ++i)
+      {
+        max_entries += ('=' == data[i]) ? 1 : 0;
+      }
+      m_pEntries = new (std::nothrow) Entry[(0 != max_entries) ? max_entries : 1];
+      unsigned int num_slots = 16;
+      while (num_slots < (2 * max_entries))
+      {
+        num_slots <<= 1;
+      }
+      m_pSlots = new (std::nothrow) uint32_t[num_slots];
+      if((0 == m_pEntries) || (0 == m_pSlots))
+      {
+        return 1;
+      }
+      memset(m_pSlots, 0, num_slots * sizeof(uint32_t));
+      m_slot_mask = num_slots - 1;
+
+      size_t line_begin = 0;
+      unsigned int line_number = 0;
+      while (line_begin < size)
+      {
+        ++line_number;
+        size_t line_end = line_begin;
+        while ((line_end < size) && ('\n' != data[line_end]))
+        {
+          ++line_end;
+        }
+        const size_t next_line = line_end + 1;
+
+        size_t begin = line_begin;
+        while ((begin < line_end) && isSpace(data[begin]))
+        {
+          ++begin;
+        }
+        size_t equal = begin;
+        while ((equal < line_end) && ('=' != data[equal]))
+        {
+          ++equal;
+        }
+        if((begin == line_end) || ('#' == data[begin]) || (equal == line_end) || (equal == begin))
+        {
+          if(verbose && (begin != line_end) && ('#' != data[begin]))
+          {
+            log_verbose(TAG(), "Line[%u], skip malformed line", line_number);
+          }
+          line_begin = next_line;
+          continue;
+        }
+
+        size_t name_end = equal;
+        while ((name_end > begin) && isSpace(data[name_end - 1]))
+        {
+          --name_end;
+        }
+        size_t value_begin = equal + 1;
+        while ((value_begin < line_end) && isSpace(data[value_begin]))
+        {
+          ++value_begin;
+        }
+        size_t value_end = line_end;
+        while ((value_end > value_begin) && isSpace(data[value_end - 1]))
+        {
+          --value_end;
+        }
+
+        // terminate in place. name_end is at most the '=', value_end at most the '\n'
+        // or the extra byte after the end of the file
+        data[name_end] = 0;
+        data[value_end] = 0;
+
+        Entry & entry = m_pEntries[m_num_entries];
+        entry.m_hash = hash(data + begin);
+        entry.m_name_offset = (uint32_t) begin;
+        entry.m_value_offset = (uint32_t) value_begin;
+        entry.m_value_length = (uint32_t) (value_end - value_begin);
+
+        bool duplicate = false;
+        uint32_t i = entry.m_hash & m_slot_mask;
+        for (; 0 != m_pSlots[i]; i = (i + 1) & m_slot_mask)
+        {
+          const Entry & other = m_pEntries[m_pSlots[i] - 1];
+          if((other.m_hash == entry.m_hash) && (0 == strcmp(data + other.m_name_offset, data + begin)))
+          {
+            duplicate = true;
+            break;
+          }
+        }
+        if(!duplicate)
+        {
+          m_pSlots[i] = ++m_num_entries;
+        }
+        line_begin = next_line;
+      }
+      return 0;
+    }
+
+  private:
+    Snapshot(const Snapshot & rhs);
+    Snapshot & operator=(const Snapshot & rhs);
+  };
+
+  // watches the directory, so that files replaced by rename are picked up as well
+  class Watcher: public Runnable
+  {
+  public:
+    explicit Watcher(MappedConfigFile * const pConfig) :
+        m_pConfig(pConfig), m_inotify_fd(-1), m_stop_fd(-1)
+    {
+    }
+
+    virtual ~Watcher()
+    {
+      if(m_inotify_fd >= 0)
+      {
+        close(m_inotify_fd);
+      }
+      if(m_stop_fd >= 0)
+      {
+        close(m_stop_fd);
+      }
+    }
+
+    int init()
+    {
+      const char * const filename = m_pConfig->m_filename;
+      const char * const slash = strrchr(filename, '/');
+      char dir[PATH_MAX];
+      if(0 == slash)
+      {
+        snprintf(dir, sizeof(dir), ".");
+        m_basename = filename;
+      }
+      else
+      {
+        const size_t length = (size_t) (slash - filename);
+        if(length >= sizeof(dir))
+        {
+          return 2;
+        }
+        memcpy(dir, filename, length);
+        dir[length] = 0;
+        if(0 == length)
+        {
+          snprintf(dir, sizeof(dir), "/");
+        }
+        m_basename = slash + 1;
+      }
+      m_inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+      m_stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+      if((m_inotify_fd < 0) || (m_stop_fd < 0))
+      {
+        return 3;
+      }
+      if(inotify_add_watch(m_inotify_fd, dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+      {
+        return 4;
+      }
+      return 0;
+    }
+
+    void stop()
+    {
+      const uint64_t one = 1;
+      if(sizeof(one) != write(m_stop_fd, &one, sizeof(one)))
+      {
+        log_error(TAG(), "Watcher: cannot signal stop");
+      }
+    }
+
+    virtual void run()
+    {
+      char buffer[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+      while (true)
+      {
+        struct pollfd fds[2];
+        fds[0].fd = m_inotify_fd;
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+        fds[1].fd = m_stop_fd;
+        fds[1].events = POLLIN;
+        fds[1].revents = 0;
+        if(poll(fds, 2, -1) < 0)
+        {
+          if(EINTR == errno)
+          {
+            continue;
+          }
+          log_error(TAG(), "Watcher: poll failed [%d][%s]", errno, strerror(errno));
+          break;
+        }
+        if(0 != fds[1].revents)
+        {
+          break;
+        }
+        bool changed = false;
+        ssize_t length = 0;
+        while ((length = read(m_inotify_fd, buffer, sizeof(buffer))) > 0)
+        {
+          for (const char * p = buffer; p < (buffer + length);)
+          {
+            const struct inotify_event * const event = reinterpret_cast<const struct inotify_event *>(p);
+            if((0 != event->len) && (0 == strcmp(event->name, m_basename)))
+            {
+              changed = true;
+            }
+            p += sizeof(struct inotify_event) + event->len;
+          }
+        }
+        if(changed)
+        {
+          (void) m_pConfig->reload();
+        }
+      }
+    }
+
+  private:
+    Watcher(const Watcher & rhs);
+    Watcher & operator=(const Watcher & rhs);
+
+    MappedConfigFile * m_pConfig;
+    const char * m_basename;
+    int m_inotify_fd;
+    int m_stop_fd;
+  };
+
+  explicit MappedConfigFile(const bool verbose) :
+      m_filename(0), m_verbose(verbose), m_pCurrent(0), m_pRetired(0), m_num_reloads(0),
+      m_pReloadMutex(Mutex::createInstance(TAG(), verbose)), m_pWatcher(0), m_pWatcherThread(0)
+  {
+  }
+
+  // private copy constructor and assignment operator so that the
+  // the instance can not be copied.
+  MappedConfigFile(const MappedConfigFile & rhs);
+  MappedConfigFile & operator=(const MappedConfigFile & rhs);
+
+  int startWatching()
+  {
+    int result = 1;
+    do
+    {
+      m_pWatcher = new (std::nothrow) Watcher(this);
+      if(0 == m_pWatcher)
+      {
+        result = 2;
+        break;
+      }
+      if(0 != m_pWatcher->init())
+      {
+        result = 3;
+        break;
+      }
+      m_pWatcherThread = Thread::createInstance(TAG(), m_pWatcher, false);
+      if(0 == m_pWatcherThread)
+      {
+        result = 4;
+        break;
+      }
+      if(0 != m_pWatcherThread->launch())
+      {
+        delete m_pWatcherThread;
+        m_pWatcherThread = 0;
+        result = 5;
+        break;
+      }
+      result = 0;
+    } while (false);
+
+    if(0 != result)
+    {
+      log_error(TAG(), "startWatching: failed %d, error [%d][%s]", result, errno, strerror(errno));
+    }
+    return result;
+  }
+
+  void stopWatching()
+  {
+    if(0 != m_pWatcherThread)
+    {
+      m_pWatcher->stop();
+      (void) m_pWatcherThread->join();
+      delete m_pWatcherThread;
+      m_pWatcherThread = 0;
+    }
+    delete m_pWatcher;
+    m_pWatcher = 0;
+  }
+
+  char * m_filename;
+  const bool m_verbose;
+  Snapshot * m_pCurrent;
+  // replaced snapshots, freed at destruction. only touched with m_pReloadMutex held
+  Snapshot * m_pRetired;
+  unsigned int m_num_reloads;
+  Mutex * m_pReloadMutex;
+  Watcher * m_pWatcher;
+  Thread * m_pWatcherThread;
+};
+
+} // namespace qc_loc_fw
+
+#endif //#ifndef __XTRAT_WIFI_MAPPED_CONFIG_FILE_H__
@@ -18,6 +18,8 @@
 namespace qc_loc_fw
 {
 
+class PooledOutMemoryStream;
+
 class MemoryStreamBase
 {
 public:
@@ -59,6 +61,12 @@ public:
   virtual size_t getGetCursor() const = 0;
   virtual int setGetCursor(const size_t cursor) = 0;
   virtual size_t getCapacity() const = 0;
+
+private:
+  // a pooled buffer can't be taken over, as it would later be delete[]'d instead of
+  // going back to its pool. declared but not defined, so that passing a
+  // PooledOutMemoryStream * to createInstance fails to compile
+  static InMemoryStream * createInstance(PooledOutMemoryStream * const os);
 };
 
 } // namespace qc_loc_fw
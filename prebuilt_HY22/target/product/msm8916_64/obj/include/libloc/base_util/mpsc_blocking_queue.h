@@ -0,0 +1,335 @@
+/*====*====*====*====*====*====*====*====*====*====*====*====*====*====*====*
+
+ Lock-free blocking queue
+
+ GENERAL DESCRIPTION
+ This component implements a multi-producer, single-consumer BlockingQueue
+ without locks. The consumer only parks on a futex when the queue is empty
+
+ Copyright (c) 2015 Qualcomm Technologies, Inc.
+ All Rights Reserved.
+ Confidential and Proprietary - Qualcomm Technologies, Inc.
+ =============================================================================*/
+#ifndef __XTRAT_WIFI_MPSC_BLOCKING_QUEUE_H__
+#define __XTRAT_WIFI_MPSC_BLOCKING_QUEUE_H__
+
+#include <new>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include <base_util/log.h>
+#include <base_util/sync.h>
+#include <base_util/time_routines.h>
+
+namespace qc_loc_fw
+{
+
+// Intrusive MPSC queue (Vyukov style): producers swap themselves into m_pTail
+// with one atomic exchange and then link the previous node to the new one.
+// only the consumer ever touches m_pHead, so pop needs no atomic RMW at all.
+//
+// parking protocol: the consumer snapshots m_wake_seq, announces itself in
+// m_consumer_waiting, re-checks the queue and only then waits on the futex
+// while m_wake_seq still holds the snapshot. a producer that observes the
+// announcement bumps m_wake_seq before waking, so a wake-up can never be lost
+// in between the re-check and the futex wait.
+//
+// note: pop must only be called from one thread at a time (e.g. the run loop of
+// MqClientControllerBase). push and close can be called from any thread
+class MpscBlockingQueue: public BlockingQueue
+{
+public:
+  // return codes, in addition to 0 for success
+  enum RETURN_CODE
+  {
+    RC_INVALID_PARAM = 2, RC_QUEUE_CLOSED = 3, RC_NO_MEMORY = 4, RC_TIMEOUT = 5, RC_WAIT_FAILED = 6
+  };
+
+  static MpscBlockingQueue * createInstance(const char * tag, const bool verboseLog = false)
+  {
+    MpscBlockingQueue * const pQueue = new (std::nothrow) MpscBlockingQueue(tag, verboseLog);
+    if((0 != pQueue) && (0 == pQueue->m_pHead))
+    {
+      delete pQueue;
+      return 0;
+    }
+    return pQueue;
+  }
+
+  virtual ~MpscBlockingQueue()
+  {
+    // the queue doesn't own the pointers being carried, only the nodes
+    Node * pNode = m_pHead;
+    while (0 != pNode)
+    {
+      Node * const pNext = pNode->m_pNext;
+      delete pNode;
+      pNode = pNext;
+    }
+    m_pHead = 0;
+    m_pTail = 0;
+  }
+
+  virtual int push(void * const ptr)
+  {
+    int result = 1;
+    do
+    {
+      if(0 != __atomic_load_n(&m_closed, __ATOMIC_ACQUIRE))
+      {
+        result = RC_QUEUE_CLOSED;
+        break;
+      }
+
+      Node * const pNode = new (std::nothrow) Node(ptr);
+      if(0 == pNode)
+      {
+        result = RC_NO_MEMORY;
+        break;
+      }
+
+      Node * const pPrev = __atomic_exchange_n(&m_pTail, pNode, __ATOMIC_ACQ_REL);
+      __atomic_store_n(&pPrev->m_pNext, pNode, __ATOMIC_RELEASE);
+
+      // pairs with the fence in popInternal: either we see the consumer waiting,
+      // or the consumer sees the node we just linked. only the first producer to
+      // see the consumer parked pays for the wake-up system call
+      __atomic_thread_fence(__ATOMIC_SEQ_CST);
+      if((0 != __atomic_load_n(&m_consumer_waiting, __ATOMIC_RELAXED))
+          && (0 != __atomic_exchange_n(&m_consumer_waiting, 0, __ATOMIC_ACQ_REL)))
+      {
+        wake();
+      }
+      result = 0;
+    } while (false);
+
+    if(0 != result)
+    {
+      log_error(m_tag, "push: failed %d", result);
+    }
+    return result;
+  }
+
+  virtual int close()
+  {
+    __atomic_store_n(&m_closed, 1, __ATOMIC_RELEASE);
+    wake();
+    if(m_verbose)
+    {
+      log_verbose(m_tag, "close");
+    }
+    return 0;
+  }
+
+  virtual int pop(void ** const pptr, const timespec * const timeout_abs_realtime, bool * const p_is_queue_closed = 0)
+  {
+    // FUTEX_CLOCK_REALTIME makes the kernel interpret the deadline as absolute wall clock time
+    return popInternal(pptr, timeout_abs_realtime, FUTEX_CLOCK_REALTIME, p_is_queue_closed);
+  }
+
+  virtual int pop(void ** const pptr, const TimeDiff & timeout = TimeDiff(false), bool * const p_is_queue_closed = 0)
+  {
+    if(!timeout.is_valid())
+    {
+      // wait forever
+      return popInternal(pptr, 0, 0, p_is_queue_closed);
+    }
+
+    // FUTEX_WAIT_BITSET takes an absolute CLOCK_MONOTONIC deadline when no clock flag is given
+    timespec deadline;
+    if(0 != clock_gettime(CLOCK_MONOTONIC, &deadline))
+    {
+      log_error(m_tag, "pop: clock_gettime failed %d", errno);
+      return RC_WAIT_FAILED;
+    }
+    const timespec * const pDiff = timeout.getTimeDiffPtr();
+    deadline.tv_sec += pDiff->tv_sec;
+    deadline.tv_nsec += pDiff->tv_nsec;
+    if(deadline.tv_nsec >= 1000000000)
+    {
+      deadline.tv_sec += 1;
+      deadline.tv_nsec -= 1000000000;
+    }
+    return popInternal(pptr, &deadline, 0, p_is_queue_closed);
+  }
+
+private:
+  struct Node
+  {
+    explicit Node(void * const ptr) :
+        m_pNext(0), m_ptr(ptr)
+    {
+    }
+    Node * m_pNext;
+    void * m_ptr;
+  };
+
+  MpscBlockingQueue(const char * tag, const bool verboseLog) :
+      m_tag((0 != tag) ? tag : "MpscBlockingQueue"), m_verbose(verboseLog), m_pHead(0), m_pTail(0),
+      m_closed(0), m_consumer_waiting(0), m_wake_seq(0)
+  {
+    // the queue always holds one stub node, so producers never see an empty list
+    m_pHead = new (std::nothrow) Node(0);
+    m_pTail = m_pHead;
+  }
+
+  // private copy constructor and assignment operator so that the
+  // the instance can not be copied.
+  MpscBlockingQueue(const MpscBlockingQueue & rhs);
+  MpscBlockingQueue & operator=(const MpscBlockingQueue & rhs);
+
+  // consumer only. returns true and fills *pptr if an item was dequeued
+  bool tryPop(void ** const pptr)
+  {
+    Node * const pHead = m_pHead;
+    Node * const pNext = __atomic_load_n(&pHead->m_pNext, __ATOMIC_ACQUIRE);
+    if(0 == pNext)
+    {
+      // empty, or a producer is between its exchange and its link. either way it will wake us
+      return false;
+    }
+    // pNext becomes the new stub node
+    *pptr = pNext->m_ptr;
+    pNext->m_ptr = 0;
+    m_pHead = pNext;
+    delete pHead;
+    return true;
+  }
+
+  void wake()
+  {
+    __atomic_add_fetch(&m_wake_seq, 1, __ATOMIC_SEQ_CST);
+    (void) syscall(__NR_futex, &m_wake_seq, FUTEX_WAKE_PRIVATE, 1, 0, 0, 0);
+  }
+
+  int popInternal(void ** const pptr, const timespec * const pDeadline, const int clock_flag,
+      bool * const p_is_queue_closed)
+  {
+    int result = 1;
+    bool is_closed = false;
+    do
+    {
+      if(0 == pptr)
+      {
+        result = RC_INVALID_PARAM;
+        break;
+      }
+      *pptr = 0;
+
+      while (true)
+      {
+        if(tryPop(pptr))
+        {
+          result = 0;
+          break;
+        }
+
+        if(0 != __atomic_load_n(&m_closed, __ATOMIC_ACQUIRE))
+        {
+          // drain whatever was pushed before close, then report the closure
+          if(tryPop(pptr))
+          {
+            result = 0;
+          }
+          else
+          {
+            is_closed = true;
+            result = RC_QUEUE_CLOSED;
+          }
+          break;
+        }
+
+        if((0 != pDeadline) && isDeadlinePassed(pDeadline, clock_flag))
+        {
+          result = RC_TIMEOUT;
+          break;
+        }
+
+        const int seq = __atomic_load_n(&m_wake_seq, __ATOMIC_ACQUIRE);
+        __atomic_store_n(&m_consumer_waiting, 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+        if(tryPop(pptr))
+        {
+          __atomic_store_n(&m_consumer_waiting, 0, __ATOMIC_RELAXED);
+          result = 0;
+          break;
+        }
+
+        int rc = 0;
+        if(0 == __atomic_load_n(&m_closed, __ATOMIC_ACQUIRE))
+        {
+          rc = syscall(__NR_futex, &m_wake_seq, FUTEX_WAIT_BITSET_PRIVATE | clock_flag, seq, pDeadline, 0,
+              FUTEX_BITSET_MATCH_ANY);
+        }
+        __atomic_store_n(&m_consumer_waiting, 0, __ATOMIC_RELAXED);
+
+        if((0 != rc) && (EAGAIN != errno) && (EINTR != errno) && (ETIMEDOUT != errno))
+        {
+          log_error(m_tag, "pop: futex wait failed %d", errno);
+          result = RC_WAIT_FAILED;
+          break;
+        }
+        // loop back: either woken up, interrupted, or timed out. timeout is checked against the clock
+      }
+    } while (false);
+
+    if(0 != p_is_queue_closed)
+    {
+      *p_is_queue_closed = is_closed;
+    }
+
+    if((0 != result) && (RC_TIMEOUT != result) && (RC_QUEUE_CLOSED != result))
+    {
+      log_error(m_tag, "pop: failed %d", result);
+    }
+    else if(m_verbose)
+    {
+      log_verbose(m_tag, "pop: result %d", result);
+    }
+    return result;
+  }
+
+  static bool isDeadlinePassed(const timespec * const pDeadline, const int clock_flag)
+  {
+    timespec now;
+    if(0 != clock_gettime((0 != clock_flag) ? CLOCK_REALTIME : CLOCK_MONOTONIC, &now))
+    {
+      // cannot tell, treat as expired instead of spinning
+      return true;
+    }
+    return (now.tv_sec > pDeadline->tv_sec)
+        || ((now.tv_sec == pDeadline->tv_sec) && (now.tv_nsec >= pDeadline->tv_nsec));
+  }
+
+  const char * const m_tag;
+  const bool m_verbose;
+
+  // consumer side
+  Node * m_pHead;
+
+  // producer side. kept away from m_pHead to avoid false sharing between producers and the consumer
+  char m_padding[64];
+  Node * m_pTail;
+
+  int m_closed;
+  int m_consumer_waiting;
+  // futex word
+  int m_wake_seq;
+};
+
+inline BlockingQueue * BlockingQueue::createInstance(const char * tag, const QUEUE_TYPE type, const bool verboseLog)
+{
+  if(BQ_LOCK_FREE_MPSC == type)
+  {
+    return MpscBlockingQueue::createInstance(tag, verboseLog);
+  }
+  return createInstance(tag, verboseLog);
+}
+
+} // namespace qc_loc_fw
+
+#endif //#ifndef __XTRAT_WIFI_MPSC_BLOCKING_QUEUE_H__
@@ -0,0 +1,616 @@
+/*====*====*====*====*====*====*====*====*====*====*====*====*====*====*====*
+
+ Postcard encode profiler
+
+ GENERAL DESCRIPTION
+ This header declares an OutPostcard decorator which measures the cost of
+ encoding (time per field, bytes and allocations per message), flags cards
+ whose encode buffer grows more often than geometric growth allows, and can
+ record the finalized cards as a replay corpus for InPostcard fuzzing
+
+ Copyright (c) 2015 Qualcomm Technologies, Inc.
+ All Rights Reserved.
+ Confidential and Proprietary - Qualcomm Technologies, Inc.
+ =============================================================================*/
+#ifndef __XTRAT_WIFI_POSTCARD_PROFILER_H__
+#define __XTRAT_WIFI_POSTCARD_PROFILER_H__
+
+#include <new>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <base_util/log.h>
+#include <base_util/memorystream.h>
+#include <base_util/postcard.h>
+
+namespace qc_loc_fw
+{
+
+// Usage
+//
+//   PostcardProfile * pProfile = PostcardProfile::createInstance("LOWI", "/data/misc/location/corpus");
+//   ...
+//   OutPostcard * pCard = ProfiledOutPostcard::createInstance(pProfile);  // instead of OutPostcard::createInstance
+//   pCard->init();
+//   pCard->addString("TO", "LOWI-CLIENT");
+//   ...
+//   pCard->finalize();                                                      // stats recorded here
+//   ...
+//   pProfile->logStats();
+//
+// one PostcardProfile is normally shared by all cards of a module, and it must outlive them.
+// timing covers the time spent inside add/finalize only, so the caller's own work between
+// fields is not charged to the encoder. it adds two clock_gettime calls to every field, so
+// this is meant for profiling builds or for a sample of the traffic, not for every card.
+//
+// allocations are counted from what is visible through the OutPostcard interface: the
+// OutMemoryStream created by init, plus the initial encode buffer and every time it has
+// moved after an add (the stock stream allocates the new block before freeing the old one,
+// so a grown buffer always has a new address). the card object itself is not counted.
+//
+// the corpus is written as one file per distinct card, named after a hash of its content,
+// so it can be fed to a fuzzer as a seed directory for InPostcard::init/getXxx, and
+// replaying it shows whether decode cost stays linear in the card size.
+
+struct PostcardProfileStats
+{
+  // cards which have been finalized
+  uint64_t m_num_messages;
+  // add calls, a nested card counts as one field of its parent
+  uint64_t m_num_fields;
+  // time spent inside add/finalize
+  uint64_t m_encode_ns;
+  // finalized size, summed and largest
+  uint64_t m_encoded_bytes;
+  uint64_t m_max_message_bytes;
+  // OutMemoryStream objects and encode buffer (re)allocations
+  uint64_t m_num_allocations;
+  // cards whose buffer grew more often than doubling from 64 bytes would need
+  uint64_t m_num_growth_warnings;
+  // corpus files written
+  uint64_t m_num_corpus_entries;
+};
+
+class PostcardProfile
+{
+private:
+  // header only class, so the log tag is a function rather than a static data member
+  static const char * TAG()
+  {
+    return "PostcardProfile";
+  }
+
+  static const size_t MAX_TAG_LENGTH = 32;
+  static const size_t MAX_PATH_LENGTH = 256;
+  static const size_t INITIAL_BUFFER_SIZE = 64;
+
+public:
+  // 'tag' is used in the log and as the prefix of corpus file names.
+  // 'corpus_dir' is optional. if set, up to 'max_corpus_entries' distinct cards are written to it
+  static PostcardProfile * createInstance(const char * const tag, const char * const corpus_dir = 0,
+      const unsigned int max_corpus_entries = 256)
+  {
+    int result = 1;
+    PostcardProfile * pProfile = 0;
+    do
+    {
+      if(0 == tag)
+      {
+        result = 2;
+        break;
+      }
+      if((0 != corpus_dir) && (strlen(corpus_dir) >= MAX_PATH_LENGTH))
+      {
+        result = 3;
+        break;
+      }
+      pProfile = new (std::nothrow) PostcardProfile(tag, corpus_dir, max_corpus_entries);
+      if(0 == pProfile)
+      {
+        result = 4;
+        break;
+      }
+      result = 0;
+    } while (false);
+
+    if(0 != result)
+    {
+      log_error(TAG(), "createInstance: failed %d", result);
+    }
+    return pProfile;
+  }
+
+  ~PostcardProfile()
+  {
+  }
+
+  void getStats(PostcardProfileStats & stats) const
+  {
+    stats.m_num_messages = __atomic_load_n(&m_stats.m_num_messages, __ATOMIC_RELAXED);
+    stats.m_num_fields = __atomic_load_n(&m_stats.m_num_fields, __ATOMIC_RELAXED);
+    stats.m_encode_ns = __atomic_load_n(&m_stats.m_encode_ns, __ATOMIC_RELAXED);
+    stats.m_encoded_bytes = __atomic_load_n(&m_stats.m_encoded_bytes, __ATOMIC_RELAXED);
+    stats.m_max_message_bytes = __atomic_load_n(&m_stats.m_max_message_bytes, __ATOMIC_RELAXED);
+    stats.m_num_allocations = __atomic_load_n(&m_stats.m_num_allocations, __ATOMIC_RELAXED);
+    stats.m_num_growth_warnings = __atomic_load_n(&m_stats.m_num_growth_warnings, __ATOMIC_RELAXED);
+    stats.m_num_corpus_entries = __atomic_load_n(&m_stats.m_num_corpus_entries, __ATOMIC_RELAXED);
+  }
+
+  // logs ns/field, bytes/message and allocations/message
+  void logStats() const
+  {
+    PostcardProfileStats stats;
+    getStats(stats);
+    const uint64_t messages = (0 != stats.m_num_messages) ? stats.m_num_messages : 1;
+    const uint64_t fields = (0 != stats.m_num_fields) ? stats.m_num_fields : 1;
+    log_info(TAG(), "[%s] %llu messages, %llu fields, %llu ns/field, %llu bytes/message (max %llu), "
+        "%llu.%02llu allocations/message, %llu growth warnings, %llu corpus entries", m_tag,
+        (unsigned long long) stats.m_num_messages, (unsigned long long) stats.m_num_fields,
+        (unsigned long long) (stats.m_encode_ns / fields), (unsigned long long) (stats.m_encoded_bytes / messages),
+        (unsigned long long) stats.m_max_message_bytes, (unsigned long long) (stats.m_num_allocations / messages),
+        (unsigned long long) ((stats.m_num_allocations * 100 / messages) % 100),
+        (unsigned long long) stats.m_num_growth_warnings, (unsigned long long) stats.m_num_corpus_entries);
+  }
+
+private:
+  friend class ProfiledOutPostcard;
+
+  PostcardProfile(const char * const tag, const char * const corpus_dir, const unsigned int max_corpus_entries) :
+      m_max_corpus_entries(max_corpus_entries), m_num_corpus_reserved(0)
+  {
+    memset(&m_stats, 0, sizeof(m_stats));
+    snprintf(m_tag, sizeof(m_tag), "%s", tag);
+    m_corpus_dir[0] = 0;
+    if(0 != corpus_dir)
+    {
+      snprintf(m_corpus_dir, sizeof(m_corpus_dir), "%s", corpus_dir);
+    }
+  }
+
+  // private copy constructor and assignment operator so that the
+  // the instance can not be copied.
+  PostcardProfile(const PostcardProfile & rhs);
+  PostcardProfile & operator=(const PostcardProfile & rhs);
+
+  static inline uint64_t now_ns()
+  {
+    struct timespec now;
+    (void) clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+  }
+
+  // number of allocations a buffer doubling from INITIAL_BUFFER_SIZE needs to hold 'size' bytes
+  static unsigned int expectedAllocations(const size_t size)
+  {
+    unsigned int num = 1;
+    for (size_t capacity = INITIAL_BUFFER_SIZE; capacity < size; capacity *= 2)
+    {
+      ++num;
+    }
+    return num;
+  }
+
+  inline void addFields(const uint64_t num_fields, const uint64_t encode_ns)
+  {
+    __atomic_add_fetch(&m_stats.m_num_fields, num_fields, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&m_stats.m_encode_ns, encode_ns, __ATOMIC_RELAXED);
+  }
+
+  // 'buffer_allocations' excludes the OutMemoryStream object
+  void addMessage(const MemoryStreamBase * const pEncoded, const unsigned int buffer_allocations,
+      const uint64_t num_fields)
+  {
+    const size_t size = pEncoded->getSize();
+    __atomic_add_fetch(&m_stats.m_num_messages, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&m_stats.m_encoded_bytes, size, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&m_stats.m_num_allocations, buffer_allocations + 1, __ATOMIC_RELAXED);
+    uint64_t max = __atomic_load_n(&m_stats.m_max_message_bytes, __ATOMIC_RELAXED);
+    while ((size > max)
+        && !__atomic_compare_exchange_n(&m_stats.m_max_message_bytes, &max, size, true, __ATOMIC_RELAXED,
+            __ATOMIC_RELAXED))
+    {
+    }
+
+    // one spare allocation for a stream which starts smaller than INITIAL_BUFFER_SIZE
+    if(buffer_allocations > expectedAllocations(size) + 1)
+    {
+      __atomic_add_fetch(&m_stats.m_num_growth_warnings, 1, __ATOMIC_RELAXED);
+      log_warning(TAG(), "[%s] %u buffer allocations for a %u-byte card with %u fields, expected at most %u",
+          m_tag, buffer_allocations, (unsigned int) size, (unsigned int) num_fields, expectedAllocations(size) + 1);
+    }
+
+    if(0 != m_corpus_dir[0])
+    {
+      writeCorpusEntry(pEncoded);
+    }
+  }
+
+  void writeCorpusEntry(const MemoryStreamBase * const pEncoded)
+  {
+    int result = 1;
+    int fd = -1;
+    do
+    {
+      if(__atomic_load_n(&m_num_corpus_reserved, __ATOMIC_RELAXED) >= m_max_corpus_entries)
+      {
+        result = 0;
+        break;
+      }
+      const uint8_t * const pData = pEncoded->getBuffer();
+      const size_t size = pEncoded->getSize();
+      if((0 == pData) || (0 == size))
+      {
+        result = 2;
+        break;
+      }
+
+      // FNV-1a 64, so identical cards map to the same file
+      uint64_t hash = 14695981039346656037ULL;
+      for (size_t i = 0; i < size; ++i)
+      {
+        hash ^= pData[i];
+        hash *= 1099511628211ULL;
+      }
+      // "<dir>/<tag>-<16 hex digits>.card"
+      char path[MAX_PATH_LENGTH + MAX_TAG_LENGTH + 24];
+      snprintf(path, sizeof(path), "%s/%s-%016llx.card", m_corpus_dir, m_tag, (unsigned long long) hash);
+      fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0640);
+      if(fd < 0)
+      {
+        result = (EEXIST == errno) ? 0 : 3;
+        break;
+      }
+      if(__atomic_add_fetch(&m_num_corpus_reserved, 1, __ATOMIC_RELAXED) > m_max_corpus_entries)
+      {
+        // lost the race for the last entry
+        (void) unlink(path);
+        result = 0;
+        break;
+      }
+      size_t written = 0;
+      while (written < size)
+      {
+        const ssize_t rc = write(fd, pData + written, size - written);
+        if(rc < 0)
+        {
+          if(EINTR == errno)
+          {
+            continue;
+          }
+          break;
+        }
+        written += (size_t) rc;
+      }
+      if(written != size)
+      {
+        (void) unlink(path);
+        result = 4;
+        break;
+      }
+      __atomic_add_fetch(&m_stats.m_num_corpus_entries, 1, __ATOMIC_RELAXED);
+      result = 0;
+    } while (false);
+
+    if(fd >= 0)
+    {
+      (void) close(fd);
+    }
+    if(0 != result)
+    {
+      log_error(TAG(), "[%s] writeCorpusEntry: failed %d, errno %d", m_tag, result, errno);
+    }
+  }
+
+  char m_tag[MAX_TAG_LENGTH];
+  char m_corpus_dir[MAX_PATH_LENGTH];
+  const unsigned int m_max_corpus_entries;
+  unsigned int m_num_corpus_reserved;
+  PostcardProfileStats m_stats;
+};
+
+// forwards everything to a stock OutPostcard and reports to a PostcardProfile.
+// the encoded buffer is identical to the one the stock OutPostcard produces
+class ProfiledOutPostcard: public OutPostcard
+{
+private:
+  // header only class, so the log tag is a function rather than a static data member
+  static const char * TAG()
+  {
+    return "ProfiledOutPostcard";
+  }
+
+public:
+  // 'pProfile' is not owned and must outlive this card
+  static ProfiledOutPostcard * createInstance(PostcardProfile * const pProfile)
+  {
+    int result = 1;
+    ProfiledOutPostcard * pCard = 0;
+    OutPostcard * pInner = 0;
+    do
+    {
+      if(0 == pProfile)
+      {
+        result = 2;
+        break;
+      }
+      pInner = OutPostcard::createInstance();
+      if(0 == pInner)
+      {
+        result = 3;
+        break;
+      }
+      pCard = new (std::nothrow) ProfiledOutPostcard(pProfile, pInner);
+      if(0 == pCard)
+      {
+        result = 4;
+        break;
+      }
+      pInner = 0;
+      result = 0;
+    } while (false);
+
+    if(0 != pInner)
+    {
+      delete pInner;
+    }
+    if(0 != result)
+    {
+      log_error(TAG(), "createInstance: failed %d", result);
+    }
+    return pCard;
+  }
+
+  virtual ~ProfiledOutPostcard()
+  {
+    delete m_pInner;
+    m_pInner = 0;
+  }
+
+  virtual int init()
+  {
+    m_num_fields = 0;
+    m_encode_ns = 0;
+    m_num_buffer_allocations = 0;
+    m_pLastBuffer = 0;
+    const uint64_t start = PostcardProfile::now_ns();
+    const int result = m_pInner->init();
+    m_encode_ns += PostcardProfile::now_ns() - start;
+    if(0 == result)
+    {
+      trackBuffer();
+    }
+    return result;
+  }
+
+  virtual int finalize()
+  {
+    const uint64_t start = PostcardProfile::now_ns();
+    const int result = m_pInner->finalize();
+    m_encode_ns += PostcardProfile::now_ns() - start;
+    if(0 == result)
+    {
+      trackBuffer();
+      m_pProfile->addFields(m_num_fields, m_encode_ns);
+      const MemoryStreamBase * const pEncoded = m_pInner->getEncodedBuffer();
+      if(0 != pEncoded)
+      {
+        m_pProfile->addMessage(pEncoded, m_num_buffer_allocations, m_num_fields);
+      }
+    }
+    return result;
+  }
+
+  virtual const MemoryStreamBase * getEncodedBuffer() const
+  {
+    return m_pInner->getEncodedBuffer();
+  }
+
+  virtual OutMemoryStream * getInternalBuffer()
+  {
+    return m_pInner->getInternalBuffer();
+  }
+
+  virtual int addDouble(const char * const name, const DOUBLE & value)
+  {
+    const uint64_t start = PostcardProfile::now_ns();
+    return addDone(start, m_pInner->addDouble(name, value));
+  }
+  virtual int addFloat(const char * const name, const FLOAT & value)
+  {
+    const uint64_t start = PostcardProfile::now_ns();
+    return addDone(start, m_pInner->addFloat(name, value));
+  }
+  virtual int addInt64(const char * const name, const INT64 & value)
+  {
+    const uint64_t start = PostcardProfile::now_ns();
+    return addDone(start, m_pInner->addInt64(name, value));
+  }
+  virtual int addUInt64(const char * const name, const UINT64 & value)
+  {
+    const uint64_t start = PostcardProfile::now_ns();
+    return addDone(start, m_pInner->addUInt64(name, value));
+  }
+  virtual int addInt32(const char * const name, const INT32 & value)
+  {
+    const uint64_t start = PostcardProfile::now_ns();
+    return addDone(start, m_pInner->addInt32(name, value));
+  }
+  virtual int addUInt32(const char * const name, const UINT32 & value)
+  {
+    const uint64_t start = PostcardProfile::now_ns();
+    return addDone(start, m_pInner->addUInt32(name, value));
+  }
+  virtual int addInt16(const char * const name, const INT16 & value)
+  {
+    const uint64_t start = PostcardProfile::now_ns();
+    return addDone(start, m_pInner->addInt16(name, value));
+  }
+  virtual int addUInt16(const char * const name, const UINT16 & value)
+  {
+    const uint64_t start = PostcardProfile::now_ns();
+    return addDone(start, m_pInner->addUInt16(name, value));
+  }
+  virtual int addInt8(const char * const name, const INT8 & value)
+  {
+    const uint64_t start = PostcardProfile::now_ns();
+    return addDone(start, m_pInner->addInt8(name, value));
+  }
+  virtual int addUInt8(const char * const name, const UINT8 & value)
+  {
+    const uint64_t start = PostcardProfile::now_ns();
+    return addDone(start, m_pInner->addUInt8(name, value));
+  }
+  virtual int addBool(const char * const name, const BOOL & value)
+  {
+    const uint64_t start = PostcardProfile::now_ns();
+    return addDone(start, m_pInner->addBool(name, value));
+  }
+  virtual int addString(const char * const name, const char * const str)
+  {
+    const uint64_t start = PostcardProfile::now_ns();
+    return addDone(start, m_pInner->addString(name, str));
+  }
+  virtual int addPtr(const char * const name, const PTR & value)
+  {
+    const uint64_t start = PostcardProfile::now_ns();
+    return addDone(start, m_pInner->addPtr(name, value));
+  }
+  virtual int addBlob(const char * const name, const void * const blob, const size_t length)
+  {
+    const uint64_t start = PostcardProfile::now_ns();
+    return addDone(start, m_pInner->addBlob(name, blob, length));
+  }
+
+  // 'pCard' may be a ProfiledOutPostcard or a stock OutPostcard. the stock addCard reads
+  // the state and the stream of the child card directly, so a ProfiledOutPostcard is
+  // unwrapped to its inner card first. a nested ProfiledOutPostcard reports its own fields
+  // and message when it is finalized, so deeply nested cards show up as extra messages
+  // whose bytes are copied once more into each parent
+  virtual int addCard(const char * const name, const OutPostcard * const pCard)
+  {
+    const OutPostcard * pChild = pCard;
+    if((0 != pChild) && isProfiled(pChild))
+    {
+      pChild = static_cast<const ProfiledOutPostcard *>(pChild)->m_pInner;
+    }
+    const uint64_t start = PostcardProfile::now_ns();
+    return addDone(start, m_pInner->addCard(name, pChild));
+  }
+
+  virtual int addArrayDouble(const char * const name, const int num_element, const DOUBLE array[])
+  {
+    const uint64_t start = PostcardProfile::now_ns();
+    return addDone(start, m_pInner->addArrayDouble(name, num_element, array));
+  }
+  virtual int addArrayFloat(const char * const name, const int num_element, const FLOAT array[])
+  {
+    const uint64_t start = PostcardProfile::now_ns();
+    return addDone(start, m_pInner->addArrayFloat(name, num_element, array));
+  }
+  virtual int addArrayInt64(const char * const name, const int num_element, const INT64 array[])
+  {
+    const uint64_t start = PostcardProfile::now_ns();
+    return addDone(start, m_pInner->addArrayInt64(name, num_element, array));
+  }
+  virtual int addArrayUInt64(const char * const name, const int num_element, const UINT64 array[])
+  {
+    const uint64_t start = PostcardProfile::now_ns();
+    return addDone(start, m_pInner->addArrayUInt64(name, num_element, array));
+  }
+  virtual int addArrayInt32(const char * const name, const int num_element, const INT32 array[])
+  {
+    const uint64_t start = PostcardProfile::now_ns();
+    return addDone(start, m_pInner->addArrayInt32(name, num_element, array));
+  }
+  virtual int addArrayUInt32(const char * const name, const int num_element, const UINT32 array[])
+  {
+    const uint64_t start = PostcardProfile::now_ns();
+    return addDone(start, m_pInner->addArrayUInt32(name, num_element, array));
+  }
+  virtual int addArrayInt16(const char * const name, const int num_element, const INT16 array[])
+  {
+    const uint64_t start = PostcardProfile::now_ns();
+    return addDone(start, m_pInner->addArrayInt16(name, num_element, array));
+  }
+  virtual int addArrayUInt16(const char * const name, const int num_element, const UINT16 array[])
+  {
+    const uint64_t start = PostcardProfile::now_ns();
+    return addDone(start, m_pInner->addArrayUInt16(name, num_element, array));
+  }
+  virtual int addArrayInt8(const char * const name, const int num_element, const INT8 array[])
+  {
+    const uint64_t start = PostcardProfile::now_ns();
+    return addDone(start, m_pInner->addArrayInt8(name, num_element, array));
+  }
+  virtual int addArrayUInt8(const char * const name, const int num_element, const UINT8 array[])
+  {
+    const uint64_t start = PostcardProfile::now_ns();
+    return addDone(start, m_pInner->addArrayUInt8(name, num_element, array));
+  }
+  virtual int addArrayBool(const char * const name, const int num_element, const BOOL array[])
+  {
+    const uint64_t start = PostcardProfile::now_ns();
+    return addDone(start, m_pInner->addArrayBool(name, num_element, array));
+  }
+  virtual int addArrayPtr(const char * const name, const int num_element, const PTR array[])
+  {
+    const uint64_t start = PostcardProfile::now_ns();
+    return addDone(start, m_pInner->addArrayPtr(name, num_element, array));
+  }
+
+private:
+  ProfiledOutPostcard(PostcardProfile * const pProfile, OutPostcard * const pInner) :
+      m_pProfile(pProfile), m_pInner(pInner), m_num_fields(0), m_encode_ns(0), m_num_buffer_allocations(0),
+      m_pLastBuffer(0)
+  {
+  }
+
+  // private copy constructor and assignment operator so that the
+  // the instance can not be copied.
+  ProfiledOutPostcard(const ProfiledOutPostcard & rhs);
+  ProfiledOutPostcard & operator=(const ProfiledOutPostcard & rhs);
+
+  // RTTI may be off, so a ProfiledOutPostcard is told apart from other cards by its vtable
+  // pointer, which is the first word of every object of a polymorphic class
+  inline bool isProfiled(const OutPostcard * const pCard) const
+  {
+    const OutPostcard * const pSelf = this;
+    return (*reinterpret_cast<const void * const *>(pCard) == *reinterpret_cast<const void * const *>(pSelf));
+  }
+
+  inline int addDone(const uint64_t start, const int result)
+  {
+    m_encode_ns += PostcardProfile::now_ns() - start;
+    ++m_num_fields;
+    trackBuffer();
+    return result;
+  }
+
+  // counts the encode buffer moving to a new block
+  inline void trackBuffer()
+  {
+    const OutMemoryStream * const pStream = m_pInner->getInternalBuffer();
+    const MemoryStreamBase::BYTE * const pBuffer = (0 != pStream) ? pStream->getBuffer() : 0;
+    if((0 != pBuffer) && (pBuffer != m_pLastBuffer))
+    {
+      ++m_num_buffer_allocations;
+      m_pLastBuffer = pBuffer;
+    }
+  }
+
+  PostcardProfile * const m_pProfile;
+  OutPostcard * m_pInner;
+  uint64_t m_num_fields;
+  uint64_t m_encode_ns;
+  unsigned int m_num_buffer_allocations;
+  const MemoryStreamBase::BYTE * m_pLastBuffer;
+};
+
+} // namespace qc_loc_fw
+
+#endif //#ifndef __XTRAT_WIFI_POSTCARD_PROFILER_H__
@@ -0,0 +1,673 @@
+/*====*====*====*====*====*====*====*====*====*====*====*====*====*====*====*
+
+ Postcard schema
+
+ GENERAL DESCRIPTION
+ This header declares an optional, compiled-schema encoding for postcards.
+ Field names are registered once into a compact ID table and fields are
+ encoded and looked up by small integer IDs instead of by name
+
+ Copyright (c) 2015 Qualcomm Technologies, Inc.
+ All Rights Reserved.
+ Confidential and Proprietary - Qualcomm Technologies, Inc.
+ =============================================================================*/
+#ifndef __XTRAT_WIFI_POSTCARD_SCHEMA_H__
+#define __XTRAT_WIFI_POSTCARD_SCHEMA_H__
+
+#include <new>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <base_util/buffer_pool.h>
+#include <base_util/log.h>
+#include <base_util/memorystream.h>
+#include <base_util/postcard.h>
+
+namespace qc_loc_fw
+{
+
+// Wire format
+//
+// schema-encoded fields travel as a single blob named SchemaPostcardBase::blobName() in an
+// ordinary OutPostcard, so routing fields (e.g. TO/FROM) stay name-keyed and the
+// IPC hub doesn't need to know about schemas. the blob layout is:
+//
+//   header : magic (2 bytes) | format version (1) | reserved (1) | schema hash (4)
+//   field  : id (1) | type (1) | payload length (2) | payload
+//
+// the schema hash is computed over the registered names in registration order,
+// so a reader with a different schema refuses the blob instead of misreading it.
+// all multi-byte values are in host byte order, same as the rest of the postcard.
+//
+// cards which do not carry the blob (every card produced by name-keyed code) are
+// still readable through SchemaInPostcard: it then falls back to looking the
+// field up by its registered name
+
+class PostcardSchema
+{
+private:
+  // header only class, so the log tag is a function rather than a static data member
+  static const char * TAG()
+  {
+    return "PostcardSchema";
+  }
+public:
+  // ids are encoded in one byte
+  static const unsigned int MAX_FIELDS = 256;
+
+  PostcardSchema() :
+      m_num_fields(0), m_hash(FNV_OFFSET_BASIS)
+  {
+  }
+
+  // register a field name. names are only shallow copied (only the pointer is copied),
+  // so use constant strings, the same way Mutex::createInstance does for its tag
+  int registerField(const char * const name, uint8_t & id)
+  {
+    int result = 1;
+    do
+    {
+      if((0 == name) || (0 == name[0]) || (strlen(name) >= OutPostcard::MAX_ENCODE_NAME_LENGTH))
+      {
+        result = 2;
+        break;
+      }
+      if(m_num_fields >= MAX_FIELDS)
+      {
+        result = 3;
+        break;
+      }
+      uint8_t existing_id = 0;
+      if(0 == findId(name, existing_id))
+      {
+        // registering the same name twice would make the id ambiguous
+        result = 4;
+        break;
+      }
+
+      id = (uint8_t) m_num_fields;
+      m_names[m_num_fields] = name;
+      ++m_num_fields;
+
+      for (const char * p = name; 0 != *p; ++p)
+      {
+        m_hash = (m_hash ^ (uint8_t) *p) * FNV_PRIME;
+      }
+      // separator, so that {"ab", "c"} and {"a", "bc"} hash differently
+      m_hash = (m_hash ^ 0xFF) * FNV_PRIME;
+      result = 0;
+    } while (false);
+
+    if(0 != result)
+    {
+      log_error(TAG(), "registerField: failed %d", result);
+    }
+    return result;
+  }
+
+  // linear search. meant for setup time, not for the per-message path
+  int findId(const char * const name, uint8_t & id) const
+  {
+    if(0 == name)
+    {
+      return 2;
+    }
+    for (unsigned int i = 0; i < m_num_fields; ++i)
+    {
+      if(0 == strcmp(m_names[i], name))
+      {
+        id = (uint8_t) i;
+        return 0;
+      }
+    }
+    return 1;
+  }
+
+  inline const char * getName(const uint8_t id) const
+  {
+    return (id < m_num_fields) ? m_names[id] : 0;
+  }
+
+  inline unsigned int getNumOfFields() const
+  {
+    return m_num_fields;
+  }
+
+  inline uint32_t getHash() const
+  {
+    return m_hash;
+  }
+
+private:
+  static const uint32_t FNV_OFFSET_BASIS = 2166136261U;
+  static const uint32_t FNV_PRIME = 16777619U;
+
+  // private copy constructor and assignment operator so that the
+  // the instance can not be copied.
+  PostcardSchema(const PostcardSchema & rhs);
+  PostcardSchema & operator=(const PostcardSchema & rhs);
+
+  const char * m_names[MAX_FIELDS];
+  unsigned int m_num_fields;
+  uint32_t m_hash;
+};
+
+class SchemaPostcardBase: public PostcardBase
+{
+public:
+  virtual ~SchemaPostcardBase()
+  {
+  }
+
+  // name of the blob field carrying the schema-encoded payload
+  static const char * blobName()
+  {
+    return "SCHEMA_CARD";
+  }
+
+protected:
+  enum FIELD_TYPE
+  {
+    FT_DOUBLE = 1, FT_FLOAT, FT_INT64, FT_UINT64, FT_INT32, FT_UINT32, FT_INT16, FT_UINT16,
+    FT_INT8, FT_UINT8, FT_BOOL, FT_STRING, FT_BLOB
+  };
+
+  static const uint8_t MAGIC_0 = 'S';
+  static const uint8_t MAGIC_1 = 'C';
+  static const uint8_t FORMAT_VERSION = 1;
+  static const size_t HEADER_LENGTH = 8;
+  static const size_t FIELD_HEADER_LENGTH = 4;
+  static const size_t MAX_PAYLOAD_LENGTH = 0xFFFF;
+};
+
+class SchemaOutPostcard: public SchemaPostcardBase
+{
+private:
+  // header only class, so the log tag is a function rather than a static data member
+  static const char * TAG()
+  {
+    return "SchemaOutPostcard";
+  }
+public:
+  explicit SchemaOutPostcard(const PostcardSchema & schema) :
+      m_schema(schema), m_pStream(0)
+  {
+  }
+
+  virtual ~SchemaOutPostcard()
+  {
+    if(0 != m_pStream)
+    {
+      delete m_pStream;
+      m_pStream = 0;
+    }
+  }
+
+  // can be called again to re-use this object for another message.
+  // the encoded bytes live in a pooled buffer, which goes back to BufferPool when this
+  // card is deleted or re-initialized. 'size_hint' is the expected encoded size, if known
+  int init(const size_t size_hint = 0)
+  {
+    int result = 1;
+    do
+    {
+      if(0 != m_pStream)
+      {
+        delete m_pStream;
+        m_pStream = 0;
+      }
+      m_pStream = PooledOutMemoryStream::createInstance((size_hint > HEADER_LENGTH) ? size_hint : HEADER_LENGTH);
+      if(0 == m_pStream)
+      {
+        result = 2;
+        break;
+      }
+
+      const uint32_t hash = m_schema.getHash();
+      uint8_t header[HEADER_LENGTH];
+      header[0] = MAGIC_0;
+      header[1] = MAGIC_1;
+      header[2] = FORMAT_VERSION;
+      header[3] = 0;
+      memcpy(header + 4, &hash, sizeof(hash));
+      if(0 != m_pStream->append(header, sizeof(header)))
+      {
+        result = 3;
+        break;
+      }
+      result = 0;
+    } while (false);
+
+    if(0 != result)
+    {
+      log_error(TAG(), "init: failed %d", result);
+    }
+    return result;
+  }
+
+  inline int addDouble(const uint8_t id, const DOUBLE & value)
+  {
+    return addField(id, FT_DOUBLE, &value, sizeof(value));
+  }
+  inline int addFloat(const uint8_t id, const FLOAT & value)
+  {
+    return addField(id, FT_FLOAT, &value, sizeof(value));
+  }
+  inline int addInt64(const uint8_t id, const INT64 & value)
+  {
+    return addField(id, FT_INT64, &value, sizeof(value));
+  }
+  inline int addUInt64(const uint8_t id, const UINT64 & value)
+  {
+    return addField(id, FT_UINT64, &value, sizeof(value));
+  }
+  inline int addInt32(const uint8_t id, const INT32 & value)
+  {
+    return addField(id, FT_INT32, &value, sizeof(value));
+  }
+  inline int addUInt32(const uint8_t id, const UINT32 & value)
+  {
+    return addField(id, FT_UINT32, &value, sizeof(value));
+  }
+  inline int addInt16(const uint8_t id, const INT16 & value)
+  {
+    return addField(id, FT_INT16, &value, sizeof(value));
+  }
+  inline int addUInt16(const uint8_t id, const UINT16 & value)
+  {
+    return addField(id, FT_UINT16, &value, sizeof(value));
+  }
+  inline int addInt8(const uint8_t id, const INT8 & value)
+  {
+    return addField(id, FT_INT8, &value, sizeof(value));
+  }
+  inline int addUInt8(const uint8_t id, const UINT8 & value)
+  {
+    return addField(id, FT_UINT8, &value, sizeof(value));
+  }
+  inline int addBool(const uint8_t id, const BOOL & value)
+  {
+    const uint8_t encoded = value ? 1 : 0;
+    return addField(id, FT_BOOL, &encoded, sizeof(encoded));
+  }
+  // the terminating null character is encoded as well, so the reader can return a pointer into the buffer
+  inline int addString(const uint8_t id, const char * const str)
+  {
+    if(0 == str)
+    {
+      log_error(TAG(), "addString: null string for id %d", id);
+      return 2;
+    }
+    return addField(id, FT_STRING, str, strlen(str) + 1);
+  }
+  inline int addBlob(const uint8_t id, const void * const blob, const size_t length)
+  {
+    return addField(id, FT_BLOB, blob, length);
+  }
+
+  // append the encoded fields to 'dest' as one blob. 'dest' still has to be finalized by the caller
+  int attachTo(OutPostcard * const dest) const
+  {
+    int result = 1;
+    do
+    {
+      if((0 == dest) || (0 == m_pStream))
+      {
+        result = 2;
+        break;
+      }
+      if(0 != dest->addBlob(blobName(), m_pStream->getBuffer(), m_pStream->getSize()))
+      {
+        result = 3;
+        break;
+      }
+      result = 0;
+    } while (false);
+
+    if(0 != result)
+    {
+      log_error(TAG(), "attachTo: failed %d", result);
+    }
+    return result;
+  }
+
+  inline const MemoryStreamBase * getEncodedBuffer() const
+  {
+    return m_pStream;
+  }
+
+private:
+  // private copy constructor and assignment operator so that the
+  // the instance can not be copied.
+  SchemaOutPostcard(const SchemaOutPostcard & rhs);
+  SchemaOutPostcard & operator=(const SchemaOutPostcard & rhs);
+
+  int addField(const uint8_t id, const FIELD_TYPE type, const void * const pValue, const size_t length)
+  {
+    int result = 1;
+    do
+    {
+      if(0 == m_pStream)
+      {
+        // init was not called, or failed
+        result = 2;
+        break;
+      }
+      if(id >= m_schema.getNumOfFields())
+      {
+        result = 3;
+        break;
+      }
+      if(((0 == pValue) && (0 != length)) || (length > MAX_PAYLOAD_LENGTH))
+      {
+        result = 4;
+        break;
+      }
+
+      const uint16_t encoded_length = (uint16_t) length;
+      uint8_t field_header[FIELD_HEADER_LENGTH];
+      field_header[0] = id;
+      field_header[1] = (uint8_t) type;
+      memcpy(field_header + 2, &encoded_length, sizeof(encoded_length));
+      if(0 != m_pStream->append(field_header, sizeof(field_header)))
+      {
+        result = 5;
+        break;
+      }
+      if((0 != length) && (0 != m_pStream->append(pValue, length)))
+      {
+        result = 6;
+        break;
+      }
+      result = 0;
+    } while (false);
+
+    if(0 != result)
+    {
+      log_error(TAG(), "addField: failed %d for id %d", result, id);
+    }
+    return result;
+  }
+
+  const PostcardSchema & m_schema;
+  PooledOutMemoryStream * m_pStream;
+};
+
+// reader for cards written either by SchemaOutPostcard, or by name-keyed code.
+// the InPostcard is not owned and must outlive this object
+class SchemaInPostcard: public SchemaPostcardBase
+{
+private:
+  // header only class, so the log tag is a function rather than a static data member
+  static const char * TAG()
+  {
+    return "SchemaInPostcard";
+  }
+public:
+  static const int FIELD_NOT_FOUND = InPostcard::FIELD_NOT_FOUND;
+
+  explicit SchemaInPostcard(const PostcardSchema & schema) :
+      m_schema(schema), m_pCard(0), m_pBuffer(0), m_length(0)
+  {
+    resetIndex();
+  }
+
+  virtual ~SchemaInPostcard()
+  {
+  }
+
+  // one pass over the schema blob to build the id -> offset index.
+  // if the card carries no schema blob, every getter falls back to name lookup
+  int init(InPostcard * const pCard)
+  {
+    int result = 1;
+    do
+    {
+      m_pCard = pCard;
+      m_pBuffer = 0;
+      m_length = 0;
+      resetIndex();
+
+      if(0 == pCard)
+      {
+        result = 2;
+        break;
+      }
+
+      const void * pBlob = 0;
+      size_t length = 0;
+      if((0 != pCard->getBlob(blobName(), &pBlob, &length)) || (0 == pBlob))
+      {
+        // legacy, name-keyed card
+        result = 0;
+        break;
+      }
+
+      const uint8_t * const pBytes = reinterpret_cast<const uint8_t *>(pBlob);
+      uint32_t hash = 0;
+      if(length < HEADER_LENGTH)
+      {
+        result = 3;
+        break;
+      }
+      memcpy(&hash, pBytes + 4, sizeof(hash));
+      if((MAGIC_0 != pBytes[0]) || (MAGIC_1 != pBytes[1]) || (FORMAT_VERSION != pBytes[2])
+          || (hash != m_schema.getHash()))
+      {
+        result = 4;
+        break;
+      }
+
+      size_t cursor = HEADER_LENGTH;
+      while (cursor < length)
+      {
+        if((length - cursor) < FIELD_HEADER_LENGTH)
+        {
+          result = 5;
+          break;
+        }
+        uint16_t payload_length = 0;
+        memcpy(&payload_length, pBytes + cursor + 2, sizeof(payload_length));
+        if((length - cursor - FIELD_HEADER_LENGTH) < payload_length)
+        {
+          result = 6;
+          break;
+        }
+        // last one wins, same as adding a field twice
+        m_offsets[pBytes[cursor]] = (uint32_t) (cursor + 1);
+        cursor += FIELD_HEADER_LENGTH + payload_length;
+      }
+      if(cursor != length)
+      {
+        // result already set by the loop above
+        break;
+      }
+
+      m_pBuffer = pBytes;
+      m_length = length;
+      result = 0;
+    } while (false);
+
+    if(0 != result)
+    {
+      resetIndex();
+      log_error(TAG(), "init: failed %d", result);
+    }
+    return result;
+  }
+
+  // true if fields are read through the id index, false if they fall back to names
+  inline bool isSchemaEncoded() const
+  {
+    return (0 != m_pBuffer);
+  }
+
+  int getDouble(const uint8_t id, DOUBLE & value)
+  {
+    return isSchemaEncoded() ? getScalar(id, FT_DOUBLE, &value, sizeof(value)) : legacy(id, &InPostcard::getDouble, value);
+  }
+  int getFloat(const uint8_t id, FLOAT & value)
+  {
+    return isSchemaEncoded() ? getScalar(id, FT_FLOAT, &value, sizeof(value)) : legacy(id, &InPostcard::getFloat, value);
+  }
+  int getInt64(const uint8_t id, INT64 & value)
+  {
+    return isSchemaEncoded() ? getScalar(id, FT_INT64, &value, sizeof(value)) : legacy(id, &InPostcard::getInt64, value);
+  }
+  int getUInt64(const uint8_t id, UINT64 & value)
+  {
+    return isSchemaEncoded() ? getScalar(id, FT_UINT64, &value, sizeof(value)) : legacy(id, &InPostcard::getUInt64, value);
+  }
+  int getInt32(const uint8_t id, INT32 & value)
+  {
+    return isSchemaEncoded() ? getScalar(id, FT_INT32, &value, sizeof(value)) : legacy(id, &InPostcard::getInt32, value);
+  }
+  int getUInt32(const uint8_t id, UINT32 & value)
+  {
+    return isSchemaEncoded() ? getScalar(id, FT_UINT32, &value, sizeof(value)) : legacy(id, &InPostcard::getUInt32, value);
+  }
+  int getInt16(const uint8_t id, INT16 & value)
+  {
+    return isSchemaEncoded() ? getScalar(id, FT_INT16, &value, sizeof(value)) : legacy(id, &InPostcard::getInt16, value);
+  }
+  int getUInt16(const uint8_t id, UINT16 & value)
+  {
+    return isSchemaEncoded() ? getScalar(id, FT_UINT16, &value, sizeof(value)) : legacy(id, &InPostcard::getUInt16, value);
+  }
+  int getInt8(const uint8_t id, INT8 & value)
+  {
+    return isSchemaEncoded() ? getScalar(id, FT_INT8, &value, sizeof(value)) : legacy(id, &InPostcard::getInt8, value);
+  }
+  int getUInt8(const uint8_t id, UINT8 & value)
+  {
+    return isSchemaEncoded() ? getScalar(id, FT_UINT8, &value, sizeof(value)) : legacy(id, &InPostcard::getUInt8, value);
+  }
+  int getBool(const uint8_t id, BOOL & value)
+  {
+    if(!isSchemaEncoded())
+    {
+      return legacy(id, &InPostcard::getBool, value);
+    }
+    uint8_t encoded = 0;
+    const int result = getScalar(id, FT_BOOL, &encoded, sizeof(encoded));
+    if(0 == result)
+    {
+      value = (0 != encoded);
+    }
+    return result;
+  }
+
+  // the returned string points into the card buffer, and is valid as long as the InPostcard is
+  int getString(const uint8_t id, const char ** pStr)
+  {
+    if(0 == pStr)
+    {
+      return 2;
+    }
+    if(!isSchemaEncoded())
+    {
+      const char * const name = m_schema.getName(id);
+      return ((0 != m_pCard) && (0 != name)) ? m_pCard->getString(name, pStr) : FIELD_NOT_FOUND;
+    }
+    const void * pPayload = 0;
+    size_t length = 0;
+    int result = find(id, FT_STRING, &pPayload, &length);
+    if((0 == result) && ((0 == length) || (0 != reinterpret_cast<const char *>(pPayload)[length - 1])))
+    {
+      // not null terminated
+      result = 3;
+    }
+    if(0 == result)
+    {
+      *pStr = reinterpret_cast<const char *>(pPayload);
+    }
+    return result;
+  }
+
+  // the returned blob points into the card buffer, and is valid as long as the InPostcard is
+  int getBlob(const uint8_t id, const void ** const pBlob, size_t * const pLength)
+  {
+    if((0 == pBlob) || (0 == pLength))
+    {
+      return 2;
+    }
+    if(!isSchemaEncoded())
+    {
+      const char * const name = m_schema.getName(id);
+      return ((0 != m_pCard) && (0 != name)) ? m_pCard->getBlob(name, pBlob, pLength) : FIELD_NOT_FOUND;
+    }
+    return find(id, FT_BLOB, pBlob, pLength);
+  }
+
+private:
+  // private copy constructor and assignment operator so that the
+  // the instance can not be copied.
+  SchemaInPostcard(const SchemaInPostcard & rhs);
+  SchemaInPostcard & operator=(const SchemaInPostcard & rhs);
+
+  void resetIndex()
+  {
+    memset(m_offsets, 0, sizeof(m_offsets));
+  }
+
+  // O(1): one array lookup, no string compare
+  int find(const uint8_t id, const FIELD_TYPE type, const void ** const ppPayload, size_t * const pLength) const
+  {
+    const uint32_t offset_plus_1 = m_offsets[id];
+    if(0 == offset_plus_1)
+    {
+      return FIELD_NOT_FOUND;
+    }
+    const uint8_t * const pField = m_pBuffer + offset_plus_1 - 1;
+    if(type != pField[1])
+    {
+      log_error(TAG(), "find: type mismatch for id %d: %d/%d", id, type, pField[1]);
+      return 4;
+    }
+    uint16_t length = 0;
+    memcpy(&length, pField + 2, sizeof(length));
+    *ppPayload = pField + FIELD_HEADER_LENGTH;
+    *pLength = length;
+    return 0;
+  }
+
+  int getScalar(const uint8_t id, const FIELD_TYPE type, void * const pValue, const size_t size) const
+  {
+    const void * pPayload = 0;
+    size_t length = 0;
+    int result = find(id, type, &pPayload, &length);
+    if((0 == result) && (length != size))
+    {
+      result = 5;
+    }
+    if(0 == result)
+    {
+      // payload is not aligned, copy it out
+      memcpy(pValue, pPayload, size);
+    }
+    return result;
+  }
+
+  template<typename T>
+  int legacy(const uint8_t id, int (InPostcard::*getter)(const char * const, T &), T & value)
+  {
+    const char * const name = m_schema.getName(id);
+    if((0 == m_pCard) || (0 == name))
+    {
+      return FIELD_NOT_FOUND;
+    }
+    return (m_pCard->*getter)(name, value);
+  }
+
+  const PostcardSchema & m_schema;
+  InPostcard * m_pCard;
+  const uint8_t * m_pBuffer;
+  size_t m_length;
+  // 0 means not present, otherwise offset of the field header + 1
+  uint32_t m_offsets[PostcardSchema::MAX_FIELDS];
+};
+
+} // namespace qc_loc_fw
+
+#endif //#ifndef __XTRAT_WIFI_POSTCARD_SCHEMA_H__
@@ -19,6 +19,10 @@
 namespace qc_loc_fw
 {
 
+// note: top and pop walk the whole list, so draining a queue of n elements is O(n^2).
+// this class is kept as is for existing users of the List interface.
+// new code with deep queues should use RingQueue<T> (base_util/ring_queue.h),
+// which offers the same push/top/pop error codes with O(1) cost
 template<typename T>
 class Queue: public List<T>
 {
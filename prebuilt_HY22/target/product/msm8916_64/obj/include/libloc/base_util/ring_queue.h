@@ -0,0 +1,278 @@
+/*====*====*====*====*====*====*====*====*====*====*====*====*====*====*====*
+
+ Ring queue template
+
+ GENERAL DESCRIPTION
+ This component implements a FIFO queue of any type on top of a contiguous
+ ring buffer, with O(1) push, top and pop
+
+ Copyright (c) 2015 Qualcomm Technologies, Inc.
+ All Rights Reserved.
+ Confidential and Proprietary - Qualcomm Technologies, Inc.
+ =============================================================================*/
+#ifndef __XTRAT_WIFI_RING_QUEUE_H__
+#define __XTRAT_WIFI_RING_QUEUE_H__
+
+#include <new>
+
+// for size_t
+#include <stddef.h>
+
+#include <base_util/log.h>
+
+namespace qc_loc_fw
+{
+
+// Queue<T> (base_util/queue.h) is a singly linked list and has to walk the
+// whole list on every top/pop. RingQueue<T> keeps the same int error code API
+// (0 for success, 2 for null output pointer, 3 for empty queue) but stores
+// the elements in a power-of-two sized array indexed by head/tail cursors.
+//
+// the queue can be bounded: push returns 4 once max_capacity elements are
+// queued. set max_capacity to 0 to let it grow without limit. growth doubles
+// the storage, so the amortized cost of push stays O(1)
+template<typename T>
+class RingQueue
+{
+private:
+  static const char * const TAG;
+  static const size_t DEFAULT_CAPACITY = 64;
+public:
+  explicit RingQueue(const size_t initial_capacity = DEFAULT_CAPACITY, const size_t max_capacity = 0) :
+      m_pStorage(0), m_capacity(0), m_max_capacity(max_capacity), m_head(0), m_size(0),
+      m_initial_capacity(round_up_power_of_2(initial_capacity))
+  {
+  }
+
+  virtual ~RingQueue()
+  {
+    flush();
+  }
+
+  void flush()
+  {
+    if(0 != m_pStorage)
+    {
+      for (size_t i = 0; i < m_size; ++i)
+      {
+        slot((m_head + i) & (m_capacity - 1))->~T();
+      }
+      ::operator delete(m_pStorage);
+      m_pStorage = 0;
+    }
+    m_capacity = 0;
+    m_head = 0;
+    m_size = 0;
+  }
+
+  // pre-allocate storage for at least 'capacity' elements
+  int reserve(const size_t capacity)
+  {
+    int result = 0;
+    if(capacity > m_capacity)
+    {
+      result = grow(round_up_power_of_2(capacity));
+    }
+    if(0 != result)
+    {
+      log_error(TAG, "reserve: failed %d", result);
+    }
+    return result;
+  }
+
+  int push(const T& rhs)
+  {
+    int result = 1;
+    do
+    {
+      if((0 != m_max_capacity) && (m_size >= m_max_capacity))
+      {
+        // bounded queue is full
+        result = 4;
+        break;
+      }
+
+      if(m_size == m_capacity)
+      {
+        size_t new_capacity = (0 == m_capacity) ? m_initial_capacity : (2 * m_capacity);
+        if(0 != grow(new_capacity))
+        {
+          result = 5;
+          break;
+        }
+      }
+
+      new (slot((m_head + m_size) & (m_capacity - 1))) T(rhs);
+      ++m_size;
+      result = 0;
+    } while (false);
+
+    if(0 != result)
+    {
+      log_error(TAG, "push: failed %d", result);
+    }
+    return result;
+  }
+
+  int top(T * const pValue)
+  {
+    int result = 1;
+    do
+    {
+      if(0 == pValue)
+      {
+        result = 2;
+        break;
+      }
+
+      if(0 == m_size)
+      {
+        // we started with an empty queue
+        result = 3;
+        break;
+      }
+
+      *pValue = *slot(m_head);
+      result = 0;
+    } while (false);
+
+    if(0 != result)
+    {
+      log_error(TAG, "top: failed %d", result);
+    }
+    return result;
+  }
+
+  int pop(T * const pValue)
+  {
+    int result = 1;
+    do
+    {
+      if(0 == pValue)
+      {
+        result = 2;
+        break;
+      }
+
+      if(0 == m_size)
+      {
+        // we started with an empty queue
+        result = 3;
+        break;
+      }
+
+      T * const pSlot = slot(m_head);
+      *pValue = *pSlot;
+      pSlot->~T();
+      m_head = (m_head + 1) & (m_capacity - 1);
+      --m_size;
+      result = 0;
+    } while (false);
+
+    if(0 != result)
+    {
+      log_error(TAG, "pop: failed %d", result);
+    }
+    return result;
+  }
+
+  inline size_t getSize() const
+  {
+    return m_size;
+  }
+
+  inline size_t getCapacity() const
+  {
+    return m_capacity;
+  }
+
+  inline size_t getMaxCapacity() const
+  {
+    return m_max_capacity;
+  }
+
+  inline bool isEmpty() const
+  {
+    return (0 == m_size);
+  }
+
+private:
+  // private copy constructor and assignment operator so that the
+  // the instance can not be copied.
+  RingQueue(const RingQueue<T> & rhs);
+  RingQueue<T> & operator=(const RingQueue<T> & rhs);
+
+  inline T * slot(const size_t index) const
+  {
+    return reinterpret_cast<T *>(m_pStorage) + index;
+  }
+
+  static size_t round_up_power_of_2(const size_t value)
+  {
+    size_t capacity = 1;
+    while (capacity < value)
+    {
+      capacity <<= 1;
+    }
+    return capacity;
+  }
+
+  // move the existing elements, in FIFO order, to the beginning of a new block
+  int grow(size_t new_capacity)
+  {
+    int result = 1;
+    do
+    {
+      if((0 != m_max_capacity) && (new_capacity > m_max_capacity))
+      {
+        // never allocate more than we are allowed to hold, rounded up to keep the mask valid
+        new_capacity = round_up_power_of_2(m_max_capacity);
+      }
+
+      if(new_capacity <= m_capacity)
+      {
+        result = 0;
+        break;
+      }
+
+      void * pNewStorage = ::operator new(new_capacity * sizeof(T), std::nothrow);
+      if(0 == pNewStorage)
+      {
+        result = 2;
+        break;
+      }
+
+      T * const pNewArray = reinterpret_cast<T *>(pNewStorage);
+      for (size_t i = 0; i < m_size; ++i)
+      {
+        T * const pOld = slot((m_head + i) & (m_capacity - 1));
+        new (pNewArray + i) T(*pOld);
+        pOld->~T();
+      }
+
+      if(0 != m_pStorage)
+      {
+        ::operator delete(m_pStorage);
+      }
+      m_pStorage = pNewStorage;
+      m_capacity = new_capacity;
+      m_head = 0;
+      result = 0;
+    } while (false);
+    return result;
+  }
+
+  void * m_pStorage;
+  size_t m_capacity;
+  const size_t m_max_capacity;
+  size_t m_head;
+  size_t m_size;
+  const size_t m_initial_capacity;
+};
+
+template<typename T>
+const char * const RingQueue<T>::TAG = "RingQueue";
+
+} // namespace qc_loc_fw
+
+#endif //#ifndef __XTRAT_WIFI_RING_QUEUE_H__
@@ -0,0 +1,326 @@
+/*====*====*====*====*====*====*====*====*====*====*====*====*====*====*====*
+
+ Shared memory stream
+
+ GENERAL DESCRIPTION
+ This header declares a reference counted memory block which can be handed
+ out as any number of read-only InMemoryStream views (or slices) without
+ copying the underlying bytes
+
+ Copyright (c) 2015 Qualcomm Technologies, Inc.
+ All Rights Reserved.
+ Confidential and Proprietary - Qualcomm Technologies, Inc.
+ =============================================================================*/
+#ifndef __XTRAT_WIFI_SHARED_MEMORY_STREAM_H__
+#define __XTRAT_WIFI_SHARED_MEMORY_STREAM_H__
+
+#include <new>
+#include <stddef.h>
+#include <string.h>
+
+#include <base_util/buffer_pool.h>
+#include <base_util/log.h>
+#include <base_util/memorystream.h>
+#include <base_util/postcard.h>
+
+namespace qc_loc_fw
+{
+
+// Usage, delivering one encoded postcard to several local peers and the IPC socket:
+//
+//   card->finalize();
+//   SharedMemoryBlock * block = SharedMemoryBlock::createInstance(card);
+//   delete card;   // the block has taken over the encoded bytes
+//   for each peer:
+//     InPostcard * in_card = InPostcard::createInstance(block->createView());
+//     ... hand in_card to the peer, e.g. through MqMsgWrapper
+//   conn->send(view) with another view, then delete that view
+//   block->release();
+//
+// the memory is freed when the last view is deleted and the creator has released
+// its own reference, in whichever order that happens, from whichever thread
+class SharedMemoryBlock
+{
+private:
+  // header only class, so the log tag is a function rather than a static data member
+  static const char * TAG()
+  {
+    return "SharedMemoryBlock";
+  }
+public:
+  typedef MemoryStreamBase::BYTE BYTE;
+
+  // take over the memory block of 'os' without copying it, through
+  // InMemoryStream::createInstance(OutMemoryStream*). after this call 'os' is no
+  // longer usable, but the caller still has to delete the 'os' object itself.
+  // the returned block starts with one reference, owned by the caller
+  static SharedMemoryBlock * createInstance(OutMemoryStream * const os)
+  {
+    SharedMemoryBlock * pBlock = 0;
+    int result = 1;
+    do
+    {
+      if(0 == os)
+      {
+        result = 2;
+        break;
+      }
+      InMemoryStream * const pOwner = InMemoryStream::createInstance(os);
+      if(0 == pOwner)
+      {
+        result = 3;
+        break;
+      }
+      pBlock = new (std::nothrow) SharedMemoryBlock(pOwner, pOwner->getBuffer(), pOwner->getSize());
+      if(0 == pBlock)
+      {
+        delete pOwner;
+        result = 4;
+        break;
+      }
+      result = 0;
+    } while (false);
+
+    if(0 != result)
+    {
+      log_error(TAG(), "createInstance: failed %d", result);
+    }
+    return pBlock;
+  }
+
+  // same as above, for a stream on top of BufferPool, which can't go through
+  // InMemoryStream. the buffer is moved into a stream owned by the block, and
+  // goes back to the pool when the block is freed. 'os' is left empty
+  static SharedMemoryBlock * createInstance(PooledOutMemoryStream * const os)
+  {
+    SharedMemoryBlock * pBlock = 0;
+    int result = 1;
+    do
+    {
+      if(0 == os)
+      {
+        result = 2;
+        break;
+      }
+      PooledOutMemoryStream * const pOwner = PooledOutMemoryStream::createInstance();
+      if(0 == pOwner)
+      {
+        result = 3;
+        break;
+      }
+      pOwner->takeBuffer(*os);
+      pBlock = new (std::nothrow) SharedMemoryBlock(pOwner, pOwner->getBuffer(), pOwner->getSize());
+      if(0 == pBlock)
+      {
+        // hand the buffer back, so a failure leaves 'os' as it was
+        os->takeBuffer(*pOwner);
+        delete pOwner;
+        result = 4;
+        break;
+      }
+      result = 0;
+    } while (false);
+
+    if(0 != result)
+    {
+      log_error(TAG(), "createInstance: failed %d", result);
+    }
+    return pBlock;
+  }
+
+  // same as above, with the internal buffer of a finalized postcard.
+  // 'card' can only be deleted after this call
+  static SharedMemoryBlock * createInstance(OutPostcard * const card)
+  {
+    if(0 == card)
+    {
+      log_error(TAG(), "createInstance: null card");
+      return 0;
+    }
+    return createInstance(card->getInternalBuffer());
+  }
+
+  inline void addRef()
+  {
+    (void) __atomic_add_fetch(&m_ref_count, 1, __ATOMIC_RELAXED);
+  }
+
+  // drop one reference. the object is deleted when the count reaches zero
+  inline void release()
+  {
+    if(0 == __atomic_sub_fetch(&m_ref_count, 1, __ATOMIC_ACQ_REL))
+    {
+      delete this;
+    }
+  }
+
+  inline const BYTE * getBuffer() const
+  {
+    return m_pBuffer;
+  }
+
+  inline size_t getSize() const
+  {
+    return m_size;
+  }
+
+  // a read-only stream over the whole block, holding one reference until it's deleted
+  inline InMemoryStream * createView()
+  {
+    return createView(0, m_size);
+  }
+
+  // a read-only stream over [offset, offset + length) of the block
+  InMemoryStream * createView(const size_t offset, const size_t length);
+
+private:
+  SharedMemoryBlock(MemoryStreamBase * const pOwner, const BYTE * const pBuffer, const size_t size) :
+      m_ref_count(1), m_pOwner(pOwner), m_pBuffer(pBuffer), m_size(size)
+  {
+  }
+
+  ~SharedMemoryBlock()
+  {
+    // frees the memory block taken over from the OutMemoryStream, or returns it
+    // to its pool
+    delete m_pOwner;
+    m_pOwner = 0;
+  }
+
+  // private copy constructor and assignment operator so that the
+  // the instance can not be copied.
+  SharedMemoryBlock(const SharedMemoryBlock & rhs);
+  SharedMemoryBlock & operator=(const SharedMemoryBlock & rhs);
+
+  int m_ref_count;
+  MemoryStreamBase * m_pOwner;
+  const BYTE * const m_pBuffer;
+  const size_t m_size;
+};
+
+// read-only view into a SharedMemoryBlock. the buffer can't be replaced, so
+// setBufferOwnership/setBufferNoDup fail; everything else behaves as InMemoryStream
+class SharedInMemoryStream: public InMemoryStream
+{
+private:
+  // header only class, so the log tag is a function rather than a static data member
+  static const char * TAG()
+  {
+    return "SharedInMemoryStream";
+  }
+public:
+  SharedInMemoryStream(SharedMemoryBlock * const pBlock, const BYTE * const pBuffer, const size_t size) :
+      m_pBlock(pBlock), m_pBuffer(pBuffer), m_size(size), m_cursor(0)
+  {
+    m_pBlock->addRef();
+  }
+
+  virtual ~SharedInMemoryStream()
+  {
+    m_pBlock->release();
+    m_pBlock = 0;
+  }
+
+  virtual size_t getSize() const
+  {
+    return m_size;
+  }
+
+  virtual const BYTE * getBuffer() const
+  {
+    return m_pBuffer;
+  }
+
+  virtual int setBufferOwnership(const void ** const, const size_t)
+  {
+    log_error(TAG(), "setBufferOwnership: shared views are read-only");
+    return 1;
+  }
+
+  virtual int setBufferNoDup(const void * const, const size_t)
+  {
+    log_error(TAG(), "setBufferNoDup: shared views are read-only");
+    return 1;
+  }
+
+  virtual int extract(void * const pData, const size_t length)
+  {
+    int result = 1;
+    do
+    {
+      if((0 == pData) && (0 != length))
+      {
+        result = 2;
+        break;
+      }
+      if(length > (m_size - m_cursor))
+      {
+        result = 3;
+        break;
+      }
+      if(0 != length)
+      {
+        memcpy(pData, m_pBuffer + m_cursor, length);
+      }
+      m_cursor += length;
+      result = 0;
+    } while (false);
+
+    if(0 != result)
+    {
+      log_error(TAG(), "extract: failed %d", result);
+    }
+    return result;
+  }
+
+  virtual size_t getGetCursor() const
+  {
+    return m_cursor;
+  }
+
+  virtual int setGetCursor(const size_t cursor)
+  {
+    if(cursor > m_size)
+    {
+      log_error(TAG(), "setGetCursor: out of range %d", (int) cursor);
+      return 2;
+    }
+    m_cursor = cursor;
+    return 0;
+  }
+
+  virtual size_t getCapacity() const
+  {
+    return m_size;
+  }
+
+private:
+  // private copy constructor and assignment operator so that the
+  // the instance can not be copied.
+  SharedInMemoryStream(const SharedInMemoryStream & rhs);
+  SharedInMemoryStream & operator=(const SharedInMemoryStream & rhs);
+
+  SharedMemoryBlock * m_pBlock;
+  const BYTE * const m_pBuffer;
+  const size_t m_size;
+  size_t m_cursor;
+};
+
+inline InMemoryStream * SharedMemoryBlock::createView(const size_t offset, const size_t length)
+{
+  if((offset > m_size) || (length > (m_size - offset)))
+  {
+    log_error(TAG(), "createView: slice out of range");
+    return 0;
+  }
+  InMemoryStream * const pView = new (std::nothrow) SharedInMemoryStream(this, m_pBuffer + offset, length);
+  if(0 == pView)
+  {
+    log_error(TAG(), "createView: out of memory");
+  }
+  return pView;
+}
+
+} // namespace qc_loc_fw
+
+#endif //#ifndef __XTRAT_WIFI_SHARED_MEMORY_STREAM_H__
@@ -48,6 +48,18 @@ public:
 
   static BlockingQueue * createInstance(const char * tag, const bool verboseLog = false);
 
+  enum QUEUE_TYPE
+  {
+    // mutex and condition variable protected queue
+    BQ_MUTEX_CONDVAR = 0,
+    // lock-free, multiple producers but only one thread may call pop
+    // see base_util/mpsc_blocking_queue.h
+    BQ_LOCK_FREE_MPSC = 1
+  };
+  // defined in base_util/mpsc_blocking_queue.h, include that header to use this overload.
+  // it is not included from here, to keep the futex and syscall headers out of every user of sync.h
+  static inline BlockingQueue * createInstance(const char * tag, const QUEUE_TYPE type, const bool verboseLog = false);
+
   virtual int push(void * const ptr) = 0;
   virtual int close() = 0;
 
@@ -0,0 +1,962 @@
+/*====*====*====*====*====*====*====*====*====*====*====*====*====*====*====*
+
+ Thread pool executor
+
+ GENERAL DESCRIPTION
+ This component runs Runnable tasks, immediately or after a delay, on a fixed
+ number of worker threads which steal work from each other when idle
+
+ Copyright (c) 2015 Qualcomm Technologies, Inc.
+ All Rights Reserved.
+ Confidential and Proprietary - Qualcomm Technologies, Inc.
+ =============================================================================*/
+#ifndef __XTRAT_WIFI_THREAD_POOL_EXECUTOR_H__
+#define __XTRAT_WIFI_THREAD_POOL_EXECUTOR_H__
+
+#include <new>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include <base_util/log.h>
+#include <base_util/ring_queue.h>
+#include <base_util/sync.h>
+#include <base_util/time_routines.h>
+
+namespace qc_loc_fw
+{
+
+// Thread::createInstance gives every Runnable an OS thread of its own. ThreadPoolExecutor
+// runs any number of them on a few threads instead:
+//
+//   ThreadPoolExecutor * pool = ThreadPoolExecutor::createInstance("LocPool", 2);
+//   pool->execute(new MyTask());                      // deleted after run, as Thread would
+//   pool->schedule(new MyTask(), delay);              // TimeDiff delay
+//   ...
+//   delete pool;                                      // shutdown() and join the workers
+//
+// each worker owns a FIFO queue. tasks submitted from a worker go to its own queue, others
+// are spread round-robin. a worker with nothing to do takes from its peers before it parks
+// on a futex. delayed tasks wait in a heap ordered by deadline, and whichever worker is
+// idle when one falls due runs it.
+//
+// tasks on a ThreadPoolExecutor may run concurrently. use a SerialExecutor on top of it
+// for code which expects the one-thread-at-a-time semantics of a dedicated thread, e.g. a
+// lightweight controller which would otherwise own a thread and a BlockingQueue
+
+struct ExecutorStats
+{
+  // tasks which have finished running
+  uint64_t m_num_executed;
+  // tasks taken from another worker's queue
+  uint64_t m_num_stolen;
+  // time from a task becoming runnable (submission, or deadline for delayed ones) until
+  // a worker starts running it
+  uint64_t m_total_latency_ns;
+  uint64_t m_max_latency_ns;
+  // runnable tasks waiting for a worker, now and at most
+  unsigned int m_queue_depth;
+  unsigned int m_max_queue_depth;
+  // delayed tasks which are not due yet
+  unsigned int m_num_delayed;
+};
+
+class ThreadPoolExecutor
+{
+private:
+  // header only class, so the log tag is a function rather than a static data member
+  static const char * TAG()
+  {
+    return "ThreadPoolExecutor";
+  }
+
+  static const unsigned int MAX_NUM_OF_THREADS = 32;
+  static const uint64_t NO_DEADLINE = ~((uint64_t) 0);
+
+  struct Task
+  {
+    Runnable * m_pRunnable;
+    bool m_delete_after_run;
+    // monotonic clock, ns
+    uint64_t m_ready_ns;
+  };
+
+  class Worker: public Runnable
+  {
+  public:
+    Worker(ThreadPoolExecutor * const pOwner, const unsigned int index) :
+        m_pOwner(pOwner), m_index(index), m_pMutex(0), m_pThread(0)
+    {
+    }
+
+    virtual ~Worker()
+    {
+      delete m_pMutex;
+      m_pMutex = 0;
+    }
+
+    virtual void run()
+    {
+      m_pOwner->workerLoop(this);
+    }
+
+    ThreadPoolExecutor * const m_pOwner;
+    const unsigned int m_index;
+    // protects m_tasks, which the owner and thieves take from
+    Mutex * m_pMutex;
+    RingQueue<Task> m_tasks;
+    Thread * m_pThread;
+
+  private:
+    Worker(const Worker & rhs);
+    Worker & operator=(const Worker & rhs);
+  };
+
+public:
+  // return codes, in addition to 0 for success
+  enum RETURN_CODE
+  {
+    RC_INVALID_PARAM = 2, RC_SHUT_DOWN = 3, RC_NO_MEMORY = 4
+  };
+
+  // starts num_threads workers. tag is only shallow copied, so use a constant string
+  static ThreadPoolExecutor * createInstance(const char * const tag, const unsigned int num_threads,
+      const bool verbose = false)
+  {
+    ThreadPoolExecutor * pExecutor = 0;
+    int result = 1;
+    do
+    {
+      if((0 == num_threads) || (num_threads > MAX_NUM_OF_THREADS))
+      {
+        result = 2;
+        break;
+      }
+      pExecutor = new (std::nothrow) ThreadPoolExecutor(tag, num_threads, verbose);
+      if(0 == pExecutor)
+      {
+        result = 3;
+        break;
+      }
+      if(0 != pExecutor->init())
+      {
+        result = 4;
+        break;
+      }
+      result = 0;
+    } while (false);
+
+    if(0 != result)
+    {
+      log_error(TAG(), "createInstance failed %d", result);
+      delete pExecutor;
+      pExecutor = 0;
+    }
+    return pExecutor;
+  }
+
+  virtual ~ThreadPoolExecutor()
+  {
+    if((0 != m_pShutdownMutex) && (0 != m_pDelayedMutex))
+    {
+      (void) shutdown();
+    }
+    for (unsigned int i = 0; (0 != m_workers) && (i < m_num_threads); ++i)
+    {
+      delete m_workers[i];
+      m_workers[i] = 0;
+    }
+    delete[] m_workers;
+    m_workers = 0;
+    delete[] m_pDelayed;
+    m_pDelayed = 0;
+    delete m_pDelayedMutex;
+    m_pDelayedMutex = 0;
+    delete m_pShutdownMutex;
+    m_pShutdownMutex = 0;
+    if(m_key_created)
+    {
+      (void) pthread_key_delete(m_current_worker);
+    }
+  }
+
+  // multiple access. the task is deleted after it has run if delete_after_run is true.
+  // on failure the caller keeps the ownership
+  int execute(Runnable * const pRunnable, const bool delete_after_run = true)
+  {
+    int result = 1;
+    do
+    {
+      if(0 == pRunnable)
+      {
+        result = RC_INVALID_PARAM;
+        break;
+      }
+      if(0 != __atomic_load_n(&m_stopping, __ATOMIC_ACQUIRE))
+      {
+        result = RC_SHUT_DOWN;
+        break;
+      }
+      Task task;
+      task.m_pRunnable = pRunnable;
+      task.m_delete_after_run = delete_after_run;
+      task.m_ready_ns = now_ns();
+      result = enqueue(task);
+    } while (false);
+
+    if(0 != result)
+    {
+      log_error(m_tag, "execute failed %d", result);
+    }
+    return result;
+  }
+
+  // multiple access. runs the task once 'delay' has passed. same ownership rules as execute
+  int schedule(Runnable * const pRunnable, const TimeDiff & delay, const bool delete_after_run = true)
+  {
+    int result = 1;
+    do
+    {
+      if((0 == pRunnable) || (!delay.is_valid()))
+      {
+        result = RC_INVALID_PARAM;
+        break;
+      }
+      const timespec * const pDelay = delay.getTimeDiffPtr();
+      if((pDelay->tv_sec < 0) || ((0 == pDelay->tv_sec) && (pDelay->tv_nsec <= 0)))
+      {
+        result = execute(pRunnable, delete_after_run);
+        break;
+      }
+      Task task;
+      task.m_pRunnable = pRunnable;
+      task.m_delete_after_run = delete_after_run;
+      task.m_ready_ns = now_ns() + ((uint64_t) pDelay->tv_sec * 1000000000ULL) + (uint64_t) pDelay->tv_nsec;
+
+      AutoLock autolock(m_pDelayedMutex);
+      if(0 != autolock.ZeroIfLocked())
+      {
+        result = 5;
+        break;
+      }
+      if(0 != __atomic_load_n(&m_stopping, __ATOMIC_ACQUIRE))
+      {
+        result = RC_SHUT_DOWN;
+        break;
+      }
+      if(0 != pushDelayed(task))
+      {
+        result = RC_NO_MEMORY;
+        break;
+      }
+      if(task.m_ready_ns < __atomic_load_n(&m_next_deadline_ns, __ATOMIC_ACQUIRE))
+      {
+        // the new deadline is the earliest: a parked worker has to shorten its sleep
+        __atomic_store_n(&m_next_deadline_ns, task.m_ready_ns, __ATOMIC_SEQ_CST);
+        wake(1);
+      }
+      result = 0;
+    } while (false);
+
+    if(0 != result)
+    {
+      log_error(m_tag, "schedule failed %d", result);
+    }
+    return result;
+  }
+
+  // multiple access. stops accepting tasks, lets the workers finish everything which
+  // is runnable, then joins them. delayed tasks which are not due are dropped
+  int shutdown()
+  {
+    AutoLock autolock(m_pShutdownMutex);
+    if(0 != autolock.ZeroIfLocked())
+    {
+      log_error(m_tag, "shutdown failed to lock");
+      return 1;
+    }
+    if(m_joined)
+    {
+      return 0;
+    }
+    {
+      // no schedule() in flight after this
+      AutoLock delayed_lock(m_pDelayedMutex);
+      __atomic_store_n(&m_stopping, 1, __ATOMIC_SEQ_CST);
+    }
+    wake(INT_MAX);
+    for (unsigned int i = 0; i < m_num_threads; ++i)
+    {
+      if((0 != m_workers[i]) && (0 != m_workers[i]->m_pThread))
+      {
+        (void) m_workers[i]->m_pThread->join();
+        delete m_workers[i]->m_pThread;
+        m_workers[i]->m_pThread = 0;
+      }
+    }
+    // anything which slipped in after the workers left still runs, on this thread
+    Task task;
+    for (unsigned int i = 0; i < m_num_threads; ++i)
+    {
+      while ((0 != m_workers[i]) && (0 != m_workers[i]->m_pMutex) && takeFrom(m_workers[i], &task))
+      {
+        runTask(task);
+      }
+    }
+    for (unsigned int i = 0; i < m_num_delayed; ++i)
+    {
+      if(m_pDelayed[i].m_delete_after_run)
+      {
+        delete m_pDelayed[i].m_pRunnable;
+      }
+    }
+    if(0 != m_num_delayed)
+    {
+      log_info(m_tag, "shutdown: dropped %u delayed tasks", m_num_delayed);
+    }
+    m_num_delayed = 0;
+    m_joined = true;
+    return 0;
+  }
+
+  void getStats(ExecutorStats & stats) const
+  {
+    stats.m_num_executed = __atomic_load_n(&m_num_executed, __ATOMIC_RELAXED);
+    stats.m_num_stolen = __atomic_load_n(&m_num_stolen, __ATOMIC_RELAXED);
+    stats.m_total_latency_ns = __atomic_load_n(&m_total_latency_ns, __ATOMIC_RELAXED);
+    stats.m_max_latency_ns = __atomic_load_n(&m_max_latency_ns, __ATOMIC_RELAXED);
+    stats.m_queue_depth = getQueueDepth();
+    stats.m_max_queue_depth = __atomic_load_n(&m_max_queue_depth, __ATOMIC_RELAXED);
+    stats.m_num_delayed = __atomic_load_n(&m_num_delayed, __ATOMIC_RELAXED);
+  }
+
+  inline unsigned int getQueueDepth() const
+  {
+    const int depth = __atomic_load_n(&m_queue_depth, __ATOMIC_RELAXED);
+    return (depth > 0) ? (unsigned int) depth : 0;
+  }
+
+  inline unsigned int getNumOfThreads() const
+  {
+    return m_num_threads;
+  }
+
+  // true if called from one of this executor's workers
+  inline bool isWorkerThread() const
+  {
+    return (0 != pthread_getspecific(m_current_worker));
+  }
+
+private:
+  ThreadPoolExecutor(const char * const tag, const unsigned int num_threads, const bool verbose) :
+      m_tag((0 != tag) ? tag : TAG()), m_verbose(verbose), m_num_threads(num_threads), m_workers(0),
+      m_key_created(false), m_next_worker(0), m_pDelayedMutex(0), m_pDelayed(0), m_num_delayed(0),
+      m_delayed_capacity(0), m_next_deadline_ns(NO_DEADLINE), m_pShutdownMutex(0), m_stopping(0),
+      m_joined(false), m_wake_seq(0), m_num_sleeping(0), m_queue_depth(0), m_max_queue_depth(0),
+      m_num_executed(0), m_num_stolen(0), m_total_latency_ns(0), m_max_latency_ns(0)
+  {
+  }
+
+  // private copy constructor and assignment operator so that the
+  // the instance can not be copied.
+  ThreadPoolExecutor(const ThreadPoolExecutor & rhs);
+  ThreadPoolExecutor & operator=(const ThreadPoolExecutor & rhs);
+
+  int init()
+  {
+    int result = 1;
+    do
+    {
+      if(0 != pthread_key_create(&m_current_worker, 0))
+      {
+        result = 2;
+        break;
+      }
+      m_key_created = true;
+      m_pDelayedMutex = Mutex::createInstance(m_tag, m_verbose);
+      m_pShutdownMutex = Mutex::createInstance(m_tag, m_verbose);
+      // zeroed, so the destructor can tell which workers exist
+      m_workers = new (std::nothrow) Worker *[m_num_threads]();
+      if((0 == m_pDelayedMutex) || (0 == m_pShutdownMutex) || (0 == m_workers))
+      {
+        result = 3;
+        break;
+      }
+      unsigned int num_created = 0;
+      for (unsigned int i = 0; i < m_num_threads; ++i)
+      {
+        m_workers[i] = new (std::nothrow) Worker(this, i);
+        if(0 != m_workers[i])
+        {
+          m_workers[i]->m_pMutex = Mutex::createInstance(m_tag, m_verbose);
+          if(0 != m_workers[i]->m_pMutex)
+          {
+            ++num_created;
+          }
+        }
+      }
+      if(m_num_threads != num_created)
+      {
+        result = 4;
+        break;
+      }
+      unsigned int num_launched = 0;
+      for (unsigned int i = 0; i < m_num_threads; ++i)
+      {
+        // the executor owns the workers, not their threads
+        m_workers[i]->m_pThread = Thread::createInstance(m_tag, m_workers[i], false);
+        if((0 == m_workers[i]->m_pThread) || (0 != m_workers[i]->m_pThread->launch()))
+        {
+          delete m_workers[i]->m_pThread;
+          m_workers[i]->m_pThread = 0;
+          break;
+        }
+        ++num_launched;
+      }
+      if(m_num_threads != num_launched)
+      {
+        // the destructor stops the ones which did start
+        result = 5;
+        break;
+      }
+      result = 0;
+    } while (false);
+
+    if(0 != result)
+    {
+      log_error(m_tag, "init failed %d", result);
+    }
+    return result;
+  }
+
+  static inline uint64_t now_ns()
+  {
+    timespec now;
+    (void) clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((uint64_t) now.tv_sec * 1000000000ULL) + (uint64_t) now.tv_nsec;
+  }
+
+  int enqueue(const Task & task)
+  {
+    Worker * pWorker = static_cast<Worker *>(pthread_getspecific(m_current_worker));
+    if(0 == pWorker)
+    {
+      pWorker = m_workers[__atomic_fetch_add(&m_next_worker, 1, __ATOMIC_RELAXED) % m_num_threads];
+    }
+    {
+      AutoLock autolock(pWorker->m_pMutex);
+      if(0 != autolock.ZeroIfLocked())
+      {
+        return 5;
+      }
+      // checked again under the lock shutdown() drains the queues with, so a task
+      // is either drained or refused
+      if(0 != __atomic_load_n(&m_stopping, __ATOMIC_SEQ_CST))
+      {
+        return RC_SHUT_DOWN;
+      }
+      if(0 != pWorker->m_tasks.push(task))
+      {
+        return RC_NO_MEMORY;
+      }
+    }
+    const int depth = __atomic_add_fetch(&m_queue_depth, 1, __ATOMIC_SEQ_CST);
+    unsigned int max_depth = __atomic_load_n(&m_max_queue_depth, __ATOMIC_RELAXED);
+    while (((unsigned int) depth > max_depth)
+        && !__atomic_compare_exchange_n(&m_max_queue_depth, &max_depth, (unsigned int) depth, true,
+            __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+    }
+    if(0 != __atomic_load_n(&m_num_sleeping, __ATOMIC_SEQ_CST))
+    {
+      wake(1);
+    }
+    return 0;
+  }
+
+  bool takeFrom(Worker * const pWorker, Task * const pTask)
+  {
+    AutoLock autolock(pWorker->m_pMutex);
+    if((0 != autolock.ZeroIfLocked()) || pWorker->m_tasks.isEmpty() || (0 != pWorker->m_tasks.pop(pTask)))
+    {
+      return false;
+    }
+    (void) __atomic_sub_fetch(&m_queue_depth, 1, __ATOMIC_RELAXED);
+    return true;
+  }
+
+  bool takeTask(Worker * const pSelf, Task * const pTask)
+  {
+    if(takeFrom(pSelf, pTask))
+    {
+      return true;
+    }
+    for (unsigned int i = 1; i < m_num_threads; ++i)
+    {
+      Worker * const pVictim = m_workers[(pSelf->m_index + i) % m_num_threads];
+      // peek without the lock: most of the time there is nothing to steal
+      if(0 == __atomic_load_n(&m_queue_depth, __ATOMIC_RELAXED))
+      {
+        break;
+      }
+      if(takeFrom(pVictim, pTask))
+      {
+        (void) __atomic_add_fetch(&m_num_stolen, 1, __ATOMIC_RELAXED);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // binary heap of delayed tasks, earliest deadline first. called with m_pDelayedMutex held
+  int pushDelayed(const Task & task)
+  {
+    if(m_num_delayed == m_delayed_capacity)
+    {
+      const unsigned int new_capacity = (0 == m_delayed_capacity) ? 16 : (2 * m_delayed_capacity);
+      Task * const pNew = new (std::nothrow) Task[new_capacity];
+      if(0 == pNew)
+      {
+        return 1;
+      }
+      for (unsigned int i = 0; i < m_num_delayed; ++i)
+      {
+        pNew[i] = m_pDelayed[i];
+      }
+      delete[] m_pDelayed;
+      m_pDelayed = pNew;
+      m_delayed_capacity = new_capacity;
+    }
+    unsigned int index = m_num_delayed;
+    while (index > 0)
+    {
+      const unsigned int parent = (index - 1) / 2;
+      if(m_pDelayed[parent].m_ready_ns <= task.m_ready_ns)
+      {
+        break;
+      }
+      m_pDelayed[index] = m_pDelayed[parent];
+      index = parent;
+    }
+    m_pDelayed[index] = task;
+    __atomic_store_n(&m_num_delayed, m_num_delayed + 1, __ATOMIC_RELAXED);
+    return 0;
+  }
+
+  void popDelayed()
+  {
+    const unsigned int size = m_num_delayed - 1;
+    const Task last = m_pDelayed[size];
+    unsigned int index = 0;
+    while (true)
+    {
+      unsigned int child = (2 * index) + 1;
+      if(child >= size)
+      {
+        break;
+      }
+      if(((child + 1) < size) && (m_pDelayed[child + 1].m_ready_ns < m_pDelayed[child].m_ready_ns))
+      {
+        ++child;
+      }
+      if(last.m_ready_ns <= m_pDelayed[child].m_ready_ns)
+      {
+        break;
+      }
+      m_pDelayed[index] = m_pDelayed[child];
+      index = child;
+    }
+    m_pDelayed[index] = last;
+    __atomic_store_n(&m_num_delayed, size, __ATOMIC_RELAXED);
+  }
+
+  // takes the earliest delayed task if it is due
+  bool takeDueTask(Task * const pTask)
+  {
+    if(now_ns() < __atomic_load_n(&m_next_deadline_ns, __ATOMIC_ACQUIRE))
+    {
+      return false;
+    }
+    AutoLock autolock(m_pDelayedMutex);
+    if((0 != autolock.ZeroIfLocked()) || (0 == m_num_delayed) || (m_pDelayed[0].m_ready_ns > now_ns()))
+    {
+      return false;
+    }
+    *pTask = m_pDelayed[0];
+    popDelayed();
+    uint64_t next_deadline = NO_DEADLINE;
+    if(0 != m_num_delayed)
+    {
+      next_deadline = m_pDelayed[0].m_ready_ns;
+    }
+    __atomic_store_n(&m_next_deadline_ns, next_deadline, __ATOMIC_SEQ_CST);
+    return true;
+  }
+
+  void runTask(const Task & task)
+  {
+    const uint64_t latency = now_ns() - task.m_ready_ns;
+    (void) __atomic_add_fetch(&m_total_latency_ns, latency, __ATOMIC_RELAXED);
+    uint64_t max_latency = __atomic_load_n(&m_max_latency_ns, __ATOMIC_RELAXED);
+    while ((latency > max_latency)
+        && !__atomic_compare_exchange_n(&m_max_latency_ns, &max_latency, latency, true, __ATOMIC_RELAXED,
+            __ATOMIC_RELAXED))
+    {
+    }
+    task.m_pRunnable->run();
+    if(task.m_delete_after_run)
+    {
+      delete task.m_pRunnable;
+    }
+    (void) __atomic_add_fetch(&m_num_executed, 1, __ATOMIC_RELAXED);
+  }
+
+  void wake(const int num_threads)
+  {
+    __atomic_add_fetch(&m_wake_seq, 1, __ATOMIC_SEQ_CST);
+    (void) syscall(__NR_futex, &m_wake_seq, FUTEX_WAKE_PRIVATE, num_threads, 0, 0, 0);
+  }
+
+  void workerLoop(Worker * const pSelf)
+  {
+    (void) pthread_setspecific(m_current_worker, pSelf);
+    if(m_verbose)
+    {
+      log_verbose(m_tag, "worker %u started", pSelf->m_index);
+    }
+    Task task;
+    while (true)
+    {
+      if(takeTask(pSelf, &task) || takeDueTask(&task))
+      {
+        runTask(task);
+        continue;
+      }
+      if(0 != __atomic_load_n(&m_stopping, __ATOMIC_ACQUIRE))
+      {
+        if(0 == __atomic_load_n(&m_queue_depth, __ATOMIC_ACQUIRE))
+        {
+          break;
+        }
+        continue;
+      }
+
+      // park. same protocol as MpscBlockingQueue: snapshot the sequence, announce, re-check
+      const int seq = __atomic_load_n(&m_wake_seq, __ATOMIC_ACQUIRE);
+      (void) __atomic_add_fetch(&m_num_sleeping, 1, __ATOMIC_SEQ_CST);
+      const uint64_t deadline = __atomic_load_n(&m_next_deadline_ns, __ATOMIC_SEQ_CST);
+      const uint64_t now = now_ns();
+      if((0 == __atomic_load_n(&m_queue_depth, __ATOMIC_SEQ_CST)) && (deadline > now)
+          && (0 == __atomic_load_n(&m_stopping, __ATOMIC_SEQ_CST)))
+      {
+        timespec timeout;
+        timespec * pTimeout = 0;
+        if(NO_DEADLINE != deadline)
+        {
+          timeout.tv_sec = (time_t) ((deadline - now) / 1000000000ULL);
+          timeout.tv_nsec = (long) ((deadline - now) % 1000000000ULL);
+          pTimeout = &timeout;
+        }
+        const long rc = syscall(__NR_futex, &m_wake_seq, FUTEX_WAIT_PRIVATE, seq, pTimeout, 0, 0);
+        if((0 != rc) && (EAGAIN != errno) && (EINTR != errno) && (ETIMEDOUT != errno))
+        {
+          log_error(m_tag, "worker %u: futex wait failed %d", pSelf->m_index, errno);
+        }
+      }
+      (void) __atomic_sub_fetch(&m_num_sleeping, 1, __ATOMIC_SEQ_CST);
+    }
+    if(m_verbose)
+    {
+      log_verbose(m_tag, "worker %u stopped", pSelf->m_index);
+    }
+  }
+
+  const char * const m_tag;
+  const bool m_verbose;
+  unsigned int m_num_threads;
+  Worker ** m_workers;
+  pthread_key_t m_current_worker;
+  bool m_key_created;
+  unsigned int m_next_worker;
+
+  // delayed tasks
+  Mutex * m_pDelayedMutex;
+  Task * m_pDelayed;
+  unsigned int m_num_delayed;
+  unsigned int m_delayed_capacity;
+  uint64_t m_next_deadline_ns;
+
+  Mutex * m_pShutdownMutex;
+  int m_stopping;
+  bool m_joined;
+
+  // futex word workers park on
+  int m_wake_seq;
+  int m_num_sleeping;
+
+  // counters
+  int m_queue_depth;
+  unsigned int m_max_queue_depth;
+  uint64_t m_num_executed;
+  uint64_t m_num_stolen;
+  uint64_t m_total_latency_ns;
+  uint64_t m_max_latency_ns;
+};
+
+// runs tasks one at a time, in submission order, on a ThreadPoolExecutor. a task may run
+// on any of the workers, but never concurrently with another task of the same SerialExecutor,
+// so state touched only from its tasks needs no locking. several of them share the pool's
+// threads, where each would otherwise need a thread of its own.
+//
+// delete it only once it is idle, or after the ThreadPoolExecutor has been shut down
+class SerialExecutor
+{
+private:
+  // header only class, so the log tag is a function rather than a static data member
+  static const char * TAG()
+  {
+    return "SerialExecutor";
+  }
+
+  // tasks run per turn before the drainer goes back to the end of the pool's queue,
+  // so that a busy SerialExecutor doesn't hold on to a worker forever
+  static const unsigned int MAX_TASKS_PER_TURN = 64;
+
+  struct Task
+  {
+    Runnable * m_pRunnable;
+    bool m_delete_after_run;
+  };
+
+  class Drainer: public Runnable
+  {
+  public:
+    explicit Drainer(SerialExecutor * const pOwner) :
+        m_pOwner(pOwner)
+    {
+    }
+    virtual ~Drainer()
+    {
+    }
+    virtual void run()
+    {
+      m_pOwner->drain();
+    }
+  private:
+    SerialExecutor * const m_pOwner;
+  };
+
+  // hands a delayed task over to the SerialExecutor once it is due
+  class Forwarder: public Runnable
+  {
+  public:
+    Forwarder(SerialExecutor * const pOwner, Runnable * const pRunnable, const bool delete_after_run) :
+        m_pOwner(pOwner), m_pRunnable(pRunnable), m_delete_after_run(delete_after_run)
+    {
+    }
+    virtual ~Forwarder()
+    {
+    }
+    virtual void run()
+    {
+      if((0 != m_pOwner->execute(m_pRunnable, m_delete_after_run)) && m_delete_after_run)
+      {
+        delete m_pRunnable;
+      }
+    }
+  private:
+    SerialExecutor * const m_pOwner;
+    Runnable * const m_pRunnable;
+    const bool m_delete_after_run;
+  };
+
+public:
+  static SerialExecutor * createInstance(ThreadPoolExecutor * const pExecutor, const char * const tag = 0)
+  {
+    SerialExecutor * pSerial = 0;
+    if(0 != pExecutor)
+    {
+      pSerial = new (std::nothrow) SerialExecutor(pExecutor, tag);
+      if((0 != pSerial) && (0 == pSerial->m_pMutex))
+      {
+        delete pSerial;
+        pSerial = 0;
+      }
+    }
+    if(0 == pSerial)
+    {
+      log_error(TAG(), "createInstance failed");
+    }
+    return pSerial;
+  }
+
+  ~SerialExecutor()
+  {
+    Task task;
+    while ((!m_tasks.isEmpty()) && (0 == m_tasks.pop(&task)))
+    {
+      if(task.m_delete_after_run)
+      {
+        delete task.m_pRunnable;
+      }
+    }
+    delete m_pMutex;
+    m_pMutex = 0;
+  }
+
+  // multiple access. same ownership rules as ThreadPoolExecutor::execute
+  int execute(Runnable * const pRunnable, const bool delete_after_run = true)
+  {
+    int result = 1;
+    bool start_drainer = false;
+    do
+    {
+      if(0 == pRunnable)
+      {
+        result = 2;
+        break;
+      }
+      AutoLock autolock(m_pMutex);
+      if(0 != autolock.ZeroIfLocked())
+      {
+        result = 3;
+        break;
+      }
+      Task task;
+      task.m_pRunnable = pRunnable;
+      task.m_delete_after_run = delete_after_run;
+      if(0 != m_tasks.push(task))
+      {
+        result = 4;
+        break;
+      }
+      if(!m_scheduled)
+      {
+        m_scheduled = true;
+        start_drainer = true;
+      }
+      result = 0;
+    } while (false);
+
+    if(start_drainer && (0 != m_pExecutor->execute(&m_drainer, false)))
+    {
+      // the pool is shutting down. the caller keeps the task on failure, so take it
+      // back out, or it would be deleted once more with us
+      AutoLock autolock(m_pMutex);
+      m_scheduled = false;
+      removeTask(pRunnable, delete_after_run);
+      result = 5;
+    }
+
+    if(0 != result)
+    {
+      log_error(m_tag, "execute failed %d", result);
+    }
+    return result;
+  }
+
+  // multiple access. same ownership rules as ThreadPoolExecutor::schedule
+  int schedule(Runnable * const pRunnable, const TimeDiff & delay, const bool delete_after_run = true)
+  {
+    if(0 == pRunnable)
+    {
+      log_error(m_tag, "schedule failed 2");
+      return 2;
+    }
+    Forwarder * const pForwarder = new (std::nothrow) Forwarder(this, pRunnable, delete_after_run);
+    if(0 == pForwarder)
+    {
+      log_error(m_tag, "schedule failed 3");
+      return 3;
+    }
+    const int result = m_pExecutor->schedule(pForwarder, delay, true);
+    if(0 != result)
+    {
+      delete pForwarder;
+    }
+    return result;
+  }
+
+  // number of tasks which haven't started yet
+  size_t getQueueDepth()
+  {
+    AutoLock autolock(m_pMutex);
+    return m_tasks.getSize();
+  }
+
+private:
+  SerialExecutor(ThreadPoolExecutor * const pExecutor, const char * const tag) :
+      m_tag((0 != tag) ? tag : TAG()), m_pExecutor(pExecutor), m_pMutex(Mutex::createInstance(m_tag)),
+      m_scheduled(false), m_drainer(this)
+  {
+  }
+
+  // private copy constructor and assignment operator so that the
+  // the instance can not be copied.
+  SerialExecutor(const SerialExecutor & rhs);
+  SerialExecutor & operator=(const SerialExecutor & rhs);
+
+  // drop one queued entry of 'pRunnable'. entries of the same runnable can't be told
+  // apart, so it doesn't matter which. called with m_pMutex held
+  void removeTask(Runnable * const pRunnable, const bool delete_after_run)
+  {
+    bool removed = false;
+    // rotate the queue once, leaving the entry out. no push can fail, as the queue
+    // never holds more than it just did
+    for (size_t remaining = m_tasks.getSize(); 0 != remaining; --remaining)
+    {
+      Task task;
+      (void) m_tasks.pop(&task);
+      if((!removed) && (pRunnable == task.m_pRunnable) && (delete_after_run == task.m_delete_after_run))
+      {
+        removed = true;
+        continue;
+      }
+      (void) m_tasks.push(task);
+    }
+  }
+
+  void drain()
+  {
+    for (unsigned int i = 0; i < MAX_TASKS_PER_TURN; ++i)
+    {
+      Task task;
+      {
+        AutoLock autolock(m_pMutex);
+        if(m_tasks.isEmpty() || (0 != m_tasks.pop(&task)))
+        {
+          m_scheduled = false;
+          return;
+        }
+      }
+      task.m_pRunnable->run();
+      if(task.m_delete_after_run)
+      {
+        delete task.m_pRunnable;
+      }
+    }
+    // more to do: take another turn, behind whatever else the pool has queued
+    if(0 != m_pExecutor->execute(&m_drainer, false))
+    {
+      AutoLock autolock(m_pMutex);
+      m_scheduled = false;
+    }
+  }
+
+  const char * const m_tag;
+  ThreadPoolExecutor * const m_pExecutor;
+  Mutex * m_pMutex;
+  RingQueue<Task> m_tasks;
+  // true while m_drainer is queued or running
+  bool m_scheduled;
+  Drainer m_drainer;
+};
+
+} // namespace qc_loc_fw
+
+#endif //#ifndef __XTRAT_WIFI_THREAD_POOL_EXECUTOR_H__
@@ -13,11 +13,18 @@
 #ifndef __XTRAT_WIFI_VECTOR_H__
 #define __XTRAT_WIFI_VECTOR_H__
 
+#include <new>
+
 #include <base_util/log.h>
 
 namespace qc_loc_fw
 {
 
+// note: instances of this template are shared with prebuilt libraries (e.g. the
+// scan measurement vectors in LOWI responses), which release the storage with
+// delete[]. so the storage must always come from new T[], and every slot up to the
+// capacity holds a constructed element. growth and reserve move the live elements
+// (C++11) or copy them (C++03) and never touch the unused part of the old array
 template<typename T>
 class vector
 {
@@ -39,6 +46,17 @@ public:
     (void) operator =(rhs);
   }
 
+#if __cplusplus >= 201103L
+  // take over the array of rhs, leaving it empty
+  vector(vector<T> && rhs) :
+    m_pArray(rhs.m_pArray), m_capacity(rhs.m_capacity), m_num_elements(rhs.m_num_elements)
+  {
+    rhs.m_pArray = 0;
+    rhs.m_capacity = 0;
+    rhs.m_num_elements = 0;
+  }
+#endif
+
   virtual ~vector()
   {
     flush();
@@ -55,48 +73,24 @@ public:
     m_num_elements = 0;
   }
 
-  int push_back(const T & element)
+  // make sure 'capacity' elements can be held without reallocation
+  int reserve(const unsigned int capacity)
   {
     int result = 0;
-
-    // Check if the Array has been allocated already.
-    if (0 == m_pArray)
+    if(capacity > m_capacity)
     {
-      // Inserting an element where as the Array is not yet allocated
-      // Allocate the array to default size
-      m_capacity = DEFAULT_CAPACITY;
-      m_pArray = new (std::nothrow) T[m_capacity];
-      if (0 == m_pArray)
-      {
-        result = -1;
-      }
+      result = reallocate(capacity);
     }
-    else
+    if(0 != result)
     {
-      // Memory is already allocated. Check if the Array is running on boundary
-      if (m_capacity == m_num_elements)
-      {
-        // We do not have space for more elements
-        // Double the size and copy over the elements in new array
-        unsigned int new_size = 2 * m_capacity;
-        T* pNewArray = new (std::nothrow) T[new_size];
-        if (0 != pNewArray)
-        {
-          for (unsigned int i = 0; i < m_capacity; ++i)
-          {
-            pNewArray[i] = m_pArray[i];
-          }
-          m_capacity = new_size;
-          delete [] m_pArray;
-          m_pArray = pNewArray;
-        }
-        else
-        {
-          result = -2;
-        }
-      }
+      log_error(TAG, "reserve failed %d", result);
     }
+    return result;
+  }
 
+  int push_back(const T & element)
+  {
+    int result = grow_if_full();
     if (0 == result)
     {
       // Store the new element
@@ -110,6 +104,41 @@ public:
     return result;
   }
 
+#if __cplusplus >= 201103L
+  int push_back(T && element)
+  {
+    int result = grow_if_full();
+    if (0 == result)
+    {
+      m_pArray [m_num_elements] = static_cast<T &&>(element);
+      ++m_num_elements;
+    }
+    else
+    {
+      log_error(TAG, "insertion failed %d", result);
+    }
+    return result;
+  }
+
+  // the slot already holds a constructed element (see the note above the class),
+  // so the new element is built in a temporary and moved in
+  template<typename... Args>
+  int emplace_back(Args && ... args)
+  {
+    int result = grow_if_full();
+    if (0 == result)
+    {
+      m_pArray [m_num_elements] = T(static_cast<Args &&>(args)...);
+      ++m_num_elements;
+    }
+    else
+    {
+      log_error(TAG, "insertion failed %d", result);
+    }
+    return result;
+  }
+#endif
+
   T & operator [](const unsigned int index)
   {
     if(index < m_num_elements)
@@ -158,26 +187,30 @@ public:
       return *this;
     }
 
-    flush();
-    int new_size = rhs.getCapacity();
-
-    if(new_size > 0)
+    const unsigned int elements = rhs.getNumOfElements();
+    if(elements <= m_capacity)
     {
-      int elements = rhs.getNumOfElements();
-      T * pNewArray = new (std::nothrow) T[new_size];
+      // the current array is big enough, copy over the elements without reallocation
+      for (unsigned int i = 0; i < elements; ++i)
+      {
+        m_pArray[i] = rhs.m_pArray[i];
+      }
+      m_num_elements = elements;
+      result = 0;
+    }
+    else
+    {
+      // only allocate what is in use, not the whole capacity of rhs
+      flush();
+      T * pNewArray = new (std::nothrow) T[elements];
       if(0 != pNewArray)
       {
-        for (int i = 0; i < elements; ++i)
+        for (unsigned int i = 0; i < elements; ++i)
         {
           pNewArray[i] = rhs.m_pArray[i];
         }
-        m_capacity = new_size;
+        m_capacity = elements;
         m_num_elements = elements;
-
-        if(0 != m_pArray)
-        {
-          delete[] m_pArray;
-        }
         m_pArray = pNewArray;
         result = 0;
       }
@@ -186,11 +219,6 @@ public:
         result = 2;
       }
     }
-    else
-    {
-      // do nothing. it's okay to insert empty array into an array
-      result = 0;
-    }
 
     if(0 != result)
     {
@@ -199,6 +227,23 @@ public:
     return *this;
   }
 
+#if __cplusplus >= 201103L
+  const vector<T> & operator =(vector<T> && rhs)
+  {
+    if(&rhs != this)
+    {
+      flush();
+      m_pArray = rhs.m_pArray;
+      m_capacity = rhs.m_capacity;
+      m_num_elements = rhs.m_num_elements;
+      rhs.m_pArray = 0;
+      rhs.m_capacity = 0;
+      rhs.m_num_elements = 0;
+    }
+    return *this;
+  }
+#endif
+
   Iterator begin()
   {
     return Iterator(m_pArray);
@@ -210,6 +255,49 @@ public:
   }
 
 private:
+  // make room for one more element, doubling the capacity when needed
+  int grow_if_full()
+  {
+    int result = 0;
+    if (0 == m_pArray)
+    {
+      // Inserting an element where as the Array is not yet allocated
+      // Allocate the array to default size
+      result = (0 == reallocate(DEFAULT_CAPACITY)) ? 0 : -1;
+    }
+    else if (m_capacity == m_num_elements)
+    {
+      // We do not have space for more elements
+      // Double the size and move over the elements in new array
+      result = reallocate(2 * m_capacity);
+    }
+    return result;
+  }
+
+  int reallocate(const unsigned int new_size)
+  {
+    T * pNewArray = new (std::nothrow) T[new_size];
+    if (0 == pNewArray)
+    {
+      return -2;
+    }
+    for (unsigned int i = 0; i < m_num_elements; ++i)
+    {
+#if __cplusplus >= 201103L
+      pNewArray[i] = static_cast<T &&>(m_pArray[i]);
+#else
+      pNewArray[i] = m_pArray[i];
+#endif
+    }
+    if (0 != m_pArray)
+    {
+      delete [] m_pArray;
+    }
+    m_pArray = pNewArray;
+    m_capacity = new_size;
+    return 0;
+  }
+
   T * m_pArray;
   unsigned int m_capacity;
   unsigned int m_num_elements;
@@ -0,0 +1,603 @@
+/*====*====*====*====*====*====*====*====*====*====*====*====*====*====*====*
+
+ mq-client, batched
+
+ GENERAL DESCRIPTION
+ This header declares a message queue client which sends and receives
+ messages in batches, to cut the number of system calls and callbacks
+ when peers burst many small messages
+
+ Copyright (c) 2015 Qualcomm Technologies, Inc.
+ All Rights Reserved.
+ Confidential and Proprietary - Qualcomm Technologies, Inc.
+ =============================================================================*/
+#ifndef __XTRAT_WIFI_MESSAGE_QUEUE_CLIENT_BATCH_H__
+#define __XTRAT_WIFI_MESSAGE_QUEUE_CLIENT_BATCH_H__
+
+#include <errno.h>
+#include <new>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <base_util/log.h>
+#include <base_util/memorystream.h>
+#include <base_util/sync.h>
+#include <mq_client/mq_client.h>
+
+namespace qc_loc_fw
+{
+
+// receives every message which was already waiting in the socket in one call.
+// as with newMsg, the callee owns each stream from the moment it's called, whatever it returns
+class MessageQueueBatchCallback: public MessageQueueServiceCallback
+{
+public:
+  virtual ~MessageQueueBatchCallback()
+  {
+  }
+
+  virtual int newMsgBatch(InMemoryStream * const * const new_buffers, const size_t count) = 0;
+
+  // single messages are delivered as a batch of one
+  virtual int newMsg(InMemoryStream * new_buffer)
+  {
+    return newMsgBatch(&new_buffer, 1);
+  }
+};
+
+// same socket and wire format as MessageQueueClient::createInstance(), so it can talk to
+// the existing server and peers:
+// each message is the raw encoded buffer, which starts with its own 32-bit length,
+// excluding those 4 bytes. the length is in host order, the socket is a local stream socket
+//
+// - sendBatch writes any number of messages with one sendmsg per IOV_MAX_PER_CALL buffers
+// - run_block/run_block_batch read whatever is waiting, up to the receive buffer size, with
+//   one recv, and split it into messages. run_block_batch then makes one callback per read
+class BatchMessageQueueClient: public MessageQueueClient
+{
+private:
+  // header only class, so the log tag is a function rather than a static data member
+  static const char * TAG()
+  {
+    return "MessageQ_Client_Batch";
+  }
+  // largest message accepted, same as MessageQueueClient
+  static const uint32_t MAX_MESSAGE_LENGTH = 0x3FFFFFFE;
+public:
+  static const size_t DEFAULT_RECEIVE_BUFFER_SIZE = 64 * 1024;
+  static const size_t DEFAULT_MAX_BATCH = 64;
+
+  // receive_buffer_size bounds how much one recv call can read. larger messages still work,
+  // they're just read on their own
+  static BatchMessageQueueClient * createInstance(const size_t receive_buffer_size = DEFAULT_RECEIVE_BUFFER_SIZE,
+      const size_t max_batch = DEFAULT_MAX_BATCH)
+  {
+    BatchMessageQueueClient * pClient = 0;
+    int result = 1;
+    do
+    {
+      if((receive_buffer_size < sizeof(uint32_t)) || (0 == max_batch))
+      {
+        result = 2;
+        break;
+      }
+      pClient = new (std::nothrow) BatchMessageQueueClient(receive_buffer_size, max_batch);
+      if(0 == pClient)
+      {
+        result = 3;
+        break;
+      }
+      if((0 == pClient->m_pMutex) || (0 == pClient->m_pSendMutex) || (0 == pClient->m_pRxBuffer)
+          || (0 == pClient->m_ppBatch))
+      {
+        result = 4;
+        break;
+      }
+      result = 0;
+    } while (false);
+
+    if(0 != result)
+    {
+      log_error(TAG(), "createInstance failed %d", result);
+      delete pClient;
+      pClient = 0;
+    }
+    return pClient;
+  }
+
+  virtual ~BatchMessageQueueClient()
+  {
+    if(m_socket >= 0)
+    {
+      close(m_socket);
+      m_socket = -1;
+    }
+    free(m_server_name);
+    m_server_name = 0;
+    delete[] m_pRxBuffer;
+    m_pRxBuffer = 0;
+    delete[] m_ppBatch;
+    m_ppBatch = 0;
+    delete m_pSendMutex;
+    m_pSendMutex = 0;
+    delete m_pMutex;
+    m_pMutex = 0;
+  }
+
+  virtual int setServerNameDup(const char * const name)
+  {
+    int result = 1;
+    do
+    {
+      if(0 == name)
+      {
+        result = 2;
+        break;
+      }
+      char * const copy = strdup(name);
+      if(0 == copy)
+      {
+        result = 3;
+        break;
+      }
+      free(m_server_name);
+      m_server_name = copy;
+      result = 0;
+    } while (false);
+
+    if(0 != result)
+    {
+      log_error(TAG(), "setServerNameDup failed %d", result);
+    }
+    return result;
+  }
+
+  virtual int connect(const bool name_in_file_system = true)
+  {
+    int result = 1;
+    do
+    {
+      if(0 == m_server_name)
+      {
+        result = 2;
+        break;
+      }
+      const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+      if(fd < 0)
+      {
+        log_error(TAG(), "socket error: %d, [%s]", errno, strerror(errno));
+        result = 3;
+        break;
+      }
+      struct sockaddr_un addr;
+      memset(&addr, 0, sizeof(addr));
+      addr.sun_family = AF_UNIX;
+      if(name_in_file_system)
+      {
+        snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", m_server_name);
+      }
+      else
+      {
+        // abstract namespace
+        snprintf(addr.sun_path, sizeof(addr.sun_path), " %s", m_server_name);
+        addr.sun_path[0] = 0;
+      }
+      log_info(TAG(), "connecting to server [%s]", m_server_name);
+      if(0 != ::connect(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)))
+      {
+        log_error(TAG(), "connect error: %d, [%s]", errno, strerror(errno));
+        close(fd);
+        result = 4;
+        break;
+      }
+      {
+        AutoLock autolock(m_pMutex);
+        if(0 != autolock.ZeroIfLocked())
+        {
+          close(fd);
+          result = 5;
+          break;
+        }
+        if(m_socket >= 0)
+        {
+          close(m_socket);
+        }
+        m_socket = fd;
+      }
+      log_info(TAG(), "connected");
+      result = 0;
+    } while (false);
+
+    if(0 != result)
+    {
+      log_error(TAG(), "connect failed %d", result);
+    }
+    return result;
+  }
+
+  virtual int send(const MemoryStreamBase * const buffer)
+  {
+    return sendBatch(&buffer, 1);
+  }
+
+  // writes all buffers in order, with as few system calls as possible. buffers from
+  // concurrent send/sendBatch calls are never interleaved
+  int sendBatch(const MemoryStreamBase * const * const buffers, const size_t count)
+  {
+    int result = 1;
+    do
+    {
+      if((0 == buffers) && (0 != count))
+      {
+        result = 2;
+        break;
+      }
+      AutoLock autolock(m_pSendMutex);
+      if(0 != autolock.ZeroIfLocked())
+      {
+        result = 101;
+        break;
+      }
+      const int fd = getSocket();
+
+      struct iovec iov[IOV_MAX_PER_CALL];
+      size_t next = 0;
+      result = 0;
+      while ((0 == result) && (next < count))
+      {
+        size_t num_iov = 0;
+        for (; (next < count) && (num_iov < IOV_MAX_PER_CALL); ++next)
+        {
+          if(0 == buffers[next])
+          {
+            result = 3;
+            break;
+          }
+          const size_t size = buffers[next]->getSize();
+          if(0 != size)
+          {
+            iov[num_iov].iov_base = const_cast<MemoryStreamBase::BYTE *>(buffers[next]->getBuffer());
+            iov[num_iov].iov_len = size;
+            ++num_iov;
+          }
+        }
+        if(0 != result)
+        {
+          break;
+        }
+        result = sendAll(fd, iov, num_iov);
+      }
+    } while (false);
+
+    if(0 != result)
+    {
+      log_error(TAG(), "send failed %d", result);
+    }
+    return result;
+  }
+
+  // per message callbacks, but still reading many messages per recv
+  virtual int run_block(MessageQueueServiceCallback * const callback)
+  {
+    return receiveLoop(callback, 0);
+  }
+
+  // one callback per batch of messages read together, at most max_batch messages each
+  int run_block_batch(MessageQueueBatchCallback * const callback)
+  {
+    return receiveLoop(callback, callback);
+  }
+
+  // multiple access. called by any thread which wishes to shutdown communication
+  virtual int shutdown()
+  {
+    int result = 1;
+    AutoLock autolock(m_pMutex);
+    if(0 != autolock.ZeroIfLocked())
+    {
+      result = 2;
+    }
+    else if((m_socket >= 0) && (0 != ::shutdown(m_socket, SHUT_RDWR)))
+    {
+      log_error(TAG(), "shutdown failed. errno %d, [%s]", errno, strerror(errno));
+      result = 3;
+    }
+    else
+    {
+      result = 0;
+    }
+    return result;
+  }
+
+private:
+  static const size_t IOV_MAX_PER_CALL = 64;
+
+  BatchMessageQueueClient(const size_t receive_buffer_size, const size_t max_batch) :
+      m_pMutex(Mutex::createInstance(TAG())), m_pSendMutex(Mutex::createInstance(TAG())), m_server_name(0),
+      m_socket(-1), m_pRxBuffer(new (std::nothrow) MemoryStreamBase::BYTE[receive_buffer_size]),
+      m_rx_buffer_size(receive_buffer_size), m_ppBatch(new (std::nothrow) InMemoryStream *[max_batch]),
+      m_max_batch(max_batch)
+  {
+  }
+
+  // private copy constructor and assignment operator so that the
+  // the instance can not be copied.
+  BatchMessageQueueClient(const BatchMessageQueueClient & rhs);
+  BatchMessageQueueClient & operator=(const BatchMessageQueueClient & rhs);
+
+  int getSocket()
+  {
+    AutoLock autolock(m_pMutex);
+    return (0 == autolock.ZeroIfLocked()) ? m_socket : -1;
+  }
+
+  // keeps writing until every byte described by iov is sent
+  static int sendAll(const int fd, struct iovec * iov, size_t num_iov)
+  {
+    while (0 != num_iov)
+    {
+      struct msghdr msg;
+      memset(&msg, 0, sizeof(msg));
+      msg.msg_iov = iov;
+      msg.msg_iovlen = num_iov;
+      const ssize_t sent = sendmsg(fd, &msg, MSG_NOSIGNAL);
+      if(sent < 0)
+      {
+        if(EINTR == errno)
+        {
+          continue;
+        }
+        log_error(TAG(), "send error: %d, [%s]", errno, strerror(errno));
+        return 102;
+      }
+      // skip what was written, possibly stopping in the middle of a buffer
+      size_t remaining = (size_t) sent;
+      while ((0 != num_iov) && (remaining >= iov->iov_len))
+      {
+        remaining -= iov->iov_len;
+        ++iov;
+        --num_iov;
+      }
+      if(0 != num_iov)
+      {
+        iov->iov_base = reinterpret_cast<char *>(iov->iov_base) + remaining;
+        iov->iov_len -= remaining;
+      }
+    }
+    return 0;
+  }
+
+  static int recvAll(const int fd, void * const pData, const size_t length)
+  {
+    size_t done = 0;
+    while (done < length)
+    {
+      const ssize_t n = recv(fd, reinterpret_cast<char *>(pData) + done, length - done, MSG_WAITALL);
+      if(n < 0)
+      {
+        if(EINTR == errno)
+        {
+          continue;
+        }
+        log_error(TAG(), "read error: %d, [%s]", errno, strerror(errno));
+        return 107;
+      }
+      if(0 == n)
+      {
+        return 108;
+      }
+      done += (size_t) n;
+    }
+    return 0;
+  }
+
+  // wraps one complete message, length prefix included, the way MessageQueueClient does
+  static int createMessage(MemoryStreamBase::BYTE * pMessage, const size_t size, InMemoryStream ** ppStream)
+  {
+    InMemoryStream * const pStream = InMemoryStream::createInstance();
+    if(0 == pStream)
+    {
+      delete[] pMessage;
+      return 109;
+    }
+    const void * pBuffer = pMessage;
+    if(0 != pStream->setBufferOwnership(&pBuffer, size))
+    {
+      delete[] pMessage;
+      delete pStream;
+      return 110;
+    }
+    *ppStream = pStream;
+    return 0;
+  }
+
+  // hands m_ppBatch over to the callback(s). streams which were not delivered are freed
+  int deliver(MessageQueueServiceCallback * const callback, MessageQueueBatchCallback * const batch_callback,
+      size_t & num_pending)
+  {
+    int rc = MessageQueueServiceCallback::RC_NO_ERROR_CONTINUE;
+    if(0 == num_pending)
+    {
+      return rc;
+    }
+    if(0 != batch_callback)
+    {
+      rc = batch_callback->newMsgBatch(m_ppBatch, num_pending);
+    }
+    else
+    {
+      size_t i = 0;
+      while (i < num_pending)
+      {
+        rc = callback->newMsg(m_ppBatch[i++]);
+        if(MessageQueueServiceCallback::RC_NO_ERROR_CONTINUE != rc)
+        {
+          break;
+        }
+      }
+      for (; i < num_pending; ++i)
+      {
+        delete m_ppBatch[i];
+      }
+    }
+    num_pending = 0;
+    return rc;
+  }
+
+  int receiveLoop(MessageQueueServiceCallback * const callback, MessageQueueBatchCallback * const batch_callback)
+  {
+    // same result codes as MessageQueueClient::run_block
+    int result = 1;
+    size_t num_pending = 0;
+    size_t have = 0;
+    MemoryStreamBase::BYTE * const buffer = m_pRxBuffer;
+    do
+    {
+      if(0 == callback)
+      {
+        result = 2;
+        break;
+      }
+      result = 0;
+      while (0 == result)
+      {
+        const int fd = getSocket();
+        const ssize_t n = recv(fd, buffer + have, m_rx_buffer_size - have, 0);
+        if(n < 0)
+        {
+          if(EINTR == errno)
+          {
+            continue;
+          }
+          log_error(TAG(), "read error: %d, [%s]", errno, strerror(errno));
+          result = 102;
+          break;
+        }
+        if(0 == n)
+        {
+          // peer closed, or shutdown()
+          result = (have < sizeof(uint32_t)) ? 103 : 108;
+          break;
+        }
+        have += (size_t) n;
+
+        // split everything complete in the buffer into messages
+        size_t offset = 0;
+        while ((0 == result) && ((have - offset) >= sizeof(uint32_t)))
+        {
+          uint32_t length = 0;
+          memcpy(&length, buffer + offset, sizeof(length));
+          if(length > MAX_MESSAGE_LENGTH)
+          {
+            result = 104;
+            break;
+          }
+          if(0 == length)
+          {
+            result = 105;
+            break;
+          }
+          const size_t size = sizeof(uint32_t) + length;
+          const size_t available = have - offset;
+          if((available < size) && (size <= m_rx_buffer_size))
+          {
+            // wait for the rest with the next read
+            break;
+          }
+
+          MemoryStreamBase::BYTE * const pMessage = new (std::nothrow) MemoryStreamBase::BYTE[size];
+          if(0 == pMessage)
+          {
+            result = 106;
+            break;
+          }
+          if(available >= size)
+          {
+            memcpy(pMessage, buffer + offset, size);
+            offset += size;
+          }
+          else
+          {
+            // larger than the receive buffer: read the rest of it directly
+            memcpy(pMessage, buffer + offset, available);
+            offset = have;
+            result = recvAll(fd, pMessage + available, size - available);
+            if(0 != result)
+            {
+              delete[] pMessage;
+              break;
+            }
+          }
+          result = createMessage(pMessage, size, &m_ppBatch[num_pending]);
+          if(0 != result)
+          {
+            break;
+          }
+          ++num_pending;
+          if(num_pending == m_max_batch)
+          {
+            result = callbackResult(deliver(callback, batch_callback, num_pending));
+          }
+        }
+        if(0 == result)
+        {
+          result = callbackResult(deliver(callback, batch_callback, num_pending));
+        }
+
+        // keep the partial message, if any, at the start of the buffer
+        if(offset < have)
+        {
+          memmove(buffer, buffer + offset, have - offset);
+        }
+        have -= offset;
+      }
+    } while (false);
+
+    for (size_t i = 0; i < num_pending; ++i)
+    {
+      delete m_ppBatch[i];
+    }
+
+    if(100 == result)
+    {
+      log_info(TAG(), "run finished without error");
+      result = 0;
+    }
+    else
+    {
+      log_error(TAG(), "run failed %d", result);
+    }
+    return result;
+  }
+
+  static inline int callbackResult(const int rc)
+  {
+    if(MessageQueueServiceCallback::RC_NO_ERROR_CONTINUE == rc)
+    {
+      return 0;
+    }
+    return (MessageQueueServiceCallback::RC_NO_ERROR_STOP_LOOP == rc) ? 100 : 111;
+  }
+
+  // protects m_socket
+  Mutex * m_pMutex;
+  // serializes writers, so that messages are never interleaved on the stream
+  Mutex * m_pSendMutex;
+  char * m_server_name;
+  int m_socket;
+  MemoryStreamBase::BYTE * m_pRxBuffer;
+  const size_t m_rx_buffer_size;
+  InMemoryStream ** m_ppBatch;
+  const size_t m_max_batch;
+};
+
+} // namespace qc_loc_fw
+
+#endif //#ifndef __XTRAT_WIFI_MESSAGE_QUEUE_CLIENT_BATCH_H__
@@ -0,0 +1,1374 @@
+/*====*====*====*====*====*====*====*====*====*====*====*====*====*====*====*
+
+ mq-client, shared memory transport
+
+ GENERAL DESCRIPTION
+ This header declares a message queue transport which moves messages through
+ a pair of single producer, single consumer rings in shared memory, with
+ eventfd doorbells, and falls back to the socket when the peer doesn't
+ support it
+
+ Copyright (c) 2015 Qualcomm Technologies, Inc.
+ All Rights Reserved.
+ Confidential and Proprietary - Qualcomm Technologies, Inc.
+ =============================================================================*/
+#ifndef __XTRAT_WIFI_MESSAGE_QUEUE_SHM_TRANSPORT_H__
+#define __XTRAT_WIFI_MESSAGE_QUEUE_SHM_TRANSPORT_H__
+
+#include <errno.h>
+#include <fcntl.h>
+#include <new>
+#include <poll.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#ifdef __ANDROID__
+#include <linux/ashmem.h>
+#endif
+
+#include <base_util/log.h>
+#include <base_util/memorystream.h>
+#include <base_util/sync.h>
+#include <mq_client/mq_client.h>
+#include <mq_client/mq_client_batch.h>
+
+namespace qc_loc_fw
+{
+
+// Usage
+//
+//   peer which accepts shared memory connections, e.g. a local server:
+//     int listen_fd = ShmMessageQueueConnection::listen("/dev/socket/foo.shm", true);
+//     ShmMessageQueueConnection * conn = ShmMessageQueueConnection::accept(listen_fd);
+//     conn->run_block(callback); conn->send(buffer); ...
+//
+//   client, instead of MessageQueueClient::createInstance():
+//     ShmMessageQueueClient * client = ShmMessageQueueClient::createInstance();
+//     client->setServerNameDup("/dev/socket/foo");
+//     client->connect();   // "/dev/socket/foo.shm" if someone listens there, else "/dev/socket/foo"
+//
+// negotiation is by address: a peer which supports this transport listens on the server
+// name plus SHM_NAME_SUFFIX. nothing is ever sent to a peer which doesn't, so the existing
+// server keeps working unchanged.
+//
+// messages up to half the ring size are copied once, into the ring, and delivered as
+// read-only streams which point into it. ring space is given back when those streams are
+// deleted, in any order, so don't hold on to them for long: a receiver which keeps a ring's
+// worth of them while it waits for more stalls the sender. larger messages go through
+// the socket, in order with the others
+
+// control block at the start of each ring. lives in shared memory
+struct ShmRingControl
+{
+  uint32_t m_magic;
+  uint32_t m_capacity;
+  uint32_t m_closed;
+  uint32_t m_reserved;
+  uint8_t m_padding0[48];
+  // written by the producer only
+  uint32_t m_head;
+  uint32_t m_consumer_waiting;
+  uint8_t m_padding1[56];
+  // written by the consumer only
+  uint32_t m_tail;
+  uint32_t m_producer_waiting;
+  uint8_t m_padding2[56];
+};
+
+// the receive side of one ring, shared between the connection and the streams it delivered.
+// the memory stays mapped until the last of them is gone
+class ShmReceiveState
+{
+public:
+  static const unsigned int MAX_IN_FLIGHT = 1024;
+
+  ShmReceiveState(void * const pMap, const size_t map_size, ShmRingControl * const pControl,
+      MemoryStreamBase::BYTE * const pRing, const int space_fd) :
+      m_ref_count(1), m_pMap(pMap), m_map_size(map_size), m_pControl(pControl), m_pRing(pRing),
+      m_space_fd(space_fd), m_slot_head(0), m_slot_tail(0), m_sweeping(0)
+  {
+  }
+
+  inline void addRef()
+  {
+    (void) __atomic_add_fetch(&m_ref_count, 1, __ATOMIC_RELAXED);
+  }
+
+  inline void release()
+  {
+    if(0 == __atomic_sub_fetch(&m_ref_count, 1, __ATOMIC_ACQ_REL))
+    {
+      delete this;
+    }
+  }
+
+  inline MemoryStreamBase::BYTE * getRing() const
+  {
+    return m_pRing;
+  }
+
+  inline ShmRingControl * getControl() const
+  {
+    return m_pControl;
+  }
+
+  // receive thread only
+  inline bool hasFreeSlot() const
+  {
+    return (m_slot_head - __atomic_load_n(&m_slot_tail, __ATOMIC_ACQUIRE)) < MAX_IN_FLIGHT;
+  }
+
+  // receive thread only. 'end' is the ring position right after the record
+  unsigned int push(const uint32_t end, const bool released)
+  {
+    const unsigned int index = m_slot_head;
+    Slot & slot = m_slots[index % MAX_IN_FLIGHT];
+    slot.m_end = end;
+    __atomic_store_n(&slot.m_released, released ? 1 : 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&m_slot_head, index + 1, __ATOMIC_RELEASE);
+    if(released)
+    {
+      sweep();
+    }
+    return index;
+  }
+
+  // any thread
+  inline void markReleased(const unsigned int index)
+  {
+    __atomic_store_n(&m_slots[index % MAX_IN_FLIGHT].m_released, 1, __ATOMIC_RELEASE);
+    sweep();
+  }
+
+  // give the oldest released records back to the producer
+  void sweep()
+  {
+    while (0 == __atomic_exchange_n(&m_sweeping, 1, __ATOMIC_ACQUIRE))
+    {
+      unsigned int tail = m_slot_tail;
+      const unsigned int head = __atomic_load_n(&m_slot_head, __ATOMIC_ACQUIRE);
+      uint32_t end = 0;
+      bool advanced = false;
+      while ((tail != head) && (0 != __atomic_load_n(&m_slots[tail % MAX_IN_FLIGHT].m_released, __ATOMIC_ACQUIRE)))
+      {
+        end = m_slots[tail % MAX_IN_FLIGHT].m_end;
+        ++tail;
+        advanced = true;
+      }
+      if(advanced)
+      {
+        __atomic_store_n(&m_slot_tail, tail, __ATOMIC_RELEASE);
+        __atomic_store_n(&m_pControl->m_tail, end, __ATOMIC_SEQ_CST);
+        if(0 != __atomic_exchange_n(&m_pControl->m_producer_waiting, 0, __ATOMIC_SEQ_CST))
+        {
+          ring(m_space_fd);
+        }
+      }
+      __atomic_store_n(&m_sweeping, 0, __ATOMIC_RELEASE);
+
+      // a record released while we were busy would otherwise wait for the next sweep
+      const unsigned int new_head = __atomic_load_n(&m_slot_head, __ATOMIC_ACQUIRE);
+      if((tail == new_head)
+          || (0 == __atomic_load_n(&m_slots[tail % MAX_IN_FLIGHT].m_released, __ATOMIC_ACQUIRE)))
+      {
+        break;
+      }
+    }
+  }
+
+  static inline void ring(const int fd)
+  {
+    const uint64_t one = 1;
+    if((ssize_t) sizeof(one) != write(fd, &one, sizeof(one)))
+    {
+      // EAGAIN: the counter is saturated, the peer will wake up anyway
+    }
+  }
+
+private:
+  struct Slot
+  {
+    uint32_t m_end;
+    int m_released;
+  };
+
+  ~ShmReceiveState()
+  {
+    munmap(m_pMap, m_map_size);
+    close(m_space_fd);
+  }
+
+  ShmReceiveState(const ShmReceiveState & rhs);
+  ShmReceiveState & operator=(const ShmReceiveState & rhs);
+
+  int m_ref_count;
+  void * const m_pMap;
+  const size_t m_map_size;
+  ShmRingControl * const m_pControl;
+  MemoryStreamBase::BYTE * const m_pRing;
+  const int m_space_fd;
+  Slot m_slots[MAX_IN_FLIGHT];
+  unsigned int m_slot_head;
+  unsigned int m_slot_tail;
+  int m_sweeping;
+};
+
+// read-only view of one message in the ring
+class ShmInMemoryStream: public InMemoryStream
+{
+private:
+  // header only class, so the log tag is a function rather than a static data member
+  static const char * TAG()
+  {
+    return "ShmInMemoryStream";
+  }
+public:
+  ShmInMemoryStream(ShmReceiveState * const pState, const unsigned int slot, const BYTE * const pBuffer,
+      const size_t size) :
+      m_pState(pState), m_slot(slot), m_pBuffer(pBuffer), m_size(size), m_cursor(0)
+  {
+    m_pState->addRef();
+  }
+
+  virtual ~ShmInMemoryStream()
+  {
+    m_pState->markReleased(m_slot);
+    m_pState->release();
+    m_pState = 0;
+  }
+
+  virtual size_t getSize() const
+  {
+    return m_size;
+  }
+
+  virtual const BYTE * getBuffer() const
+  {
+    return m_pBuffer;
+  }
+
+  virtual int setBufferOwnership(const void ** const, const size_t)
+  {
+    log_error(TAG(), "setBufferOwnership: shared memory views are read-only");
+    return 1;
+  }
+
+  virtual int setBufferNoDup(const void * const, const size_t)
+  {
+    log_error(TAG(), "setBufferNoDup: shared memory views are read-only");
+    return 1;
+  }
+
+  virtual int extract(void * const pData, const size_t length)
+  {
+    if(((0 == pData) && (0 != length)) || (length > (m_size - m_cursor)))
+    {
+      log_error(TAG(), "extract: failed");
+      return 2;
+    }
+    if(0 != length)
+    {
+      memcpy(pData, m_pBuffer + m_cursor, length);
+    }
+    m_cursor += length;
+    return 0;
+  }
+
+  virtual size_t getGetCursor() const
+  {
+    return m_cursor;
+  }
+
+  virtual int setGetCursor(const size_t cursor)
+  {
+    if(cursor > m_size)
+    {
+      log_error(TAG(), "setGetCursor: out of range %d", (int) cursor);
+      return 2;
+    }
+    m_cursor = cursor;
+    return 0;
+  }
+
+  virtual size_t getCapacity() const
+  {
+    return m_size;
+  }
+
+private:
+  ShmInMemoryStream(const ShmInMemoryStream & rhs);
+  ShmInMemoryStream & operator=(const ShmInMemoryStream & rhs);
+
+  ShmReceiveState * m_pState;
+  const unsigned int m_slot;
+  const BYTE * const m_pBuffer;
+  const size_t m_size;
+  size_t m_cursor;
+};
+
+// one end of a shared memory connection. both ends are the same after the handshake
+class ShmMessageQueueConnection
+{
+private:
+  // header only class, so the log tag is a function rather than a static data member
+  static const char * TAG()
+  {
+    return "ShmMessageQueue";
+  }
+
+  static const uint32_t HELLO_MAGIC = 0x4D485351;
+  static const uint32_t ACK_MAGIC = 0x4B435351;
+  static const uint32_t CONTROL_MAGIC = 0x474E5251;
+  static const uint32_t PROTOCOL_VERSION = 1;
+  static const size_t CONTROL_SIZE = 256;
+  // record lengths with a special meaning
+  static const uint32_t RECORD_SKIP = 0xFFFFFFFF;
+  static const uint32_t RECORD_ON_SOCKET = 0xFFFFFFFE;
+  // largest message accepted through the socket, same as MessageQueueClient
+  static const uint32_t MAX_MESSAGE_LENGTH = 0x3FFFFFFE;
+  // the ring's memory and four doorbells: data and space, for each direction
+  static const int NUM_FDS = 5;
+
+  struct Hello
+  {
+    uint32_t m_magic;
+    uint32_t m_version;
+    uint32_t m_ring_size;
+  };
+public:
+  static const uint32_t DEFAULT_RING_SIZE = 1024 * 1024;
+
+  // returns a listening socket for accept(), or -1
+  static int listen(const char * const name, const bool name_in_file_system = true)
+  {
+    int fd = -1;
+    int result = 1;
+    do
+    {
+      struct sockaddr_un addr;
+      if(0 != makeAddress(name, name_in_file_system, addr))
+      {
+        result = 2;
+        break;
+      }
+      fd = socket(AF_UNIX, SOCK_STREAM, 0);
+      if(fd < 0)
+      {
+        result = 3;
+        break;
+      }
+      if(name_in_file_system)
+      {
+        (void) unlink(name);
+      }
+      if((0 != bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr))) || (0 != ::listen(fd, 8)))
+      {
+        result = 4;
+        break;
+      }
+      result = 0;
+    } while (false);
+
+    if(0 != result)
+    {
+      log_error(TAG(), "listen failed %d, error [%d][%s]", result, errno, strerror(errno));
+      if(fd >= 0)
+      {
+        close(fd);
+        fd = -1;
+      }
+    }
+    return fd;
+  }
+
+  // client side. returns 0 if nobody listens there, or the handshake fails
+  static ShmMessageQueueConnection * connect(const char * const name, const bool name_in_file_system = true,
+      const uint32_t ring_size = DEFAULT_RING_SIZE)
+  {
+    ShmMessageQueueConnection * pConnection = 0;
+    int sock = -1;
+    int fds[NUM_FDS] = { -1, -1, -1, -1, -1 };
+    void * pMap = MAP_FAILED;
+    size_t map_size = 0;
+    int result = 1;
+    do
+    {
+      if((ring_size < 4096) || (0 != (ring_size & (ring_size - 1))))
+      {
+        result = 2;
+        break;
+      }
+      struct sockaddr_un addr;
+      if(0 != makeAddress(name, name_in_file_system, addr))
+      {
+        result = 3;
+        break;
+      }
+      sock = socket(AF_UNIX, SOCK_STREAM, 0);
+      if(sock < 0)
+      {
+        result = 4;
+        break;
+      }
+      if(0 != ::connect(sock, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)))
+      {
+        // expected when the peer doesn't support shared memory
+        result = 5;
+        break;
+      }
+
+      map_size = 2 * (CONTROL_SIZE + ring_size);
+      fds[0] = createSharedMemory(map_size);
+      if(fds[0] < 0)
+      {
+        result = 6;
+        break;
+      }
+      pMap = mmap(0, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+      if(MAP_FAILED == pMap)
+      {
+        result = 7;
+        break;
+      }
+      for (int i = 0; i < 2; ++i)
+      {
+        ShmRingControl * const pControl = getControl(pMap, ring_size, i);
+        memset(pControl, 0, sizeof(*pControl));
+        pControl->m_magic = CONTROL_MAGIC;
+        pControl->m_capacity = ring_size;
+      }
+      int num_doorbells = 0;
+      for (int i = 1; i < NUM_FDS; ++i)
+      {
+        fds[i] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if(fds[i] >= 0)
+        {
+          ++num_doorbells;
+        }
+      }
+      if((NUM_FDS - 1) != num_doorbells)
+      {
+        result = 8;
+        break;
+      }
+
+      Hello hello;
+      hello.m_magic = HELLO_MAGIC;
+      hello.m_version = PROTOCOL_VERSION;
+      hello.m_ring_size = ring_size;
+      if(0 != sendFds(sock, &hello, sizeof(hello), fds, NUM_FDS))
+      {
+        result = 9;
+        break;
+      }
+      uint32_t ack = 0;
+      if((0 != setReceiveTimeout(sock, 2)) || ((ssize_t) sizeof(ack) != recv(sock, &ack, sizeof(ack), MSG_WAITALL))
+          || (ACK_MAGIC != ack) || (0 != setReceiveTimeout(sock, 0)))
+      {
+        result = 10;
+        break;
+      }
+
+      // the client produces into ring 0 and consumes ring 1
+      pConnection = create(sock, pMap, map_size, ring_size, 0, fds);
+      sock = -1;
+      pMap = MAP_FAILED;
+      if(0 == pConnection)
+      {
+        result = 11;
+        break;
+      }
+      result = 0;
+    } while (false);
+
+    if(0 != result)
+    {
+      if(5 == result)
+      {
+        log_info(TAG(), "connect: [%s] not available, error [%d][%s]", name, errno, strerror(errno));
+      }
+      else
+      {
+        log_error(TAG(), "connect failed %d, error [%d][%s]", result, errno, strerror(errno));
+      }
+      if(sock >= 0)
+      {
+        close(sock);
+      }
+      if(MAP_FAILED != pMap)
+      {
+        munmap(pMap, map_size);
+      }
+    }
+    // the connection dups what it keeps
+    for (int i = 0; i < NUM_FDS; ++i)
+    {
+      if(fds[i] >= 0)
+      {
+        close(fds[i]);
+      }
+    }
+    return pConnection;
+  }
+
+  // server side: accept one client from a listen() socket and complete the handshake
+  static ShmMessageQueueConnection * accept(const int listen_fd)
+  {
+    ShmMessageQueueConnection * pConnection = 0;
+    int sock = -1;
+    int fds[NUM_FDS] = { -1, -1, -1, -1, -1 };
+    void * pMap = MAP_FAILED;
+    size_t map_size = 0;
+    int result = 1;
+    do
+    {
+      sock = ::accept(listen_fd, 0, 0);
+      if(sock < 0)
+      {
+        result = 2;
+        break;
+      }
+      Hello hello;
+      if((0 != setReceiveTimeout(sock, 2)) || (0 != receiveFds(sock, &hello, sizeof(hello), fds, NUM_FDS))
+          || (0 != setReceiveTimeout(sock, 0)))
+      {
+        result = 3;
+        break;
+      }
+      const uint32_t ring_size = hello.m_ring_size;
+      if((HELLO_MAGIC != hello.m_magic) || (PROTOCOL_VERSION != hello.m_version) || (ring_size < 4096)
+          || (0 != (ring_size & (ring_size - 1))))
+      {
+        result = 4;
+        break;
+      }
+      map_size = 2 * (CONTROL_SIZE + ring_size);
+      struct stat st;
+      if((0 != fstat(fds[0], &st)) || ((size_t) st.st_size < map_size))
+      {
+        result = 5;
+        break;
+      }
+      pMap = mmap(0, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+      if(MAP_FAILED == pMap)
+      {
+        result = 6;
+        break;
+      }
+      const ShmRingControl * const pControl0 = getControl(pMap, ring_size, 0);
+      const ShmRingControl * const pControl1 = getControl(pMap, ring_size, 1);
+      if((CONTROL_MAGIC != pControl0->m_magic) || (ring_size != pControl0->m_capacity)
+          || (CONTROL_MAGIC != pControl1->m_magic) || (ring_size != pControl1->m_capacity))
+      {
+        result = 7;
+        break;
+      }
+      const uint32_t ack = ACK_MAGIC;
+      if((ssize_t) sizeof(ack) != ::send(sock, &ack, sizeof(ack), MSG_NOSIGNAL))
+      {
+        result = 8;
+        break;
+      }
+      // the server produces into ring 1 and consumes ring 0
+      pConnection = create(sock, pMap, map_size, ring_size, 1, fds);
+      sock = -1;
+      pMap = MAP_FAILED;
+      if(0 == pConnection)
+      {
+        result = 9;
+        break;
+      }
+      result = 0;
+    } while (false);
+
+    if(0 != result)
+    {
+      log_error(TAG(), "accept failed %d, error [%d][%s]", result, errno, strerror(errno));
+      if(sock >= 0)
+      {
+        close(sock);
+      }
+      if(MAP_FAILED != pMap)
+      {
+        munmap(pMap, map_size);
+      }
+    }
+    for (int i = 0; i < NUM_FDS; ++i)
+    {
+      if(fds[i] >= 0)
+      {
+        close(fds[i]);
+      }
+    }
+    return pConnection;
+  }
+
+  ~ShmMessageQueueConnection()
+  {
+    (void) shutdown();
+    close(m_socket);
+    close(m_tx_data_fd);
+    close(m_tx_space_fd);
+    close(m_rx_data_fd);
+    // the transmit ring shares the mapping with the receive state
+    m_pRxState->release();
+    m_pRxState = 0;
+    delete m_pSendMutex;
+    m_pSendMutex = 0;
+  }
+
+  // multiple access. messages from concurrent calls are never interleaved
+  int send(const MemoryStreamBase * const buffer)
+  {
+    int result = 1;
+    do
+    {
+      if(0 == buffer)
+      {
+        result = 2;
+        break;
+      }
+      AutoLock autolock(m_pSendMutex);
+      if(0 != autolock.ZeroIfLocked())
+      {
+        result = 101;
+        break;
+      }
+      const size_t size = buffer->getSize();
+      if((size < sizeof(uint32_t)) || (size > (MAX_MESSAGE_LENGTH + sizeof(uint32_t))))
+      {
+        result = 3;
+        break;
+      }
+      const uint32_t need = align(sizeof(uint32_t) + size);
+      if(need > (m_capacity / 2))
+      {
+        // too large for the ring: leave a marker so the receiver reads it from the
+        // socket in the right order
+        result = writeRecord(RECORD_ON_SOCKET, 0, 0);
+        if(0 == result)
+        {
+          result = sendAll(buffer->getBuffer(), size);
+        }
+        break;
+      }
+      result = writeRecord((uint32_t) size, buffer->getBuffer(), size);
+    } while (false);
+
+    if(0 != result)
+    {
+      log_error(TAG(), "send failed %d", result);
+    }
+    return result;
+  }
+
+  // same contract and result codes as MessageQueueClient::run_block
+  int run_block(MessageQueueServiceCallback * const callback)
+  {
+    int result = 1;
+    ShmRingControl * const pControl = m_pRxState->getControl();
+    const MemoryStreamBase::BYTE * const pRing = m_pRxState->getRing();
+    do
+    {
+      if(0 == callback)
+      {
+        result = 2;
+        break;
+      }
+      result = 0;
+      while (0 == result)
+      {
+        const uint32_t head = __atomic_load_n(&pControl->m_head, __ATOMIC_ACQUIRE);
+        if(m_rx_read == head)
+        {
+          result = waitForData(pControl);
+          continue;
+        }
+        if(!m_pRxState->hasFreeSlot())
+        {
+          // too many messages still held by the callbacks
+          m_pRxState->sweep();
+          if(!m_pRxState->hasFreeSlot())
+          {
+            struct timespec idle;
+            idle.tv_sec = 0;
+            idle.tv_nsec = 1000000;
+            nanosleep(&idle, 0);
+          }
+          continue;
+        }
+
+        const uint32_t position = m_rx_read & (m_capacity - 1);
+        const uint32_t to_end = m_capacity - position;
+        uint32_t length = 0;
+        memcpy(&length, pRing + position, sizeof(length));
+
+        if(RECORD_SKIP == length)
+        {
+          m_rx_read += to_end;
+          (void) m_pRxState->push(m_rx_read, true);
+          continue;
+        }
+        if(RECORD_ON_SOCKET == length)
+        {
+          m_rx_read += align(sizeof(uint32_t));
+          (void) m_pRxState->push(m_rx_read, true);
+          InMemoryStream * pStream = 0;
+          result = receiveFromSocket(&pStream);
+          if(0 == result)
+          {
+            result = callbackResult(callback->newMsg(pStream));
+          }
+          continue;
+        }
+        // the length is written by the peer; bound it before aligning so
+        // it can not wrap around
+        if((length < sizeof(uint32_t)) || (length > MAX_MESSAGE_LENGTH)
+            || (length > (to_end - sizeof(uint32_t))))
+        {
+          // corrupted ring
+          result = 104;
+          break;
+        }
+        const size_t need = (sizeof(uint32_t) + length + 7) & ~((size_t) 7);
+        if((need > to_end) || (need > (head - m_rx_read)))
+        {
+          // corrupted ring
+          result = 104;
+          break;
+        }
+        m_rx_read += need;
+        const unsigned int slot = m_pRxState->push(m_rx_read, false);
+        InMemoryStream * const pStream = new (std::nothrow) ShmInMemoryStream(m_pRxState, slot,
+            pRing + position + sizeof(uint32_t), length);
+        if(0 == pStream)
+        {
+          m_pRxState->markReleased(slot);
+          result = 106;
+          break;
+        }
+        result = callbackResult(callback->newMsg(pStream));
+      }
+    } while (false);
+
+    if(100 == result)
+    {
+      log_info(TAG(), "run finished without error");
+      result = 0;
+    }
+    else
+    {
+      log_error(TAG(), "run failed %d", result);
+    }
+    return result;
+  }
+
+  // multiple access. wakes up both ends
+  int shutdown()
+  {
+    if(0 != __atomic_exchange_n(&m_shut_down, 1, __ATOMIC_ACQ_REL))
+    {
+      return 0;
+    }
+    __atomic_store_n(&m_pTxControl->m_closed, 1, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&m_pRxState->getControl()->m_closed, 1, __ATOMIC_SEQ_CST);
+    ShmReceiveState::ring(m_tx_data_fd);
+    ShmReceiveState::ring(m_rx_data_fd);
+    ShmReceiveState::ring(m_tx_space_fd);
+    if(0 != ::shutdown(m_socket, SHUT_RDWR))
+    {
+      log_error(TAG(), "shutdown failed. errno %d, [%s]", errno, strerror(errno));
+      return 1;
+    }
+    return 0;
+  }
+
+private:
+  ShmMessageQueueConnection(const int sock, ShmRingControl * const pTxControl,
+      MemoryStreamBase::BYTE * const pTxRing, const uint32_t capacity, ShmReceiveState * const pRxState,
+      const int tx_data_fd, const int tx_space_fd, const int rx_data_fd) :
+      m_socket(sock), m_pTxControl(pTxControl), m_pTxRing(pTxRing), m_capacity(capacity), m_tx_head(0),
+      m_pRxState(pRxState), m_rx_read(0), m_tx_data_fd(tx_data_fd), m_tx_space_fd(tx_space_fd),
+      m_rx_data_fd(rx_data_fd), m_pSendMutex(Mutex::createInstance(TAG())), m_shut_down(0),
+      m_stall_reported(false)
+  {
+  }
+
+  ShmMessageQueueConnection(const ShmMessageQueueConnection & rhs);
+  ShmMessageQueueConnection & operator=(const ShmMessageQueueConnection & rhs);
+
+  static inline uint32_t align(const size_t size)
+  {
+    return (uint32_t) ((size + 7) & ~((size_t) 7));
+  }
+
+  static inline ShmRingControl * getControl(void * const pMap, const uint32_t ring_size, const int index)
+  {
+    return reinterpret_cast<ShmRingControl *>(reinterpret_cast<MemoryStreamBase::BYTE *>(pMap)
+        + (index * (CONTROL_SIZE + ring_size)));
+  }
+
+  static inline MemoryStreamBase::BYTE * getRing(void * const pMap, const uint32_t ring_size, const int index)
+  {
+    return reinterpret_cast<MemoryStreamBase::BYTE *>(getControl(pMap, ring_size, index)) + CONTROL_SIZE;
+  }
+
+  // fds: shared memory, ring 0 data, ring 0 space, ring 1 data, ring 1 space.
+  // 'tx' is the ring this end produces into. takes the socket and the mapping, even on failure
+  static ShmMessageQueueConnection * create(const int sock, void * const pMap, const size_t map_size,
+      const uint32_t ring_size, const int tx, const int fds[NUM_FDS])
+  {
+    const int rx = 1 - tx;
+    const int tx_data_fd = dup(fds[1 + (2 * tx)]);
+    const int tx_space_fd = dup(fds[2 + (2 * tx)]);
+    const int rx_data_fd = dup(fds[1 + (2 * rx)]);
+    const int rx_space_fd = dup(fds[2 + (2 * rx)]);
+    ShmReceiveState * pState = 0;
+    if((tx_data_fd >= 0) && (tx_space_fd >= 0) && (rx_data_fd >= 0) && (rx_space_fd >= 0))
+    {
+      // owns the mapping and rx_space_fd from here on
+      pState = new (std::nothrow) ShmReceiveState(pMap, map_size, getControl(pMap, ring_size, rx),
+          getRing(pMap, ring_size, rx), rx_space_fd);
+    }
+    if(0 == pState)
+    {
+      const int leftovers[] = { sock, tx_data_fd, tx_space_fd, rx_data_fd, rx_space_fd };
+      for (size_t i = 0; i < (sizeof(leftovers) / sizeof(leftovers[0])); ++i)
+      {
+        if(leftovers[i] >= 0)
+        {
+          close(leftovers[i]);
+        }
+      }
+      munmap(pMap, map_size);
+      return 0;
+    }
+    ShmMessageQueueConnection * pConnection = new (std::nothrow) ShmMessageQueueConnection(sock,
+        getControl(pMap, ring_size, tx), getRing(pMap, ring_size, tx), ring_size, pState, tx_data_fd,
+        tx_space_fd, rx_data_fd);
+    if(0 == pConnection)
+    {
+      close(sock);
+      close(tx_data_fd);
+      close(tx_space_fd);
+      close(rx_data_fd);
+      pState->release();
+      return 0;
+    }
+    if(0 == pConnection->m_pSendMutex)
+    {
+      delete pConnection;
+      return 0;
+    }
+    return pConnection;
+  }
+
+  static int makeAddress(const char * const name, const bool name_in_file_system, struct sockaddr_un & addr)
+  {
+    if(0 == name)
+    {
+      return 1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(name_in_file_system)
+    {
+      snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", name);
+    }
+    else
+    {
+      // abstract namespace, the same way MessageQueueClient does it
+      snprintf(addr.sun_path, sizeof(addr.sun_path), " %s", name);
+      addr.sun_path[0] = 0;
+    }
+    return 0;
+  }
+
+  static int createSharedMemory(const size_t size)
+  {
+    int fd = -1;
+#ifdef __NR_memfd_create
+    fd = (int) syscall(__NR_memfd_create, "mq_shm_transport", 1 /* MFD_CLOEXEC */);
+    if((fd >= 0) && (0 != ftruncate(fd, (off_t) size)))
+    {
+      close(fd);
+      fd = -1;
+    }
+#endif
+#ifdef __ANDROID__
+    if(fd < 0)
+    {
+      // kernels before 3.17 don't have memfd
+      fd = open("/dev/ashmem", O_RDWR | O_CLOEXEC);
+      if((fd >= 0)
+          && ((0 != ioctl(fd, ASHMEM_SET_NAME, "mq_shm_transport")) || (0 != ioctl(fd, ASHMEM_SET_SIZE, size))))
+      {
+        close(fd);
+        fd = -1;
+      }
+    }
+#endif
+    return fd;
+  }
+
+  static int setReceiveTimeout(const int sock, const int seconds)
+  {
+    struct timeval timeout;
+    timeout.tv_sec = seconds;
+    timeout.tv_usec = 0;
+    return setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  }
+
+  static int sendFds(const int sock, const void * const pData, const size_t length, const int * const fds,
+      const int num_fds)
+  {
+    struct iovec iov;
+    iov.iov_base = const_cast<void *>(pData);
+    iov.iov_len = length;
+    union
+    {
+      struct cmsghdr m_align;
+      char m_buffer[CMSG_SPACE(sizeof(int) * NUM_FDS)];
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.m_buffer;
+    msg.msg_controllen = CMSG_SPACE(sizeof(int) * num_fds);
+    struct cmsghdr * const pHeader = CMSG_FIRSTHDR(&msg);
+    pHeader->cmsg_level = SOL_SOCKET;
+    pHeader->cmsg_type = SCM_RIGHTS;
+    pHeader->cmsg_len = CMSG_LEN(sizeof(int) * num_fds);
+    memcpy(CMSG_DATA(pHeader), fds, sizeof(int) * num_fds);
+    return ((ssize_t) length == sendmsg(sock, &msg, MSG_NOSIGNAL)) ? 0 : 1;
+  }
+
+  static int receiveFds(const int sock, void * const pData, const size_t length, int * const fds,
+      const int num_fds)
+  {
+    struct iovec iov;
+    iov.iov_base = pData;
+    iov.iov_len = length;
+    union
+    {
+      struct cmsghdr m_align;
+      char m_buffer[CMSG_SPACE(sizeof(int) * NUM_FDS)];
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.m_buffer;
+    msg.msg_controllen = sizeof(control.m_buffer);
+    if((ssize_t) length != recvmsg(sock, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC))
+    {
+      return 1;
+    }
+    const struct cmsghdr * const pHeader = CMSG_FIRSTHDR(&msg);
+    if((0 == pHeader) || (SOL_SOCKET != pHeader->cmsg_level) || (SCM_RIGHTS != pHeader->cmsg_type)
+        || (CMSG_LEN(sizeof(int) * num_fds) != pHeader->cmsg_len))
+    {
+      return 2;
+    }
+    memcpy(fds, CMSG_DATA(pHeader), sizeof(int) * num_fds);
+    return 0;
+  }
+
+  // transmit side. called with m_pSendMutex held
+  int writeRecord(const uint32_t length, const MemoryStreamBase::BYTE * const pData, const size_t size)
+  {
+    const uint32_t need = align(sizeof(uint32_t) + size);
+    uint32_t position = m_tx_head & (m_capacity - 1);
+    const uint32_t to_end = m_capacity - position;
+    // a record never wraps: the rest of the ring is skipped instead
+    const uint32_t total = (to_end < need) ? (to_end + need) : need;
+    while ((m_capacity - (m_tx_head - __atomic_load_n(&m_pTxControl->m_tail, __ATOMIC_ACQUIRE))) < total)
+    {
+      if(0 != __atomic_load_n(&m_pTxControl->m_closed, __ATOMIC_ACQUIRE))
+      {
+        return 103;
+      }
+      __atomic_store_n(&m_pTxControl->m_producer_waiting, 1, __ATOMIC_SEQ_CST);
+      if((m_capacity - (m_tx_head - __atomic_load_n(&m_pTxControl->m_tail, __ATOMIC_SEQ_CST))) >= total)
+      {
+        __atomic_store_n(&m_pTxControl->m_producer_waiting, 0, __ATOMIC_RELAXED);
+        break;
+      }
+      // only a hang-up wakes us up from the socket: messages the peer sends us are
+      // read by run_block, and mustn't make this loop spin
+      const int wait_result = waitFd(m_tx_space_fd, m_socket, POLLRDHUP);
+      if(2 == wait_result)
+      {
+        // the peer died without closing the ring
+        return 103;
+      }
+      if(0 != wait_result)
+      {
+        return 102;
+      }
+    }
+    if(to_end < need)
+    {
+      const uint32_t skip = RECORD_SKIP;
+      memcpy(m_pTxRing + position, &skip, sizeof(skip));
+      m_tx_head += to_end;
+      position = 0;
+    }
+    memcpy(m_pTxRing + position, &length, sizeof(length));
+    if(0 != size)
+    {
+      memcpy(m_pTxRing + position + sizeof(length), pData, size);
+    }
+    m_tx_head += need;
+    __atomic_store_n(&m_pTxControl->m_head, m_tx_head, __ATOMIC_SEQ_CST);
+    if(0 != __atomic_exchange_n(&m_pTxControl->m_consumer_waiting, 0, __ATOMIC_SEQ_CST))
+    {
+      ShmReceiveState::ring(m_tx_data_fd);
+    }
+    return 0;
+  }
+
+  int sendAll(const MemoryStreamBase::BYTE * pData, size_t length)
+  {
+    while (0 != length)
+    {
+      const ssize_t sent = ::send(m_socket, pData, length, MSG_NOSIGNAL);
+      if(sent < 0)
+      {
+        if(EINTR == errno)
+        {
+          continue;
+        }
+        log_error(TAG(), "send error: %d, [%s]", errno, strerror(errno));
+        return 102;
+      }
+      pData += sent;
+      length -= (size_t) sent;
+    }
+    return 0;
+  }
+
+  // waits, without a timeout, until 'fd' is readable or 'other_fd' reports one of
+  // 'other_events'. drains the doorbell. returns 2 if 'other_fd' has been hung up
+  static int waitFd(const int fd, const int other_fd, const short other_events)
+  {
+    struct pollfd fds[2];
+    fds[0].fd = fd;
+    fds[0].events = POLLIN;
+    fds[0].revents = 0;
+    fds[1].fd = other_fd;
+    fds[1].events = other_events;
+    fds[1].revents = 0;
+    if(poll(fds, 2, -1) < 0)
+    {
+      return (EINTR == errno) ? 0 : 1;
+    }
+    if(0 != fds[0].revents)
+    {
+      uint64_t value = 0;
+      if((ssize_t) sizeof(value) != read(fd, &value, sizeof(value)))
+      {
+        // already drained
+      }
+    }
+    return (0 != (fds[1].revents & (POLLRDHUP | POLLHUP | POLLERR))) ? 2 : 0;
+  }
+
+  // receive side: block until the producer publishes something, or the connection closes
+  int waitForData(ShmRingControl * const pControl)
+  {
+    __atomic_store_n(&pControl->m_consumer_waiting, 1, __ATOMIC_SEQ_CST);
+    if(m_rx_read != __atomic_load_n(&pControl->m_head, __ATOMIC_SEQ_CST))
+    {
+      __atomic_store_n(&pControl->m_consumer_waiting, 0, __ATOMIC_RELAXED);
+      return 0;
+    }
+    if(0 != __atomic_load_n(&pControl->m_closed, __ATOMIC_ACQUIRE))
+    {
+      return 103;
+    }
+    // the socket becomes readable when the peer goes away. large messages are only sent
+    // after their marker is in the ring, so data on the socket alone isn't a message yet.
+    // a hang-up is handled below, once the ring has been checked for what came before it
+    if(1 == waitFd(m_rx_data_fd, m_socket, POLLIN))
+    {
+      return 102;
+    }
+    if((0 != __atomic_load_n(&pControl->m_producer_waiting, __ATOMIC_ACQUIRE))
+        && (m_rx_read != __atomic_load_n(&pControl->m_tail, __ATOMIC_ACQUIRE))
+        && (m_rx_read == __atomic_load_n(&pControl->m_head, __ATOMIC_ACQUIRE)))
+    {
+      if(!m_stall_reported)
+      {
+        log_warning(TAG(), "sender is waiting for messages which haven't been deleted yet");
+        m_stall_reported = true;
+      }
+    }
+    else
+    {
+      m_stall_reported = false;
+    }
+    char peek = 0;
+    const ssize_t n = recv(m_socket, &peek, sizeof(peek), MSG_PEEK | MSG_DONTWAIT);
+    if((n >= 0) && (m_rx_read == __atomic_load_n(&pControl->m_head, __ATOMIC_ACQUIRE)))
+    {
+      // closed by the peer, or something which isn't a large message
+      return (0 == n) ? 103 : 104;
+    }
+    return 0;
+  }
+
+  // one message sent through the socket, in the MessageQueueClient format
+  int receiveFromSocket(InMemoryStream ** ppStream)
+  {
+    uint32_t length = 0;
+    if((ssize_t) sizeof(length) != recv(m_socket, &length, sizeof(length), MSG_WAITALL))
+    {
+      return 103;
+    }
+    if(length > MAX_MESSAGE_LENGTH)
+    {
+      return 104;
+    }
+    if(0 == length)
+    {
+      return 105;
+    }
+    MemoryStreamBase::BYTE * const pMessage = new (std::nothrow) MemoryStreamBase::BYTE[length + sizeof(length)];
+    if(0 == pMessage)
+    {
+      return 106;
+    }
+    memcpy(pMessage, &length, sizeof(length));
+    if((ssize_t) length != recv(m_socket, pMessage + sizeof(length), length, MSG_WAITALL))
+    {
+      delete[] pMessage;
+      return 108;
+    }
+    InMemoryStream * const pStream = InMemoryStream::createInstance();
+    if(0 == pStream)
+    {
+      delete[] pMessage;
+      return 109;
+    }
+    const void * pBuffer = pMessage;
+    if(0 != pStream->setBufferOwnership(&pBuffer, length + sizeof(length)))
+    {
+      delete[] pMessage;
+      delete pStream;
+      return 110;
+    }
+    *ppStream = pStream;
+    return 0;
+  }
+
+  static inline int callbackResult(const int rc)
+  {
+    if(MessageQueueServiceCallback::RC_NO_ERROR_CONTINUE == rc)
+    {
+      return 0;
+    }
+    return (MessageQueueServiceCallback::RC_NO_ERROR_STOP_LOOP == rc) ? 100 : 111;
+  }
+
+  const int m_socket;
+  ShmRingControl * const m_pTxControl;
+  MemoryStreamBase::BYTE * const m_pTxRing;
+  const uint32_t m_capacity;
+  uint32_t m_tx_head;
+  ShmReceiveState * m_pRxState;
+  uint32_t m_rx_read;
+  const int m_tx_data_fd;
+  const int m_tx_space_fd;
+  const int m_rx_data_fd;
+  Mutex * m_pSendMutex;
+  int m_shut_down;
+  bool m_stall_reported;
+};
+
+// MessageQueueClient which uses the shared memory transport when the server offers it,
+// and the socket otherwise
+class ShmMessageQueueClient: public MessageQueueClient
+{
+private:
+  // header only class, so the log tag is a function rather than a static data member
+  static const char * TAG()
+  {
+    return "ShmMessageQueueClient";
+  }
+public:
+  static ShmMessageQueueClient * createInstance(
+      const uint32_t ring_size = ShmMessageQueueConnection::DEFAULT_RING_SIZE)
+  {
+    return new (std::nothrow) ShmMessageQueueClient(ring_size);
+  }
+
+  static const char * shmName()
+  {
+    return ".shm";
+  }
+
+  virtual ~ShmMessageQueueClient()
+  {
+    delete m_pShm;
+    m_pShm = 0;
+    delete m_pSocket;
+    m_pSocket = 0;
+    free(m_server_name);
+    m_server_name = 0;
+  }
+
+  virtual int setServerNameDup(const char * const name)
+  {
+    if(0 == name)
+    {
+      log_error(TAG(), "setServerNameDup failed 2");
+      return 2;
+    }
+    char * const copy = strdup(name);
+    if(0 == copy)
+    {
+      log_error(TAG(), "setServerNameDup failed 3");
+      return 3;
+    }
+    free(m_server_name);
+    m_server_name = copy;
+    return 0;
+  }
+
+  virtual int connect(const bool name_in_file_system = true)
+  {
+    int result = 1;
+    do
+    {
+      if((0 == m_server_name) || (0 != m_pShm) || (0 != m_pSocket))
+      {
+        result = 2;
+        break;
+      }
+      const size_t length = strlen(m_server_name) + strlen(shmName()) + 1;
+      char * const shm_name = new (std::nothrow) char[length];
+      if(0 == shm_name)
+      {
+        result = 3;
+        break;
+      }
+      snprintf(shm_name, length, "%s%s", m_server_name, shmName());
+      m_pShm = ShmMessageQueueConnection::connect(shm_name, name_in_file_system, m_ring_size);
+      delete[] shm_name;
+      if(0 != m_pShm)
+      {
+        log_info(TAG(), "connect: using shared memory");
+        result = 0;
+        break;
+      }
+
+      // socket fallback
+      m_pSocket = BatchMessageQueueClient::createInstance();
+      if(0 == m_pSocket)
+      {
+        result = 4;
+        break;
+      }
+      result = m_pSocket->setServerNameDup(m_server_name);
+      if(0 == result)
+      {
+        result = m_pSocket->connect(name_in_file_system);
+      }
+      if(0 != result)
+      {
+        delete m_pSocket;
+        m_pSocket = 0;
+        result = 5;
+        break;
+      }
+      result = 0;
+    } while (false);
+
+    if(0 != result)
+    {
+      log_error(TAG(), "connect failed %d", result);
+    }
+    return result;
+  }
+
+  // true if connected through shared memory
+  inline bool isShared() const
+  {
+    return (0 != m_pShm);
+  }
+
+  virtual int send(const MemoryStreamBase * const buffer)
+  {
+    if(0 != m_pShm)
+    {
+      return m_pShm->send(buffer);
+    }
+    if(0 != m_pSocket)
+    {
+      return m_pSocket->send(buffer);
+    }
+    log_error(TAG(), "send failed: not connected");
+    return 1;
+  }
+
+  virtual int run_block(MessageQueueServiceCallback * const callback)
+  {
+    if(0 != m_pShm)
+    {
+      return m_pShm->run_block(callback);
+    }
+    if(0 != m_pSocket)
+    {
+      return m_pSocket->run_block(callback);
+    }
+    log_error(TAG(), "run_block failed: not connected");
+    return 1;
+  }
+
+  // multiple access. called by any thread which wishes to shutdown communication
+  virtual int shutdown()
+  {
+    if(0 != m_pShm)
+    {
+      return m_pShm->shutdown();
+    }
+    if(0 != m_pSocket)
+    {
+      return m_pSocket->shutdown();
+    }
+    return 0;
+  }
+
+private:
+  explicit ShmMessageQueueClient(const uint32_t ring_size) :
+      m_ring_size(ring_size), m_server_name(0), m_pShm(0), m_pSocket(0)
+  {
+  }
+
+  ShmMessageQueueClient(const ShmMessageQueueClient & rhs);
+  ShmMessageQueueClient & operator=(const ShmMessageQueueClient & rhs);
+
+  const uint32_t m_ring_size;
+  char * m_server_name;
+  ShmMessageQueueConnection * m_pShm;
+  BatchMessageQueueClient * m_pSocket;
+};
+
+} // namespace qc_loc_fw
+
+#endif //#ifndef __XTRAT_WIFI_MESSAGE_QUEUE_SHM_TRANSPORT_H__
@@ -0,0 +1,551 @@
+/*====*====*====*====*====*====*====*====*====*====*====*====*====*====*====*
+
+ Timer wheel
+
+ GENERAL DESCRIPTION
+ This header declares a hashed hierarchical timing wheel for functional
+ module timers: O(1) insert and cancel, and a cheap next deadline query
+
+ Copyright (c) 2015 Qualcomm Technologies, Inc.
+ All Rights Reserved.
+ Confidential and Proprietary - Qualcomm Technologies, Inc.
+ =============================================================================*/
+#ifndef __MQ_CLIENT_TIMER_WHEEL_H__
+#define __MQ_CLIENT_TIMER_WHEEL_H__
+
+#include <new>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include <base_util/log.h>
+#include <base_util/time_routines.h>
+#include <mq_client/mq_client_controller.h>
+
+namespace qc_loc_fw
+{
+
+// Drop-in store for what MqClientControllerBase keeps in its TimerCallbackEntry list:
+// the same (deadline, module, data) triplets, the same removal by module and data,
+// and the same getNearestDeadline signature. a controller owning a TimerWheel calls
+//   getNearestDeadline() to get the timeout for BlockingQueue::pop, and
+//   expire() after every pop, to run TimerCallbacks of every timer which is due
+//
+// time is kept in ticks of 'tick_ms' milliseconds since the wheel was created,
+// measured on one clock (CLOCK_BOOTTIME or CLOCK_MONOTONIC, same as Timestamp).
+// deadlines are rounded up to the next tick, so a timer never fires early.
+//
+// the wheel has NUM_LEVELS levels of SLOTS_PER_LEVEL slots. level 0 holds timers
+// due within one rotation, one tick per slot. level n holds timers due within
+// SLOTS_PER_LEVEL^(n+1) ticks, and each of its slots is moved (cascaded) one level
+// down when the lower level wraps around. a bitmap per level makes the next
+// deadline query a handful of bit scans instead of a walk over every timer.
+// timers are also chained in a hash table keyed on the module pointer, so that
+// removal by (module, data) only compares the timers of that one module
+class TimerWheel
+{
+private:
+  // header only class, so the log tag is a function rather than a static data member
+  static const char * TAG()
+  {
+    return "TimerWheel";
+  }
+public:
+  static const unsigned int SLOT_BITS = 8;
+  static const unsigned int SLOTS_PER_LEVEL = 1 << SLOT_BITS;
+  static const unsigned int NUM_LEVELS = 4;
+  static const unsigned int NUM_MODULE_BUCKETS = 64;
+  static const unsigned int DEFAULT_TICK_MS = 10;
+
+  // opaque, identifies one timer for cancel
+  typedef void * Handle;
+
+  // 'clock_id' must match the clock of the Timestamps passed in later,
+  // e.g. CLOCK_BOOTTIME or CLOCK_MONOTONIC. see loaded() for construction failure
+  explicit TimerWheel(const int clock_id, const unsigned int tick_ms = DEFAULT_TICK_MS) :
+      m_clock_id(clock_id), m_tick_ms((0 != tick_ms) ? tick_ms : DEFAULT_TICK_MS), m_current_tick(0),
+      m_num_timers(0), m_valid(false)
+  {
+    memset(m_slots, 0, sizeof(m_slots));
+    memset(m_bitmap, 0, sizeof(m_bitmap));
+    memset(m_modules, 0, sizeof(m_modules));
+    m_valid = (0 == clock_gettime(m_clock_id, &m_origin));
+    if(!m_valid)
+    {
+      log_error(TAG(), "clock %d not available", m_clock_id);
+    }
+  }
+
+  ~TimerWheel()
+  {
+    for (unsigned int level = 0; level < NUM_LEVELS; ++level)
+    {
+      for (unsigned int index = 0; index < SLOTS_PER_LEVEL; ++index)
+      {
+        Node * pNode = m_slots[level][index];
+        while (0 != pNode)
+        {
+          Node * const pNext = pNode->m_pSlotNext;
+          delete pNode;
+          pNode = pNext;
+        }
+      }
+    }
+  }
+
+  inline bool loaded() const
+  {
+    return m_valid;
+  }
+
+  inline unsigned int getNumOfTimers() const
+  {
+    return m_num_timers;
+  }
+
+  // same semantics as MqClientControllerBase::setLocalTimer with an absolute deadline.
+  // if 'pHandle' is given, it receives a handle for cancel
+  int add(const Timestamp & absolute_timeout, MqClientFunctionalModuleBase * const module,
+      const TimerDataInterface * const data, Handle * const pHandle = 0)
+  {
+    int result = 1;
+    do
+    {
+      if(!m_valid)
+      {
+        result = 2;
+        break;
+      }
+      if(0 == module)
+      {
+        result = 3;
+        break;
+      }
+      uint64_t tick = 0;
+      if(0 != toTick(absolute_timeout, true, tick))
+      {
+        result = 4;
+        break;
+      }
+      Node * const pNode = new (std::nothrow) Node(tick, module, data);
+      if(0 == pNode)
+      {
+        result = 5;
+        break;
+      }
+      insertIntoSlot(pNode);
+      insertIntoModuleBucket(pNode);
+      ++m_num_timers;
+      if(0 != pHandle)
+      {
+        *pHandle = pNode;
+      }
+      result = 0;
+    } while (false);
+
+    if(0 != result)
+    {
+      log_error(TAG(), "add: failed %d", result);
+    }
+    return result;
+  }
+
+  // same semantics as MqClientControllerBase::setLocalTimer with a relative timeout
+  int add(const TimeDiff & timeout_diff, MqClientFunctionalModuleBase * const module,
+      const TimerDataInterface * const data, Handle * const pHandle = 0)
+  {
+    Timestamp now(m_clock_id);
+    return add(now + timeout_diff, module, data, pHandle);
+  }
+
+  // same semantics as MqClientControllerBase::removeLocalTimer: the first timer of 'module'
+  // whose data compares equal (TimerDataInterface::operator ==) to 'data' is removed
+  int remove(const MqClientFunctionalModuleBase * const module, const TimerDataInterface * const data)
+  {
+    for (Node * pNode = m_modules[hashModule(module)]; 0 != pNode; pNode = pNode->m_pModuleNext)
+    {
+      if((module == pNode->m_entry.module) && isSameData(pNode->m_entry.data, data))
+      {
+        return cancel(pNode);
+      }
+    }
+    log_error(TAG(), "remove: timer not found");
+    return 1;
+  }
+
+  // O(1) removal with the handle returned by add. the handle is no longer valid once
+  // the timer has been cancelled or its callback has been run
+  int cancel(const Handle handle)
+  {
+    Node * const pNode = reinterpret_cast<Node *>(handle);
+    if((0 == pNode) || (0 == pNode->m_ppSlotPrev))
+    {
+      log_error(TAG(), "cancel: invalid handle");
+      return 1;
+    }
+    removeFromModuleBucket(pNode);
+    removeFromSlot(pNode);
+    delete pNode;
+    --m_num_timers;
+    return 0;
+  }
+
+  // same signature as MqClientControllerBase::getNearestDeadline.
+  // the deadline returned is never later than the earliest timer. it might be earlier,
+  // when a higher level has to be cascaded first, in which case the caller simply
+  // calls expire and asks again
+  int getNearestDeadline(bool & fgDeadlineSet, Timestamp & timeout) const
+  {
+    fgDeadlineSet = false;
+    if(!m_valid)
+    {
+      return 1;
+    }
+    if(0 == m_num_timers)
+    {
+      return 0;
+    }
+
+    bool found = false;
+    uint64_t nearest = 0;
+    for (unsigned int level = 0; level < NUM_LEVELS; ++level)
+    {
+      const unsigned int shift = level * SLOT_BITS;
+      const unsigned int current_index = (unsigned int) ((m_current_tick >> shift) & (SLOTS_PER_LEVEL - 1));
+      // level 0 holds exact ticks, starting at the current one. higher levels are
+      // cascaded when the level below wraps, so their current slot is already done
+      const unsigned int from = (0 == level) ? current_index : (current_index + 1);
+      unsigned int distance = 0;
+      if(!findNextSlot(level, from & (SLOTS_PER_LEVEL - 1), distance))
+      {
+        continue;
+      }
+      distance += (from - current_index);
+      // tick at which that slot is reached
+      const uint64_t candidate = (0 == level) ? (m_current_tick + distance)
+          : (((m_current_tick >> shift) + distance) << shift);
+      if(!found || (candidate < nearest))
+      {
+        nearest = candidate;
+        found = true;
+      }
+    }
+
+    if(found)
+    {
+      timeout = fromTick(nearest);
+      fgDeadlineSet = true;
+    }
+    return 0;
+  }
+
+  // run the callbacks of every timer due at or before 'now', in deadline order.
+  // callbacks may add or remove timers
+  int expire(const Timestamp & now)
+  {
+    if(!m_valid)
+    {
+      return 1;
+    }
+    uint64_t target = 0;
+    if(0 != toTick(now, false, target))
+    {
+      log_error(TAG(), "expire: bad timestamp");
+      return 2;
+    }
+
+    Node * pExpiredHead = 0;
+    Node ** ppExpiredTail = &pExpiredHead;
+    while ((m_current_tick <= target) && (0 != m_num_timers))
+    {
+      const unsigned int index = (unsigned int) (m_current_tick & (SLOTS_PER_LEVEL - 1));
+
+      // detach the whole slot, and take its timers out of the module hash right away,
+      // so callbacks can't remove a timer which is about to be run
+      Node * pNode = m_slots[0][index];
+      m_slots[0][index] = 0;
+      clearBit(0, index);
+      while (0 != pNode)
+      {
+        Node * const pNext = pNode->m_pSlotNext;
+        removeFromModuleBucket(pNode);
+        --m_num_timers;
+        pNode->m_pSlotNext = 0;
+        pNode->m_ppSlotPrev = 0;
+        *ppExpiredTail = pNode;
+        ppExpiredTail = &pNode->m_pSlotNext;
+        pNode = pNext;
+      }
+
+      // skip over empty slots up to the next occupied one, the end of this rotation,
+      // or just past the target, whichever comes first
+      uint64_t next_tick = m_current_tick + (SLOTS_PER_LEVEL - index);
+      unsigned int distance = 0;
+      if(((index + 1) < SLOTS_PER_LEVEL) && findNextSlot(0, index + 1, distance)
+          && ((index + 1 + distance) < SLOTS_PER_LEVEL))
+      {
+        next_tick = m_current_tick + 1 + distance;
+      }
+      if(next_tick > (target + 1))
+      {
+        next_tick = target + 1;
+      }
+      advanceTo(next_tick);
+    }
+    if((0 == m_num_timers) && (m_current_tick <= target))
+    {
+      // nothing left to cascade, so we can jump straight past the target
+      m_current_tick = target + 1;
+    }
+
+    while (0 != pExpiredHead)
+    {
+      Node * const pNode = pExpiredHead;
+      pExpiredHead = pNode->m_pSlotNext;
+      pNode->m_entry.module->timerCallback(pNode->m_entry.data);
+      delete pNode;
+    }
+    return 0;
+  }
+
+private:
+  struct Node
+  {
+    Node(const uint64_t tick, MqClientFunctionalModuleBase * const module, const TimerDataInterface * const data) :
+        m_tick(tick), m_pSlotNext(0), m_ppSlotPrev(0), m_pModuleNext(0), m_ppModulePrev(0), m_level(0), m_index(0)
+    {
+      m_entry.module = module;
+      m_entry.data = data;
+    }
+    uint64_t m_tick;
+    // doubly linked within its slot, for O(1) unlink
+    Node * m_pSlotNext;
+    Node ** m_ppSlotPrev;
+    // doubly linked within its module hash bucket
+    Node * m_pModuleNext;
+    Node ** m_ppModulePrev;
+    unsigned int m_level;
+    unsigned int m_index;
+    TimerCallbackEntry m_entry;
+  };
+
+  // private copy constructor and assignment operator so that the
+  // the instance can not be copied.
+  TimerWheel(const TimerWheel & rhs);
+  TimerWheel & operator=(const TimerWheel & rhs);
+
+  static bool isSameData(const TimerDataInterface * const lhs, const TimerDataInterface * const rhs)
+  {
+    if((0 == lhs) || (0 == rhs))
+    {
+      return (lhs == rhs);
+    }
+    return (*lhs == *rhs);
+  }
+
+  static unsigned int hashModule(const MqClientFunctionalModuleBase * const module)
+  {
+    // drop the alignment bits, then fold
+    const uintptr_t value = reinterpret_cast<uintptr_t>(module) >> 4;
+    return (unsigned int) ((value ^ (value >> 6) ^ (value >> 12)) % NUM_MODULE_BUCKETS);
+  }
+
+  int toTick(const Timestamp & ts, const bool round_up, uint64_t & tick) const
+  {
+    if((!ts.is_valid()) || (ts.get_clock_id() != m_clock_id))
+    {
+      return 1;
+    }
+    const timespec * const pTs = ts.getTimestampPtr();
+    const int64_t delta_ms_x1000 = ((int64_t) (pTs->tv_sec - m_origin.tv_sec)) * 1000000
+        + (pTs->tv_nsec - m_origin.tv_nsec) / 1000;
+    if(delta_ms_x1000 <= 0)
+    {
+      tick = 0;
+      return 0;
+    }
+    const uint64_t tick_us = (uint64_t) m_tick_ms * 1000;
+    tick = (uint64_t) delta_ms_x1000 / tick_us;
+    if(round_up && (0 != ((uint64_t) delta_ms_x1000 % tick_us)))
+    {
+      ++tick;
+    }
+    return 0;
+  }
+
+  Timestamp fromTick(const uint64_t tick) const
+  {
+    const uint64_t ms = tick * m_tick_ms;
+    timespec ts = m_origin;
+    ts.tv_sec += (time_t) (ms / 1000);
+    ts.tv_nsec += (long) ((ms % 1000) * 1000000);
+    if(ts.tv_nsec >= 1000000000)
+    {
+      ts.tv_sec += 1;
+      ts.tv_nsec -= 1000000000;
+    }
+    return Timestamp(m_clock_id, ts);
+  }
+
+  void insertIntoSlot(Node * const pNode)
+  {
+    uint64_t tick = pNode->m_tick;
+    if(tick < m_current_tick)
+    {
+      // already due, run it at the next expire
+      tick = m_current_tick;
+    }
+    const uint64_t delta = tick - m_current_tick;
+    unsigned int level = 0;
+    while ((level < (NUM_LEVELS - 1)) && (delta >= ((uint64_t) 1 << ((level + 1) * SLOT_BITS))))
+    {
+      ++level;
+    }
+    if(delta >= ((uint64_t) 1 << (NUM_LEVELS * SLOT_BITS)))
+    {
+      // beyond the range of the top level: park it in the last slot reachable,
+      // it will be re-inserted with its real deadline when that slot is cascaded
+      tick = m_current_tick + ((uint64_t) 1 << (NUM_LEVELS * SLOT_BITS)) - 1;
+    }
+    const unsigned int index = (unsigned int) ((tick >> (level * SLOT_BITS)) & (SLOTS_PER_LEVEL - 1));
+
+    pNode->m_level = level;
+    pNode->m_index = index;
+    pNode->m_pSlotNext = m_slots[level][index];
+    pNode->m_ppSlotPrev = &m_slots[level][index];
+    if(0 != pNode->m_pSlotNext)
+    {
+      pNode->m_pSlotNext->m_ppSlotPrev = &pNode->m_pSlotNext;
+    }
+    m_slots[level][index] = pNode;
+    setBit(level, index);
+  }
+
+  void removeFromSlot(Node * const pNode)
+  {
+    *pNode->m_ppSlotPrev = pNode->m_pSlotNext;
+    if(0 != pNode->m_pSlotNext)
+    {
+      pNode->m_pSlotNext->m_ppSlotPrev = pNode->m_ppSlotPrev;
+    }
+    if(0 == m_slots[pNode->m_level][pNode->m_index])
+    {
+      clearBit(pNode->m_level, pNode->m_index);
+    }
+    pNode->m_pSlotNext = 0;
+    pNode->m_ppSlotPrev = 0;
+  }
+
+  void insertIntoModuleBucket(Node * const pNode)
+  {
+    Node ** const ppHead = &m_modules[hashModule(pNode->m_entry.module)];
+    pNode->m_pModuleNext = *ppHead;
+    pNode->m_ppModulePrev = ppHead;
+    if(0 != pNode->m_pModuleNext)
+    {
+      pNode->m_pModuleNext->m_ppModulePrev = &pNode->m_pModuleNext;
+    }
+    *ppHead = pNode;
+  }
+
+  void removeFromModuleBucket(Node * const pNode)
+  {
+    *pNode->m_ppModulePrev = pNode->m_pModuleNext;
+    if(0 != pNode->m_pModuleNext)
+    {
+      pNode->m_pModuleNext->m_ppModulePrev = pNode->m_ppModulePrev;
+    }
+    pNode->m_pModuleNext = 0;
+    pNode->m_ppModulePrev = 0;
+  }
+
+  // move the current slot of 'level' one level down. called when level - 1 wraps around
+  void cascade(const unsigned int level)
+  {
+    if(level >= NUM_LEVELS)
+    {
+      return;
+    }
+    const unsigned int index = (unsigned int) ((m_current_tick >> (level * SLOT_BITS)) & (SLOTS_PER_LEVEL - 1));
+    if(0 == index)
+    {
+      // this level wraps as well, the level above goes first
+      cascade(level + 1);
+    }
+    Node * pNode = m_slots[level][index];
+    m_slots[level][index] = 0;
+    clearBit(level, index);
+    while (0 != pNode)
+    {
+      Node * const pNext = pNode->m_pSlotNext;
+      insertIntoSlot(pNode);
+      pNode = pNext;
+    }
+  }
+
+  // move the current tick forward within the current level 0 rotation, or exactly to
+  // its end. reaching the end of a rotation cascades the next slot of level 1 right
+  // away, so that level 0 is always complete for the rotation being processed
+  void advanceTo(const uint64_t tick)
+  {
+    m_current_tick = tick;
+    if(0 == (m_current_tick & (SLOTS_PER_LEVEL - 1)))
+    {
+      cascade(1);
+    }
+  }
+
+  inline void setBit(const unsigned int level, const unsigned int index)
+  {
+    m_bitmap[level][index >> 6] |= ((uint64_t) 1 << (index & 63));
+  }
+
+  inline void clearBit(const unsigned int level, const unsigned int index)
+  {
+    m_bitmap[level][index >> 6] &= ~((uint64_t) 1 << (index & 63));
+  }
+
+  // distance from 'from' to the next occupied slot of 'level', wrapping around
+  bool findNextSlot(const unsigned int level, const unsigned int from, unsigned int & distance) const
+  {
+    for (unsigned int step = 0; step <= BITMAP_WORDS; ++step)
+    {
+      const unsigned int word = ((from >> 6) + step) % BITMAP_WORDS;
+      uint64_t bits = m_bitmap[level][word];
+      if(0 == step)
+      {
+        // ignore the slots before 'from' in the first word; they are checked after wrapping
+        bits &= ~(uint64_t) 0 << (from & 63);
+      }
+      else if(BITMAP_WORDS == step)
+      {
+        bits &= ~(~(uint64_t) 0 << (from & 63));
+      }
+      if(0 != bits)
+      {
+        const unsigned int index = (word << 6) + (unsigned int) __builtin_ctzll(bits);
+        distance = (index + SLOTS_PER_LEVEL - from) % SLOTS_PER_LEVEL;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  static const unsigned int BITMAP_WORDS = SLOTS_PER_LEVEL / 64;
+
+  const int m_clock_id;
+  const unsigned int m_tick_ms;
+  timespec m_origin;
+  // next tick to be processed by expire
+  uint64_t m_current_tick;
+  unsigned int m_num_timers;
+  bool m_valid;
+
+  Node * m_slots[NUM_LEVELS][SLOTS_PER_LEVEL];
+  uint64_t m_bitmap[NUM_LEVELS][SLOTS_PER_LEVEL / 64];
+  Node * m_modules[NUM_MODULE_BUCKETS];
+};
+
+} // namespace qc_loc_fw
+
+#endif //#ifndef __MQ_CLIENT_TIMER_WHEEL_H__
@@ -0,0 +1,606 @@
+#ifndef __LOWI_BSSID_CACHE_H__
+#define __LOWI_BSSID_CACHE_H__
+
+/*====*====*====*====*====*====*====*====*====*====*====*====*====*====*====*
+
+        LOWI BSSID Cache Interface Header file
+
+GENERAL DESCRIPTION
+  This file contains the structure definitions and function prototypes for
+  LOWIBssidCache, a hash indexed cache of the latest measurement per BSSID
+
+Copyright (c) 2012-2013 Qualcomm Atheros, Inc.
+  All Rights Reserved.
+  Qualcomm Atheros Confidential and Proprietary.
+
+Export of this technology or software is regulated by the U.S. Government.
+Diversion contrary to U.S. law prohibited.
+=============================================================================*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include <base_util/vector.h>
+#include <inc/lowi_const.h>
+#include <inc/lowi_mac_address.h>
+#include <inc/lowi_scan_measurement.h>
+#include <inc/lowi_scan_result_set.h>
+
+namespace qc_loc_fw
+{
+
+/**
+ * Latest measurement kept by LOWIBssidCache for one BSSID
+ */
+struct LOWIBssidCacheEntry
+{
+  /** BSSID packed as upper 24 bits followed by lower 24 bits */
+  uint64 bssid;
+  /** Time stamp of the measurement, same units as
+   *  LOWIMeasurementInfo::rssi_timestamp */
+  int64  rssi_timestamp;
+  /** Primary channel frequency */
+  uint32 frequency;
+  /** Measurement age in msec, -1 if not available */
+  int32  meas_age;
+  /** Signal strength in 0.5dBm */
+  int16  rssi;
+  /** Secure access point or not */
+  bool   isSecure;
+  /** Number of scans that reported this BSSID since it was cached */
+  uint32 numScans;
+
+  /**
+   * Returns the BSSID as LOWIMacAddress
+   * @return LOWIMacAddress BSSID
+   */
+  LOWIMacAddress getBssid () const
+  {
+    LOWIMacAddress mac;
+    (void) mac.setMac ((int) (bssid >> 24), (int) (bssid & 0xFFFFFF));
+    return mac;
+  }
+};
+
+/**
+ * Statistics of a LOWIBssidCache
+ */
+struct LOWIBssidCacheStats
+{
+  /** lookups that found the BSSID */
+  uint64 m_hits;
+  /** lookups that did not find the BSSID */
+  uint64 m_misses;
+  /** BSSIDs added to the cache */
+  uint64 m_inserts;
+  /** cached BSSIDs refreshed by a newer measurement */
+  uint64 m_updates;
+  /** measurements ignored because the cached one was newer */
+  uint64 m_staleUpdates;
+  /** BSSIDs evicted to make room for a new one */
+  uint64 m_evictions;
+  /** BSSIDs dropped by expire () */
+  uint64 m_expirations;
+};
+
+/**
+ * Hash indexed cache of the latest measurement per BSSID.
+ *
+ * Consumers that correlate access points across scans used to search the
+ * scan measurement vectors linearly. LOWIBssidCache keeps one entry per
+ * BSSID in an open addressing table keyed on the packed 48 bit MAC, so
+ * "latest measurement for BSSID X" is O(1), and each new scan is merged
+ * incrementally: an entry is only replaced by a measurement with a newer
+ * time stamp.
+ *
+ * The number of entries is bounded at creation time. When the cache is
+ * full a new BSSID evicts an existing one according to eEvictionPolicy.
+ * Independently of the policy, expire () drops every entry whose
+ * measurement is older than a cut off; entries are kept in time stamp
+ * order so this only touches the entries it removes.
+ *
+ * Entry pointers returned by find () are valid until the next call that
+ * modifies the cache. The cache is not thread safe.
+ */
+class LOWIBssidCache
+{
+public:
+  /**
+   * Defines which entry is evicted when the cache is full
+   */
+  enum eEvictionPolicy
+  {
+    /** Evict the BSSID with the oldest measurement time stamp */
+    EVICT_OLDEST_MEASUREMENT = 0,
+    /** Evict the BSSID that was least recently looked up or updated */
+    EVICT_LEAST_RECENTLY_USED,
+    /** Do not evict, reject new BSSIDs until expire () or remove () */
+    EVICT_NONE
+  };
+
+  /**
+   * Creates a cache
+   * @param uint32 Maximum number of BSSIDs kept
+   * @param eEvictionPolicy Policy applied when the cache is full
+   * @return LOWIBssidCache* NULL on failure
+   */
+  static LOWIBssidCache * createInstance (const uint32 max_entries,
+      const eEvictionPolicy policy = EVICT_OLDEST_MEASUREMENT)
+  {
+    LOWIBssidCache * cache = NULL;
+    if (max_entries > 0 && max_entries < (1u << 30))
+    {
+      cache = new (std::nothrow) LOWIBssidCache (policy);
+      if (NULL != cache && 0 != cache->init (max_entries))
+      {
+        delete cache;
+        cache = NULL;
+      }
+    }
+    return cache;
+  }
+
+  /** Destructor */
+  ~LOWIBssidCache ()
+  {
+    free (mSlots);
+    free (mNodes);
+  }
+
+  /**
+   * Merges one measurement. A BSSID that is not cached yet is added, a
+   * cached one is replaced only if the new measurement is not older.
+   * @param uint64 BSSID packed as in LOWIMacAddress::getFull48 ()
+   * @param uint32 Primary channel frequency
+   * @param int16 Signal strength in 0.5dBm
+   * @param int64 Measurement time stamp
+   * @param int32 Measurement age in msec, -1 if not available
+   * @param bool Secure access point or not
+   * @return 0 for success, 1 if ignored as stale, negative for error
+   */
+  int update (const uint64 bssid, const uint32 frequency, const int16 rssi,
+      const int64 rssi_timestamp, const int32 meas_age = -1,
+      const bool secure = false)
+  {
+    const uint64 key = bssid & BSSID_MASK;
+    uint32 slot = 0;
+    uint32 node = lookup (key, slot);
+    if (INVALID != node)
+    {
+      Node & n = mNodes[node];
+      if (rssi_timestamp < n.entry.rssi_timestamp)
+      {
+        ++mStats.m_staleUpdates;
+        return 1;
+      }
+      fill (n.entry, key, frequency, rssi, rssi_timestamp, meas_age, secure);
+      ++n.entry.numScans;
+      unlink (mAgeList, node, &Node::ageLink);
+      insertByTimestamp (node);
+      unlink (mLruList, node, &Node::lruLink);
+      append (mLruList, node, &Node::lruLink);
+      ++mStats.m_updates;
+      return 0;
+    }
+
+    if (INVALID == mFreeList)
+    {
+      uint32 victim = INVALID;
+      if (EVICT_OLDEST_MEASUREMENT == mPolicy)
+      {
+        victim = mAgeList.head;
+      }
+      else if (EVICT_LEAST_RECENTLY_USED == mPolicy)
+      {
+        victim = mLruList.head;
+      }
+      if (INVALID == victim)
+      {
+        return -1;
+      }
+      erase (victim);
+      ++mStats.m_evictions;
+      // the probe position is no longer valid after a backward shift
+      (void) lookup (key, slot);
+    }
+
+    node = mFreeList;
+    mFreeList = mNodes[node].ageLink.next;
+    Node & n = mNodes[node];
+    fill (n.entry, key, frequency, rssi, rssi_timestamp, meas_age, secure);
+    n.entry.numScans = 1;
+    n.slot = slot;
+    mSlots[slot].key = key;
+    mSlots[slot].node = node;
+    insertByTimestamp (node);
+    append (mLruList, node, &Node::lruLink);
+    ++mNumEntries;
+    ++mStats.m_inserts;
+    return 0;
+  }
+
+  /**
+   * Merges a parsed measurement, using its first LOWIMeasurementInfo
+   * @param LOWIScanMeasurement& Measurement
+   * @return 0 for success, 1 if ignored as stale, negative for error
+   */
+  int update (const LOWIScanMeasurement & meas)
+  {
+    if (0 == meas.measurementsInfo.getNumOfElements () ||
+        NULL == meas.measurementsInfo[0])
+    {
+      return -2;
+    }
+    const LOWIMeasurementInfo * info = meas.measurementsInfo[0];
+    return update (meas.bssid.getFull48 (), meas.frequency, info->rssi,
+        info->rssi_timestamp, info->meas_age, meas.isSecure);
+  }
+
+  /**
+   * Merges all measurements of a scan
+   * @param vector<LOWIScanMeasurement*>& Measurements
+   * @return number of measurements that failed to merge
+   */
+  uint32 merge (const vector <LOWIScanMeasurement*> & measurements)
+  {
+    uint32 failed = 0;
+    for (uint32 ii = 0; ii < measurements.getNumOfElements (); ++ii)
+    {
+      if (NULL == measurements[ii] || update (*measurements[ii]) < 0)
+      {
+        ++failed;
+      }
+    }
+    return failed;
+  }
+
+  /**
+   * Merges all measurements of a scan held in a LOWIScanResultSet
+   * @param LOWIScanResultSet& Scan results
+   * @return number of measurements that failed to merge
+   */
+  uint32 merge (const LOWIScanResultSet & results)
+  {
+    uint32 failed = 0;
+    for (uint32 ii = 0; ii < results.getNumOfMeasurements (); ++ii)
+    {
+      const LOWIScanMeasurementView meas = results[ii];
+      if (update (meas.getBssid48 (), meas.getFrequency (), meas.getRssi (),
+          meas.getRssiTimestamp (), meas.getMeasAge (), meas.isSecure ()) < 0)
+      {
+        ++failed;
+      }
+    }
+    return failed;
+  }
+
+  /**
+   * Returns the latest measurement for a BSSID
+   * @param uint64 BSSID packed as in LOWIMacAddress::getFull48 ()
+   * @return LOWIBssidCacheEntry* NULL if not cached
+   */
+  const LOWIBssidCacheEntry * find (const uint64 bssid)
+  {
+    uint32 slot = 0;
+    const uint32 node = lookup (bssid & BSSID_MASK, slot);
+    if (INVALID == node)
+    {
+      ++mStats.m_misses;
+      return NULL;
+    }
+    ++mStats.m_hits;
+    if (EVICT_LEAST_RECENTLY_USED == mPolicy)
+    {
+      unlink (mLruList, node, &Node::lruLink);
+      append (mLruList, node, &Node::lruLink);
+    }
+    return &mNodes[node].entry;
+  }
+
+  /**
+   * Returns the latest measurement for a BSSID
+   * @param LOWIMacAddress& BSSID
+   * @return LOWIBssidCacheEntry* NULL if not cached
+   */
+  const LOWIBssidCacheEntry * find (const LOWIMacAddress & bssid)
+  {
+    return find ((uint64) bssid.getFull48 ());
+  }
+
+  /**
+   * Removes a BSSID
+   * @param uint64 BSSID packed as in LOWIMacAddress::getFull48 ()
+   * @return 0 for success, non zero if not cached
+   */
+  int remove (const uint64 bssid)
+  {
+    uint32 slot = 0;
+    const uint32 node = lookup (bssid & BSSID_MASK, slot);
+    if (INVALID == node)
+    {
+      return 1;
+    }
+    erase (node);
+    return 0;
+  }
+
+  /**
+   * Removes every BSSID whose measurement is older than the cut off
+   * @param int64 Cut off time stamp, entries with rssi_timestamp less than
+   *              this are removed
+   * @return number of BSSIDs removed
+   */
+  uint32 expire (const int64 oldest_timestamp)
+  {
+    uint32 removed = 0;
+    while (INVALID != mAgeList.head &&
+           mNodes[mAgeList.head].entry.rssi_timestamp < oldest_timestamp)
+    {
+      erase (mAgeList.head);
+      ++removed;
+    }
+    mStats.m_expirations += removed;
+    return removed;
+  }
+
+  /**
+   * Removes all BSSIDs
+   */
+  void clear ()
+  {
+    while (INVALID != mAgeList.head)
+    {
+      erase (mAgeList.head);
+    }
+  }
+
+  /**
+   * Returns the number of cached BSSIDs
+   * @return uint32 number of entries
+   */
+  uint32 getNumOfEntries () const
+  {
+    return mNumEntries;
+  }
+
+  /**
+   * Returns the maximum number of cached BSSIDs
+   * @return uint32 capacity
+   */
+  uint32 getCapacity () const
+  {
+    return mCapacity;
+  }
+
+  /**
+   * Returns the statistics
+   * @param [out] LOWIBssidCacheStats& statistics
+   */
+  void getStats (LOWIBssidCacheStats & stats) const
+  {
+    stats = mStats;
+  }
+
+private:
+  static const uint32 INVALID = 0xFFFFFFFF;
+  static const uint64 BSSID_MASK = 0xFFFFFFFFFFFFULL;
+
+  struct Link
+  {
+    uint32 prev;
+    uint32 next;
+  };
+
+  struct List
+  {
+    uint32 head;
+    uint32 tail;
+  };
+
+  struct Node
+  {
+    LOWIBssidCacheEntry entry;
+    /** ordered by measurement time stamp, also used as free list */
+    Link   ageLink;
+    /** ordered by last use */
+    Link   lruLink;
+    /** position in the hash table */
+    uint32 slot;
+  };
+
+  struct Slot
+  {
+    uint64 key;
+    uint32 node;
+  };
+
+  const eEvictionPolicy mPolicy;
+  Slot *   mSlots;
+  uint32   mSlotMask;
+  Node *   mNodes;
+  uint32   mCapacity;
+  uint32   mNumEntries;
+  uint32   mFreeList;
+  List     mAgeList;
+  List     mLruList;
+  LOWIBssidCacheStats mStats;
+
+  LOWIBssidCache (const eEvictionPolicy policy) :
+      mPolicy(policy), mSlots(NULL), mSlotMask(0), mNodes(NULL),
+      mCapacity(0), mNumEntries(0), mFreeList(INVALID)
+  {
+    mAgeList.head = mAgeList.tail = INVALID;
+    mLruList.head = mLruList.tail = INVALID;
+    memset (&mStats, 0, sizeof (mStats));
+  }
+
+  int init (const uint32 max_entries)
+  {
+    // keep the load factor at or below 0.5 so probe sequences stay short
+    uint32 numSlots = 16;
+    while (numSlots < max_entries * 2)
+    {
+      numSlots <<= 1;
+    }
+    mSlots = (Slot *) malloc (numSlots * sizeof (Slot));
+    mNodes = (Node *) malloc (max_entries * sizeof (Node));
+    if (NULL == mSlots || NULL == mNodes)
+    {
+      return -1;
+    }
+    for (uint32 ii = 0; ii < numSlots; ++ii)
+    {
+      mSlots[ii].node = INVALID;
+    }
+    for (uint32 ii = 0; ii < max_entries; ++ii)
+    {
+      mNodes[ii].ageLink.next = ii + 1;
+    }
+    mNodes[max_entries - 1].ageLink.next = INVALID;
+    mFreeList = 0;
+    mSlotMask = numSlots - 1;
+    mCapacity = max_entries;
+    return 0;
+  }
+
+  static uint32 hash (uint64 key)
+  {
+    // 64 bit finalizer from MurmurHash3, the low bits of a MAC are
+    // sequential for most vendors so they need to be mixed
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ULL;
+    key ^= key >> 33;
+    return (uint32) key;
+  }
+
+  /**
+   * Finds the node of a key, or the empty slot where it would be inserted
+   * @return node index, INVALID if not found
+   */
+  uint32 lookup (const uint64 key, uint32 & slot) const
+  {
+    uint32 pos = hash (key) & mSlotMask;
+    while (INVALID != mSlots[pos].node)
+    {
+      if (key == mSlots[pos].key)
+      {
+        slot = pos;
+        return mSlots[pos].node;
+      }
+      pos = (pos + 1) & mSlotMask;
+    }
+    slot = pos;
+    return INVALID;
+  }
+
+  void erase (const uint32 node)
+  {
+    // backward shift deletion keeps linear probing free of tombstones
+    uint32 hole = mNodes[node].slot;
+    uint32 pos = (hole + 1) & mSlotMask;
+    while (INVALID != mSlots[pos].node)
+    {
+      const uint32 home = hash (mSlots[pos].key) & mSlotMask;
+      if (((pos - home) & mSlotMask) >= ((pos - hole) & mSlotMask))
+      {
+        mSlots[hole] = mSlots[pos];
+        mNodes[mSlots[hole].node].slot = hole;
+        hole = pos;
+      }
+      pos = (pos + 1) & mSlotMask;
+    }
+    mSlots[hole].node = INVALID;
+
+    unlink (mAgeList, node, &Node::ageLink);
+    unlink (mLruList, node, &Node::lruLink);
+    mNodes[node].ageLink.next = mFreeList;
+    mFreeList = node;
+    --mNumEntries;
+  }
+
+  void unlink (List & list, const uint32 node, Link Node::* link)
+  {
+    Link & l = mNodes[node].*link;
+    if (INVALID != l.prev)
+    {
+      (mNodes[l.prev].*link).next = l.next;
+    }
+    else
+    {
+      list.head = l.next;
+    }
+    if (INVALID != l.next)
+    {
+      (mNodes[l.next].*link).prev = l.prev;
+    }
+    else
+    {
+      list.tail = l.prev;
+    }
+  }
+
+  void insertAfter (List & list, const uint32 after, const uint32 node,
+      Link Node::* link)
+  {
+    Link & l = mNodes[node].*link;
+    l.prev = after;
+    l.next = (INVALID != after) ? (mNodes[after].*link).next : list.head;
+    if (INVALID != l.next)
+    {
+      (mNodes[l.next].*link).prev = node;
+    }
+    else
+    {
+      list.tail = node;
+    }
+    if (INVALID != after)
+    {
+      (mNodes[after].*link).next = node;
+    }
+    else
+    {
+      list.head = node;
+    }
+  }
+
+  void append (List & list, const uint32 node, Link Node::* link)
+  {
+    insertAfter (list, list.tail, node, link);
+  }
+
+  void insertByTimestamp (const uint32 node)
+  {
+    // scans arrive roughly in time order, so the walk from the tail
+    // normally stops at the first entry
+    const int64 ts = mNodes[node].entry.rssi_timestamp;
+    uint32 after = mAgeList.tail;
+    while (INVALID != after && mNodes[after].entry.rssi_timestamp > ts)
+    {
+      after = mNodes[after].ageLink.prev;
+    }
+    insertAfter (mAgeList, after, node, &Node::ageLink);
+  }
+
+  static void fill (LOWIBssidCacheEntry & entry, const uint64 key,
+      const uint32 frequency, const int16 rssi, const int64 rssi_timestamp,
+      const int32 meas_age, const bool secure)
+  {
+    entry.bssid = key;
+    entry.frequency = frequency;
+    entry.rssi = rssi;
+    entry.rssi_timestamp = rssi_timestamp;
+    entry.meas_age = meas_age;
+    entry.isSecure = secure;
+  }
+
+  // private copy constructor and assignment operator so that the
+  // the instance can not be copied.
+  LOWIBssidCache (const LOWIBssidCache & rhs);
+  LOWIBssidCache & operator = (const LOWIBssidCache & rhs);
+};
+
+} // namespace qc_loc_fw
+
+#endif //#ifndef __LOWI_BSSID_CACHE_H__
@@ -0,0 +1,700 @@
+#ifndef __LOWI_LOAD_GENERATOR_H__
+#define __LOWI_LOAD_GENERATOR_H__
+
+/*====*====*====*====*====*====*====*====*====*====*====*====*====*====*====*
+
+        LOWI Load Generator Interface Header file
+
+GENERAL DESCRIPTION
+  This file contains the structure definitions and function prototypes for
+  LOWILoadGenerator, which drives a number of LOWIClient instances against
+  the LOWI server and measures throughput and latency
+
+Copyright (c) 2012-2013 Qualcomm Atheros, Inc.
+  All Rights Reserved.
+  Qualcomm Atheros Confidential and Proprietary.
+
+Export of this technology or software is regulated by the U.S. Government.
+Diversion contrary to U.S. law prohibited.
+=============================================================================*/
+
+#include <string.h>
+#include <time.h>
+#include <new>
+#include <base_util/log.h>
+#include <base_util/sync.h>
+#include <base_util/vector.h>
+#include <base_util/time_routines.h>
+#include <base_util/clock_source.h>
+#include <base_util/thread_pool_executor.h>
+#include <inc/lowi_const.h>
+#include <inc/lowi_request.h>
+#include <inc/lowi_response.h>
+#include <inc/lowi_client.h>
+
+namespace qc_loc_fw
+{
+
+/**
+ * Workload of a LOWILoadGenerator.
+ * Every client runs a closed loop: send a request, wait for its response
+ * (or responseTimeoutMs), wait thinkTimeMs, send the next one.
+ */
+struct LOWILoadGeneratorConfig
+{
+  /** LOWIClient instances, each with its own connection to the IPC hub */
+  uint32 numClients;
+  /** How long requests are issued for */
+  uint32 durationMs;
+  /** Pause between a response and the next request of the same client */
+  uint32 thinkTimeMs;
+  /** Share of the requests that are ranging scans, the rest are discovery */
+  uint32 rangingPercent;
+  /** Share of the discovery scans that are CACHE_ONLY, the rest are NORMAL */
+  uint32 cacheOnlyPercent;
+  /** Nodes per ranging scan */
+  uint32 numRangingNodes;
+  /** Time after which a request without response is counted as lost */
+  uint32 responseTimeoutMs;
+  /** Time allowed for outstanding requests to complete after durationMs */
+  uint32 drainTimeoutMs;
+  /** Threads issuing the requests */
+  uint32 numThreads;
+
+  /** Constructor */
+  LOWILoadGeneratorConfig () :
+      numClients (8), durationMs (10000), thinkTimeMs (0), rangingPercent (25),
+      cacheOnlyPercent (50), numRangingNodes (4), responseTimeoutMs (10000),
+      drainTimeoutMs (10000), numThreads (2)
+  {
+  }
+};
+
+/**
+ * Results of a LOWILoadGenerator run.
+ * Latencies are from LOWIClient::sendRequest to
+ * LOWIClientListener::responseReceived.
+ */
+struct LOWILoadGeneratorStats
+{
+  /** Latency histogram: 8 buckets per power of two, so ~12% resolution */
+  static const uint32 NUM_LATENCY_BUCKETS = 136;
+
+  /** requests sent */
+  uint64 m_requestsSent;
+  /** requests LOWIClient::sendRequest refused */
+  uint64 m_sendErrors;
+  /** responses received in time */
+  uint64 m_responses;
+  /** responses whose status is not SCAN_STATUS_SUCCESS */
+  uint64 m_failedResponses;
+  /** requests that got no response within responseTimeoutMs */
+  uint64 m_timeouts;
+  /** responses that arrived after their request timed out */
+  uint64 m_lateResponses;
+  /** scan measurements received */
+  uint64 m_measurements;
+  /** sum of the latencies of the responses received in time */
+  uint64 m_latencyTotalMs;
+  /** smallest latency */
+  uint64 m_latencyMinMs;
+  /** largest latency */
+  uint64 m_latencyMaxMs;
+  /** time from the first request to the end of the run */
+  uint64 m_elapsedMs;
+  /** responses by latency, see getLatencyBucket */
+  uint64 m_latencyHistogram[NUM_LATENCY_BUCKETS];
+
+  /**
+   * Returns the histogram bucket of a latency. Latencies below 8 msec get
+   * a bucket each, above that every power of two is split in 8.
+   * @param uint64 Latency in msec
+   * @return uint32 bucket index
+   */
+  static uint32 getLatencyBucket (const uint64 latency_ms)
+  {
+    if (latency_ms < 8)
+    {
+      return (uint32) latency_ms;
+    }
+    uint32 exponent = 63 - __builtin_clzll (latency_ms);
+    uint32 bucket = 8 * (exponent - 2) + (uint32) ((latency_ms >> (exponent - 3)) & 7);
+    return (bucket < NUM_LATENCY_BUCKETS) ? bucket : NUM_LATENCY_BUCKETS - 1;
+  }
+
+  /**
+   * Returns the largest latency that falls in a bucket
+   * @param uint32 bucket index
+   * @return uint64 Latency in msec
+   */
+  static uint64 getBucketUpperBoundMs (const uint32 bucket)
+  {
+    if (bucket < 8)
+    {
+      return bucket;
+    }
+    const uint32 exponent = bucket / 8 + 2;
+    return ((uint64) (8 + bucket % 8 + 1) << (exponent - 3)) - 1;
+  }
+
+  /**
+   * Returns a latency percentile, to the resolution of the histogram
+   * @param uint32 percentile, 0 - 100
+   * @return uint64 Latency in msec, 0 if there were no responses
+   */
+  uint64 getLatencyPercentileMs (const uint32 percentile) const
+  {
+    const uint64 rank = (m_responses * percentile + 99) / 100;
+    uint64 count = 0;
+    for (uint32 ii = 0; ii < NUM_LATENCY_BUCKETS; ++ii)
+    {
+      count += m_latencyHistogram[ii];
+      if (0 != count && count >= rank)
+      {
+        const uint64 bound = getBucketUpperBoundMs (ii);
+        return (bound < m_latencyMaxMs) ? bound : m_latencyMaxMs;
+      }
+    }
+    return 0;
+  }
+
+  /**
+   * Returns the throughput of the run
+   * @return uint64 responses per second
+   */
+  uint64 getResponsesPerSec () const
+  {
+    return (0 == m_elapsedMs) ? 0 : m_responses * 1000 / m_elapsedMs;
+  }
+};
+
+/**
+ * Load generator for LOWI.
+ *
+ * Creates numClients LOWIClient instances and keeps each of them busy
+ * with a closed loop of discovery and ranging scans, then reports
+ * throughput and the latency distribution. Pointed at a
+ * LOWIStandInServer with fixed latencies it measures the overhead of the
+ * IPC hub, the postcard encoding and LOWIClient itself; pointed at the
+ * real LOWI server it measures how the server copes with concurrent
+ * clients.
+ *
+ * Ranging scans target the BSSIDs LOWIStandInServer reports, so against
+ * the stand-in every ranging node gets a measurement.
+ */
+class LOWILoadGenerator
+{
+public:
+  /**
+   * Creates the generator and its clients. Blocks until every LOWIClient
+   * is registered with the IPC hub.
+   * @param LOWILoadGeneratorConfig& Workload
+   * @param bool To enable / disable LOWIClient logging
+   * @param LOWIClient::eLogLevel LOWIClient log level
+   * @return LOWILoadGenerator* NULL on failure
+   */
+  static LOWILoadGenerator * createInstance (const LOWILoadGeneratorConfig & config,
+      const bool enableLogging = false,
+      const LOWIClient::eLogLevel log_level = LOWIClient::LL_INFO)
+  {
+    LOWILoadGenerator * generator = new (std::nothrow) LOWILoadGenerator (config);
+    if (NULL != generator && 0 != generator->init (enableLogging, log_level))
+    {
+      delete generator;
+      generator = NULL;
+    }
+    return generator;
+  }
+
+  /** Destructor */
+  ~LOWILoadGenerator ()
+  {
+    if (NULL != mExecutor)
+    {
+      mExecutor->shutdown ();
+    }
+    for (uint32 ii = 0; ii < mClients.getNumOfElements (); ++ii)
+    {
+      delete mClients[ii];
+    }
+    delete mExecutor;
+    delete mMutex;
+  }
+
+  /**
+   * Runs the workload. Blocks for durationMs plus the time it takes the
+   * outstanding requests to complete, at most drainTimeoutMs.
+   * Can be called more than once; statistics start from zero every time.
+   * @param LOWILoadGeneratorStats& results of the run
+   * @return int 0 on success, non-zero if no request could be issued
+   */
+  int run (LOWILoadGeneratorStats & stats)
+  {
+    {
+      AutoLock autolock (mMutex);
+      memset (&mStats, 0, sizeof (mStats));
+      mStats.m_latencyMinMs = ~((uint64) 0);
+      mStartMs = nowMs ();
+      mRunning = true;
+    }
+
+    int result = 0;
+    for (uint32 ii = 0; ii < mClients.getNumOfElements (); ++ii)
+    {
+      if (0 != scheduleNext (mClients[ii], 0))
+      {
+        result = 1;
+      }
+    }
+
+    const int64 stop_ms = mStartMs + mConfig.durationMs;
+    sleepUntil (stop_ms);
+    {
+      AutoLock autolock (mMutex);
+      mRunning = false;
+    }
+    const int64 drain_end_ms = stop_ms + mConfig.drainTimeoutMs;
+    while (nowMs () < drain_end_ms && 0 != getNumOutstanding ())
+    {
+      sleepUntil (nowMs () + DRAIN_POLL_MS);
+    }
+
+    AutoLock autolock (mMutex);
+    mStats.m_elapsedMs = (uint64) (nowMs () - mStartMs);
+    if (0 == mStats.m_responses)
+    {
+      mStats.m_latencyMinMs = 0;
+    }
+    stats = mStats;
+    if (0 != result)
+    {
+      log_error (TAG (), "run: failed to issue requests");
+    }
+    return result;
+  }
+
+  /**
+   * Logs the results of a run
+   * @param LOWILoadGeneratorStats& results
+   */
+  static void logStats (const LOWILoadGeneratorStats & stats)
+  {
+    log_info (TAG (), "sent %llu (errors %llu), responses %llu (failed %llu),"
+        " timeouts %llu, late %llu, measurements %llu in %llu ms: %llu responses/s",
+        (unsigned long long) stats.m_requestsSent,
+        (unsigned long long) stats.m_sendErrors,
+        (unsigned long long) stats.m_responses,
+        (unsigned long long) stats.m_failedResponses,
+        (unsigned long long) stats.m_timeouts,
+        (unsigned long long) stats.m_lateResponses,
+        (unsigned long long) stats.m_measurements,
+        (unsigned long long) stats.m_elapsedMs,
+        (unsigned long long) stats.getResponsesPerSec ());
+    log_info (TAG (), "latency ms: min %llu, avg %llu, p50 %llu, p90 %llu,"
+        " p99 %llu, max %llu",
+        (unsigned long long) stats.m_latencyMinMs,
+        (unsigned long long) ((0 == stats.m_responses) ? 0 :
+            stats.m_latencyTotalMs / stats.m_responses),
+        (unsigned long long) stats.getLatencyPercentileMs (50),
+        (unsigned long long) stats.getLatencyPercentileMs (90),
+        (unsigned long long) stats.getLatencyPercentileMs (99),
+        (unsigned long long) stats.m_latencyMaxMs);
+  }
+
+private:
+  // header only class, so the log tag is a function rather than a static data member
+  static const char * TAG ()
+  {
+    return "LOWILoadGenerator";
+  }
+
+  static const uint32 DRAIN_POLL_MS = 10;
+  /** request ids are client index * ID_STRIDE + sequence number */
+  static const uint32 ID_STRIDE = 0x100000;
+
+  /** One LOWIClient and its single outstanding request */
+  class Client : public LOWIClientListener
+  {
+  public:
+    LOWILoadGenerator * const mGenerator;
+    const uint32 mIndex;
+    LOWIClient * mClient;
+    /** id of the outstanding request, 0 if none */
+    uint32 mOutstandingId;
+    uint32 mSequence;
+    int64 mSentMs;
+    uint32 mRandom;
+
+    Client (LOWILoadGenerator * const generator, const uint32 index) :
+        mGenerator (generator), mIndex (index), mClient (NULL),
+        mOutstandingId (0), mSequence (0), mSentMs (0), mRandom (index + 1)
+    {
+    }
+
+    virtual ~Client ()
+    {
+      delete mClient;
+    }
+
+    virtual void responseReceived (LOWIResponse * response)
+    {
+      mGenerator->handleResponse (this, response);
+    }
+  };
+
+  /** Sends the next request of a client */
+  class IssueTask : public Runnable
+  {
+  public:
+    explicit IssueTask (Client * const client) :
+        mClient (client)
+    {
+    }
+
+    virtual void run ()
+    {
+      mClient->mGenerator->issue (mClient);
+    }
+
+  private:
+    Client * const mClient;
+  };
+
+  /** Gives up on a request that got no response */
+  class TimeoutTask : public Runnable
+  {
+  public:
+    TimeoutTask (Client * const client, const uint32 request_id) :
+        mClient (client), mRequestId (request_id)
+    {
+    }
+
+    virtual void run ()
+    {
+      mClient->mGenerator->handleTimeout (mClient, mRequestId);
+    }
+
+  private:
+    Client * const mClient;
+    const uint32 mRequestId;
+  };
+
+  const LOWILoadGeneratorConfig mConfig;
+  vector <Client *> mClients;
+  ThreadPoolExecutor * mExecutor;
+  /** protects everything below and the request state of the clients */
+  Mutex * mMutex;
+  bool mRunning;
+  int64 mStartMs;
+  LOWILoadGeneratorStats mStats;
+
+  explicit LOWILoadGenerator (const LOWILoadGeneratorConfig & config) :
+      mConfig (config), mExecutor (NULL), mMutex (NULL), mRunning (false),
+      mStartMs (0)
+  {
+    memset (&mStats, 0, sizeof (mStats));
+  }
+
+  /**
+   * private copy constructor and assignment operator so that the
+   * the instance can not be copied.
+   */
+  LOWILoadGenerator (const LOWILoadGenerator & rhs);
+  LOWILoadGenerator & operator= (const LOWILoadGenerator & rhs);
+
+  int init (const bool enableLogging, const LOWIClient::eLogLevel log_level)
+  {
+    int result = 1;
+    do
+    {
+      if (0 == mConfig.numClients || mConfig.numClients >= (0xFFFFFFFF / ID_STRIDE))
+      {
+        result = 2;
+        break;
+      }
+      mMutex = Mutex::createInstance ("LOWILoadGenerator");
+      if (NULL == mMutex)
+      {
+        result = 3;
+        break;
+      }
+      mExecutor = ThreadPoolExecutor::createInstance ("LOWILoadGenerator",
+          (0 == mConfig.numThreads) ? 1 : mConfig.numThreads);
+      if (NULL == mExecutor)
+      {
+        result = 4;
+        break;
+      }
+      uint32 ii = 0;
+      for (; ii < mConfig.numClients; ++ii)
+      {
+        Client * const client = new (std::nothrow) Client (this, ii);
+        if (NULL == client || 0 != mClients.push_back (client))
+        {
+          delete client;
+          break;
+        }
+        client->mClient = LOWIClient::createInstance (client, enableLogging, log_level);
+        if (NULL == client->mClient)
+        {
+          break;
+        }
+      }
+      if (ii != mConfig.numClients)
+      {
+        result = 5;
+        break;
+      }
+      result = 0;
+    } while (false);
+
+    if (0 != result)
+    {
+      log_error (TAG (), "init: failed %d", result);
+    }
+    return result;
+  }
+
+  static int64 nowMs ()
+  {
+    return ClockSource::now_ms (CLOCK_MONOTONIC, ClockSource::PRECISION_EXACT);
+  }
+
+  static void sleepUntil (const int64 deadline_ms)
+  {
+    int64 now = nowMs ();
+    while (now < deadline_ms)
+    {
+      const int64 remaining = deadline_ms - now;
+      timespec ts;
+      ts.tv_sec = (time_t) (remaining / 1000);
+      ts.tv_nsec = (long) ((remaining % 1000) * 1000000);
+      (void) nanosleep (&ts, NULL);
+      now = nowMs ();
+    }
+  }
+
+  uint32 getNumOutstanding ()
+  {
+    AutoLock autolock (mMutex);
+    uint32 count = 0;
+    for (uint32 ii = 0; ii < mClients.getNumOfElements (); ++ii)
+    {
+      if (0 != mClients[ii]->mOutstandingId)
+      {
+        ++count;
+      }
+    }
+    return count;
+  }
+
+  int scheduleNext (Client * const client, const uint32 delay_ms)
+  {
+    IssueTask * const task = new (std::nothrow) IssueTask (client);
+    if (NULL == task)
+    {
+      return -1;
+    }
+    TimeDiff delay;
+    delay.add_msec ((int) delay_ms);
+    if (0 != mExecutor->schedule (task, delay))
+    {
+      delete task;
+      return -1;
+    }
+    return 0;
+  }
+
+  /** linear congruential generator, uniform in [0, 100). caller holds mMutex */
+  static uint32 nextPercent (Client * const client)
+  {
+    client->mRandom = client->mRandom * 1103515245u + 12345u;
+    return (client->mRandom >> 8) % 100;
+  }
+
+  /** caller holds mMutex */
+  LOWIRequest * createRequest (Client * const client, const uint32 request_id)
+  {
+    if (nextPercent (client) < mConfig.rangingPercent)
+    {
+      vector <LOWINodeInfo> nodes;
+      for (uint32 ii = 0; ii < mConfig.numRangingNodes; ++ii)
+      {
+        // the access points LOWIStandInServer reports, one on each channel
+        const uint32 ap = (client->mIndex + ii) % 11;
+        LOWINodeInfo node;
+        node.bssid = LOWIMacAddress (0x02, 0x10, 0x57, 0, 0, (uint8) ap);
+        node.frequency = 2412 + 5 * ap;
+        node.nodeType = ACCESS_POINT;
+        node.rttType = RTT3_RANGING;
+        if (0 != nodes.push_back (node))
+        {
+          return NULL;
+        }
+      }
+      return new (std::nothrow) LOWIRangingScanRequest (request_id, nodes, 0);
+    }
+    if (nextPercent (client) < mConfig.cacheOnlyPercent)
+    {
+      return LOWIDiscoveryScanRequest::createCacheOnlyRequest (request_id,
+          LOWIDiscoveryScanRequest::BAND_ALL, 10, 0, false);
+    }
+    return LOWIDiscoveryScanRequest::createFreshScanRequest (request_id,
+        LOWIDiscoveryScanRequest::BAND_ALL, LOWIDiscoveryScanRequest::PASSIVE_SCAN,
+        10, 0, LOWIDiscoveryScanRequest::NORMAL);
+  }
+
+  /** Runs on the executor */
+  void issue (Client * const client)
+  {
+    LOWIRequest * request = NULL;
+    uint32 request_id = 0;
+    {
+      AutoLock autolock (mMutex);
+      if (!mRunning || 0 != client->mOutstandingId)
+      {
+        return;
+      }
+      client->mSequence = (client->mSequence + 1) % ID_STRIDE;
+      if (0 == client->mSequence)
+      {
+        client->mSequence = 1;
+      }
+      request_id = (client->mIndex + 1) * ID_STRIDE + client->mSequence;
+      request = createRequest (client, request_id);
+      if (NULL == request)
+      {
+        ++mStats.m_sendErrors;
+        return;
+      }
+      // set before sending, the response may arrive before sendRequest returns
+      client->mOutstandingId = request_id;
+      client->mSentMs = nowMs ();
+    }
+
+    const LOWIClient::eRequestStatus status = client->mClient->sendRequest (request);
+    delete request;
+
+    if (LOWIClient::STATUS_OK != status)
+    {
+      log_warning (TAG (), "issue: client %u sendRequest failed %d",
+          client->mIndex, (int) status);
+      {
+        AutoLock autolock (mMutex);
+        ++mStats.m_sendErrors;
+        if (request_id == client->mOutstandingId)
+        {
+          client->mOutstandingId = 0;
+        }
+      }
+      // back off instead of spinning on a broken connection
+      (void) scheduleNext (client, mConfig.thinkTimeMs + DRAIN_POLL_MS);
+      return;
+    }
+
+    {
+      AutoLock autolock (mMutex);
+      ++mStats.m_requestsSent;
+    }
+    TimeoutTask * const task = new (std::nothrow) TimeoutTask (client, request_id);
+    if (NULL != task)
+    {
+      TimeDiff timeout;
+      timeout.add_msec ((int) mConfig.responseTimeoutMs);
+      if (0 != mExecutor->schedule (task, timeout))
+      {
+        delete task;
+      }
+    }
+  }
+
+  /** Runs on the LOWIClient receiver thread */
+  void handleResponse (Client * const client, LOWIResponse * const response)
+  {
+    uint32 measurements = 0;
+    LOWIResponse::eScanStatus status = LOWIResponse::SCAN_STATUS_SUCCESS;
+    switch (response->getResponseType ())
+    {
+    case LOWIResponse::DISCOVERY_SCAN:
+      {
+        LOWIDiscoveryScanResponse * const resp =
+            static_cast<LOWIDiscoveryScanResponse *> (response);
+        measurements = resp->scanMeasurements.getNumOfElements ();
+        status = resp->scanStatus;
+        break;
+      }
+    case LOWIResponse::RANGING_SCAN:
+      {
+        LOWIRangingScanResponse * const resp =
+            static_cast<LOWIRangingScanResponse *> (response);
+        measurements = resp->scanMeasurements.getNumOfElements ();
+        status = resp->scanStatus;
+        break;
+      }
+    case LOWIResponse::LOWI_STATUS:
+      status = static_cast<LOWIStatusResponse *> (response)->scanStatus;
+      break;
+    default:
+      break;
+    }
+
+    bool next = false;
+    {
+      AutoLock autolock (mMutex);
+      if (response->getRequestId () != client->mOutstandingId)
+      {
+        ++mStats.m_lateResponses;
+        return;
+      }
+      client->mOutstandingId = 0;
+      const uint64 latency = (uint64) (nowMs () - client->mSentMs);
+      ++mStats.m_responses;
+      mStats.m_measurements += measurements;
+      mStats.m_latencyTotalMs += latency;
+      if (latency < mStats.m_latencyMinMs)
+      {
+        mStats.m_latencyMinMs = latency;
+      }
+      if (latency > mStats.m_latencyMaxMs)
+      {
+        mStats.m_latencyMaxMs = latency;
+      }
+      ++mStats.m_latencyHistogram[LOWILoadGeneratorStats::getLatencyBucket (latency)];
+      if (LOWIResponse::SCAN_STATUS_SUCCESS != status)
+      {
+        ++mStats.m_failedResponses;
+      }
+      next = mRunning;
+    }
+    if (next)
+    {
+      (void) scheduleNext (client, mConfig.thinkTimeMs);
+    }
+  }
+
+  /** Runs on the executor */
+  void handleTimeout (Client * const client, const uint32 request_id)
+  {
+    bool next = false;
+    {
+      AutoLock autolock (mMutex);
+      if (request_id != client->mOutstandingId)
+      {
+        return;
+      }
+      client->mOutstandingId = 0;
+      ++mStats.m_timeouts;
+      next = mRunning;
+    }
+    log_warning (TAG (), "handleTimeout: client %u request %u got no response",
+        client->mIndex, request_id);
+    if (next)
+    {
+      (void) scheduleNext (client, mConfig.thinkTimeMs);
+    }
+  }
+};
+
+} // namespace qc_loc_fw
+
+#endif //#ifndef __LOWI_LOAD_GENERATOR_H__
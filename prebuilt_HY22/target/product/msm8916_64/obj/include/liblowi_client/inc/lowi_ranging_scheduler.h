@@ -0,0 +1,866 @@
+#ifndef __LOWI_RANGING_SCHEDULER_H__
+#define __LOWI_RANGING_SCHEDULER_H__
+
+/*====*====*====*====*====*====*====*====*====*====*====*====*====*====*====*
+
+        LOWI Ranging Scheduler Interface Header file
+
+GENERAL DESCRIPTION
+  This file contains the structure definitions and function prototypes for
+  LOWIRangingScheduler, which aligns periodic ranging targets onto a shared
+  timeline and batches them into as few ranging requests as possible
+
+Copyright (c) 2012-2013 Qualcomm Atheros, Inc.
+  All Rights Reserved.
+  Qualcomm Atheros Confidential and Proprietary.
+
+Export of this technology or software is regulated by the U.S. Government.
+Diversion contrary to U.S. law prohibited.
+=============================================================================*/
+
+#include <time.h>
+#include <new>
+#include <base_util/log.h>
+#include <base_util/sync.h>
+#include <base_util/vector.h>
+#include <base_util/clock_source.h>
+#include <base_util/time_routines.h>
+#include <base_util/thread_pool_executor.h>
+#include <inc/lowi_const.h>
+#include <inc/lowi_request.h>
+#include <inc/lowi_response.h>
+#include <inc/lowi_client.h>
+
+namespace qc_loc_fw
+{
+
+/**
+ * Statistics of a LOWIRangingScheduler
+ */
+struct LOWIRangingSchedulerStats
+{
+  /** periodic ranging requests accepted from clients */
+  uint64 m_sessions;
+  /** ranging targets added by those requests */
+  uint64 m_targetsAdded;
+  /** ranging targets removed by LOWICancelRangingScanRequest */
+  uint64 m_targetsCancelled;
+  /** ranging requests sent to LOWI */
+  uint64 m_requestsSent;
+  /** wifi nodes carried by those requests */
+  uint64 m_nodesSent;
+  /** due targets that shared a node with another session's target */
+  uint64 m_nodesShared;
+  /** due targets skipped because their previous measurement was
+   *  still outstanding */
+  uint64 m_skippedInFlight;
+  /** ranging responses delivered to clients */
+  uint64 m_reportsDelivered;
+  /** outstanding ranging requests given up on */
+  uint64 m_timeouts;
+};
+
+/**
+ * Client side scheduler for periodic RTT ranging.
+ *
+ * A LOWIPeriodicRangingScanRequest is serviced with its own periodicity,
+ * so many overlapping periodic sessions produce many small, unaligned
+ * ranging bursts, and a peer that is in several sessions is ranged once
+ * per session. LOWIRangingScheduler takes the periodic requests instead
+ * and drives LOWI with one-shot LOWIRangingScanRequests:
+ *
+ *  - every target period is rounded to a multiple of the scheduler tick
+ *    (never below LOWI_MIN_MEAS_PERIOD) and its measurements are placed on
+ *    absolute multiples of that period, so targets with the same or
+ *    commensurate periods come due on the same tick;
+ *  - on each tick all due targets are collected, a peer wanted by several
+ *    sessions with the same ranging parameters is ranged once, and the
+ *    peers are packed into requests of at most the per request node limit
+ *    (LOWI supports 16);
+ *  - a target whose previous measurement has not come back yet is not
+ *    requested again on that tick.
+ *
+ * Each session keeps receiving LOWIRangingScanResponses with its own
+ * request id, with the measurements of its own targets and measurementNum
+ * counting that target's measurements, at the rate it asked for. The first
+ * measurement of a target is taken on the next tick, so the interval to
+ * the second one may be shorter than the period, never longer.
+ *
+ * LOWICancelRangingScanRequest removes the listed peers from the
+ * sessions of the same listener; results still in flight for them are
+ * dropped.
+ *
+ * The timeline runs on the given ThreadPoolExecutor; with no executor the
+ * owner calls tick () itself. The executor must be shut down before the
+ * scheduler is deleted. Responses passed to listeners are owned by the
+ * scheduler and deleted once the listener returns. Listeners are called
+ * from the LOWIClient receiver thread without any scheduler lock held.
+ */
+class LOWIRangingScheduler : public LOWIClientListener
+{
+public:
+  /** Granularity of the shared timeline */
+  static const uint32 DEFAULT_TICK_MS = 100;
+  /** Number of wifi nodes LOWI accepts in one ranging request */
+  static const uint32 DEFAULT_MAX_NODES_PER_REQUEST = 16;
+  /** Time after which an outstanding ranging request is considered lost */
+  static const uint32 IN_FLIGHT_TIMEOUT_MS = 10000;
+
+  /**
+   * Creates the scheduler and its LOWIClient. Blocks until the LOWIClient
+   * is registered with the IPC hub.
+   * @param ThreadPoolExecutor* Executor that runs the timeline, or NULL if
+   *        the owner calls tick ()
+   * @param uint32 Maximum number of wifi nodes per ranging request
+   * @param uint32 Timeline granularity in msec
+   * @param bool To enable / disable LOWIClient logging
+   * @param LOWIClient::eLogLevel LOWIClient log level
+   * @return LOWIRangingScheduler* NULL on failure
+   */
+  static LOWIRangingScheduler * createInstance (
+      ThreadPoolExecutor * const executor,
+      const uint32 max_nodes_per_request = DEFAULT_MAX_NODES_PER_REQUEST,
+      const uint32 tick_ms = DEFAULT_TICK_MS,
+      const bool enableLogging = false,
+      const LOWIClient::eLogLevel log_level = LOWIClient::LL_INFO)
+  {
+    LOWIRangingScheduler * scheduler = NULL;
+    if (max_nodes_per_request > 0 && tick_ms > 0)
+    {
+      scheduler = new (std::nothrow) LOWIRangingScheduler (executor,
+          max_nodes_per_request, tick_ms);
+      if (NULL != scheduler && 0 != scheduler->init (enableLogging, log_level))
+      {
+        delete scheduler;
+        scheduler = NULL;
+      }
+    }
+    return scheduler;
+  }
+
+  /** Destructor */
+  virtual ~LOWIRangingScheduler ()
+  {
+    // delete the client first so no response arrives while tearing down
+    delete mClient;
+    for (uint32 ii = 0; ii < mTargets.getNumOfElements (); ++ii)
+    {
+      delete mTargets[ii];
+    }
+    for (uint32 ii = 0; ii < mBatches.getNumOfElements (); ++ii)
+    {
+      delete mBatches[ii];
+    }
+    delete mMutex;
+  }
+
+  /**
+   * Applies the capabilities reported by LOWI. Ranging requests are
+   * rejected if ranging is not supported and node bandwidths are clamped
+   * to the highest supported one. Until this is called nothing is
+   * rejected or clamped.
+   * @param LOWICapabilities& Capabilities from LOWICapabilityResponse
+   */
+  void setCapabilities (const LOWICapabilities & capabilities)
+  {
+    AutoLock autolock (mMutex);
+    mCapabilities = capabilities;
+    mCapabilitiesKnown = true;
+  }
+
+  /**
+   * Adds the targets of a periodic ranging request to the timeline.
+   * Targets with periodic == 0 are measured once. The request is not
+   * modified and remains owned by the caller.
+   * @param LOWIPeriodicRangingScanRequest* Request
+   * @param LOWIClientListener* Listener that receives the responses
+   * @return LOWIClient::eRequestStatus
+   */
+  LOWIClient::eRequestStatus sendRequest (
+      LOWIPeriodicRangingScanRequest * const request,
+      LOWIClientListener * const listener)
+  {
+    if (NULL == request || NULL == listener)
+    {
+      return LOWIClient::BAD_PARAMS;
+    }
+    vector <LOWIPeriodicNodeInfo> & nodes = request->getNodes ();
+    const int64 now = nowMs ();
+    {
+      AutoLock autolock (mMutex);
+      if (mCapabilitiesKnown && !mCapabilities.rangingScanSupported)
+      {
+        return LOWIClient::BAD_PARAMS;
+      }
+      const int64 firstDue = alignUp (now, mTickMs);
+      // the targets join the timeline together, or not at all
+      vector <Target *> added;
+      bool failed = false;
+      for (uint32 ii = 0; !failed && ii < nodes.getNumOfElements (); ++ii)
+      {
+        Target * target = new (std::nothrow) Target ();
+        if (NULL == target)
+        {
+          failed = true;
+          break;
+        }
+        target->id = mNextTargetId++;
+        target->listener = listener;
+        target->requestId = request->getRequestId ();
+        target->reportType = request->getReportType ();
+        target->node = nodes[ii];
+        if (mCapabilitiesKnown &&
+            (uint32) target->node.bandwidth > (uint32) mCapabilities.bwSupport)
+        {
+          target->node.bandwidth = (eRangingBandwidth) mCapabilities.bwSupport;
+        }
+        target->periodMs = quantizePeriod (target->node.meas_period);
+        target->remaining = (0 != target->node.periodic) ?
+            target->node.num_measurements : 1;
+        target->measurementNum = 0;
+        target->nextDueMs = firstDue;
+        target->inFlight = false;
+        if (0 == target->remaining)
+        {
+          delete target;
+          continue;
+        }
+        if (0 != added.push_back (target))
+        {
+          delete target;
+          failed = true;
+        }
+      }
+      if (failed || 0 != mTargets.reserve (
+          mTargets.getNumOfElements () + added.getNumOfElements ()))
+      {
+        for (uint32 ii = 0; ii < added.getNumOfElements (); ++ii)
+        {
+          delete added[ii];
+        }
+        return LOWIClient::SEND_FAILURE;
+      }
+      for (uint32 ii = 0; ii < added.getNumOfElements (); ++ii)
+      {
+        // can not fail after the reserve
+        (void) mTargets.push_back (added[ii]);
+        ++mStats.m_targetsAdded;
+      }
+      ++mStats.m_sessions;
+    }
+    scheduleTick (now);
+    return LOWIClient::STATUS_OK;
+  }
+
+  /**
+   * Removes the listed peers from the sessions of the listener
+   * @param LOWICancelRangingScanRequest* Request
+   * @param LOWIClientListener* Listener the sessions were created with
+   * @return LOWIClient::eRequestStatus
+   */
+  LOWIClient::eRequestStatus sendRequest (
+      LOWICancelRangingScanRequest * const request,
+      LOWIClientListener * const listener)
+  {
+    if (NULL == request || NULL == listener)
+    {
+      return LOWIClient::BAD_PARAMS;
+    }
+    vector <LOWIMacAddress> & bssids = request->getBssids ();
+    AutoLock autolock (mMutex);
+    for (uint32 ii = 0; ii < mTargets.getNumOfElements (); )
+    {
+      Target * target = mTargets[ii];
+      bool cancel = false;
+      for (uint32 jj = 0; !cancel && jj < bssids.getNumOfElements (); ++jj)
+      {
+        cancel = (target->listener == listener &&
+                  0 == LOWIMacAddress::compareTo (&target->node.bssid, &bssids[jj]));
+      }
+      if (cancel)
+      {
+        removeTarget (ii);
+        ++mStats.m_targetsCancelled;
+      }
+      else
+      {
+        ++ii;
+      }
+    }
+    return LOWIClient::STATUS_OK;
+  }
+
+  /**
+   * Sends the ranging requests for every target due at or before now.
+   * Called by the timeline task; owners that created the scheduler
+   * without an executor call it themselves.
+   * @param int64 Current time in msec on CLOCK_MONOTONIC
+   * @return time in msec of the next due target, -1 if there is none
+   */
+  int64 tick (const int64 now)
+  {
+    AutoLock autolock (mMutex);
+    expireInFlight (now);
+
+    vector <Node> due;
+    for (uint32 ii = 0; ii < mTargets.getNumOfElements (); ++ii)
+    {
+      Target * target = mTargets[ii];
+      if (target->nextDueMs > now)
+      {
+        continue;
+      }
+      // place the next measurement on the shared grid of this period
+      target->nextDueMs = alignUp (now + 1, target->periodMs);
+      if (target->inFlight)
+      {
+        ++mStats.m_skippedInFlight;
+        continue;
+      }
+      addToNodes (due, target);
+    }
+
+    // pack the due nodes into requests, one report type per request
+    vector <bool> sent;
+    for (uint32 ii = 0; ii < due.getNumOfElements (); ++ii)
+    {
+      sent.push_back (false);
+    }
+    for (uint32 ii = 0; ii < due.getNumOfElements (); ++ii)
+    {
+      if (sent[ii])
+      {
+        continue;
+      }
+      Batch * batch = new (std::nothrow) Batch ();
+      if (NULL == batch)
+      {
+        break;
+      }
+      batch->reportType = due[ii].reportType;
+      for (uint32 jj = ii; jj < due.getNumOfElements () &&
+           batch->nodes.getNumOfElements () < mMaxNodesPerRequest; ++jj)
+      {
+        if (!sent[jj] && due[jj].reportType == batch->reportType)
+        {
+          batch->nodes.push_back (due[jj]);
+          sent[jj] = true;
+        }
+      }
+      sendBatch (batch, now);
+    }
+
+    return nextDue ();
+  }
+
+  /**
+   * Returns the statistics
+   * @param [out] LOWIRangingSchedulerStats& statistics
+   */
+  void getStats (LOWIRangingSchedulerStats & stats)
+  {
+    AutoLock autolock (mMutex);
+    stats = mStats;
+  }
+
+  /**
+   * Returns the number of scheduled targets
+   * @return uint32 number of targets
+   */
+  uint32 getNumOfTargets ()
+  {
+    AutoLock autolock (mMutex);
+    return mTargets.getNumOfElements ();
+  }
+
+  /**
+   * LOWIClientListener callback, called by the LOWIClient receiver thread
+   * @param LOWIResponse* Response received
+   */
+  virtual void responseReceived (LOWIResponse * response)
+  {
+    if (NULL == response)
+    {
+      return;
+    }
+    vector <Delivery> deliveries;
+    {
+      AutoLock autolock (mMutex);
+      for (uint32 ii = 0; ii < mBatches.getNumOfElements (); ++ii)
+      {
+        if (mBatches[ii]->internalId == response->getRequestId ())
+        {
+          fanOut (*mBatches[ii], response, deliveries);
+          removeBatch (ii);
+          break;
+        }
+      }
+    }
+    for (uint32 ii = 0; ii < deliveries.getNumOfElements (); ++ii)
+    {
+      deliveries[ii].listener->responseReceived (deliveries[ii].response);
+      delete deliveries[ii].response;
+    }
+  }
+
+private:
+  // header only class, so the log tag is a function rather than a static data member
+  static const char * TAG ()
+  {
+    return "LOWIRangingScheduler";
+  }
+
+  struct Target
+  {
+    uint32 id;
+    LOWIClientListener * listener;
+    uint32 requestId;
+    eRttReportType reportType;
+    LOWIPeriodicNodeInfo node;
+    uint32 periodMs;
+    uint32 remaining;
+    uint32 measurementNum;
+    int64 nextDueMs;
+    bool inFlight;
+  };
+
+  /** one wifi node in a ranging request and the targets it serves */
+  struct Node
+  {
+    LOWINodeInfo info;
+    eRttReportType reportType;
+    vector <uint32> targetIds;
+  };
+
+  struct Batch
+  {
+    uint32 internalId;
+    int64 sentMs;
+    eRttReportType reportType;
+    vector <Node> nodes;
+  };
+
+  struct Delivery
+  {
+    LOWIClientListener * listener;
+    LOWIResponse * response;
+  };
+
+  /** timeline task, stale once a newer one has been scheduled */
+  class TickTask : public Runnable
+  {
+  public:
+    TickTask (LOWIRangingScheduler * const scheduler, const uint32 generation) :
+        mScheduler(scheduler), mGeneration(generation)
+    {
+    }
+    virtual ~TickTask ()
+    {
+    }
+    virtual void run ()
+    {
+      mScheduler->onTickTask (mGeneration);
+    }
+  private:
+    LOWIRangingScheduler * const mScheduler;
+    const uint32 mGeneration;
+  };
+
+  LOWIClient *         mClient;
+  ThreadPoolExecutor * mExecutor;
+  Mutex *              mMutex;
+  const uint32         mMaxNodesPerRequest;
+  const uint32         mTickMs;
+  uint32               mNextTargetId;
+  uint32               mNextRequestId;
+  uint32               mGeneration;
+  int64                mScheduledMs;
+  bool                 mCapabilitiesKnown;
+  LOWICapabilities     mCapabilities;
+  vector <Target *>    mTargets;
+  vector <Batch *>     mBatches;
+  LOWIRangingSchedulerStats mStats;
+
+  LOWIRangingScheduler (ThreadPoolExecutor * const executor,
+      const uint32 max_nodes_per_request, const uint32 tick_ms) :
+      mClient(NULL), mExecutor(executor), mMutex(NULL),
+      mMaxNodesPerRequest(max_nodes_per_request), mTickMs(tick_ms),
+      mNextTargetId(1), mNextRequestId(1), mGeneration(0), mScheduledMs(-1),
+      mCapabilitiesKnown(false)
+  {
+    memset (&mStats, 0, sizeof (mStats));
+  }
+
+  int init (const bool enableLogging, const LOWIClient::eLogLevel log_level)
+  {
+    int result = 1;
+    do
+    {
+      mMutex = Mutex::createInstance ("LOWIRangingScheduler");
+      if (NULL == mMutex)
+      {
+        result = 2;
+        break;
+      }
+      mClient = LOWIClient::createInstance (this, enableLogging, log_level);
+      if (NULL == mClient)
+      {
+        result = 3;
+        break;
+      }
+      result = 0;
+    } while (false);
+    if (0 != result)
+    {
+      log_error (TAG (), "init: failed %d", result);
+    }
+    return result;
+  }
+
+  static int64 nowMs ()
+  {
+    return ClockSource::now_ms (CLOCK_MONOTONIC, ClockSource::PRECISION_EXACT);
+  }
+
+  static int64 alignUp (const int64 t, const uint32 period)
+  {
+    return ((t + period - 1) / period) * period;
+  }
+
+  uint32 quantizePeriod (const uint32 meas_period) const
+  {
+    uint32 period = (meas_period < LOWI_MIN_MEAS_PERIOD) ?
+        LOWI_MIN_MEAS_PERIOD : meas_period;
+    period = ((period + mTickMs / 2) / mTickMs) * mTickMs;
+    return (period < mTickMs) ? mTickMs : period;
+  }
+
+  /**
+   * Makes sure a timeline task is pending for the next due target. The due
+   * time is taken under the lock, so whichever caller schedules last sees
+   * every target added so far.
+   */
+  void scheduleTick (const int64 now)
+  {
+    if (NULL == mExecutor)
+    {
+      return;
+    }
+    uint32 generation = 0;
+    int64 due = -1;
+    {
+      AutoLock autolock (mMutex);
+      due = nextDue ();
+      if (due < 0 || (-1 != mScheduledMs && mScheduledMs <= due))
+      {
+        return;
+      }
+      generation = ++mGeneration;
+      mScheduledMs = due;
+    }
+    TickTask * task = new (std::nothrow) TickTask (this, generation);
+    TimeDiff delay;
+    delay.add_msec ((int) ((due > now) ? (due - now) : 0));
+    if (NULL == task || 0 != mExecutor->schedule (task, delay))
+    {
+      log_error (TAG (), "scheduleTick: failed to schedule tick at %lld",
+          (long long) due);
+      // the executor did not take the task; let the next caller try again
+      delete task;
+      AutoLock autolock (mMutex);
+      if (generation == mGeneration)
+      {
+        mScheduledMs = -1;
+      }
+    }
+  }
+
+  void onTickTask (const uint32 generation)
+  {
+    {
+      AutoLock autolock (mMutex);
+      if (generation != mGeneration)
+      {
+        return;
+      }
+      mScheduledMs = -1;
+    }
+    const int64 now = nowMs ();
+    (void) tick (now);
+    scheduleTick (now);
+  }
+
+  /** called with mMutex held */
+  int64 nextDue () const
+  {
+    int64 next = -1;
+    for (uint32 ii = 0; ii < mTargets.getNumOfElements (); ++ii)
+    {
+      if (-1 == next || mTargets[ii]->nextDueMs < next)
+      {
+        next = mTargets[ii]->nextDueMs;
+      }
+    }
+    return next;
+  }
+
+  static bool sameRanging (const LOWINodeInfo & lhs, const LOWINodeInfo & rhs)
+  {
+    return lhs.frequency == rhs.frequency &&
+        lhs.rttType == rhs.rttType &&
+        lhs.bandwidth == rhs.bandwidth &&
+        lhs.preamble == rhs.preamble &&
+        lhs.nodeType == rhs.nodeType &&
+        lhs.ftmRangingParameters == rhs.ftmRangingParameters &&
+        lhs.num_pkts_per_meas == rhs.num_pkts_per_meas &&
+        0 == LOWIMacAddress::compareTo (&lhs.spoofMacId, &rhs.spoofMacId);
+  }
+
+  /** called with mMutex held */
+  void addToNodes (vector <Node> & nodes, Target * const target)
+  {
+    for (uint32 ii = 0; ii < nodes.getNumOfElements (); ++ii)
+    {
+      Node & node = nodes[ii];
+      if (node.reportType == target->reportType &&
+          0 == LOWIMacAddress::compareTo (&node.info.bssid, &target->node.bssid) &&
+          sameRanging (node.info, target->node))
+      {
+        if (node.info.num_retries_per_meas < target->node.num_retries_per_meas)
+        {
+          node.info.num_retries_per_meas = target->node.num_retries_per_meas;
+        }
+        node.targetIds.push_back (target->id);
+        target->inFlight = true;
+        ++mStats.m_nodesShared;
+        return;
+      }
+    }
+    Node node;
+    node.info = target->node;
+    node.reportType = target->reportType;
+    node.targetIds.push_back (target->id);
+    if (0 == nodes.push_back (node))
+    {
+      target->inFlight = true;
+    }
+  }
+
+  /** called with mMutex held; takes ownership of the batch */
+  void sendBatch (Batch * const batch, const int64 now)
+  {
+    batch->internalId = mNextRequestId++;
+    batch->sentMs = now;
+    vector <LOWINodeInfo> infos;
+    for (uint32 ii = 0; ii < batch->nodes.getNumOfElements (); ++ii)
+    {
+      infos.push_back (batch->nodes[ii].info);
+    }
+    LOWIRangingScanRequest request (batch->internalId, infos, 0);
+    request.setReportType (batch->reportType);
+    if (LOWIClient::STATUS_OK == mClient->sendRequest (&request) &&
+        0 == mBatches.push_back (batch))
+    {
+      ++mStats.m_requestsSent;
+      mStats.m_nodesSent += infos.getNumOfElements ();
+      return;
+    }
+    log_warning (TAG (), "sendBatch: failed to send %u nodes",
+        infos.getNumOfElements ());
+    // the targets are requested again on their next due tick
+    releaseTargets (*batch);
+    delete batch;
+  }
+
+  /** called with mMutex held */
+  Target * findTarget (const uint32 id)
+  {
+    for (uint32 ii = 0; ii < mTargets.getNumOfElements (); ++ii)
+    {
+      if (mTargets[ii]->id == id)
+      {
+        return mTargets[ii];
+      }
+    }
+    return NULL;
+  }
+
+  /** called with mMutex held */
+  void releaseTargets (const Batch & batch)
+  {
+    for (uint32 ii = 0; ii < batch.nodes.getNumOfElements (); ++ii)
+    {
+      const Node & node = batch.nodes[ii];
+      for (uint32 jj = 0; jj < node.targetIds.getNumOfElements (); ++jj)
+      {
+        Target * target = findTarget (node.targetIds[jj]);
+        if (NULL != target)
+        {
+          target->inFlight = false;
+        }
+      }
+    }
+  }
+
+  /** called with mMutex held */
+  void removeTarget (const uint32 index)
+  {
+    delete mTargets[index];
+    vector <Target *> remaining;
+    for (uint32 ii = 0; ii < mTargets.getNumOfElements (); ++ii)
+    {
+      if (ii != index)
+      {
+        remaining.push_back (mTargets[ii]);
+      }
+    }
+    mTargets = remaining;
+  }
+
+  /** called with mMutex held */
+  void removeBatch (const uint32 index)
+  {
+    delete mBatches[index];
+    vector <Batch *> remaining;
+    for (uint32 ii = 0; ii < mBatches.getNumOfElements (); ++ii)
+    {
+      if (ii != index)
+      {
+        remaining.push_back (mBatches[ii]);
+      }
+    }
+    mBatches = remaining;
+  }
+
+  /** called with mMutex held */
+  void expireInFlight (const int64 now)
+  {
+    for (uint32 ii = 0; ii < mBatches.getNumOfElements (); )
+    {
+      if (now - mBatches[ii]->sentMs >= (int64) IN_FLIGHT_TIMEOUT_MS)
+      {
+        log_warning (TAG (), "expireInFlight: no response for id %u",
+            mBatches[ii]->internalId);
+        ++mStats.m_timeouts;
+        releaseTargets (*mBatches[ii]);
+        removeBatch (ii);
+      }
+      else
+      {
+        ++ii;
+      }
+    }
+  }
+
+  /** called with mMutex held */
+  LOWIRangingScanResponse * findDelivery (vector <Delivery> & deliveries,
+      const Target & target)
+  {
+    for (uint32 ii = 0; ii < deliveries.getNumOfElements (); ++ii)
+    {
+      if (deliveries[ii].listener == target.listener &&
+          deliveries[ii].response->getRequestId () == target.requestId)
+      {
+        return static_cast <LOWIRangingScanResponse *> (deliveries[ii].response);
+      }
+    }
+    LOWIRangingScanResponse * response = new (std::nothrow)
+        LOWIRangingScanResponse (target.requestId);
+    if (NULL != response)
+    {
+      Delivery delivery;
+      delivery.listener = target.listener;
+      delivery.response = response;
+      if (0 != deliveries.push_back (delivery))
+      {
+        delete response;
+        response = NULL;
+      }
+    }
+    return response;
+  }
+
+  /** called with mMutex held */
+  void fanOut (const Batch & batch, LOWIResponse * const response,
+      vector <Delivery> & deliveries)
+  {
+    LOWIRangingScanResponse * ranging = NULL;
+    LOWIResponse::eScanStatus status = LOWIResponse::SCAN_STATUS_INTERNAL_ERROR;
+    if (LOWIResponse::RANGING_SCAN == response->getResponseType ())
+    {
+      ranging = static_cast <LOWIRangingScanResponse *> (response);
+      status = ranging->scanStatus;
+    }
+    else if (LOWIResponse::LOWI_STATUS == response->getResponseType ())
+    {
+      status = static_cast <LOWIStatusResponse *> (response)->scanStatus;
+    }
+
+    for (uint32 ii = 0; ii < batch.nodes.getNumOfElements (); ++ii)
+    {
+      const Node & node = batch.nodes[ii];
+      const LOWIScanMeasurement * meas = NULL;
+      for (uint32 jj = 0; NULL != ranging &&
+           jj < ranging->scanMeasurements.getNumOfElements (); ++jj)
+      {
+        const LOWIScanMeasurement * candidate = ranging->scanMeasurements[jj];
+        if (NULL != candidate &&
+            0 == LOWIMacAddress::compareTo (&candidate->bssid, &node.info.bssid))
+        {
+          meas = candidate;
+          break;
+        }
+      }
+
+      for (uint32 jj = 0; jj < node.targetIds.getNumOfElements (); ++jj)
+      {
+        Target * target = findTarget (node.targetIds[jj]);
+        if (NULL == target)
+        {
+          // cancelled while the measurement was in flight
+          continue;
+        }
+        target->inFlight = false;
+        LOWIRangingScanResponse * out = findDelivery (deliveries, *target);
+        if (NULL != out)
+        {
+          out->scanStatus = status;
+          if (NULL != meas)
+          {
+            LOWIScanMeasurement * copy = new (std::nothrow) LOWIScanMeasurement (*meas);
+            if (NULL != copy)
+            {
+              copy->measurementNum = target->measurementNum;
+              if (0 != out->scanMeasurements.push_back (copy))
+              {
+                delete copy;
+              }
+            }
+          }
+        }
+        ++target->measurementNum;
+        if (0 == --target->remaining)
+        {
+          for (uint32 kk = 0; kk < mTargets.getNumOfElements (); ++kk)
+          {
+            if (mTargets[kk] == target)
+            {
+              removeTarget (kk);
+              break;
+            }
+          }
+        }
+      }
+    }
+    mStats.m_reportsDelivered += deliveries.getNumOfElements ();
+  }
+
+  // private copy constructor and assignment operator so that the
+  // the instance can not be copied.
+  LOWIRangingScheduler (const LOWIRangingScheduler & rhs);
+  LOWIRangingScheduler & operator = (const LOWIRangingScheduler & rhs);
+};
+
+} // namespace qc_loc_fw
+
+#endif //#ifndef __LOWI_RANGING_SCHEDULER_H__
@@ -0,0 +1,996 @@
+#ifndef __LOWI_SCAN_COALESCER_H__
+#define __LOWI_SCAN_COALESCER_H__
+
+/*====*====*====*====*====*====*====*====*====*====*====*====*====*====*====*
+
+        LOWI Scan Coalescer Interface Header file
+
+GENERAL DESCRIPTION
+  This file contains the structure definitions and function prototypes for
+  LOWIDiscoveryScanCoalescer, which merges concurrent discovery scan
+  requests into shared scans
+
+Copyright (c) 2012-2013 Qualcomm Atheros, Inc.
+  All Rights Reserved.
+  Qualcomm Atheros Confidential and Proprietary.
+
+Export of this technology or software is regulated by the U.S. Government.
+Diversion contrary to U.S. law prohibited.
+=============================================================================*/
+
+#include <time.h>
+#include <new>
+#include <base_util/log.h>
+#include <base_util/sync.h>
+#include <base_util/vector.h>
+#include <base_util/clock_source.h>
+#include <base_util/time_routines.h>
+#include <base_util/thread_pool_executor.h>
+#include <inc/lowi_const.h>
+#include <inc/lowi_request.h>
+#include <inc/lowi_response.h>
+#include <inc/lowi_client.h>
+
+namespace qc_loc_fw
+{
+
+/**
+ * Statistics of a LOWIDiscoveryScanCoalescer.
+ * Scans saved is m_requests - m_scansSent.
+ */
+struct LOWIScanCoalescerStats
+{
+  /** discovery scan requests received from clients */
+  uint64 m_requests;
+  /** discovery scan requests sent to LOWI */
+  uint64 m_scansSent;
+  /** requests served by a scan that was already outstanding */
+  uint64 m_attachedInFlight;
+  /** requests merged into a scan queued behind an outstanding one */
+  uint64 m_mergedQueued;
+  /** responses delivered to clients */
+  uint64 m_responsesDelivered;
+  /** outstanding scans given up on because no response arrived */
+  uint64 m_inFlightTimeouts;
+  /** total time requests waited in the queue before their scan was sent */
+  uint64 m_queueDelayTotalMs;
+  /** longest time a request waited in the queue */
+  uint64 m_queueDelayMaxMs;
+  /** total time from request to response, over all delivered responses */
+  uint64 m_latencyTotalMs;
+};
+
+/**
+ * Client side coalescer for LOWIDiscoveryScanRequest.
+ *
+ * Every LOWIDiscoveryScanRequest sent through LOWIClient::sendRequest
+ * triggers its own scan, even when the age filter / fallback tolerance of
+ * several concurrent requests would allow them to share one result.
+ * LOWIDiscoveryScanCoalescer owns a single LOWIClient and sits between the
+ * requesters and LOWI:
+ *
+ *  - A request that is covered by a scan already outstanding (same or
+ *    larger channel set, active if the request is active, at least as
+ *    large an age filter and at least as fresh a request mode) is
+ *    attached to that scan and sends nothing.
+ *  - If no scan is outstanding the request is sent right away, so a lone
+ *    requester sees no extra latency.
+ *  - Otherwise the request is merged into one queued scan (union of the
+ *    channels, active wins, largest age filter, freshest mode) that is
+ *    sent as soon as the outstanding scan completes. LOWI serves scans one
+ *    at a time anyway, so the queued requests would have waited for the
+ *    driver regardless.
+ *  - CACHE_ONLY requests are never queued behind a fresh scan; they only
+ *    share an outstanding CACHE_ONLY request and are sent immediately
+ *    otherwise.
+ *
+ * When the response arrives, every requester gets its own
+ * LOWIDiscoveryScanResponse with its own request id, holding only the
+ * measurements on the channels it asked for and within its age filter.
+ * The response passed to LOWIClientListener::responseReceived is owned by
+ * the coalescer and deleted once the listener returns, so listeners must
+ * copy whatever they want to keep. Listeners are called from the
+ * LOWIClient receiver thread, without any coalescer lock held.
+ *
+ * Responses to any other request sent through getClient () are passed on
+ * to the default listener given at creation. The scans the coalescer sends
+ * use request ids from INTERNAL_ID_BASE up, so requests sent through
+ * getClient () must use ids below it.
+ *
+ * Outstanding scans that get no response are failed after the in flight
+ * timeout by a timer on the given ThreadPoolExecutor. The executor must be
+ * shut down before the coalescer is deleted. With no executor the timeout
+ * is only checked when a request or response comes in, or when the owner
+ * calls tick ().
+ */
+class LOWIDiscoveryScanCoalescer : public LOWIClientListener
+{
+public:
+  /** Time after which an outstanding scan is considered lost */
+  static const uint32 DEFAULT_IN_FLIGHT_TIMEOUT_MS = 30000;
+  /** First request id of the scans sent by the coalescer */
+  static const uint32 INTERNAL_ID_BASE = 0xC0000000;
+
+  /**
+   * Creates the coalescer and its LOWIClient. Blocks until the LOWIClient
+   * is registered with the IPC hub.
+   * @param LOWIClientListener* Listener for responses to requests that are
+   *        not discovery scans sent through the coalescer, may be NULL
+   * @param bool To enable / disable LOWIClient logging
+   * @param LOWIClient::eLogLevel LOWIClient log level
+   * @param uint32 Time in msec after which an outstanding scan that got no
+   *        response is failed with SCAN_STATUS_DRIVER_TIMEOUT
+   * @param ThreadPoolExecutor* Executor that runs the in flight timeout, or
+   *        NULL if the owner calls tick ()
+   * @return LOWIDiscoveryScanCoalescer* NULL on failure
+   */
+  static LOWIDiscoveryScanCoalescer * createInstance (
+      LOWIClientListener * const default_listener = NULL,
+      const bool enableLogging = false,
+      const LOWIClient::eLogLevel log_level = LOWIClient::LL_INFO,
+      const uint32 in_flight_timeout_ms = DEFAULT_IN_FLIGHT_TIMEOUT_MS,
+      ThreadPoolExecutor * const executor = NULL)
+  {
+    LOWIDiscoveryScanCoalescer * coalescer = new (std::nothrow)
+        LOWIDiscoveryScanCoalescer (default_listener, in_flight_timeout_ms,
+            executor);
+    if (NULL != coalescer && 0 != coalescer->init (enableLogging, log_level))
+    {
+      delete coalescer;
+      coalescer = NULL;
+    }
+    return coalescer;
+  }
+
+  /**
+   * Destructor. Requesters of scans that are still outstanding or queued
+   * get no response. The executor given at creation must be shut down
+   * first, since a pending timeout task calls back into the coalescer.
+   */
+  virtual ~LOWIDiscoveryScanCoalescer ()
+  {
+    // delete the client first so no response arrives while tearing down
+    delete mClient;
+    for (uint32 ii = 0; ii < mBatches.getNumOfElements (); ++ii)
+    {
+      delete mBatches[ii];
+    }
+    delete mPending;
+    delete mMutex;
+  }
+
+  /**
+   * Sends a discovery scan request, possibly sharing the scan with other
+   * requesters. The request is not modified and remains owned by the
+   * caller; it may be deleted as soon as this call returns.
+   * @param LOWIDiscoveryScanRequest* Request
+   * @param LOWIClientListener* Listener that receives the response
+   * @return LOWIClient::eRequestStatus
+   */
+  LOWIClient::eRequestStatus sendRequest (
+      LOWIDiscoveryScanRequest * const request,
+      LOWIClientListener * const listener)
+  {
+    if (NULL == request || NULL == listener)
+    {
+      return LOWIClient::BAD_PARAMS;
+    }
+
+    Requester requester;
+    requester.listener = listener;
+    requester.requestId = request->getRequestId ();
+    requester.arrivalMs = nowMs ();
+    ScanParams::fromRequest (*request, requester.params);
+
+    vector <Delivery> deliveries;
+    LOWIClient::eRequestStatus status = LOWIClient::STATUS_OK;
+    {
+      AutoLock autolock (mMutex);
+      ++mStats.m_requests;
+      expireInFlight (requester.arrivalMs, deliveries);
+
+      bool done = false;
+      bool scanInFlight = false;
+      for (uint32 ii = 0; !done && ii < mBatches.getNumOfElements (); ++ii)
+      {
+        Batch * batch = mBatches[ii];
+        if (batch->params.satisfies (requester.params))
+        {
+          done = (0 == batch->requesters.push_back (requester));
+          if (done)
+          {
+            ++mStats.m_attachedInFlight;
+          }
+        }
+        scanInFlight = scanInFlight ||
+            LOWIDiscoveryScanRequest::CACHE_ONLY != batch->params.mode;
+      }
+
+      if (!done &&
+          (LOWIDiscoveryScanRequest::CACHE_ONLY == requester.params.mode ||
+           !scanInFlight))
+      {
+        Batch * batch = new (std::nothrow) Batch ();
+        if (NULL == batch)
+        {
+          status = LOWIClient::SEND_FAILURE;
+        }
+        else
+        {
+          batch->params = requester.params;
+          status = (0 == batch->requesters.push_back (requester)) ?
+              sendBatch (batch) : LOWIClient::SEND_FAILURE;
+          if (LOWIClient::STATUS_OK != status)
+          {
+            delete batch;
+          }
+        }
+        done = true;
+      }
+
+      if (!done)
+      {
+        if (NULL == mPending)
+        {
+          mPending = new (std::nothrow) Batch ();
+          if (NULL != mPending)
+          {
+            mPending->params = requester.params;
+          }
+        }
+        else
+        {
+          mPending->params.merge (requester.params);
+          ++mStats.m_mergedQueued;
+        }
+        if (NULL == mPending || 0 != mPending->requesters.push_back (requester))
+        {
+          status = LOWIClient::SEND_FAILURE;
+        }
+      }
+    }
+    deliver (deliveries);
+    scheduleExpiry (requester.arrivalMs);
+    return status;
+  }
+
+  /**
+   * Fails the outstanding scans that got no response in time, and sends
+   * the queued scan if that leaves LOWI idle. Called by the timeout task;
+   * owners that created the coalescer without an executor may call it
+   * themselves.
+   * @param int64 Current time in msec on CLOCK_MONOTONIC
+   * @return time in msec when the next outstanding scan times out, -1 if
+   *         there is none
+   */
+  int64 tick (const int64 now)
+  {
+    vector <Delivery> deliveries;
+    int64 next = -1;
+    {
+      AutoLock autolock (mMutex);
+      expireInFlight (now, deliveries);
+      next = nextExpiry ();
+    }
+    deliver (deliveries);
+    return next;
+  }
+
+  /**
+   * Returns the LOWIClient used by the coalescer, for requests other than
+   * discovery scans. Their responses go to the default listener. Their
+   * request ids must be below INTERNAL_ID_BASE.
+   * @return LOWIClient*
+   */
+  LOWIClient * getClient ()
+  {
+    return mClient;
+  }
+
+  /**
+   * Returns the statistics
+   * @param [out] LOWIScanCoalescerStats& statistics
+   */
+  void getStats (LOWIScanCoalescerStats & stats)
+  {
+    AutoLock autolock (mMutex);
+    stats = mStats;
+  }
+
+  /**
+   * Logs the statistics
+   */
+  void logStats ()
+  {
+    LOWIScanCoalescerStats stats;
+    getStats (stats);
+    log_info (TAG (), "requests %llu, scans sent %llu, attached %llu, "
+        "merged %llu, delivered %llu, timeouts %llu, queue delay total %llu ms "
+        "max %llu ms, latency total %llu ms",
+        (unsigned long long) stats.m_requests,
+        (unsigned long long) stats.m_scansSent,
+        (unsigned long long) stats.m_attachedInFlight,
+        (unsigned long long) stats.m_mergedQueued,
+        (unsigned long long) stats.m_responsesDelivered,
+        (unsigned long long) stats.m_inFlightTimeouts,
+        (unsigned long long) stats.m_queueDelayTotalMs,
+        (unsigned long long) stats.m_queueDelayMaxMs,
+        (unsigned long long) stats.m_latencyTotalMs);
+  }
+
+  /**
+   * LOWIClientListener callback, called by the LOWIClient receiver thread
+   * @param LOWIResponse* Response received
+   */
+  virtual void responseReceived (LOWIResponse * response)
+  {
+    if (NULL == response)
+    {
+      return;
+    }
+    // a scan is answered with its results, or with a status if LOWI
+    // could not take it. any other response is for getClient ()
+    const LOWIResponse::eResponseType type = response->getResponseType ();
+    const bool scanResponse = response->getRequestId () >= INTERNAL_ID_BASE &&
+        (LOWIResponse::DISCOVERY_SCAN == type ||
+         LOWIResponse::LOWI_STATUS == type);
+    vector <Delivery> deliveries;
+    bool matched = false;
+    const int64 now = nowMs ();
+    {
+      AutoLock autolock (mMutex);
+      for (uint32 ii = 0; scanResponse && ii < mBatches.getNumOfElements (); ++ii)
+      {
+        Batch * batch = mBatches[ii];
+        if (batch->internalId == response->getRequestId ())
+        {
+          matched = true;
+          fanOut (*batch, response, now, deliveries);
+          removeBatch (ii);
+          break;
+        }
+      }
+      expireInFlight (now, deliveries);
+      sendPendingIfIdle (now, deliveries);
+    }
+    deliver (deliveries);
+    scheduleExpiry (now);
+
+    if (!matched && NULL != mDefaultListener)
+    {
+      mDefaultListener->responseReceived (response);
+    }
+  }
+
+private:
+  // header only class, so the log tag is a function rather than a static data member
+  static const char * TAG ()
+  {
+    return "LOWIScanCoalescer";
+  }
+
+  enum
+  {
+    BAND_MASK_2G = 0x01,
+    BAND_MASK_5G = 0x02
+  };
+
+  /**
+   * Scan parameters of one request, or the merged parameters of a batch
+   */
+  struct ScanParams
+  {
+    /** bands requested as a whole */
+    uint8 bandMask;
+    /** individual channels requested */
+    uint32 numFreqs;
+    uint32 freqs[MAX_CHAN_INFO_SIZE];
+    LOWIDiscoveryScanRequest::eScanType scanType;
+    LOWIDiscoveryScanRequest::eRequestMode mode;
+    uint32 measAgeFilterSec;
+    uint32 fallbackToleranceSec;
+    int64 timeoutTimestamp;
+    bool bufferCacheRequest;
+
+    static uint8 bandMaskOf (const uint32 freq)
+    {
+      return (freq < 4000) ? BAND_MASK_2G : BAND_MASK_5G;
+    }
+
+    static int rankOf (const LOWIDiscoveryScanRequest::eRequestMode mode)
+    {
+      switch (mode)
+      {
+      case LOWIDiscoveryScanRequest::FORCED_FRESH:
+        return 3;
+      case LOWIDiscoveryScanRequest::NORMAL:
+        return 2;
+      case LOWIDiscoveryScanRequest::CACHE_FALLBACK:
+        return 1;
+      default:
+        return 0;
+      }
+    }
+
+    static void fromRequest (LOWIDiscoveryScanRequest & request,
+        ScanParams & params)
+    {
+      params.bandMask = 0;
+      params.numFreqs = 0;
+      vector <LOWIChannelInfo> & channels = request.getChannels ();
+      for (uint32 ii = 0; ii < channels.getNumOfElements (); ++ii)
+      {
+        // LOWI ignores channels past MAX_CHAN_INFO_SIZE, so do we
+        if (params.numFreqs < MAX_CHAN_INFO_SIZE)
+        {
+          params.freqs[params.numFreqs++] = channels[ii].getFrequency ();
+        }
+      }
+      if (0 == params.numFreqs)
+      {
+        switch (request.getBand ())
+        {
+        case LOWIDiscoveryScanRequest::TWO_POINT_FOUR_GHZ:
+          params.bandMask = BAND_MASK_2G;
+          break;
+        case LOWIDiscoveryScanRequest::FIVE_GHZ:
+          params.bandMask = BAND_MASK_5G;
+          break;
+        default:
+          params.bandMask = BAND_MASK_2G | BAND_MASK_5G;
+          break;
+        }
+      }
+      params.scanType = request.getScanType ();
+      params.mode = request.getRequestMode ();
+      params.measAgeFilterSec = request.getMeasAgeFilterSec ();
+      params.fallbackToleranceSec = request.getFallbackToleranceSec ();
+      params.timeoutTimestamp = request.getTimeoutTimestamp ();
+      params.bufferCacheRequest = request.getBufferCacheRequest ();
+    }
+
+    bool coversFreq (const uint32 freq) const
+    {
+      if (0 != (bandMask & bandMaskOf (freq)))
+      {
+        return true;
+      }
+      for (uint32 ii = 0; ii < numFreqs; ++ii)
+      {
+        if (freqs[ii] == freq)
+        {
+          return true;
+        }
+      }
+      return false;
+    }
+
+    /**
+     * Checks if a scan with these parameters gives the requester
+     * everything it asked for
+     */
+    bool satisfies (const ScanParams & req) const
+    {
+      if ((req.bandMask & bandMask) != req.bandMask)
+      {
+        return false;
+      }
+      for (uint32 ii = 0; ii < req.numFreqs; ++ii)
+      {
+        if (!coversFreq (req.freqs[ii]))
+        {
+          return false;
+        }
+      }
+      if (LOWIDiscoveryScanRequest::ACTIVE_SCAN == req.scanType &&
+          LOWIDiscoveryScanRequest::ACTIVE_SCAN != scanType)
+      {
+        return false;
+      }
+      if (measAgeFilterSec < req.measAgeFilterSec)
+      {
+        return false;
+      }
+      if (LOWIDiscoveryScanRequest::CACHE_ONLY == req.mode ||
+          LOWIDiscoveryScanRequest::CACHE_ONLY == mode)
+      {
+        return req.mode == mode;
+      }
+      if (rankOf (mode) < rankOf (req.mode))
+      {
+        return false;
+      }
+      return !(LOWIDiscoveryScanRequest::CACHE_FALLBACK == mode &&
+               fallbackToleranceSec > req.fallbackToleranceSec);
+    }
+
+    /**
+     * Widens these parameters so that they satisfy the requester too
+     */
+    void merge (const ScanParams & req)
+    {
+      bandMask |= req.bandMask;
+      for (uint32 ii = 0; ii < req.numFreqs; ++ii)
+      {
+        if (coversFreq (req.freqs[ii]))
+        {
+          continue;
+        }
+        if (numFreqs < MAX_CHAN_INFO_SIZE)
+        {
+          freqs[numFreqs++] = req.freqs[ii];
+        }
+        else
+        {
+          // too many channels for one request, widen to the whole band
+          bandMask |= bandMaskOf (req.freqs[ii]);
+        }
+      }
+      if (0 != bandMask)
+      {
+        // a band scan is requested anyway, fold the channels into it
+        for (uint32 ii = 0; ii < numFreqs; ++ii)
+        {
+          bandMask |= bandMaskOf (freqs[ii]);
+        }
+        numFreqs = 0;
+      }
+      if (LOWIDiscoveryScanRequest::ACTIVE_SCAN == req.scanType)
+      {
+        scanType = LOWIDiscoveryScanRequest::ACTIVE_SCAN;
+      }
+      if (req.measAgeFilterSec > measAgeFilterSec)
+      {
+        measAgeFilterSec = req.measAgeFilterSec;
+      }
+      if (LOWIDiscoveryScanRequest::CACHE_FALLBACK == mode &&
+          LOWIDiscoveryScanRequest::CACHE_FALLBACK == req.mode &&
+          req.fallbackToleranceSec < fallbackToleranceSec)
+      {
+        fallbackToleranceSec = req.fallbackToleranceSec;
+      }
+      if (rankOf (req.mode) > rankOf (mode))
+      {
+        mode = req.mode;
+        fallbackToleranceSec = req.fallbackToleranceSec;
+      }
+      // the merged scan may only be dropped once every requester allows it
+      if (timeoutTimestamp <= 0 || req.timeoutTimestamp <= 0)
+      {
+        timeoutTimestamp = 0;
+      }
+      else if (req.timeoutTimestamp > timeoutTimestamp)
+      {
+        timeoutTimestamp = req.timeoutTimestamp;
+      }
+      bufferCacheRequest = bufferCacheRequest && req.bufferCacheRequest;
+    }
+
+    LOWIDiscoveryScanRequest * toRequest (const uint32 requestId) const
+    {
+      if (numFreqs > 0)
+      {
+        vector <LOWIChannelInfo> channels;
+        for (uint32 ii = 0; ii < numFreqs; ++ii)
+        {
+          channels.push_back (LOWIChannelInfo (freqs[ii]));
+        }
+        switch (mode)
+        {
+        case LOWIDiscoveryScanRequest::CACHE_ONLY:
+          return LOWIDiscoveryScanRequest::createCacheOnlyRequest (requestId,
+              channels, measAgeFilterSec, timeoutTimestamp, bufferCacheRequest);
+        case LOWIDiscoveryScanRequest::CACHE_FALLBACK:
+          return LOWIDiscoveryScanRequest::createCacheFallbackRequest (
+              requestId, channels, scanType, measAgeFilterSec,
+              fallbackToleranceSec, timeoutTimestamp, bufferCacheRequest);
+        default:
+          return LOWIDiscoveryScanRequest::createFreshScanRequest (requestId,
+              channels, scanType, measAgeFilterSec, timeoutTimestamp, mode);
+        }
+      }
+
+      LOWIDiscoveryScanRequest::eBand band = LOWIDiscoveryScanRequest::BAND_ALL;
+      if (BAND_MASK_2G == bandMask)
+      {
+        band = LOWIDiscoveryScanRequest::TWO_POINT_FOUR_GHZ;
+      }
+      else if (BAND_MASK_5G == bandMask)
+      {
+        band = LOWIDiscoveryScanRequest::FIVE_GHZ;
+      }
+      switch (mode)
+      {
+      case LOWIDiscoveryScanRequest::CACHE_ONLY:
+        return LOWIDiscoveryScanRequest::createCacheOnlyRequest (requestId,
+            band, measAgeFilterSec, timeoutTimestamp, bufferCacheRequest);
+      case LOWIDiscoveryScanRequest::CACHE_FALLBACK:
+        return LOWIDiscoveryScanRequest::createCacheFallbackRequest (
+            requestId, band, scanType, measAgeFilterSec,
+            fallbackToleranceSec, timeoutTimestamp, bufferCacheRequest);
+      default:
+        return LOWIDiscoveryScanRequest::createFreshScanRequest (requestId,
+            band, scanType, measAgeFilterSec, timeoutTimestamp, mode);
+      }
+    }
+  };
+
+  struct Requester
+  {
+    LOWIClientListener * listener;
+    uint32 requestId;
+    ScanParams params;
+    int64 arrivalMs;
+  };
+
+  struct Batch
+  {
+    uint32 internalId;
+    int64 sentMs;
+    ScanParams params;
+    vector <Requester> requesters;
+  };
+
+  struct Delivery
+  {
+    LOWIClientListener * listener;
+    LOWIResponse * response;
+  };
+
+  /** in flight timeout task, stale once a newer one has been scheduled */
+  class ExpiryTask : public Runnable
+  {
+  public:
+    ExpiryTask (LOWIDiscoveryScanCoalescer * const coalescer,
+        const uint32 generation) :
+        mCoalescer(coalescer), mGeneration(generation)
+    {
+    }
+    virtual ~ExpiryTask ()
+    {
+    }
+    virtual void run ()
+    {
+      mCoalescer->onExpiryTask (mGeneration);
+    }
+  private:
+    LOWIDiscoveryScanCoalescer * const mCoalescer;
+    const uint32 mGeneration;
+  };
+
+  LOWIClient *         mClient;
+  LOWIClientListener * mDefaultListener;
+  ThreadPoolExecutor * mExecutor;
+  Mutex *              mMutex;
+  const uint32         mInFlightTimeoutMs;
+  uint32               mNextId;
+  uint32               mGeneration;
+  int64                mScheduledMs;
+  vector <Batch *>     mBatches;
+  Batch *              mPending;
+  LOWIScanCoalescerStats mStats;
+
+  LOWIDiscoveryScanCoalescer (LOWIClientListener * const default_listener,
+      const uint32 in_flight_timeout_ms, ThreadPoolExecutor * const executor) :
+      mClient(NULL), mDefaultListener(default_listener), mExecutor(executor),
+      mMutex(NULL), mInFlightTimeoutMs(in_flight_timeout_ms),
+      mNextId(INTERNAL_ID_BASE), mGeneration(0), mScheduledMs(-1),
+      mPending(NULL)
+  {
+    memset (&mStats, 0, sizeof (mStats));
+  }
+
+  int init (const bool enableLogging, const LOWIClient::eLogLevel log_level)
+  {
+    int result = 1;
+    do
+    {
+      mMutex = Mutex::createInstance ("LOWIScanCoalescer");
+      if (NULL == mMutex)
+      {
+        result = 2;
+        break;
+      }
+      mClient = LOWIClient::createInstance (this, enableLogging, log_level);
+      if (NULL == mClient)
+      {
+        result = 3;
+        break;
+      }
+      result = 0;
+    } while (false);
+    if (0 != result)
+    {
+      log_error (TAG (), "init: failed %d", result);
+    }
+    return result;
+  }
+
+  static int64 nowMs ()
+  {
+    return ClockSource::now_ms (CLOCK_MONOTONIC, ClockSource::PRECISION_EXACT);
+  }
+
+  /**
+   * Makes sure a timeout task is pending for the outstanding scan that
+   * times out first. The time is taken under the lock, so whichever caller
+   * schedules last sees every scan sent so far.
+   */
+  void scheduleExpiry (const int64 now)
+  {
+    if (NULL == mExecutor)
+    {
+      return;
+    }
+    uint32 generation = 0;
+    int64 due = -1;
+    {
+      AutoLock autolock (mMutex);
+      due = nextExpiry ();
+      if (due < 0 || (-1 != mScheduledMs && mScheduledMs <= due))
+      {
+        return;
+      }
+      generation = ++mGeneration;
+      mScheduledMs = due;
+    }
+    ExpiryTask * task = new (std::nothrow) ExpiryTask (this, generation);
+    TimeDiff delay;
+    delay.add_msec ((int) ((due > now) ? (due - now) : 0));
+    if (NULL == task || 0 != mExecutor->schedule (task, delay))
+    {
+      log_error (TAG (), "scheduleExpiry: failed to schedule timeout at %lld",
+          (long long) due);
+      // the executor did not take the task; let the next caller try again
+      delete task;
+      AutoLock autolock (mMutex);
+      if (generation == mGeneration)
+      {
+        mScheduledMs = -1;
+      }
+    }
+  }
+
+  void onExpiryTask (const uint32 generation)
+  {
+    {
+      AutoLock autolock (mMutex);
+      if (generation != mGeneration)
+      {
+        return;
+      }
+      mScheduledMs = -1;
+    }
+    const int64 now = nowMs ();
+    (void) tick (now);
+    scheduleExpiry (now);
+  }
+
+  /** called with mMutex held */
+  int64 nextExpiry () const
+  {
+    int64 next = -1;
+    for (uint32 ii = 0; ii < mBatches.getNumOfElements (); ++ii)
+    {
+      const int64 expiry = mBatches[ii]->sentMs + mInFlightTimeoutMs;
+      if (-1 == next || expiry < next)
+      {
+        next = expiry;
+      }
+    }
+    return next;
+  }
+
+  /** called with mMutex held; takes ownership of the batch on success */
+  LOWIClient::eRequestStatus sendBatch (Batch * const batch)
+  {
+    batch->internalId = mNextId++;
+    if (mNextId < INTERNAL_ID_BASE)
+    {
+      // wrapped around, stay in the range of the coalescer
+      mNextId = INTERNAL_ID_BASE;
+    }
+    batch->sentMs = nowMs ();
+    LOWIDiscoveryScanRequest * request = batch->params.toRequest (batch->internalId);
+    if (NULL == request)
+    {
+      return LOWIClient::SEND_FAILURE;
+    }
+    LOWIClient::eRequestStatus status = mClient->sendRequest (request);
+    delete request;
+    if (LOWIClient::STATUS_OK == status)
+    {
+      if (0 != mBatches.push_back (batch))
+      {
+        // response could not be routed, better not to claim success
+        return LOWIClient::SEND_FAILURE;
+      }
+      ++mStats.m_scansSent;
+      log_verbose (TAG (), "sendBatch: id %u, %u requesters",
+          batch->internalId, batch->requesters.getNumOfElements ());
+    }
+    return status;
+  }
+
+  /** called with mMutex held */
+  void removeBatch (const uint32 index)
+  {
+    delete mBatches[index];
+    vector <Batch *> remaining;
+    for (uint32 ii = 0; ii < mBatches.getNumOfElements (); ++ii)
+    {
+      if (ii != index)
+      {
+        remaining.push_back (mBatches[ii]);
+      }
+    }
+    mBatches = remaining;
+  }
+
+  /** called with mMutex held */
+  void fanOut (Batch & batch, LOWIResponse * const response, const int64 now,
+      vector <Delivery> & deliveries)
+  {
+    LOWIDiscoveryScanResponse * scan = NULL;
+    LOWIResponse::eScanStatus status = LOWIResponse::SCAN_STATUS_INTERNAL_ERROR;
+    if (NULL != response)
+    {
+      if (LOWIResponse::DISCOVERY_SCAN == response->getResponseType ())
+      {
+        scan = static_cast <LOWIDiscoveryScanResponse *> (response);
+        status = scan->scanStatus;
+      }
+      else if (LOWIResponse::LOWI_STATUS == response->getResponseType ())
+      {
+        status = static_cast <LOWIStatusResponse *> (response)->scanStatus;
+      }
+    }
+    else
+    {
+      status = LOWIResponse::SCAN_STATUS_DRIVER_TIMEOUT;
+    }
+
+    for (uint32 ii = 0; ii < batch.requesters.getNumOfElements (); ++ii)
+    {
+      const Requester & req = batch.requesters[ii];
+      Delivery delivery;
+      delivery.listener = req.listener;
+      LOWIDiscoveryScanResponse * copy = new (std::nothrow)
+          LOWIDiscoveryScanResponse (req.requestId);
+      delivery.response = copy;
+      if (NULL == copy)
+      {
+        log_error (TAG (), "fanOut: no memory for request %u", req.requestId);
+        continue;
+      }
+      copy->scanStatus = status;
+      if (NULL != scan)
+      {
+        copy->scanTypeResponse = scan->scanTypeResponse;
+        copy->timestamp = scan->timestamp;
+        copyMeasurements (*scan, req, now, *copy);
+      }
+      if (0 != deliveries.push_back (delivery))
+      {
+        delete copy;
+        continue;
+      }
+      mStats.m_latencyTotalMs += (uint64) (now - req.arrivalMs);
+    }
+  }
+
+  static void copyMeasurements (const LOWIDiscoveryScanResponse & from,
+      const Requester & req, const int64 now, LOWIDiscoveryScanResponse & to)
+  {
+    const ScanParams & params = req.params;
+    // LOWI filters a cache request by the age at response time, and a
+    // fresh scan by the age at the time the request reached the driver
+    int64 maxAgeMs = (int64) params.measAgeFilterSec * 1000;
+    if (LOWIDiscoveryScanRequest::CACHE_ONLY != params.mode)
+    {
+      maxAgeMs += now - req.arrivalMs;
+    }
+    for (uint32 ii = 0; ii < from.scanMeasurements.getNumOfElements (); ++ii)
+    {
+      const LOWIScanMeasurement * meas = from.scanMeasurements[ii];
+      if (NULL == meas || !params.coversFreq (meas->frequency))
+      {
+        continue;
+      }
+      if (meas->measurementsInfo.getNumOfElements () > 0 &&
+          NULL != meas->measurementsInfo[0] &&
+          meas->measurementsInfo[0]->meas_age > maxAgeMs)
+      {
+        continue;
+      }
+      LOWIScanMeasurement * copy = new (std::nothrow) LOWIScanMeasurement (*meas);
+      if (NULL != copy && 0 != to.scanMeasurements.push_back (copy))
+      {
+        delete copy;
+      }
+    }
+  }
+
+  /** called with mMutex held */
+  void expireInFlight (const int64 now, vector <Delivery> & deliveries)
+  {
+    for (uint32 ii = 0; ii < mBatches.getNumOfElements (); )
+    {
+      if (now - mBatches[ii]->sentMs >= (int64) mInFlightTimeoutMs)
+      {
+        log_warning (TAG (), "expireInFlight: no response for id %u in %u ms",
+            mBatches[ii]->internalId, mInFlightTimeoutMs);
+        ++mStats.m_inFlightTimeouts;
+        fanOut (*mBatches[ii], NULL, now, deliveries);
+        removeBatch (ii);
+      }
+      else
+      {
+        ++ii;
+      }
+    }
+    sendPendingIfIdle (now, deliveries);
+  }
+
+  /** called with mMutex held */
+  void sendPendingIfIdle (const int64 now, vector <Delivery> & deliveries)
+  {
+    if (NULL == mPending)
+    {
+      return;
+    }
+    for (uint32 ii = 0; ii < mBatches.getNumOfElements (); ++ii)
+    {
+      if (LOWIDiscoveryScanRequest::CACHE_ONLY != mBatches[ii]->params.mode)
+      {
+        return;
+      }
+    }
+
+    Batch * batch = mPending;
+    mPending = NULL;
+    for (uint32 ii = 0; ii < batch->requesters.getNumOfElements (); ++ii)
+    {
+      const Requester & req = batch->requesters[ii];
+      const uint64 delay = (uint64) (now - req.arrivalMs);
+      mStats.m_queueDelayTotalMs += delay;
+      if (delay > mStats.m_queueDelayMaxMs)
+      {
+        mStats.m_queueDelayMaxMs = delay;
+      }
+    }
+    if (LOWIClient::STATUS_OK != sendBatch (batch))
+    {
+      log_error (TAG (), "sendPendingIfIdle: failed to send merged scan for %u"
+          " requesters", batch->requesters.getNumOfElements ());
+      LOWIStatusResponse failure (0);
+      failure.scanStatus = LOWIResponse::SCAN_STATUS_INTERNAL_ERROR;
+      fanOut (*batch, &failure, now, deliveries);
+      delete batch;
+    }
+  }
+
+  /** called without mMutex held */
+  void deliver (vector <Delivery> & deliveries)
+  {
+    for (uint32 ii = 0; ii < deliveries.getNumOfElements (); ++ii)
+    {
+      deliveries[ii].listener->responseReceived (deliveries[ii].response);
+      delete deliveries[ii].response;
+    }
+    if (deliveries.getNumOfElements () > 0)
+    {
+      AutoLock autolock (mMutex);
+      mStats.m_responsesDelivered += deliveries.getNumOfElements ();
+    }
+  }
+
+  // private copy constructor and assignment operator so that the
+  // the instance can not be copied.
+  LOWIDiscoveryScanCoalescer (const LOWIDiscoveryScanCoalescer & rhs);
+  LOWIDiscoveryScanCoalescer & operator = (const LOWIDiscoveryScanCoalescer & rhs);
+};
+
+} // namespace qc_loc_fw
+
+#endif //#ifndef __LOWI_SCAN_COALESCER_H__
@@ -0,0 +1,505 @@
+#ifndef __LOWI_SCAN_RESULT_SET_H__
+#define __LOWI_SCAN_RESULT_SET_H__
+
+/*====*====*====*====*====*====*====*====*====*====*====*====*====*====*====*
+
+        LOWI Scan Result Set Interface Header file
+
+GENERAL DESCRIPTION
+  This file contains the structure definitions and function prototypes for
+  LOWIScanResultSet, a columnar container for the scan measurements of a
+  discovery scan
+
+Copyright (c) 2012-2013 Qualcomm Atheros, Inc.
+  All Rights Reserved.
+  Qualcomm Atheros Confidential and Proprietary.
+
+Export of this technology or software is regulated by the U.S. Government.
+Diversion contrary to U.S. law prohibited.
+=============================================================================*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <new>
+#include <base_util/vector.h>
+#include <inc/lowi_const.h>
+#include <inc/lowi_mac_address.h>
+#include <inc/lowi_ssid.h>
+#include <inc/lowi_scan_measurement.h>
+
+namespace qc_loc_fw
+{
+
+// Forward declaration
+class LOWIScanResultSet;
+
+/**
+ * Lightweight, copyable handle to one wifi node stored in a
+ * LOWIScanResultSet. It holds no data of its own, only the set and the
+ * row index, so it stays valid as long as the set is alive, even if the
+ * set grows after the view was handed out.
+ */
+class LOWIScanMeasurementView
+{
+public:
+  /**
+   * Constructor
+   * @param LOWIScanResultSet* Set that owns the row
+   * @param uint32 Row index
+   */
+  LOWIScanMeasurementView (const LOWIScanResultSet * const set,
+      const uint32 index) :
+      mSet(set), mIndex(index)
+  {
+  }
+
+  /**
+   * Returns the BSSID of the wifi node
+   * @return LOWIMacAddress BSSID
+   */
+  inline LOWIMacAddress getBssid () const;
+
+  /**
+   * Returns the BSSID of the wifi node packed as upper 24 bits followed by
+   * lower 24 bits, i.e. the same value as LOWIMacAddress::getFull48()
+   * @return uint64 packed BSSID
+   */
+  inline uint64 getBssid48 () const;
+
+  /**
+   * Returns the primary channel frequency
+   * @return uint32 frequency in MHz
+   */
+  inline uint32 getFrequency () const;
+
+  /**
+   * Returns the signal strength of the first measurement
+   * @return int16 rssi in 0.5dBm
+   */
+  inline int16 getRssi () const;
+
+  /**
+   * Returns the time stamp of the first measurement
+   * @return int64 time stamp of when the beacon was received
+   */
+  inline int64 getRssiTimestamp () const;
+
+  /**
+   * Returns the age of the first measurement
+   * @return int32 age in msec, -1 if not available
+   */
+  inline int32 getMeasAge () const;
+
+  /**
+   * Checks if the SSID is valid
+   * @return true for valid, false otherwise
+   */
+  inline bool isSSIDValid () const;
+
+  /**
+   * Gets SSID
+   * @param [out] unsigned char* SSID to be retrieved, at least SSID_LEN bytes
+   * @param [out] int*   Length of the SSID
+   * @return 0 for success, non zero for error
+   */
+  inline int getSSID (unsigned char * const pSsid, int * const pLength) const;
+
+  /**
+   * Secure access point or not
+   * @return true if secure
+   */
+  inline bool isSecure () const;
+
+  /**
+   * Flag indicating if we are associated with this AP
+   * @return true if associated
+   */
+  inline bool isAssociatedToAp () const;
+
+  /**
+   * Returns the type of the wifi node
+   * @return eNodeType node type
+   */
+  inline eNodeType getType () const;
+
+  /**
+   * Returns the row index of this view in the set
+   * @return uint32 index
+   */
+  uint32 getIndex () const
+  {
+    return mIndex;
+  }
+
+private:
+  const LOWIScanResultSet * mSet;
+  uint32                    mIndex;
+};
+
+/**
+ * Columnar storage for the results of a discovery scan.
+ *
+ * A LOWIDiscoveryScanResponse carries one heap allocated
+ * LOWIScanMeasurement per wifi node, and each of those owns its own
+ * LOWIMeasurementInfo, vectors and optional LCI / LCR copies. For a dense
+ * scan that is several thousand small allocations which all have to be
+ * walked again to be freed.
+ *
+ * LOWIScanResultSet keeps the fields that discovery consumers actually
+ * read (BSSID, frequency, RSSI, RSSI time stamp, measurement age, SSID,
+ * security flag and node type) in one contiguous block, laid out column
+ * by column, and hands out LOWIScanMeasurementView handles for per node
+ * access. The whole set is released with a single free.
+ *
+ * The set may be filled either from the measurements of an already
+ * parsed response, after which the response can be deleted, or row by
+ * row through add () from any code that decodes scan results directly.
+ *
+ * The set is not thread safe.
+ */
+class LOWIScanResultSet
+{
+public:
+  /** Initial capacity used when none is given */
+  static const uint32 DEFAULT_CAPACITY = 64;
+
+  /**
+   * Creates an empty set
+   * @param uint32 Number of rows to reserve up front
+   * @return LOWIScanResultSet* NULL on failure
+   */
+  static LOWIScanResultSet * createInstance (
+      const uint32 capacity = DEFAULT_CAPACITY)
+  {
+    LOWIScanResultSet * set = new (std::nothrow) LOWIScanResultSet ();
+    if (NULL != set && 0 != set->reserve (capacity))
+    {
+      delete set;
+      set = NULL;
+    }
+    return set;
+  }
+
+  /**
+   * Creates a set holding a copy of the given measurements. The
+   * measurements are not modified and remain owned by the caller.
+   * @param vector<LOWIScanMeasurement*>& Measurements, e.g.
+   *        LOWIDiscoveryScanResponse::scanMeasurements
+   * @return LOWIScanResultSet* NULL on failure
+   */
+  static LOWIScanResultSet * createInstance (
+      const vector <LOWIScanMeasurement*> & measurements)
+  {
+    const uint32 num = measurements.getNumOfElements ();
+    LOWIScanResultSet * set = createInstance (num > 0 ? num : 1);
+    for (uint32 ii = 0; NULL != set && ii < num; ++ii)
+    {
+      if (NULL != measurements[ii] && 0 != set->add (*measurements[ii]))
+      {
+        delete set;
+        set = NULL;
+      }
+    }
+    return set;
+  }
+
+  /** Destructor */
+  ~LOWIScanResultSet ()
+  {
+    free (mBlock);
+  }
+
+  /**
+   * Makes sure the set can hold the given number of rows without growing
+   * @param uint32 Number of rows
+   * @return 0 for success, non zero for error
+   */
+  int reserve (const uint32 capacity)
+  {
+    if (capacity <= mCapacity)
+    {
+      return 0;
+    }
+    // columns are ordered by decreasing alignment so no padding is needed
+    // between them as long as the block itself comes from malloc
+    const size_t rowSize = sizeof (uint64) + sizeof (int64) +
+        sizeof (uint32) + sizeof (int32) + sizeof (int16) +
+        sizeof (int8) + sizeof (uint8) + sizeof (uint8) + SSID_LEN;
+    if (capacity > ((size_t) -1) / rowSize)
+    {
+      return -1;
+    }
+    char * block = (char *) malloc (rowSize * capacity);
+    if (NULL == block)
+    {
+      return -2;
+    }
+
+    Columns cols;
+    cols.bssid = (uint64 *) block;
+    cols.rssiTimestamp = (int64 *) (cols.bssid + capacity);
+    cols.frequency = (uint32 *) (cols.rssiTimestamp + capacity);
+    cols.measAge = (int32 *) (cols.frequency + capacity);
+    cols.rssi = (int16 *) (cols.measAge + capacity);
+    cols.ssidLength = (int8 *) (cols.rssi + capacity);
+    cols.flags = (uint8 *) (cols.ssidLength + capacity);
+    cols.type = (uint8 *) (cols.flags + capacity);
+    cols.ssid = (unsigned char *) (cols.type + capacity);
+
+    if (mNumRows > 0)
+    {
+      memcpy (cols.bssid, mCols.bssid, mNumRows * sizeof (uint64));
+      memcpy (cols.rssiTimestamp, mCols.rssiTimestamp, mNumRows * sizeof (int64));
+      memcpy (cols.frequency, mCols.frequency, mNumRows * sizeof (uint32));
+      memcpy (cols.measAge, mCols.measAge, mNumRows * sizeof (int32));
+      memcpy (cols.rssi, mCols.rssi, mNumRows * sizeof (int16));
+      memcpy (cols.ssidLength, mCols.ssidLength, mNumRows * sizeof (int8));
+      memcpy (cols.flags, mCols.flags, mNumRows * sizeof (uint8));
+      memcpy (cols.type, mCols.type, mNumRows * sizeof (uint8));
+      memcpy (cols.ssid, mCols.ssid, mNumRows * SSID_LEN);
+    }
+    free (mBlock);
+    mBlock = block;
+    mCols = cols;
+    mCapacity = capacity;
+    return 0;
+  }
+
+  /**
+   * Appends one wifi node
+   * @param uint32 Upper 24 bits of the BSSID
+   * @param uint32 Lower 24 bits of the BSSID
+   * @param uint32 Primary channel frequency
+   * @param int16 Signal strength in 0.5dBm
+   * @param int64 Measurement time stamp
+   * @param int32 Measurement age in msec, -1 if not available
+   * @param unsigned char* SSID, NULL if not available
+   * @param int Length of the SSID
+   * @param bool Secure access point or not
+   * @param eNodeType Type of the wifi node
+   * @param bool Associated to the AP or not
+   * @return 0 for success, non zero for error
+   */
+  int add (const uint32 bssid_hi24, const uint32 bssid_lo24,
+      const uint32 frequency, const int16 rssi, const int64 rssi_timestamp,
+      const int32 meas_age, const unsigned char * const ssid,
+      const int ssid_length, const bool secure,
+      const eNodeType type = ACCESS_POINT, const bool associated = false)
+  {
+    if (NULL != ssid && (ssid_length < 0 || ssid_length > SSID_LEN))
+    {
+      return -1;
+    }
+    if (mNumRows == mCapacity &&
+        0 != reserve (mCapacity > 0 ? mCapacity * 2 : DEFAULT_CAPACITY))
+    {
+      return -2;
+    }
+    const uint32 row = mNumRows;
+    mCols.bssid[row] = (((uint64) (bssid_hi24 & 0xFFFFFF)) << 24) |
+        (bssid_lo24 & 0xFFFFFF);
+    mCols.rssiTimestamp[row] = rssi_timestamp;
+    mCols.frequency[row] = frequency;
+    mCols.measAge[row] = meas_age;
+    mCols.rssi[row] = rssi;
+    mCols.flags[row] = (secure ? FLAG_SECURE : 0) |
+        (associated ? FLAG_ASSOCIATED : 0);
+    mCols.type[row] = (uint8) type;
+    if (NULL != ssid)
+    {
+      mCols.ssidLength[row] = (int8) ssid_length;
+      memcpy (mCols.ssid + row * SSID_LEN, ssid, ssid_length);
+    }
+    else
+    {
+      mCols.ssidLength[row] = -1;
+    }
+    ++mNumRows;
+    return 0;
+  }
+
+  /**
+   * Appends one wifi node copied from a parsed measurement. Only the first
+   * LOWIMeasurementInfo is kept, which is the only one a discovery scan
+   * provides.
+   * @param LOWIScanMeasurement& Measurement
+   * @return 0 for success, non zero for error
+   */
+  int add (const LOWIScanMeasurement & meas)
+  {
+    int16 rssi = 0;
+    int64 rssi_timestamp = 0;
+    int32 meas_age = -1;
+    if (meas.measurementsInfo.getNumOfElements () > 0 &&
+        NULL != meas.measurementsInfo[0])
+    {
+      rssi = meas.measurementsInfo[0]->rssi;
+      rssi_timestamp = meas.measurementsInfo[0]->rssi_timestamp;
+      meas_age = meas.measurementsInfo[0]->meas_age;
+    }
+
+    unsigned char ssid[SSID_LEN];
+    int ssid_length = 0;
+    const bool hasSsid = meas.ssid.isSSIDValid () &&
+        0 == meas.ssid.getSSID (ssid, &ssid_length);
+
+    return add (meas.bssid.getHi24 (), meas.bssid.getLo24 (),
+        meas.frequency, rssi, rssi_timestamp, meas_age,
+        hasSsid ? ssid : NULL, ssid_length, meas.isSecure, meas.type,
+        meas.associatedToAp);
+  }
+
+  /**
+   * Removes all rows but keeps the storage for reuse
+   */
+  void clear ()
+  {
+    mNumRows = 0;
+  }
+
+  /**
+   * Returns the number of wifi nodes in the set
+   * @return uint32 number of rows
+   */
+  uint32 getNumOfMeasurements () const
+  {
+    return mNumRows;
+  }
+
+  /**
+   * Returns the number of rows the set can hold without growing
+   * @return uint32 capacity
+   */
+  uint32 getCapacity () const
+  {
+    return mCapacity;
+  }
+
+  /**
+   * Returns a view of the given row. The index must be less than
+   * getNumOfMeasurements ().
+   * @param uint32 Row index
+   * @return LOWIScanMeasurementView view
+   */
+  LOWIScanMeasurementView operator [] (const uint32 index) const
+  {
+    return LOWIScanMeasurementView (this, index);
+  }
+
+  /**
+   * Direct column access for bulk processing. The pointers are invalidated
+   * by any call that grows the set.
+   */
+  const uint64 * getBssidColumn () const { return mCols.bssid; }
+  const uint32 * getFrequencyColumn () const { return mCols.frequency; }
+  const int16 * getRssiColumn () const { return mCols.rssi; }
+  const int64 * getRssiTimestampColumn () const { return mCols.rssiTimestamp; }
+  const int32 * getMeasAgeColumn () const { return mCols.measAge; }
+
+private:
+  friend class LOWIScanMeasurementView;
+
+  enum
+  {
+    FLAG_SECURE = 0x01,
+    FLAG_ASSOCIATED = 0x02
+  };
+
+  struct Columns
+  {
+    uint64 * bssid;
+    int64 * rssiTimestamp;
+    uint32 * frequency;
+    int32 * measAge;
+    int16 * rssi;
+    int8 * ssidLength;
+    uint8 * flags;
+    uint8 * type;
+    unsigned char * ssid;
+  };
+
+  char *  mBlock;
+  Columns mCols;
+  uint32  mNumRows;
+  uint32  mCapacity;
+
+  LOWIScanResultSet () :
+      mBlock(NULL), mNumRows(0), mCapacity(0)
+  {
+    memset (&mCols, 0, sizeof (mCols));
+  }
+
+  // private copy constructor and assignment operator so that the
+  // the instance can not be copied.
+  LOWIScanResultSet (const LOWIScanResultSet & rhs);
+  LOWIScanResultSet & operator = (const LOWIScanResultSet & rhs);
+};
+
+inline LOWIMacAddress LOWIScanMeasurementView::getBssid () const
+{
+  const uint64 full = mSet->mCols.bssid[mIndex];
+  LOWIMacAddress mac;
+  (void) mac.setMac ((int) (full >> 24), (int) (full & 0xFFFFFF));
+  return mac;
+}
+
+inline uint64 LOWIScanMeasurementView::getBssid48 () const
+{
+  return mSet->mCols.bssid[mIndex];
+}
+
+inline uint32 LOWIScanMeasurementView::getFrequency () const
+{
+  return mSet->mCols.frequency[mIndex];
+}
+
+inline int16 LOWIScanMeasurementView::getRssi () const
+{
+  return mSet->mCols.rssi[mIndex];
+}
+
+inline int64 LOWIScanMeasurementView::getRssiTimestamp () const
+{
+  return mSet->mCols.rssiTimestamp[mIndex];
+}
+
+inline int32 LOWIScanMeasurementView::getMeasAge () const
+{
+  return mSet->mCols.measAge[mIndex];
+}
+
+inline bool LOWIScanMeasurementView::isSSIDValid () const
+{
+  return mSet->mCols.ssidLength[mIndex] >= 0;
+}
+
+inline int LOWIScanMeasurementView::getSSID (unsigned char * const pSsid,
+    int * const pLength) const
+{
+  if (NULL == pSsid || NULL == pLength || !isSSIDValid ())
+  {
+    return -1;
+  }
+  *pLength = mSet->mCols.ssidLength[mIndex];
+  memcpy (pSsid, mSet->mCols.ssid + mIndex * SSID_LEN, *pLength);
+  return 0;
+}
+
+inline bool LOWIScanMeasurementView::isSecure () const
+{
+  return 0 != (mSet->mCols.flags[mIndex] & LOWIScanResultSet::FLAG_SECURE);
+}
+
+inline bool LOWIScanMeasurementView::isAssociatedToAp () const
+{
+  return 0 != (mSet->mCols.flags[mIndex] & LOWIScanResultSet::FLAG_ASSOCIATED);
+}
+
+inline eNodeType LOWIScanMeasurementView::getType () const
+{
+  return (eNodeType) mSet->mCols.type[mIndex];
+}
+
+} // namespace qc_loc_fw
+
+#endif //#ifndef __LOWI_SCAN_RESULT_SET_H__
@@ -0,0 +1,909 @@
+#ifndef __LOWI_STAND_IN_SERVER_H__
+#define __LOWI_STAND_IN_SERVER_H__
+
+/*====*====*====*====*====*====*====*====*====*====*====*====*====*====*====*
+
+        LOWI Stand-in Server Interface Header file
+
+GENERAL DESCRIPTION
+  This file contains the structure definitions and function prototypes for
+  LOWIStandInServer, which registers with the IPC hub in place of the LOWI
+  server and answers requests with synthesized responses
+
+Copyright (c) 2012-2013 Qualcomm Atheros, Inc.
+  All Rights Reserved.
+  Qualcomm Atheros Confidential and Proprietary.
+
+Export of this technology or software is regulated by the U.S. Government.
+Diversion contrary to U.S. law prohibited.
+=============================================================================*/
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <new>
+#include <base_util/log.h>
+#include <base_util/sync.h>
+#include <base_util/postcard.h>
+#include <base_util/memorystream.h>
+#include <base_util/time_routines.h>
+#include <base_util/clock_source.h>
+#include <base_util/thread_pool_executor.h>
+#include <mq_client/mq_client.h>
+#include <inc/lowi_const.h>
+#include <inc/lowi_request.h>
+#include <inc/lowi_response.h>
+#include <inc/lowi_utils.h>
+
+namespace qc_loc_fw
+{
+
+/** Socket of the IPC hub the LOWI server and LOWIClient connect to */
+const char* const LOWI_IPC_HUB_SOCKET = "/data/misc/location/mq/location-mq-s";
+
+/**
+ * What LOWIStandInServer reports and how long it takes to do so.
+ * All latencies are in msec and measured from the arrival of the request.
+ */
+struct LOWIStandInServerConfig
+{
+  /** Access points in every discovery scan / bgscan cached result */
+  uint32 numAps;
+  /** Latency of a discovery scan that asks for a fresh scan */
+  uint32 freshScanLatencyMs;
+  /** Latency of a CACHE_ONLY discovery scan */
+  uint32 cacheScanLatencyMs;
+  /** Fixed part of the latency of a ranging scan */
+  uint32 rangingLatencyMs;
+  /** Latency added per node in a ranging scan */
+  uint32 rangingLatencyPerNodeMs;
+  /** Latency of capability and other control requests */
+  uint32 controlLatencyMs;
+  /** Latency of bgscan requests */
+  uint32 bgscanLatencyMs;
+  /** Random extra latency, uniform in [0, latencyJitterMs] */
+  uint32 latencyJitterMs;
+  /** RTT measurements reported per ranging node */
+  uint32 numMeasPerTarget;
+  /** Threads sending the responses once their latency has passed */
+  uint32 numReplyThreads;
+  /** Seed of the rssi / rtt / jitter generator, so runs are repeatable */
+  uint32 seed;
+  /** Reported capabilities */
+  LOWICapabilities capabilities;
+
+  /**
+   * Constructor. Defaults resemble a typical driver: ~200 msec for a
+   * fresh scan, ~50 msec + 10 msec per node for ranging.
+   */
+  LOWIStandInServerConfig () :
+      numAps (20), freshScanLatencyMs (200), cacheScanLatencyMs (2),
+      rangingLatencyMs (50), rangingLatencyPerNodeMs (10),
+      controlLatencyMs (1), bgscanLatencyMs (20), latencyJitterMs (0),
+      numMeasPerTarget (5), numReplyThreads (2), seed (1)
+  {
+    capabilities.discoveryScanSupported = true;
+    capabilities.rangingScanSupported = true;
+    capabilities.activeScanSupported = true;
+    capabilities.oneSidedRangingSupported = true;
+    capabilities.dualSidedRangingSupported11v = false;
+    capabilities.dualSidedRangingSupported11mc = true;
+    capabilities.bgscanSupported = true;
+    capabilities.bwSupport = BW_80MHZ;
+    capabilities.preambleSupport = (1 << RTT_PREAMBLE_LEGACY) |
+        (1 << RTT_PREAMBLE_HT) | (1 << RTT_PREAMBLE_VHT);
+    capabilities.supportedCapablities = LOWI_DISCOVERY_SCAN_SUPPORTED |
+        LOWI_RANGING_SCAN_SUPPORTED | LOWI_BG_SCAN_SUPPORTED;
+  }
+};
+
+/**
+ * Statistics of a LOWIStandInServer
+ */
+struct LOWIStandInServerStats
+{
+  /** requests parsed */
+  uint64 m_requests;
+  /** discovery scan requests */
+  uint64 m_discoveryScans;
+  /** ranging and periodic ranging scan requests */
+  uint64 m_rangingScans;
+  /** bgscan / hotlist / significant change requests */
+  uint64 m_bgscans;
+  /** requests answered with SCAN_STATUS_NOT_SUPPORTED */
+  uint64 m_unsupported;
+  /** messages which were not a request (hub traffic, parse errors) */
+  uint64 m_ignored;
+  /** responses sent */
+  uint64 m_responses;
+  /** responses that could not be composed, scheduled or sent */
+  uint64 m_responseErrors;
+  /** scan measurements sent, over all responses */
+  uint64 m_measurements;
+};
+
+/**
+ * Local stand-in for the LOWI server.
+ *
+ * Registers with the IPC hub under SERVER_NAME, the way the LOWI server
+ * does, so unmodified LOWIClient instances talk to it. Requests are
+ * parsed and responses composed with LOWIUtils, the same routines the
+ * LOWI server uses, so the postcards on the wire are the real ones.
+ * Every request gets a synthesized response after a configurable latency:
+ *
+ *  - CAPABILITY: the configured capabilities.
+ *  - DISCOVERY_SCAN: numAps access points spread over the requested
+ *    channels (or the channels of the requested band). BSSIDs and SSIDs
+ *    are stable from scan to scan, rssi varies.
+ *  - RANGING_SCAN / PERIODIC_RANGING_SCAN: numMeasPerTarget measurements
+ *    for every requested node. Periodic requests get a single report, as
+ *    if num_measurements were 1.
+ *  - BGSCAN_CAPABILITIES / BGSCAN_CHANNELS_SUPPORTED / BGSCAN_CACHED_RESULTS:
+ *    fixed capabilities, the 2.4 and 5 GHz channel list and one cached
+ *    scan of numAps access points.
+ *  - Other bgscan, hotlist and significant change requests and
+ *    CANCEL_RANGING_SCAN: a successful status response.
+ *  - Anything else: a status response with SCAN_STATUS_NOT_SUPPORTED.
+ *
+ * Responses are sent from an internal thread pool, so slow responses do
+ * not hold up the ones behind them. The server is meant for throughput
+ * and latency measurements of the client side (see LOWILoadGenerator) on
+ * a device or emulator without a WiFi driver; the LOWI server itself
+ * must not be running at the same time.
+ */
+class LOWIStandInServer : public MessageQueueServiceCallback
+{
+public:
+  /**
+   * Creates the server, connects to the IPC hub and registers as
+   * SERVER_NAME. Requests are served as soon as this returns.
+   * @param LOWIStandInServerConfig& What to report and when
+   * @param char* Socket of the IPC hub
+   * @return LOWIStandInServer* NULL on failure
+   */
+  static LOWIStandInServer * createInstance (
+      const LOWIStandInServerConfig & config,
+      const char * const hub_socket = LOWI_IPC_HUB_SOCKET)
+  {
+    LOWIStandInServer * server = new (std::nothrow) LOWIStandInServer (config);
+    if (NULL != server && 0 != server->init (hub_socket))
+    {
+      delete server;
+      server = NULL;
+    }
+    return server;
+  }
+
+  /**
+   * Destructor. Disconnects from the hub; responses whose latency has not
+   * passed yet are dropped.
+   */
+  virtual ~LOWIStandInServer ()
+  {
+    if (NULL != mConn)
+    {
+      mConn->shutdown ();
+    }
+    if (NULL != mReceiver)
+    {
+      mReceiver->join ();
+      delete mReceiver;
+    }
+    if (NULL != mExecutor)
+    {
+      mExecutor->shutdown ();
+      delete mExecutor;
+    }
+    delete mConn;
+    delete mMutex;
+  }
+
+  /**
+   * Returns a snapshot of the statistics
+   * @param LOWIStandInServerStats& filled in
+   */
+  void getStats (LOWIStandInServerStats & stats)
+  {
+    AutoLock autolock (mMutex);
+    stats = mStats;
+  }
+
+  /** Logs the statistics */
+  void logStats ()
+  {
+    LOWIStandInServerStats stats;
+    getStats (stats);
+    log_info (TAG (), "requests %llu (discovery %llu, ranging %llu, bgscan %llu,"
+        " unsupported %llu), ignored %llu, responses %llu, errors %llu,"
+        " measurements %llu",
+        (unsigned long long) stats.m_requests,
+        (unsigned long long) stats.m_discoveryScans,
+        (unsigned long long) stats.m_rangingScans,
+        (unsigned long long) stats.m_bgscans,
+        (unsigned long long) stats.m_unsupported,
+        (unsigned long long) stats.m_ignored,
+        (unsigned long long) stats.m_responses,
+        (unsigned long long) stats.m_responseErrors,
+        (unsigned long long) stats.m_measurements);
+  }
+
+  /**
+   * Called by the receiver thread for every message from the hub.
+   * Takes ownership of the stream.
+   * @param InMemoryStream* Message received from the IPC hub
+   * @return int RC_NO_ERROR_CONTINUE
+   */
+  virtual int newMsg (InMemoryStream * new_buffer)
+  {
+    LOWIRequest * request = NULL;
+    InPostcard * card = InPostcard::createInstance (new_buffer);
+    if (NULL == card)
+    {
+      delete new_buffer;
+    }
+    else
+    {
+      request = LOWIUtils::inPostcardToRequest (card);
+      delete card;
+    }
+
+    if (NULL == request)
+    {
+      // registration acknowledgement from the hub, or garbage
+      AutoLock autolock (mMutex);
+      ++mStats.m_ignored;
+      return RC_NO_ERROR_CONTINUE;
+    }
+
+    handleRequest (request);
+    delete request;
+    return RC_NO_ERROR_CONTINUE;
+  }
+
+private:
+  // header only class, so the log tag is a function rather than a static data member
+  static const char * TAG ()
+  {
+    return "LOWIStandInServer";
+  }
+
+  /** Sends one response once its latency has passed */
+  class ReplyTask : public Runnable
+  {
+  public:
+    ReplyTask (LOWIStandInServer * const server, LOWIResponse * const response,
+        char * const client) :
+        mServer (server), mResponse (response), mClient (client)
+    {
+    }
+
+    virtual ~ReplyTask ()
+    {
+      delete mResponse;
+      free (mClient);
+    }
+
+    virtual void run ()
+    {
+      mServer->sendResponse (mResponse, mClient);
+    }
+
+  private:
+    LOWIStandInServer * const mServer;
+    LOWIResponse * const mResponse;
+    char * const mClient;
+  };
+
+  /** Runs the hub receive loop */
+  class ReceiverTask : public Runnable
+  {
+  public:
+    explicit ReceiverTask (LOWIStandInServer * const server) :
+        mServer (server)
+    {
+    }
+
+    virtual void run ()
+    {
+      int rc = mServer->mConn->run_block (mServer);
+      log_info (LOWIStandInServer::TAG (), "receiver: run_block returned %d", rc);
+    }
+
+  private:
+    LOWIStandInServer * const mServer;
+  };
+
+  static const uint32 NUM_24_GHZ_FREQS = 11;
+  static const uint32 NUM_5_GHZ_FREQS = 9;
+
+  const LOWIStandInServerConfig mConfig;
+  MessageQueueClient * mConn;
+  Thread * mReceiver;
+  ThreadPoolExecutor * mExecutor;
+  Mutex * mMutex;
+  /** state of the random generator, protected by mMutex */
+  uint32 mRandom;
+  LOWIStandInServerStats mStats;
+
+  explicit LOWIStandInServer (const LOWIStandInServerConfig & config) :
+      mConfig (config), mConn (NULL), mReceiver (NULL), mExecutor (NULL),
+      mMutex (NULL), mRandom (config.seed)
+  {
+    memset (&mStats, 0, sizeof (mStats));
+  }
+
+  /**
+   * private copy constructor and assignment operator so that the
+   * the instance can not be copied.
+   */
+  LOWIStandInServer (const LOWIStandInServer & rhs);
+  LOWIStandInServer & operator= (const LOWIStandInServer & rhs);
+
+  int init (const char * const hub_socket)
+  {
+    int result = 1;
+    do
+    {
+      mMutex = Mutex::createInstance ("LOWIStandInServer");
+      if (NULL == mMutex)
+      {
+        result = 2;
+        break;
+      }
+      mExecutor = ThreadPoolExecutor::createInstance ("LOWIStandInReply",
+          (0 == mConfig.numReplyThreads) ? 1 : mConfig.numReplyThreads);
+      if (NULL == mExecutor)
+      {
+        result = 3;
+        break;
+      }
+      mConn = MessageQueueClient::createInstance ();
+      if (NULL == mConn)
+      {
+        result = 4;
+        break;
+      }
+      if (0 != mConn->setServerNameDup (hub_socket))
+      {
+        result = 5;
+        break;
+      }
+      if (0 != mConn->connect ())
+      {
+        result = 6;
+        break;
+      }
+      if (0 != registerWithHub ())
+      {
+        result = 7;
+        break;
+      }
+      mReceiver = Thread::createInstance ("LOWIStandInReceiver",
+          new (std::nothrow) ReceiverTask (this));
+      if (NULL == mReceiver)
+      {
+        result = 8;
+        break;
+      }
+      if (0 != mReceiver->launch ())
+      {
+        result = 9;
+        break;
+      }
+      log_info (TAG (), "init: serving as %s on %s", SERVER_NAME, hub_socket);
+      result = 0;
+    } while (false);
+
+    if (0 != result)
+    {
+      log_error (TAG (), "init: failed %d", result);
+    }
+    return result;
+  }
+
+  /** Same registration postcard LOWIClient sends, under SERVER_NAME */
+  int registerWithHub ()
+  {
+    int result = 1;
+    OutPostcard * card = OutPostcard::createInstance ();
+    do
+    {
+      if (NULL == card)
+      {
+        result = 2;
+        break;
+      }
+      if (0 != card->init () ||
+          0 != card->addString ("TO", "SERVER") ||
+          0 != card->addString ("FROM", SERVER_NAME) ||
+          0 != card->addString ("REQ", "REGISTER") ||
+          0 != card->finalize ())
+      {
+        result = 3;
+        break;
+      }
+      if (0 != mConn->send (card->getEncodedBuffer ()))
+      {
+        result = 4;
+        break;
+      }
+      result = 0;
+    } while (false);
+    delete card;
+
+    if (0 != result)
+    {
+      log_error (TAG (), "registerWithHub: failed %d", result);
+    }
+    return result;
+  }
+
+  /** Synthesizes the response and schedules it */
+  void handleRequest (LOWIRequest * const request)
+  {
+    uint32 latency = mConfig.controlLatencyMs;
+    LOWIResponse * response = NULL;
+    const LOWIRequest::eRequestType type = request->getRequestType ();
+    switch (type)
+    {
+    case LOWIRequest::CAPABILITY:
+      response = new (std::nothrow) LOWICapabilityResponse (
+          request->getRequestId (), mConfig.capabilities, true);
+      break;
+    case LOWIRequest::DISCOVERY_SCAN:
+      {
+        LOWIDiscoveryScanRequest * const req =
+            static_cast<LOWIDiscoveryScanRequest *> (request);
+        latency = (LOWIDiscoveryScanRequest::CACHE_ONLY == req->getRequestMode ()) ?
+            mConfig.cacheScanLatencyMs : mConfig.freshScanLatencyMs;
+        response = createDiscoveryScanResponse (req);
+        break;
+      }
+    case LOWIRequest::RANGING_SCAN:
+      {
+        vector <LOWINodeInfo> & nodes =
+            static_cast<LOWIRangingScanRequest *> (request)->getNodes ();
+        latency = mConfig.rangingLatencyMs +
+            mConfig.rangingLatencyPerNodeMs * nodes.getNumOfElements ();
+        response = createRangingScanResponse (request->getRequestId (), nodes);
+        break;
+      }
+    case LOWIRequest::PERIODIC_RANGING_SCAN:
+      {
+        vector <LOWIPeriodicNodeInfo> & nodes =
+            static_cast<LOWIPeriodicRangingScanRequest *> (request)->getNodes ();
+        latency = mConfig.rangingLatencyMs +
+            mConfig.rangingLatencyPerNodeMs * nodes.getNumOfElements ();
+        response = createRangingScanResponse (request->getRequestId (), nodes);
+        break;
+      }
+    case LOWIRequest::BGSCAN_CAPABILITIES:
+      latency = mConfig.bgscanLatencyMs;
+      response = createGscanCapsResponse (request->getRequestId ());
+      break;
+    case LOWIRequest::BGSCAN_CHANNELS_SUPPORTED:
+      latency = mConfig.bgscanLatencyMs;
+      response = createChannelsSupportedResponse (request->getRequestId ());
+      break;
+    case LOWIRequest::BGSCAN_CACHED_RESULTS:
+      latency = mConfig.bgscanLatencyMs;
+      response = createCachedResultsResponse (request->getRequestId ());
+      break;
+    case LOWIRequest::CANCEL_RANGING_SCAN:
+      response = createStatusResponse (request,
+          LOWIResponse::SCAN_STATUS_SUCCESS);
+      break;
+    case LOWIRequest::BGSCAN_START:
+    case LOWIRequest::BGSCAN_STOP:
+    case LOWIRequest::HOTLIST_SET:
+    case LOWIRequest::HOTLIST_CLEAR:
+    case LOWIRequest::SIGNIFINCANT_CHANGE_LIST_SET:
+    case LOWIRequest::SIGNIFINCANT_CHANGE_LIST_CLEAR:
+      latency = mConfig.bgscanLatencyMs;
+      response = createStatusResponse (request,
+          LOWIResponse::SCAN_STATUS_SUCCESS);
+      break;
+    default:
+      response = createStatusResponse (request,
+          LOWIResponse::SCAN_STATUS_NOT_SUPPORTED);
+      break;
+    }
+
+    {
+      AutoLock autolock (mMutex);
+      ++mStats.m_requests;
+      switch (type)
+      {
+      case LOWIRequest::DISCOVERY_SCAN:
+        ++mStats.m_discoveryScans;
+        break;
+      case LOWIRequest::RANGING_SCAN:
+      case LOWIRequest::PERIODIC_RANGING_SCAN:
+        ++mStats.m_rangingScans;
+        break;
+      case LOWIRequest::BGSCAN_CAPABILITIES:
+      case LOWIRequest::BGSCAN_CHANNELS_SUPPORTED:
+      case LOWIRequest::BGSCAN_CACHED_RESULTS:
+      case LOWIRequest::BGSCAN_START:
+      case LOWIRequest::BGSCAN_STOP:
+      case LOWIRequest::HOTLIST_SET:
+      case LOWIRequest::HOTLIST_CLEAR:
+      case LOWIRequest::SIGNIFINCANT_CHANGE_LIST_SET:
+      case LOWIRequest::SIGNIFINCANT_CHANGE_LIST_CLEAR:
+        ++mStats.m_bgscans;
+        break;
+      case LOWIRequest::CAPABILITY:
+      case LOWIRequest::CANCEL_RANGING_SCAN:
+        break;
+      default:
+        ++mStats.m_unsupported;
+        break;
+      }
+      if (0 != mConfig.latencyJitterMs)
+      {
+        latency += nextRandom () % (mConfig.latencyJitterMs + 1);
+      }
+    }
+
+    log_verbose (TAG (), "handleRequest: %s id %u from %s, reply in %u ms",
+        LOWIUtils::to_string (type), request->getRequestId (),
+        request->getRequestOriginator (), latency);
+    scheduleResponse (response, request->getRequestOriginator (), latency);
+  }
+
+  void scheduleResponse (LOWIResponse * const response,
+      const char * const client, const uint32 latency)
+  {
+    char * const client_dup = (NULL == client) ? NULL : strdup (client);
+    if (NULL == response || NULL == client_dup)
+    {
+      log_error (TAG (), "scheduleResponse: out of memory");
+      delete response;
+      free (client_dup);
+      AutoLock autolock (mMutex);
+      ++mStats.m_responseErrors;
+      return;
+    }
+
+    ReplyTask * const task = new (std::nothrow) ReplyTask (this, response, client_dup);
+    if (NULL == task)
+    {
+      delete response;
+      free (client_dup);
+      AutoLock autolock (mMutex);
+      ++mStats.m_responseErrors;
+      return;
+    }
+    TimeDiff delay;
+    delay.add_msec ((int) latency);
+    if (0 != mExecutor->schedule (task, delay))
+    {
+      // the caller keeps the ownership on failure
+      delete task;
+      AutoLock autolock (mMutex);
+      ++mStats.m_responseErrors;
+    }
+  }
+
+  /** Called from the reply threads */
+  void sendResponse (LOWIResponse * const response, const char * const client)
+  {
+    const uint32 measurements = countMeasurements (response);
+    int result = 1;
+    OutPostcard * const card = LOWIUtils::responseToOutPostcard (response, client);
+    do
+    {
+      if (NULL == card)
+      {
+        result = 2;
+        break;
+      }
+      AutoLock autolock (mMutex);
+      if (0 != mConn->send (card->getEncodedBuffer ()))
+      {
+        result = 3;
+        break;
+      }
+      ++mStats.m_responses;
+      mStats.m_measurements += measurements;
+      result = 0;
+    } while (false);
+    delete card;
+
+    if (0 != result)
+    {
+      log_error (TAG (), "sendResponse: to %s failed %d", client, result);
+      AutoLock autolock (mMutex);
+      ++mStats.m_responseErrors;
+    }
+  }
+
+  static uint32 countMeasurements (LOWIResponse * const response)
+  {
+    switch (response->getResponseType ())
+    {
+    case LOWIResponse::DISCOVERY_SCAN:
+      return static_cast<LOWIDiscoveryScanResponse *> (response)->
+          scanMeasurements.getNumOfElements ();
+    case LOWIResponse::RANGING_SCAN:
+      return static_cast<LOWIRangingScanResponse *> (response)->
+          scanMeasurements.getNumOfElements ();
+    default:
+      return 0;
+    }
+  }
+
+  /** linear congruential generator, caller holds mMutex */
+  uint32 nextRandom ()
+  {
+    mRandom = mRandom * 1103515245u + 12345u;
+    return mRandom >> 8;
+  }
+
+  static uint32 getFreq (const bool five_ghz, const uint32 index)
+  {
+    static const uint32 freqs_5[NUM_5_GHZ_FREQS] =
+    { 5180, 5200, 5220, 5240, 5745, 5765, 5785, 5805, 5825 };
+    return five_ghz ? freqs_5[index] : 2412 + 5 * index;
+  }
+
+  /** Frequencies a discovery scan request asks for */
+  static int getRequestedFreqs (LOWIDiscoveryScanRequest * const request,
+      vector <uint32> & freqs)
+  {
+    vector <LOWIChannelInfo> & channels = request->getChannels ();
+    for (uint32 ii = 0; ii < channels.getNumOfElements (); ++ii)
+    {
+      if (0 != freqs.push_back (channels[ii].getFrequency ()))
+      {
+        return -1;
+      }
+    }
+    if (0 != freqs.getNumOfElements ())
+    {
+      return 0;
+    }
+    const LOWIDiscoveryScanRequest::eBand band = request->getBand ();
+    if (LOWIDiscoveryScanRequest::FIVE_GHZ != band)
+    {
+      for (uint32 ii = 0; ii < NUM_24_GHZ_FREQS; ++ii)
+      {
+        if (0 != freqs.push_back (getFreq (false, ii)))
+        {
+          return -1;
+        }
+      }
+    }
+    if (LOWIDiscoveryScanRequest::TWO_POINT_FOUR_GHZ != band)
+    {
+      for (uint32 ii = 0; ii < NUM_5_GHZ_FREQS; ++ii)
+      {
+        if (0 != freqs.push_back (getFreq (true, ii)))
+        {
+          return -1;
+        }
+      }
+    }
+    return 0;
+  }
+
+  /**
+   * Creates access point number index. The BSSID and SSID only depend on
+   * the index, so the same APs show up in every scan.
+   */
+  LOWIScanMeasurement * createAccessPoint (const uint32 index, const uint32 freq,
+      const int64 timestamp, const int32 meas_age)
+  {
+    LOWIScanMeasurement * const meas = new (std::nothrow) LOWIScanMeasurement ();
+    LOWIMeasurementInfo * const info = new (std::nothrow) LOWIMeasurementInfo ();
+    if (NULL == meas || NULL == info || 0 != meas->measurementsInfo.push_back (info))
+    {
+      delete meas;
+      delete info;
+      return NULL;
+    }
+    // locally administered address, the index in the lower 24 bits
+    meas->bssid = LOWIMacAddress (0x02, 0x10, 0x57, (uint8) (index >> 16),
+        (uint8) (index >> 8), (uint8) index);
+    meas->frequency = freq;
+    meas->isSecure = (0 != (index & 1));
+    meas->type = ACCESS_POINT;
+    char ssid[SSID_LEN + 1];
+    const int length = snprintf (ssid, sizeof (ssid), "standin-%u", index);
+    meas->ssid.setSSID ((const unsigned char *) ssid, length);
+
+    // -40 to -90 dBm, in 0.5 dBm units, plus up to 3 dBm of noise
+    info->rssi = (int16) (-80 - (int16) ((index * 37) % 100) - (int16) (nextRandom () % 7));
+    info->rssi_timestamp = timestamp - meas_age;
+    info->meas_age = meas_age;
+    return meas;
+  }
+
+  LOWIResponse * createDiscoveryScanResponse (LOWIDiscoveryScanRequest * const request)
+  {
+    LOWIDiscoveryScanResponse * const response =
+        new (std::nothrow) LOWIDiscoveryScanResponse (request->getRequestId ());
+    vector <uint32> freqs;
+    if (NULL == response || 0 != getRequestedFreqs (request, freqs))
+    {
+      delete response;
+      return NULL;
+    }
+    response->scanTypeResponse =
+        (LOWIDiscoveryScanRequest::ACTIVE_SCAN == request->getScanType ()) ?
+        LOWIDiscoveryScanResponse::WLAN_SCAN_TYPE_ACTIVE :
+        LOWIDiscoveryScanResponse::WLAN_SCAN_TYPE_PASSIVE;
+    response->scanStatus = LOWIResponse::SCAN_STATUS_SUCCESS;
+    response->timestamp = (uint64) ClockSource::now_ms (CLOCK_REALTIME,
+        ClockSource::PRECISION_COARSE);
+    // cached results are a few seconds old. a fresh scan visits the
+    // channels one after the other over freshScanLatencyMs, so by the
+    // time the response goes out the first channel is the oldest
+    const bool cached =
+        (LOWIDiscoveryScanRequest::CACHE_ONLY == request->getRequestMode ());
+    const uint32 num_freqs = freqs.getNumOfElements ();
+
+    AutoLock autolock (mMutex);
+    for (uint32 ii = 0; ii < mConfig.numAps && 0 != num_freqs; ++ii)
+    {
+      const uint32 channel = ii % num_freqs;
+      const int32 meas_age = cached ? 3000 :
+          (int32) ((uint64) mConfig.freshScanLatencyMs * (num_freqs - 1 - channel) / num_freqs);
+      LOWIScanMeasurement * const meas = createAccessPoint (ii,
+          freqs[channel], (int64) response->timestamp, meas_age);
+      if (NULL == meas || 0 != response->scanMeasurements.push_back (meas))
+      {
+        delete meas;
+        response->scanStatus = LOWIResponse::SCAN_STATUS_OUT_OF_MEMORY;
+        break;
+      }
+    }
+    return response;
+  }
+
+  /** Works for both LOWINodeInfo and LOWIPeriodicNodeInfo */
+  template <typename NodeInfo>
+  LOWIResponse * createRangingScanResponse (const uint32 request_id,
+      vector <NodeInfo> & nodes)
+  {
+    LOWIRangingScanResponse * const response =
+        new (std::nothrow) LOWIRangingScanResponse (request_id);
+    if (NULL == response)
+    {
+      return NULL;
+    }
+    response->scanStatus = LOWIResponse::SCAN_STATUS_SUCCESS;
+    const int64 now = (int64) ClockSource::now_ms (CLOCK_REALTIME,
+        ClockSource::PRECISION_COARSE);
+
+    AutoLock autolock (mMutex);
+    for (uint32 ii = 0; ii < nodes.getNumOfElements (); ++ii)
+    {
+      LOWIScanMeasurement * const meas = new (std::nothrow) LOWIScanMeasurement ();
+      if (NULL == meas || 0 != response->scanMeasurements.push_back (meas))
+      {
+        delete meas;
+        response->scanStatus = LOWIResponse::SCAN_STATUS_OUT_OF_MEMORY;
+        break;
+      }
+      meas->bssid = nodes[ii].bssid;
+      meas->frequency = nodes[ii].frequency;
+      meas->type = nodes[ii].nodeType;
+      meas->rttType = nodes[ii].rttType;
+      meas->targetStatus = LOWIScanMeasurement::LOWI_TARGET_STATUS_SUCCESS;
+      // every node sits at its own distance, 2 to 50 m
+      const int32 rtt = (int32) (13 + (nodes[ii].bssid.getLo24 () * 53) % 320);
+      for (uint32 jj = 0; jj < mConfig.numMeasPerTarget; ++jj)
+      {
+        LOWIMeasurementInfo * const info = new (std::nothrow) LOWIMeasurementInfo ();
+        if (NULL == info || 0 != meas->measurementsInfo.push_back (info))
+        {
+          delete info;
+          response->scanStatus = LOWIResponse::SCAN_STATUS_OUT_OF_MEMORY;
+          break;
+        }
+        info->rtt = rtt + (int32) (nextRandom () % 5) - 2;
+        info->rtt_timestamp = now;
+        info->rssi = (int16) (-100 - (int16) (rtt / 8) - (int16) (nextRandom () % 7));
+        info->rssi_timestamp = now;
+        info->meas_age = 0;
+      }
+    }
+    return response;
+  }
+
+  LOWIResponse * createGscanCapsResponse (const uint32 request_id)
+  {
+    LOWIGscanCapsResponse * const response =
+        new (std::nothrow) LOWIGscanCapsResponse (request_id);
+    if (NULL != response)
+    {
+      response->scanStatus = LOWIResponse::SCAN_STATUS_SUCCESS;
+      memset (&response->mCaps, 0, sizeof (response->mCaps));
+      response->mCaps.maxScanCacheSize = 12000;
+      response->mCaps.maxScanBuckets = 16;
+      response->mCaps.maxApCachePerScan = 64;
+      response->mCaps.maxRssiSampleSize = 8;
+      response->mCaps.maxScanReportingThres = 90;
+      response->mCaps.maxHotlistAps = 128;
+      response->mCaps.maxSignificantChangeAps = 64;
+      response->mCaps.maxBssidHistoryEntries = 4096;
+    }
+    return response;
+  }
+
+  LOWIResponse * createChannelsSupportedResponse (const uint32 request_id)
+  {
+    LOWIChannelsSupportedResponse * const response =
+        new (std::nothrow) LOWIChannelsSupportedResponse (request_id);
+    if (NULL == response)
+    {
+      return NULL;
+    }
+    response->scanStatus = LOWIResponse::SCAN_STATUS_SUCCESS;
+    for (uint32 ii = 0; ii < NUM_24_GHZ_FREQS + NUM_5_GHZ_FREQS; ++ii)
+    {
+      LOWIScanMeasurement * const meas = new (std::nothrow) LOWIScanMeasurement ();
+      if (NULL == meas || 0 != response->scanMeasurements.push_back (meas))
+      {
+        delete meas;
+        response->scanStatus = LOWIResponse::SCAN_STATUS_OUT_OF_MEMORY;
+        break;
+      }
+      meas->frequency = (ii < NUM_24_GHZ_FREQS) ? getFreq (false, ii) :
+          getFreq (true, ii - NUM_24_GHZ_FREQS);
+    }
+    return response;
+  }
+
+  LOWIResponse * createCachedResultsResponse (const uint32 request_id)
+  {
+    LOWIBGscanCachedResultsResponse * const response =
+        new (std::nothrow) LOWIBGscanCachedResultsResponse (request_id);
+    LOWIBgscanCachedResult * const result = new (std::nothrow) LOWIBgscanCachedResult ();
+    if (NULL == response || NULL == result ||
+        0 != response->cachedResults.push_back (result))
+    {
+      delete response;
+      delete result;
+      return NULL;
+    }
+    response->scanStatus = LOWIResponse::SCAN_STATUS_SUCCESS;
+    result->bgScanID = request_id;
+    result->bgScanFlags = 0;
+    const int64 now = (int64) ClockSource::now_ms (CLOCK_REALTIME,
+        ClockSource::PRECISION_COARSE);
+
+    AutoLock autolock (mMutex);
+    for (uint32 ii = 0; ii < mConfig.numAps; ++ii)
+    {
+      LOWIScanMeasurement * const meas = createAccessPoint (ii,
+          getFreq (false, ii % NUM_24_GHZ_FREQS), now, 1000);
+      if (NULL == meas || 0 != result->scanResults.push_back (meas))
+      {
+        delete meas;
+        response->scanStatus = LOWIResponse::SCAN_STATUS_OUT_OF_MEMORY;
+        break;
+      }
+    }
+    return response;
+  }
+
+  static LOWIResponse * createStatusResponse (LOWIRequest * const request,
+      const LOWIResponse::eScanStatus status)
+  {
+    LOWIStatusResponse * const response =
+        new (std::nothrow) LOWIStatusResponse (request->getRequestId ());
+    if (NULL != response)
+    {
+      response->scanStatus = status;
+      response->mRequestType = request->getRequestType ();
+    }
+    return response;
+  }
+};
+
+} // namespace qc_loc_fw
+
+#endif //#ifndef __LOWI_STAND_IN_SERVER_H__
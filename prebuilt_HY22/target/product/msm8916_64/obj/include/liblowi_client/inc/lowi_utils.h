@@ -0,0 +1,91 @@
+#ifndef __LOWI_UTILS_H__
+#define __LOWI_UTILS_H__
+
+/*====*====*====*====*====*====*====*====*====*====*====*====*====*====*====*
+
+        LOWI Utils Interface Header file
+
+GENERAL DESCRIPTION
+  This file contains the function prototypes of the LOWIUtils postcard
+  conversion routines exported by liblowi_client
+
+Copyright (c) 2012-2013 Qualcomm Atheros, Inc.
+  All Rights Reserved.
+  Qualcomm Atheros Confidential and Proprietary.
+
+Export of this technology or software is regulated by the U.S. Government.
+Diversion contrary to U.S. law prohibited.
+=============================================================================*/
+
+#include <base_util/postcard.h>
+#include <inc/lowi_request.h>
+#include <inc/lowi_response.h>
+
+namespace qc_loc_fw
+{
+
+/**
+ * Postcard conversion routines used by both ends of the LOWI IPC.
+ *
+ * LOWIClient::composePostCard and LOWIClient::parsePostCard cover the
+ * client side only. The routines below are the ones the LOWI server
+ * side uses, so tools that stand in for the server (see
+ * LOWIStandInServer) produce exactly the wire format LOWIClient parses.
+ *
+ * Only the routines needed outside the library are declared here; the rest
+ * of LOWIUtils is internal to the library.
+ */
+class LOWIUtils
+{
+public:
+  /**
+   * Converts a request to an OutPostcard, addressed to the LOWI server.
+   * Same as LOWIClient::composePostCard.
+   * @param LOWIRequest* Request to be converted
+   * @param char* ID of the originator added to the postcard
+   * @return OutPostcard* finalized postcard, NULL on failure.
+   *         Memory should be deallocated by the caller
+   */
+  static OutPostcard* requestToOutPostcard (LOWIRequest* const request,
+      const char* const originatorId);
+
+  /**
+   * Parses a request postcard received by the LOWI server.
+   * The originator of the postcard is available through
+   * LOWIRequest::getRequestOriginator.
+   * @param InPostcard* Postcard to be parsed
+   * @return LOWIRequest* NULL on failure.
+   *         Memory should be deallocated by the caller
+   */
+  static LOWIRequest* inPostcardToRequest (InPostcard* const postcard);
+
+  /**
+   * Converts a response to an OutPostcard, addressed to the given client.
+   * @param LOWIResponse* Response to be converted
+   * @param char* ID of the client the response is sent to
+   * @return OutPostcard* finalized postcard, NULL on failure.
+   *         Memory should be deallocated by the caller
+   */
+  static OutPostcard* responseToOutPostcard (LOWIResponse* const response,
+      const char* const clientId);
+
+  /**
+   * Parses a response postcard received by the client.
+   * Same as LOWIClient::parsePostCard.
+   * @param InPostcard* Postcard to be parsed
+   * @return LOWIResponse* NULL on failure.
+   *         Memory should be deallocated by the caller
+   */
+  static LOWIResponse* inPostcardToResponse (InPostcard* const postcard);
+
+  /**
+   * Returns the name of a request type, for logging
+   * @param eRequestType Type of the request
+   * @return char* Name of the request type
+   */
+  static const char* to_string (LOWIRequest::eRequestType a);
+};
+
+} // namespace qc_loc_fw
+
+#endif //#ifndef __LOWI_UTILS_H__